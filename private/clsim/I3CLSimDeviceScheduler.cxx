@@ -0,0 +1,124 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimDeviceScheduler.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#include "clsim/I3CLSimDeviceScheduler.h"
+
+#include <cmath>
+#include <limits>
+
+I3CLSimDeviceScheduler::I3CLSimDeviceScheduler(const std::vector<I3CLSimStepToPhotonConverterPtr> &converters)
+:
+converters_(converters),
+numPhotonsBooked_(converters.size(), 0),
+lastDeviceIndex_(converters.size()>0?converters.size()-1:0)
+{
+    if (converters_.empty())
+        log_fatal("I3CLSimDeviceScheduler needs at least one converter.");
+    
+    for (std::size_t i=0;i<converters_.size();++i)
+    {
+        if (!converters_[i]) log_fatal("converter #%zu is (null)", i);
+        
+        // converters may already have done some work
+        const uint64_t numPhotonsRerun = converters_[i]->GetTotalNumPhotonsRerun();
+        numPhotonsBooked_[i] = converters_[i]->GetTotalNumPhotonsGenerated()-numPhotonsRerun;
+    }
+}
+
+I3CLSimDeviceScheduler::~I3CLSimDeviceScheduler()
+{
+    
+}
+
+double I3CLSimDeviceScheduler::GetPhotonRate(std::size_t deviceIndex) const
+{
+    const double numPhotons = static_cast<double>(converters_.at(deviceIndex)->GetTotalNumPhotonsGenerated());
+    const double deviceTime = converters_[deviceIndex]->GetTotalDeviceTime(); // [ns]
+    
+    if ((numPhotons <= 0.) || (deviceTime <= 0.)) return NAN;
+    return numPhotons/deviceTime;
+}
+
+uint64_t I3CLSimDeviceScheduler::GetNumPendingPhotons(std::size_t deviceIndex) const
+{
+    // re-runs propagate photons that were only booked once. (Read them
+    // first, they are also part of the generated photons.)
+    const uint64_t numPhotonsRerun = converters_.at(deviceIndex)->GetTotalNumPhotonsRerun();
+    const uint64_t numPhotonsGenerated = converters_[deviceIndex]->GetTotalNumPhotonsGenerated()-numPhotonsRerun;
+    
+    // photons are counted once their bunch is finished, so this should
+    // not become negative. Do not rely on it, though.
+    if (numPhotonsGenerated >= numPhotonsBooked_[deviceIndex]) return 0;
+    return numPhotonsBooked_[deviceIndex]-numPhotonsGenerated;
+}
+
+std::size_t I3CLSimDeviceScheduler::SelectDevice(uint64_t numPhotons)
+{
+    const std::size_t numDevices = converters_.size();
+    if (numDevices==1) {
+        numPhotonsBooked_[0] += numPhotons;
+        return 0;
+    }
+    
+    std::vector<double> rates(numDevices);
+    double rateSum=0.;
+    std::size_t numMeasuredRates=0;
+    for (std::size_t i=0;i<numDevices;++i)
+    {
+        rates[i] = GetPhotonRate(i);
+        if (std::isnan(rates[i])) continue;
+        
+        rateSum += rates[i];
+        ++numMeasuredRates;
+    }
+    
+    // devices that have not finished a kernel yet are assumed to be
+    // average (if nothing has been measured, all devices are equal)
+    const double defaultRate = (numMeasuredRates>0)?(rateSum/static_cast<double>(numMeasuredRates)):1.;
+    
+    // start looking right after the last device used, so that ties
+    // are broken round-robin
+    std::size_t bestDeviceIndex=0;
+    double bestCompletionTime=std::numeric_limits<double>::infinity();
+    for (std::size_t j=1;j<=numDevices;++j)
+    {
+        const std::size_t i = (lastDeviceIndex_+j)%numDevices;
+        const double rate = std::isnan(rates[i])?defaultRate:rates[i];
+        
+        const double completionTime =
+        static_cast<double>(GetNumPendingPhotons(i)+numPhotons)/rate;
+        
+        if (completionTime < bestCompletionTime) {
+            bestCompletionTime=completionTime;
+            bestDeviceIndex=i;
+        }
+    }
+    
+    numPhotonsBooked_[bestDeviceIndex] += numPhotons;
+    lastDeviceIndex_=bestDeviceIndex;
+    
+    return bestDeviceIndex;
+}
@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimHelperWorkerPool.h
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#ifndef I3CLSIMHELPERWORKERPOOL_H_INCLUDED
+#define I3CLSIMHELPERWORKERPOOL_H_INCLUDED
+
+#include <cstddef>
+#include <stdint.h>
+
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace I3CLSimHelper
+{
+    /**
+     * @brief A fixed set of threads that runs one task at a time
+     * on several of them and waits for all of them to finish.
+     * The threads are started once and then reused, e.g. for every
+     * frame of a module.
+     *
+     * The calling thread acts as worker 0, so a pool with
+     * N threads only starts N-1 threads of its own.
+     */
+    class WorkerPool : private boost::noncopyable
+    {
+    public:
+        typedef boost::function<void (std::size_t)> Task;
+
+        explicit WorkerPool(std::size_t numThreads)
+        :
+        numThreads_(numThreads==0 ? 1 : numThreads),
+        numWorkers_(0),
+        pending_(0),
+        generation_(0),
+        stop_(false)
+        {
+            for (std::size_t i=1;i<numThreads_;++i)
+                threads_.create_thread(boost::bind(&WorkerPool::WorkerThread, this, i));
+        }
+
+        ~WorkerPool()
+        {
+            {
+                boost::unique_lock<boost::mutex> guard(mutex_);
+                stop_=true;
+            }
+            workAvailable_.notify_all();
+            threads_.join_all();
+        }
+
+        std::size_t GetNumThreads() const {return numThreads_;}
+
+        /**
+         * Calls task(i) for every i in [0,numWorkers) on worker i
+         * and returns once all of them are done. numWorkers is
+         * capped at GetNumThreads(). The task must not throw.
+         */
+        void Run(const Task &task, std::size_t numWorkers)
+        {
+            if (numWorkers > numThreads_) numWorkers = numThreads_;
+            if (numWorkers == 0) return;
+
+            if (numWorkers > 1)
+            {
+                boost::unique_lock<boost::mutex> guard(mutex_);
+                task_ = task;
+                numWorkers_ = numWorkers;
+                pending_ = numWorkers-1;
+                ++generation_;
+            }
+            if (numWorkers > 1) workAvailable_.notify_all();
+
+            task(0);
+
+            if (numWorkers > 1)
+            {
+                boost::unique_lock<boost::mutex> guard(mutex_);
+                while (pending_ > 0) workDone_.wait(guard);
+                task_.clear();
+            }
+        }
+
+    private:
+        void WorkerThread(std::size_t index)
+        {
+            uint64_t seenGeneration = 0;
+
+            boost::unique_lock<boost::mutex> guard(mutex_);
+            for (;;)
+            {
+                while ((!stop_) && (generation_ == seenGeneration)) workAvailable_.wait(guard);
+                if (stop_) return;
+
+                seenGeneration = generation_;
+                if (index >= numWorkers_) continue; // not needed this time
+
+                const Task task = task_;
+                guard.unlock();
+                task(index);
+                guard.lock();
+
+                if (--pending_ == 0) workDone_.notify_all();
+            }
+        }
+
+        const std::size_t numThreads_;
+        boost::thread_group threads_;
+
+        boost::mutex mutex_;
+        boost::condition_variable workAvailable_;
+        boost::condition_variable workDone_;
+
+        Task task_;
+        std::size_t numWorkers_;
+        std::size_t pending_;
+        uint64_t generation_;
+        bool stop_;
+    };
+}
+
+#endif //I3CLSIMHELPERWORKERPOOL_H_INCLUDED
@@ -30,6 +30,7 @@
 #include <inttypes.h>
 
 #include <cmath>
+#include <algorithm>
 
 #include "clsim/I3CLSimLightSourceToStepConverterPPC.h"
 #include "sim-services/I3SimConstants.h"
@@ -58,7 +59,8 @@ maxBunchSize_(512000),
 photonsPerStep_(photonsPerStep),
 highPhotonsPerStep_(highPhotonsPerStep),
 useHighPhotonsPerStepStartingFromNumPhotons_(useHighPhotonsPerStepStartingFromNumPhotons),
-useCascadeExtension_(true)
+useCascadeExtension_(true),
+numFeederThreads_(0)
 {
     if (photonsPerStep_<=0)
         throw I3CLSimLightSourceToStepConverter_exception("photonsPerStep may not be <= 0!");
@@ -102,7 +104,10 @@ void I3CLSimLightSourceToStepConverterPPC::Initialize()
     rngState_ = mwcRngInitState(randomService_, rngA_);
     
     // initialize the pre-calculator threads
-    preCalc_ = boost::shared_ptr<GenerateStepPreCalculator>(new GenerateStepPreCalculator(randomService_, /*a=*/0.39, /*b=*/2.61));
+    preCalc_ = boost::shared_ptr<GenerateStepPreCalculator>(new GenerateStepPreCalculator(randomService_, /*a=*/0.39, /*b=*/2.61,
+                                                                                          /*numberOfValues=*/102400,
+                                                                                          numFeederThreads_));
+    log_debug("using %u pre-calculator threads", preCalc_->GetNumberOfThreads());
 
     // make a copy of the medium properties
     {
@@ -163,6 +168,14 @@ void I3CLSimLightSourceToStepConverterPPC::SetMaxBunchSize(uint64_t num)
     maxBunchSize_=num;
 }
 
+void I3CLSimLightSourceToStepConverterPPC::SetNumFeederThreads(unsigned int num)
+{
+    if (initialized_)
+        throw I3CLSimLightSourceToStepConverter_exception("I3CLSimLightSourceToStepConverterPPC already initialized!");
+
+    numFeederThreads_=num;
+}
+
 void I3CLSimLightSourceToStepConverterPPC::SetWlenBias(I3CLSimFunctionConstPtr wlenBias)
 {
     if (initialized_)
@@ -677,20 +690,35 @@ I3CLSimStepSeriesConstPtr I3CLSimLightSourceToStepConverterPPC::GetConversionRes
 
 /////// HELPERS
 
+namespace {
+    unsigned int NumberOfFeederThreads(unsigned int requested)
+    {
+        if (requested > 0) return requested;
+        
+        // one per core, but not more than 8 by default: each thread keeps
+        // a few MB of values around and the consumer is usually slower
+        const unsigned int numCores = boost::thread::hardware_concurrency();
+        if (numCores == 0) return 4;
+        return std::min(numCores, 8u);
+    }
+}
+
 I3CLSimLightSourceToStepConverterPPC::GenerateStepPreCalculator::GenerateStepPreCalculator(I3RandomServicePtr randomService,
                                                      double angularDist_a,
                                                      double angularDist_b,
-                                                     std::size_t numberOfValues)
+                                                     std::size_t numberOfValues,
+                                                     unsigned int numberOfThreads)
 :
 one_over_angularDist_a_(1./angularDist_a),
 angularDist_b_(angularDist_b),
 angularDist_I_(1.-std::exp(-angularDist_b*std::pow(2., angularDist_a)) ),
 numberOfValues_(numberOfValues),
 index_(numberOfValues),
-queueFromFeederThreads_(10)  // size 10 for 5 threads
+numberOfThreads_(NumberOfFeederThreads(numberOfThreads)),
+queueFromFeederThreads_(2*numberOfThreads_)  // two blocks per thread
 {
-    const unsigned int numFeederThreads = 4;
-    const uint32_t rngAs[8] = { // numbers taken from Numerical Recipies
+    const unsigned int numRngAs = 8;
+    const uint32_t rngAs[numRngAs] = { // numbers taken from Numerical Recipies
         3874257210,
         2936881968,
         2811536238,
@@ -701,11 +729,14 @@ queueFromFeederThreads_(10)  // size 10 for 5 threads
         3947008974,
     };
     
-    // start threads
-    for (unsigned int i=0;i<numFeederThreads;++i)
+    // start threads. If there are more threads than multipliers,
+    // threads share multipliers but start at different (random)
+    // points of the generator's period.
+    for (unsigned int i=0;i<numberOfThreads_;++i)
     {
-        const uint64_t rngState = mwcRngInitState(randomService, rngAs[i]);
-        boost::shared_ptr<boost::thread> newThread(new boost::thread(boost::bind(&I3CLSimLightSourceToStepConverterPPC::GenerateStepPreCalculator::FeederThread, this, i, rngState, rngAs[i])));
+        const uint32_t rngA = rngAs[i%numRngAs];
+        const uint64_t rngState = mwcRngInitState(randomService, rngA);
+        boost::shared_ptr<boost::thread> newThread(new boost::thread(boost::bind(&I3CLSimLightSourceToStepConverterPPC::GenerateStepPreCalculator::FeederThread, this, i, rngState, rngA)));
         feederThreads_.push_back(newThread);
     }
 
@@ -742,21 +773,32 @@ void I3CLSimLightSourceToStepConverterPPC::GenerateStepPreCalculator::FeederThre
 {
     // set up storage
     uint64_t rngState = initialRngState;
+    std::vector<double> uniformValues(numberOfValues_);
     
     for (;;)
     {
         // make a bunch of steps
         boost::shared_ptr<queueVector_t> outputVector(new queueVector_t());
-        outputVector->reserve(numberOfValues_);
+        outputVector->sinValues.resize(numberOfValues_);
+        outputVector->cosValues.resize(numberOfValues_);
+        outputVector->randomValues.resize(numberOfValues_);
         
-        // calculate values
+        // draw all random numbers first (the generator is sequential)..
         for (std::size_t i=0;i<numberOfValues_;++i)
         {
-            const double cos_val=std::max(1.-std::pow(-std::log(1.-mwcRngRandomNumber_co(rngState, rngA)*angularDist_I_)/angularDist_b_, one_over_angularDist_a_), -1.);
-            const double sin_val=std::sqrt(1.-cos_val*cos_val);
-            const double random_value = mwcRngRandomNumber_co(rngState, rngA);
-            
-            outputVector->push_back(std::make_pair(std::make_pair(sin_val, cos_val), random_value));
+            uniformValues[i] = mwcRngRandomNumber_co(rngState, rngA);
+            outputVector->randomValues[i] = mwcRngRandomNumber_co(rngState, rngA);
+        }
+        
+        // ..then calculate all values at once
+        if (numberOfValues_ > 0) {
+            GenerateAngularCosSinValues(&(uniformValues[0]),
+                                        &(outputVector->cosValues[0]),
+                                        &(outputVector->sinValues[0]),
+                                        numberOfValues_,
+                                        one_over_angularDist_a_,
+                                        angularDist_b_,
+                                        angularDist_I_);
         }
 
         try 
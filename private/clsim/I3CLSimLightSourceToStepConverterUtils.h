@@ -69,7 +69,18 @@ namespace I3CLSimLightSourceToStepConverterUtils
     inline double mwcRngRandomNumber_oc(uint64_t &state, uint32_t a)
     {
         return 1.0-mwcRngRandomNumber_co(state,a);
-    } 
+    }
+
+    // Calculates cos/sin of the angular distribution used by PPC
+    // (cos = 1-(-log(1-u*I)/b)^(1/a)) for num uniform random numbers
+    // in [0;1) at once. Vectorized (AVX2/AVX-512 where available).
+    void GenerateAngularCosSinValues(const double *uniformValues,
+                                     double *cosValues,
+                                     double *sinValues,
+                                     std::size_t num,
+                                     double one_over_angularDist_a,
+                                     double angularDist_b,
+                                     double angularDist_I);
 
     
     
@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimLightSourceToStepConverterUtilsBatch.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+// This file is compiled with -ftree-vectorize -fno-math-errno -fno-trapping-math
+// (see CMakeLists.txt) so that the loop below gets vectorized. Where the compiler
+// supports it, an AVX-512 and an AVX2 version are built in addition to the
+// default one and the best one is picked at load time.
+
+#include "clsim/I3CLSimLightSourceToStepConverterUtils.h"
+
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 6) && defined(__x86_64__) && defined(__linux__)
+#define CLSIM_BATCH_TARGET_CLONES __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define CLSIM_BATCH_TARGET_CLONES
+#endif
+
+namespace {
+    inline uint64_t DoubleToBits(double x)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        return bits;
+    }
+
+    inline double BitsToDouble(uint64_t bits)
+    {
+        double x;
+        std::memcpy(&x, &bits, sizeof(x));
+        return x;
+    }
+
+    const double ln2_hi = 6.93147180369123816490e-01;
+    const double ln2_lo = 1.90821492927058770002e-10;
+
+    // Natural logarithm for x >= 0 without branches (so it can be
+    // vectorized). Uses the same argument reduction and polynomial as
+    // fdlibm's log(), the result is within 1ulp. Returns -inf for x==0,
+    // subnormal numbers, infinities and NaN are not handled.
+    inline double BatchLog(double x)
+    {
+        const double Lg1 = 6.666666666666735130e-01;
+        const double Lg2 = 3.999999999940941908e-01;
+        const double Lg3 = 2.857142874366239149e-01;
+        const double Lg4 = 2.222219843214978396e-01;
+        const double Lg5 = 1.818357216161805012e-01;
+        const double Lg6 = 1.531383769920937332e-01;
+        const double Lg7 = 1.479819860511658591e-01;
+
+        const uint64_t bits = DoubleToBits(x);
+
+        // x = m*2^k with m in [1,2). The exponent is converted to
+        // double by placing it in the mantissa of 2^52 (no integer
+        // to double conversion instructions needed).
+        double m = BitsToDouble((bits & UINT64_C(0x000fffffffffffff)) | UINT64_C(0x3ff0000000000000));
+        double k = BitsToDouble((bits >> 52) | UINT64_C(0x4330000000000000)) - (4503599627370496.0 + 1023.);
+
+        // move m to [sqrt(2)/2, sqrt(2))
+        const bool large = (m > 1.41421356237309504880);
+        m = large ? 0.5*m : m;
+        k = large ? k+1. : k;
+
+        const double f = m-1.;
+        const double s = f/(2.+f);
+        const double z = s*s;
+        const double w = z*z;
+        const double t1 = w*(Lg2+w*(Lg4+w*Lg6));
+        const double t2 = z*(Lg1+w*(Lg3+w*(Lg5+w*Lg7)));
+        const double R = t2+t1;
+        const double hfsq = 0.5*f*f;
+        const double result = k*ln2_hi - ((hfsq - (s*(hfsq+R) + k*ln2_lo)) - f);
+
+        return (x > 0.) ? result : -std::numeric_limits<double>::infinity();
+    }
+
+    // Exponential function without branches, same algorithm as
+    // fdlibm's exp(). Results below the normal range are flushed to 0,
+    // this includes exp(-inf)==0. NaN is not handled.
+    inline double BatchExp(double y)
+    {
+        const double invln2 = 1.44269504088896338700e+00;
+        const double P1 =  1.66666666666666019037e-01;
+        const double P2 = -2.77777777770155933842e-03;
+        const double P3 =  6.61375632143793436117e-05;
+        const double P4 = -1.65339022054652515390e-06;
+        const double P5 =  4.13813679705723846039e-08;
+
+        // adding 1.5*2^52 rounds to the nearest integer and leaves
+        // that integer in the lower bits of the mantissa
+        const double roundingShift = 6755399441055744.0;
+
+        const double yc = std::min(std::max(y, -708.), 709.);
+        const double kShifted = yc*invln2 + roundingShift;
+        const double k = kShifted - roundingShift;
+
+        // y = k*ln(2) + r with |r| <= ln(2)/2
+        const double r = (yc - k*ln2_hi) - k*ln2_lo;
+        const double rr = r*r;
+        const double c = r - rr*(P1+rr*(P2+rr*(P3+rr*(P4+rr*P5))));
+        const double expR = 1. - ((r*c)/(c-2.) - r);
+
+        // 2^k, built directly from the exponent bits
+        const double twoToK = BitsToDouble((DoubleToBits(kShifted) + 1023) << 52);
+
+        return (y < -708.) ? 0. : expR*twoToK;
+    }
+}
+
+namespace I3CLSimLightSourceToStepConverterUtils {
+
+    CLSIM_BATCH_TARGET_CLONES
+    void GenerateAngularCosSinValues(const double * __restrict__ uniformValues,
+                                     double * __restrict__ cosValues,
+                                     double * __restrict__ sinValues,
+                                     std::size_t num,
+                                     double one_over_angularDist_a,
+                                     double angularDist_b,
+                                     double angularDist_I)
+    {
+        const double one_over_angularDist_b = 1./angularDist_b;
+        
+        for (std::size_t i=0;i<num;++i)
+        {
+            // cos = 1 - (-log(1-u*I)/b)^(1/a)
+            const double base = -BatchLog(1.-uniformValues[i]*angularDist_I)*one_over_angularDist_b;
+            const double cos_val = std::max(1.-BatchExp(BatchLog(base)*one_over_angularDist_a), -1.);
+            
+            cosValues[i] = cos_val;
+            sinValues[i] = std::sqrt(1.-cos_val*cos_val);
+        }
+    }
+
+}
@@ -50,6 +50,7 @@
 #include "clsim/I3CLSimLightSourceToStepConverterGeant4.h"
 
 #include "clsim/I3CLSimModuleHelper.h"
+#include "clsim/I3CLSimHelperWorkerPool.h"
 
 #include <limits>
 #include <set>
@@ -75,6 +76,71 @@ namespace {
     private:
         PyThreadState *m_thread_state;
     };    
+    
+    // I3CompressedPhotons only need what is in the reduced-precision
+    // photon format, so the kernel can write that directly
+    template <typename OutputMapType>
+    struct UseCompactPhotons { static const bool value = false; };
+    
+    template <>
+    struct UseCompactPhotons<I3CompressedPhotonSeriesMap> { static const bool value = true; };
+
+    // updates the bunch size granularity and maximum bunch size
+    // with the requirements of an additional converter
+    void UpdateBunchSizeLimits(uint64_t workgroupSize,
+                               uint64_t maxNumWorkitems,
+                               uint64_t &granularity,
+                               uint64_t &maxBunchSize)
+    {
+        if (workgroupSize==0)
+            log_fatal("Internal error: converter.GetWorkgroupSize()==0.");
+        if (maxNumWorkitems==0)
+            log_fatal("Internal error: converter.GetMaxNumWorkitems()==0.");
+        
+        if (granularity==0) {
+            granularity = workgroupSize;
+        } else {
+            // least common multiple
+            const uint64_t currentGranularity = workgroupSize;
+            const uint64_t newGranularity = boost::math::lcm(currentGranularity, granularity);
+            
+            if (newGranularity != granularity) {
+#ifdef I3_LOG4CPLUS_LOGGING
+                LOG_IMPL(INFO, "new device work group size is not compatible (%" PRIu64 "), changing granularity from %" PRIu64 " to %" PRIu64,
+                         currentGranularity, granularity, newGranularity);
+#else
+                log_info("new device work group size is not compatible (%" PRIu64 "), changing granularity from %" PRIu64 " to %" PRIu64,
+                         currentGranularity, granularity, newGranularity);
+#endif
+            }
+            
+            granularity=newGranularity;
+        }
+
+        if (maxBunchSize==0) {
+            maxBunchSize = maxNumWorkitems;
+        } else {
+            const uint64_t currentMaxBunchSize = maxNumWorkitems;
+            const uint64_t newMaxBunchSize = std::min(maxBunchSize, currentMaxBunchSize);
+            const uint64_t newMaxBunchSizeWithGranularity = newMaxBunchSize - newMaxBunchSize%granularity;
+
+            if (newMaxBunchSizeWithGranularity != maxBunchSize)
+            {
+#ifdef I3_LOG4CPLUS_LOGGING
+                LOG_IMPL(INFO, "maximum bunch size decreased from %" PRIu64 " to %" PRIu64 " because of new devices maximum request of %" PRIu64 " and a granularity of %" PRIu64,
+                         maxBunchSize, newMaxBunchSizeWithGranularity, currentMaxBunchSize, granularity);
+#else
+                log_info("maximum bunch size decreased from %" PRIu64 " to %" PRIu64 " because of new devices maximum request of %" PRIu64 " and a granularity of %" PRIu64,
+                         maxBunchSize, newMaxBunchSizeWithGranularity, currentMaxBunchSize, granularity);
+#endif
+            }
+
+            if (newMaxBunchSizeWithGranularity==0)
+                log_fatal("maximum bunch sizes are incompatible with kernel work group sizes.");
+            
+            maxBunchSize = newMaxBunchSizeWithGranularity;
+        }
+    }
 }
 
 // The module
@@ -298,16 +364,107 @@ geometryIsConfigured_(false)
                  "If set to zero (the default) the largest possible workgroup size will be chosen.",
                  limitWorkgroupSize_);
 
+    compressSteps_=false;
+    AddParameter("CompressSteps",
+                 "Upload steps to the OpenCL device(s) in a compressed format. Consecutive steps of the same\n"
+                 "particle with the same beta and weight (as generated by the cascade and muon\n"
+                 "parameterizations) share a header and take 20 instead of 48 bytes each. Step positions\n"
+                 "and times are stored with a resolution of 1mm and 0.01ns relative to the first step of\n"
+                 "each group, directions with a resolution of ~5e-5 rad. Geant4 steps change beta from\n"
+                 "step to step and, like all bunches that do not compress well, are uploaded as-is.",
+                 compressSteps_);
+
+    photonChunkSize_=0;
+    AddParameter("PhotonChunkSize",
+                 "Balance the load of the OpenCL kernel on photons instead of steps. The device then runs\n"
+                 "a fixed number of work items that pull chunks of up to this many photons from all steps\n"
+                 "of a bunch until they are done, so work items with dim steps do not idle next to bright\n"
+                 "ones. This helps most if the number of photons varies a lot between steps. Set to zero\n"
+                 "(the default) to propagate all photons of a step in a single work item.",
+                 photonChunkSize_);
+
+    useCounterBasedRNG_=false;
+    AddParameter("UseCounterBasedRNG",
+                 "Use a counter-based random number generator (Philox4x32-10) in the OpenCL kernel instead of\n"
+                 "one multiply-with-carry generator per work item. The random numbers of each photon then only\n"
+                 "depend on a key drawn once from the random service, its step and its index within the step,\n"
+                 "so the results do not depend on the device(s), the workgroup size or the distribution of\n"
+                 "bunches to devices. (They differ from the ones obtained with the default generator.)",
+                 useCounterBasedRNG_);
+
+    useOpticalDepthTables_=false;
+    AddParameter("UseOpticalDepthTables",
+                 "Find the scattering and absorption points of photons in the OpenCL kernel using tables\n"
+                 "of the cumulative optical depth at all ice layer boundaries (binary search) instead of\n"
+                 "stepping through every layer crossed. Long, steep photon paths cross many layers, so\n"
+                 "this saves most for long scattering lengths or fine layers. Only available if both the\n"
+                 "scattering and absorption lengths are IceCube-style parameterizations.",
+                 useOpticalDepthTables_);
+
+    kernelCacheDirectory_="";
+    AddParameter("KernelCacheDirectory",
+                 "Directory used to cache compiled OpenCL kernels. The cache key is a hash of the\n"
+                 "full kernel source (including the medium and geometry), the build options and\n"
+                 "the device and driver version, so jobs using the same ice model, GCD and options\n"
+                 "on the same kind of device skip compilation. Set to an empty string (the default)\n"
+                 "to disable the cache.",
+                 kernelCacheDirectory_);
+
+    extraGeometry_=I3ExtraGeometryItemConstPtr();
+    AddParameter("ExtraGeometry",
+                 "An I3ExtraGeometryItem (cylinders, optionally combined using unions and moves)\n"
+                 "describing cables and other objects shadowing the DOMs. Photons hitting any of\n"
+                 "them are absorbed during propagation. Not set by default.",
+                 extraGeometry_);
+
     closestDOMDistanceCutoff_=300.*I3Units::m;
     AddParameter("ClosestDOMDistanceCutoff",
                  "Do not even start light from sources that do not have any DOMs closer to\n"
                  "to them than this distance.",
                  closestDOMDistanceCutoff_);
 
+    streamingMode_=false;
+    AddParameter("StreamingMode",
+                 "Do not flush the frame cache using a global barrier. Instead, frames are\n"
+                 "pushed as soon as all of their photons have been returned from the GPU(s) while\n"
+                 "other frames are still being worked on. \"MaxNumParallelEvents\" then is the maximum\n"
+                 "number of frames held by the module at any time.\n"
+                 "Note that every frame ends with a flush marker, which forces the partially\n"
+                 "filled last bunch of steps of that frame to be sent to the GPU (padded with\n"
+                 "dummy steps to the bunch size granularity) instead of being filled up with\n"
+                 "steps of the next frame. Each frame therefore costs at least one extra kernel\n"
+                 "call, which makes this mode inefficient for many small frames.",
+                 streamingMode_);
+
+    photonAssemblyThreads_=1;
+    AddParameter("PhotonAssemblyThreads",
+                 "Number of threads used to convert the photons returned from the GPU(s) to\n"
+                 "I3Photons and to add them to their frames. The DOMs of all frames are distributed\n"
+                 "over the threads, the output does not depend on the number of threads.\n"
+                 "Set to 0 to use one thread per CPU core.",
+                 photonAssemblyThreads_);
+
+    useNativeCPUPropagator_=false;
+    AddParameter("UseNativeCPUPropagator",
+                 "Propagate photons on the host CPU(s) without OpenCL, in addition to the\n"
+                 "devices in \"OpenCLDeviceList\" (which may be empty if this is set).\n"
+                 "Bunches are distributed according to the measured speed of each device.\n"
+                 "Cannot be used with \"SaveAllPhotons\", \"PhotonHistoryEntries\" or\n"
+                 "\"FixedNumberOfAbsorptionLengths\".",
+                 useNativeCPUPropagator_);
+
+    nativeCPUPropagatorThreads_=0;
+    AddParameter("NativeCPUPropagatorThreads",
+                 "Number of threads used by the native CPU propagator.\n"
+                 "Set to 0 to use one thread per CPU core.",
+                 nativeCPUPropagatorThreads_);
+
     // add an outbox
     AddOutBox("OutBox");
 
     frameListPhysicsFrameCounter_=0;
+    frameListOffset_=0;
+    streamingFramesFinished_=0;
 }
 
 template <typename OutputMapType>
@@ -443,9 +600,21 @@ void I3CLSimModule<OutputMapType>::Configure()
     GetParameter("PhotonHistoryEntries", photonHistoryEntries_);
 
     GetParameter("LimitWorkgroupSize", limitWorkgroupSize_);
+    GetParameter("CompressSteps", compressSteps_);
+    GetParameter("PhotonChunkSize", photonChunkSize_);
+    GetParameter("UseCounterBasedRNG", useCounterBasedRNG_);
+    GetParameter("UseOpticalDepthTables", useOpticalDepthTables_);
+    GetParameter("KernelCacheDirectory", kernelCacheDirectory_);
+    GetParameter("ExtraGeometry", extraGeometry_);
 
     GetParameter("ClosestDOMDistanceCutoff", closestDOMDistanceCutoff_);
 
+    GetParameter("StreamingMode", streamingMode_);
+    GetParameter("PhotonAssemblyThreads", photonAssemblyThreads_);
+
+    GetParameter("UseNativeCPUPropagator", useNativeCPUPropagator_);
+    GetParameter("NativeCPUPropagatorThreads", nativeCPUPropagatorThreads_);
+
     if (pancakeFactor_ != DOMOversizeFactor_) {
         log_warn("***** You set the \"DOMOversizeFactor\" to a different value than the \"DOMPancakeFactor\". Be sure you know what you are doing!");
     }
@@ -473,15 +642,43 @@ void I3CLSimModule<OutputMapType>::Configure()
     }
     if ((maxNumParallelEvents_ <= 0) && (totalEnergyToProcess_ <= 0)) 
         log_fatal("Values <= 0 are invalid for both the \"MaxNumParallelEvents\" and \"TotalEnergyToProcess\" parameter!");
-    // maxNumParallelEvents_ is the number of frames buffered by this module.
-    // Since we use double-buffering, divide the number by 2.
-    maxNumParallelEvents_ /= 2;
+    if (streamingMode_) {
+        if ((totalEnergyToProcess_ > 0) && (!std::isnan(totalEnergyToProcess_)))
+            log_fatal("The \"StreamingMode\" option cannot be used together with \"TotalEnergyToProcess\".");
+
+        // frames are pushed one by one, so there is no second buffer
+        streamingQueue_ = boost::shared_ptr<I3CLSimQueue<streamingQueueEntry> >(new I3CLSimQueue<streamingQueueEntry>(0));
+    } else {
+        // maxNumParallelEvents_ is the number of frames buffered by this module.
+        // Since we use double-buffering, divide the number by 2.
+        maxNumParallelEvents_ /= 2;
+    }
     if (maxNumParallelEvents_==0) maxNumParallelEvents_=1;
+    
+    if (photonAssemblyThreads_==0) {
+        photonAssemblyThreads_ = boost::thread::hardware_concurrency();
+        if (photonAssemblyThreads_==0) photonAssemblyThreads_=1;
+    }
+    // the assembly threads are kept around for all flushes
+    photonAssemblyPool_.reset();
+    if (photonAssemblyThreads_ > 1)
+        photonAssemblyPool_.reset(new I3CLSimHelper::WorkerPool(photonAssemblyThreads_));
     maxNumParallelEventsSecondFlush_ = maxNumParallelEvents_;
     
 
-    if (openCLDeviceList_.empty()) 
-        log_fatal("You have to provide at least one OpenCL device using the \"OpenCLDeviceList\" parameter.");
+    if ((openCLDeviceList_.empty()) && (!useNativeCPUPropagator_))
+        log_fatal("You have to provide at least one OpenCL device using the \"OpenCLDeviceList\" parameter (or set \"UseNativeCPUPropagator\").");
+    
+    if (useNativeCPUPropagator_) {
+        if (saveAllPhotons_)
+            log_fatal("The \"SaveAllPhotons\" option cannot be used with the native CPU propagator.");
+        if (photonHistoryEntries_ > 0)
+            log_fatal("The \"PhotonHistoryEntries\" option cannot be used with the native CPU propagator.");
+        if (!std::isnan(fixedNumberOfAbsorptionLengths_))
+            log_fatal("The \"FixedNumberOfAbsorptionLengths\" option cannot be used with the native CPU propagator.");
+        if (extraGeometry_)
+            log_fatal("The \"ExtraGeometry\" option cannot be used with the native CPU propagator.");
+    }
     
     // fill wavelengthGenerators_[0] (index 0 is the Cherenkov generator)
     wavelengthGenerators_.clear();
@@ -511,6 +708,7 @@ void I3CLSimModule<OutputMapType>::Configure()
     }
 
     currentParticleCacheIndex_ = 1;
+    particleCache_.Reset(currentParticleCacheIndex_);
     geometryIsConfigured_ = false;
     totalSimulatedEnergyForFlush_ = 0.;
     totalSimulatedEnergy_ = 0;
@@ -560,18 +758,18 @@ bool I3CLSimModule<OutputMapType>::Thread(boost::this_thread::disable_interrupti
     // the main thread is running again
     
     uint32_t counter=0;
-    std::size_t lastDeviceIndexToUse=0;
     
     for (;;)
     {
         // retrieve steps from Geant4
         I3CLSimStepSeriesConstPtr steps;
         bool barrierWasJustReset=false;
+        bool flushMarkerWasReached=false;
         
         {
             boost::this_thread::restore_interruption ri(di);
             try {
-                steps = geant4ParticleToStepsConverter_->GetConversionResultWithBarrierInfo(barrierWasJustReset);
+                steps = geant4ParticleToStepsConverter_->GetConversionResultWithFlushInfo(barrierWasJustReset, flushMarkerWasReached);
             } catch(boost::thread_interrupted &i) {
                 return false;
             }
@@ -590,10 +788,21 @@ bool I3CLSimModule<OutputMapType>::Thread(boost::this_thread::disable_interrupti
             log_debug("Got %zu steps from Geant4, sending them to OpenCL",
                      steps->size());
 
+            streamingQueueEntry streamingEntry;
             
             // collect statistics if requested
             if (collectStatistics_)
             {
+                // in streaming mode, statistics are sent to the main thread along with each bunch
+                std::map<uint32_t, uint64_t> *photonNumGeneratedPerParticle = &photonNumGeneratedPerParticle_;
+                std::map<uint32_t, double> *photonWeightSumGeneratedPerParticle = &photonWeightSumGeneratedPerParticle_;
+                if (streamingMode_) {
+                    streamingEntry.photonNumGeneratedPerParticle = boost::make_shared<std::map<uint32_t, uint64_t> >();
+                    streamingEntry.photonWeightSumGeneratedPerParticle = boost::make_shared<std::map<uint32_t, double> >();
+                    photonNumGeneratedPerParticle = streamingEntry.photonNumGeneratedPerParticle.get();
+                    photonWeightSumGeneratedPerParticle = streamingEntry.photonWeightSumGeneratedPerParticle.get();
+                }
+                
                 BOOST_FOREACH(const I3CLSimStep &step, *steps)
                 {
                     const uint32_t particleID = step.identifier;
@@ -604,33 +813,19 @@ bool I3CLSimModule<OutputMapType>::Thread(boost::this_thread::disable_interrupti
                     // sanity check
                     if (particleID==0) log_fatal("particleID==0, this should not happen (this index is never used)");
                     
-                    (photonNumGeneratedPerParticle_.insert(std::make_pair(particleID, 0)).first->second)+=step.numPhotons;
-                    (photonWeightSumGeneratedPerParticle_.insert(std::make_pair(particleID, 0.)).first->second)+=static_cast<double>(step.numPhotons)*step.weight;
+                    (photonNumGeneratedPerParticle->insert(std::make_pair(particleID, 0)).first->second)+=step.numPhotons;
+                    (photonWeightSumGeneratedPerParticle->insert(std::make_pair(particleID, 0.)).first->second)+=static_cast<double>(step.numPhotons)*step.weight;
                 }
             }
 
-            // determine which OpenCL device to use
-            std::vector<std::size_t> fillLevels(openCLStepsToPhotonsConverters_.size());
-            for (std::size_t i=0;i<openCLStepsToPhotonsConverters_.size();++i)
-            {
-                fillLevels[i]=openCLStepsToPhotonsConverters_[i]->QueueSize();
-            }
-            
-            std::size_t minimumFillLevel = fillLevels[0];
-            for (std::size_t i=1;i<openCLStepsToPhotonsConverters_.size();++i)
+            // determine which OpenCL device to use: the one expected
+            // to be done with this bunch first
+            uint64_t numPhotonsInBunch=0;
+            BOOST_FOREACH(const I3CLSimStep &step, *steps)
             {
-                if (fillLevels[i] < minimumFillLevel)
-                {
-                    minimumFillLevel=fillLevels[i];
-                }
+                numPhotonsInBunch+=step.numPhotons;
             }
-            
-            std::size_t deviceIndexToUse=lastDeviceIndexToUse;
-            do {
-                ++deviceIndexToUse;
-                if (deviceIndexToUse>=fillLevels.size()) deviceIndexToUse=0;
-            } while (fillLevels[deviceIndexToUse] != minimumFillLevel);
-            lastDeviceIndexToUse=deviceIndexToUse;
+            const std::size_t deviceIndexToUse = deviceScheduler_->SelectDevice(numPhotonsInBunch);
             
             // send to OpenCL
             {
@@ -644,6 +839,20 @@ bool I3CLSimModule<OutputMapType>::Thread(boost::this_thread::disable_interrupti
             
             ++numBunchesSentToOpenCL_[deviceIndexToUse];
             ++counter; // this may overflow, but it is not used for anything important/unique
+
+            if (streamingMode_) {
+                streamingEntry.isFlushMarker=false;
+                streamingEntry.deviceIndex=deviceIndexToUse;
+                streamingQueue_->Put(streamingEntry);
+            }
+        }
+        
+        if ((streamingMode_) && (flushMarkerWasReached)) {
+            // all bunches for the frame(s) before this marker have been sent
+            streamingQueueEntry streamingEntry;
+            streamingEntry.isFlushMarker=true;
+            streamingEntry.deviceIndex=0;
+            streamingQueue_->Put(streamingEntry);
         }
         
         if (barrierWasJustReset) {
@@ -732,13 +941,28 @@ void I3CLSimModule<OutputMapType>::DigestGeometry(I3FramePtr frame)
         );
     }
     
+    // used to quickly find the closest DOM to light sources
+    geometryIndex_ = I3CLSimSimpleGeometrySpatialIndexPtr
+    (new I3CLSimSimpleGeometrySpatialIndex(*geometry_));
+    
+    // used to sort photons into their DOMs
+    domIndexLookup_.Build(*geometry_);
+    
     log_info("Initializing CLSim..");
-    // initialize OpenCL converters
+    // initialize OpenCL converters (and the native CPU propagator)
     openCLStepsToPhotonsConverters_.clear();
     
     uint64_t granularity=0;
     uint64_t maxBunchSize=0;
     
+    // all devices share the same key so that they produce the same photons
+    uint64_t counterBasedRNGKey=0;
+    if (useCounterBasedRNG_) {
+        counterBasedRNGKey = static_cast<uint32_t>(randomService_->Integer(0xffffffff));
+        counterBasedRNGKey = counterBasedRNGKey<<32;
+        counterBasedRNGKey += static_cast<uint32_t>(randomService_->Integer(0xffffffff));
+    }
+    
     BOOST_FOREACH(const I3CLSimOpenCLDevice &openCLdevice, openCLDeviceList_)
     {
 #ifdef I3_LOG4CPLUS_LOGGING
@@ -764,63 +988,50 @@ void I3CLSimModule<OutputMapType>::DigestGeometry(I3FramePtr frame)
                                               fixedNumberOfAbsorptionLengths_,
                                               pancakeFactor_,
                                               photonHistoryEntries_,
-                                              limitWorkgroupSize_);
+                                              limitWorkgroupSize_,
+                                              compressSteps_,
+                                              UseCompactPhotons<OutputMapType>::value && (photonHistoryEntries_==0) && (!saveAllPhotons_),
+                                              kernelCacheDirectory_,
+                                              extraGeometry_,
+                                              photonChunkSize_,
+                                              useCounterBasedRNG_,
+                                              counterBasedRNGKey,
+                                              useOpticalDepthTables_);
         if (!openCLStepsToPhotonsConverter)
             log_fatal("Could not initialize OpenCL!");
         
-        if (openCLStepsToPhotonsConverter->GetWorkgroupSize()==0)
-            log_fatal("Internal error: converter.GetWorkgroupSize()==0.");
-        if (openCLStepsToPhotonsConverter->GetMaxNumWorkitems()==0)
-            log_fatal("Internal error: converter.GetMaxNumWorkitems()==0.");
-        
         openCLStepsToPhotonsConverters_.push_back(openCLStepsToPhotonsConverter);
         
-        if (granularity==0) {
-            granularity = openCLStepsToPhotonsConverter->GetWorkgroupSize();
-        } else {
-            // least common multiple
-            const uint64_t currentGranularity = openCLStepsToPhotonsConverter->GetWorkgroupSize();
-            const uint64_t newGranularity = boost::math::lcm(currentGranularity, granularity);
-            
-            if (newGranularity != granularity) {
-#ifdef I3_LOG4CPLUS_LOGGING
-                LOG_IMPL(INFO, "new OpenCL device work group size is not compatible (%" PRIu64 "), changing granularity from %" PRIu64 " to %" PRIu64,
-                         currentGranularity, granularity, newGranularity);
-#else
-                log_info("new OpenCL device work group size is not compatible (%" PRIu64 "), changing granularity from %" PRIu64 " to %" PRIu64,
-                         currentGranularity, granularity, newGranularity);
-#endif
-            }
-            
-            granularity=newGranularity;
-        }
-
-        if (maxBunchSize==0) {
-            maxBunchSize = openCLStepsToPhotonsConverter->GetMaxNumWorkitems();
-        } else {
-            const uint64_t currentMaxBunchSize = openCLStepsToPhotonsConverter->GetMaxNumWorkitems();
-            const uint64_t newMaxBunchSize = std::min(maxBunchSize, currentMaxBunchSize);
-            const uint64_t newMaxBunchSizeWithGranularity = newMaxBunchSize - newMaxBunchSize%granularity;
-
-            if (newMaxBunchSizeWithGranularity != maxBunchSize)
-            {
-#ifdef I3_LOG4CPLUS_LOGGING
-                LOG_IMPL(INFO, "maximum bunch size decreased from %" PRIu64 " to %" PRIu64 " because of new devices maximum request of %" PRIu64 " and a granularity of %" PRIu64,
-                         maxBunchSize, newMaxBunchSizeWithGranularity, currentMaxBunchSize, granularity);
-#else
-                log_info("maximum bunch size decreased from %" PRIu64 " to %" PRIu64 " because of new devices maximum request of %" PRIu64 " and a granularity of %" PRIu64,
-                         maxBunchSize, newMaxBunchSizeWithGranularity, currentMaxBunchSize, granularity);
-#endif
-            }
-
-            if (newMaxBunchSizeWithGranularity==0)
-                log_fatal("maximum bunch sizes are incompatible with kernel work group sizes.");
-            
-            maxBunchSize = newMaxBunchSizeWithGranularity;
-        }
+        UpdateBunchSizeLimits(openCLStepsToPhotonsConverter->GetWorkgroupSize(),
+                              openCLStepsToPhotonsConverter->GetMaxNumWorkitems(),
+                              granularity, maxBunchSize);
+    }
+    
+    if (useNativeCPUPropagator_) {
+        log_info(" -> native CPU propagator");
+        
+        I3CLSimStepToPhotonConverterNativePtr nativeStepsToPhotonsConverter =
+        I3CLSimModuleHelper::initializeNativeCPU(randomService_,
+                                                 geometry_,
+                                                 mediumProperties_,
+                                                 wavelengthGenerationBias_,
+                                                 wavelengthGenerators_,
+                                                 nativeCPUPropagatorThreads_,
+                                                 stopDetectedPhotons_,
+                                                 pancakeFactor_);
+        if (!nativeStepsToPhotonsConverter)
+            log_fatal("Could not initialize the native CPU propagator!");
         
+        openCLStepsToPhotonsConverters_.push_back(nativeStepsToPhotonsConverter);
+        
+        UpdateBunchSizeLimits(nativeStepsToPhotonsConverter->GetWorkgroupSize(),
+                              nativeStepsToPhotonsConverter->GetMaxNumWorkitems(),
+                              granularity, maxBunchSize);
     }
     
+    // distributes bunches according to the measured speed of each device
+    deviceScheduler_ = I3CLSimDeviceSchedulerPtr(new I3CLSimDeviceScheduler(openCLStepsToPhotonsConverters_));
+    
     
     log_info("Initializing Geant4..");
     // initialize Geant4 (will set bunch sizes according to the OpenCL settings)
@@ -941,86 +1152,389 @@ void AddHistoryEntries(const I3CLSimPhotonHistory &photonHistory, I3CompressedPh
     
 }
 
+// Turns the photons returned by OpenCL into I3Photons and adds them to
+// their frames. This happens in two steps that are both distributed over
+// the threads of a WorkerPool: first the photons of every frame are grouped
+// by DOM and numbered, and the output series are created (one frame at a
+// time, the frame's map is not thread-safe). Then the series of all DOMs of
+// all frames are filled independently of each other. The photons on a DOM
+// are always added in the order they were returned and get the same IDs
+// as they would in a single thread, so the output does not depend on the
+// number of threads.
 template <typename OutputMapType>
-void AddPhotonsToFrames(const I3CLSimPhotonSeries &photons,
-                        I3CLSimPhotonHistorySeriesConstPtr photonHistories,
-                        const std::vector<boost::shared_ptr<OutputMapType> > &photonsForFrameList_,
-                        std::vector<int32_t> &currentPhotonIdForFrame_,
-                        const std::vector<I3FramePtr> &frameList_,
-                        const std::map<uint32_t, typename I3CLSimModule<OutputMapType>::particleCacheEntry> &particleCache_,
-                        const std::vector<std::set<ModuleKey> > &maskedOMKeys_,
-                        bool collectStatistics_,
-                        std::map<uint32_t, uint64_t> &photonNumAtOMPerParticle,
-                        std::map<uint32_t, double> &photonWeightSumAtOMPerParticle
-                        )
+class PhotonAssembler
 {
-    if (photonsForFrameList_.size() != frameList_.size())
-        log_fatal("Internal error: cache sizes differ. (1)");
-    if (photonsForFrameList_.size() != currentPhotonIdForFrame_.size())
-        log_fatal("Internal error: cache sizes differ. (2)");
-    
-    if (photonHistories) {
-        if (photonHistories->size() != photons.size())
-        {
-            log_fatal("Error: photon history vector size (%zu) != photon vector size (%zu)",
-                      photonHistories->size(), photons.size());
-        }
-    }
-    
+public:
     typedef OutputMapType PhotonSeriesMap;
     typedef typename PhotonSeriesMap::mapped_type PhotonSeries;
-    typedef typename PhotonSeries::value_type Photon;
     typedef typename I3CLSimModule<OutputMapType>::particleCacheEntry particleCacheEntry;
-    for (std::size_t i=0;i<photons.size();++i)
+    typedef std::deque<I3CLSimStepToPhotonConverter::ConversionResult_t> ResultList;
+
+    PhotonAssembler(const ResultList &results,
+                    const std::vector<boost::shared_ptr<OutputMapType> > &photonsForFrameList,
+                    std::vector<int32_t> &currentPhotonIdForFrame,
+                    const std::vector<std::vector<bool> > &maskedDOMsForFrame,
+                    typename I3CLSimModule<OutputMapType>::domIndexLookupTable &domIndexLookup,
+                    bool collectStatistics)
+    :
+    results_(results),
+    photonsForFrameList_(photonsForFrameList),
+    currentPhotonIdForFrame_(currentPhotonIdForFrame),
+    maskedDOMsForFrame_(maskedDOMsForFrame),
+    domIndexLookup_(domIndexLookup),
+    collectStatistics_(collectStatistics),
+    frameStart_(photonsForFrameList.size()+1, 0),
+    nextItem_(0)
     {
-        const I3CLSimPhoton &photon = photons[i];
-        
-        // find identifier in particle cache
-        auto it = particleCache_.find(photon.identifier);
-        if (it == particleCache_.end())
-            log_fatal("Internal error: unknown particle id from OpenCL: %" PRIu32,
-                      photon.identifier);
-        const particleCacheEntry &cacheEntry = it->second;
-
-        if (cacheEntry.frameListEntry >= photonsForFrameList_.size())
-            log_fatal("Internal error: particle cache entry uses invalid frame cache position");
-        
-        //I3FramePtr &frame = frameList_[cacheEntry.frameListEntry];
-        PhotonSeriesMap &outputPhotonMap = *(photonsForFrameList_[cacheEntry.frameListEntry]);
+    }
+
+    // find the frame and DOM of every photon and group them by frame
+    void Sort(const typename I3CLSimModule<OutputMapType>::particleCacheList &particleCache,
+              std::size_t frameListOffset)
+    {
+        const std::size_t numFrames = photonsForFrameList_.size();
+
+        std::size_t numPhotons=0;
+        BOOST_FOREACH(const I3CLSimStepToPhotonConverter::ConversionResult_t &res, results_)
+        {
+            numPhotons += res.photons->size();
+        }
+
+        std::vector<photonRef> unsortedRefs;
+        std::vector<uint32_t> frameForPhoton;
+        unsortedRefs.reserve(numPhotons);
+        frameForPhoton.reserve(numPhotons);
+
+        for (std::size_t bunch=0;bunch<results_.size();++bunch)
+        {
+            const I3CLSimPhotonSeries &photons = *(results_[bunch].photons);
+
+            if (results_[bunch].photonHistories) {
+                if (results_[bunch].photonHistories->size() != photons.size())
+                {
+                    log_fatal("Error: photon history vector size (%zu) != photon vector size (%zu)",
+                              results_[bunch].photonHistories->size(), photons.size());
+                }
+            }
+
+            for (std::size_t i=0;i<photons.size();++i)
+            {
+                const I3CLSimPhoton &photon = photons[i];
+
+                // find identifier in particle cache
+                const particleCacheEntry *cacheEntry = particleCache.Find(photon.identifier);
+                if (!cacheEntry)
+                    log_fatal("Internal error: unknown particle id from OpenCL: %" PRIu32,
+                              photon.identifier);
+
+                if ((cacheEntry->frameListEntry < frameListOffset) ||
+                    (cacheEntry->frameListEntry - frameListOffset >= numFrames))
+                    log_fatal("Internal error: particle cache entry uses invalid frame cache position");
+                const std::size_t frameListIndex = cacheEntry->frameListEntry - frameListOffset;
+
+                // DOMs that are not in the geometry still get their photons
+                const std::size_t numKnownDOMs = domIndexLookup_.size();
+                const int32_t domIndex = domIndexLookup_.FindOrAdd(photon.stringID, photon.omID);
+                if (domIndexLookup_.size() > numKnownDOMs)
+                    log_warn("Photon on DOM (%i/%u) which is not in the geometry.",
+                             static_cast<int>(photon.stringID), static_cast<unsigned int>(photon.omID));
+
+                photonRef ref;
+                ref.bunch = static_cast<uint32_t>(bunch);
+                ref.index = static_cast<uint32_t>(i);
+                ref.domIndex = static_cast<uint32_t>(domIndex);
+                ref.photonId = 0; // assigned in PrepareFrame()
+                ref.cacheEntry = cacheEntry;
+                unsortedRefs.push_back(ref);
+                frameForPhoton.push_back(static_cast<uint32_t>(frameListIndex));
+                ++frameStart_[frameListIndex+1];
+            }
+        }
+
+        // counting sort by frame, keeping the order within each frame
+        for (std::size_t j=0;j<numFrames;++j) frameStart_[j+1] += frameStart_[j];
+        photonRefs_.resize(unsortedRefs.size());
+        std::vector<std::size_t> fillLevel(frameStart_.begin(), frameStart_.end()-1);
+        for (std::size_t i=0;i<unsortedRefs.size();++i)
+            photonRefs_[fillLevel[frameForPhoton[i]]++] = unsortedRefs[i];
+    }
+
+    void Assemble(I3CLSimHelper::WorkerPool *pool,
+                  std::map<uint32_t, uint64_t> &photonNumAtOMPerParticle,
+                  std::map<uint32_t, double> &photonWeightSumAtOMPerParticle)
+    {
+        const std::size_t numThreads = pool ? pool->GetNumThreads() : 1;
+
+        errorMessage_.clear();
+        photonNumAtOMPerParticleForThread_.assign(numThreads, std::map<uint32_t, uint64_t>());
+        photonWeightSumAtOMPerParticleForThread_.assign(numThreads, std::map<uint32_t, double>());
+
+        // step 1: one frame at a time
+        framesWithPhotons_.clear();
+        for (std::size_t j=0;j+1<frameStart_.size();++j)
+            if (frameStart_[j+1] > frameStart_[j]) framesWithPhotons_.push_back(j);
+        segmentsForFrame_.assign(frameStart_.size()-1, std::vector<domSegment>());
+
+        RunOnWorkers(pool, &PhotonAssembler<OutputMapType>::PrepareWorkerThread, framesWithPhotons_.size());
+        if (!errorMessage_.empty())
+            log_fatal("Photon assembly failed: %s", errorMessage_.c_str());
+
+        // step 2: one DOM (of any frame) at a time
+        segments_.clear();
+        for (std::size_t j=0;j<segmentsForFrame_.size();++j)
+            segments_.insert(segments_.end(), segmentsForFrame_[j].begin(), segmentsForFrame_[j].end());
+
+        RunOnWorkers(pool, &PhotonAssembler<OutputMapType>::FillWorkerThread, segments_.size());
+        if (!errorMessage_.empty())
+            log_fatal("Photon assembly failed: %s", errorMessage_.c_str());
+
+        if (!collectStatistics_) return;
+
+        // the photons of a particle can end up on any thread
+        for (std::size_t i=0;i<numThreads;++i)
+        {
+            typedef std::map<uint32_t, uint64_t>::value_type numEntry;
+            BOOST_FOREACH(const numEntry &entry, photonNumAtOMPerParticleForThread_[i])
+                photonNumAtOMPerParticle[entry.first] += entry.second;
+
+            typedef std::map<uint32_t, double>::value_type weightEntry;
+            BOOST_FOREACH(const weightEntry &entry, photonWeightSumAtOMPerParticleForThread_[i])
+                photonWeightSumAtOMPerParticle[entry.first] += entry.second;
+        }
+    }
+
+private:
+    struct photonRef
+    {
+        uint32_t bunch;
+        uint32_t index;
+        uint32_t domIndex;
+        uint32_t photonId;
+        const particleCacheEntry *cacheEntry;
+    };
+
+    // photonRefs_[begin] to photonRefs_[end-1] go to a single output series
+    struct domSegment
+    {
+        std::size_t begin;
+        std::size_t end;
+        PhotonSeries *series;
+    };
+
+    void RunOnWorkers(I3CLSimHelper::WorkerPool *pool,
+                      void (PhotonAssembler<OutputMapType>::*workerThread)(std::size_t),
+                      std::size_t numItems)
+    {
+        nextItem_=0;
+
+        const std::size_t numWorkers = pool ? std::min(pool->GetNumThreads(), numItems) : 1;
+        if (numWorkers <= 1) {
+            (this->*workerThread)(0);
+        } else {
+            pool->Run(boost::bind(workerThread, this, _1), numWorkers);
+        }
+    }
+
+    // returns false if there is nothing left to do
+    bool NextItem(std::size_t numItems, std::size_t &item)
+    {
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        if (nextItem_ >= numItems) return false;
+        item = nextItem_++;
+        return true;
+    }
+
+    void SetError(const std::exception &e, std::size_t numItems)
+    {
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        if (errorMessage_.empty()) errorMessage_ = e.what();
+        nextItem_ = numItems; // stop the other threads
+    }
+
+    void PrepareWorkerThread(std::size_t)
+    {
+        // number of photons per DOM in the current frame,
+        // later the fill level of the DOM's segment
+        std::vector<std::size_t> photonsOnDOM(domIndexLookup_.size(), 0);
+        std::vector<uint32_t> usedDOMs;
+        std::vector<photonRef> refsOfFrame;
+
+        try
+        {
+            std::size_t item;
+            while (NextItem(framesWithPhotons_.size(), item))
+            {
+                PrepareFrame(framesWithPhotons_[item], photonsOnDOM, usedDOMs, refsOfFrame);
+            }
+        }
+        catch (std::exception &e)
+        {
+            SetError(e, framesWithPhotons_.size());
+        }
+    }
+
+    void FillWorkerThread(std::size_t threadIndex)
+    {
+        try
+        {
+            std::size_t item;
+            while (NextItem(segments_.size(), item))
+            {
+                FillSegment(segments_[item],
+                            photonNumAtOMPerParticleForThread_[threadIndex],
+                            photonWeightSumAtOMPerParticleForThread_[threadIndex]);
+            }
+        }
+        catch (std::exception &e)
+        {
+            SetError(e, segments_.size());
+        }
+    }
+
+    // Numbers the photons of a frame, drops the ones on masked DOMs,
+    // groups the others by DOM and makes room for them in the output series.
+    void PrepareFrame(std::size_t frameListIndex,
+                      std::vector<std::size_t> &photonsOnDOM,
+                      std::vector<uint32_t> &usedDOMs,
+                      std::vector<photonRef> &refsOfFrame)
+    {
+        PhotonSeriesMap &outputPhotonMap = *(photonsForFrameList_[frameListIndex]);
+        const std::vector<bool> &domMask = maskedDOMsForFrame_[frameListIndex];
 
         // get the current photon id
-        int32_t &currentPhotonId = currentPhotonIdForFrame_[cacheEntry.frameListEntry];
-        
-        // generate the OMKey
-        const ModuleKey key = ModuleKeyFromOpenCLSimIDs(photon.stringID, photon.omID);
-        
-        // get the OMKey mask
-        const std::set<ModuleKey> &keyMask = maskedOMKeys_[cacheEntry.frameListEntry];
+        int32_t &currentPhotonId = currentPhotonIdForFrame_[frameListIndex];
 
-        if (keyMask.count(key) > 0) continue; // ignore masked DOMs
-        
-        // this either inserts a new vector or retrieves an existing one
-        PhotonSeries &outputPhotonSeries = outputPhotonMap.insert(std::make_pair(key, PhotonSeries())).first->second;
-        
-        EmitPhoton(photon, currentPhotonId, cacheEntry.timeShift,
-            cacheEntry.particleMinorID, cacheEntry.particleMajorID,
-            outputPhotonSeries);
-        
-        if (photonHistories) {
-            const I3CLSimPhotonHistory &photonHistory = (*photonHistories)[i];
-            AddHistoryEntries(photonHistory, outputPhotonSeries);
+        refsOfFrame.clear();
+        usedDOMs.clear();
+        for (std::size_t j=frameStart_[frameListIndex];j<frameStart_[frameListIndex+1];++j)
+        {
+            photonRef ref = photonRefs_[j];
+            if ((ref.domIndex < domMask.size()) && (domMask[ref.domIndex])) continue; // ignore masked DOMs
+
+            ref.photonId = static_cast<uint32_t>(currentPhotonId++);
+            refsOfFrame.push_back(ref);
+            if (photonsOnDOM[ref.domIndex]++ == 0) usedDOMs.push_back(ref.domIndex);
         }
-        
-        if (collectStatistics_)
+
+        std::vector<domSegment> &segments = segmentsForFrame_[frameListIndex];
+        segments.resize(usedDOMs.size());
+
+        std::size_t begin = frameStart_[frameListIndex];
+        for (std::size_t k=0;k<usedDOMs.size();++k)
         {
-            // collect statistics
-            (photonNumAtOMPerParticle.insert(std::make_pair(photon.identifier, 0)).first->second)++;
-            (photonWeightSumAtOMPerParticle.insert(std::make_pair(photon.identifier, 0.)).first->second)+=photon.GetWeight();
+            const uint32_t domIndex = usedDOMs[k];
+
+            // this either inserts a new vector or retrieves an existing one
+            PhotonSeries &outputPhotonSeries =
+            outputPhotonMap.insert(std::make_pair(domIndexLookup_.moduleKeys[domIndex], PhotonSeries())).first->second;
+
+            // a series can get photons from more than one flush, so still grow
+            // geometrically if it already has entries
+            const std::size_t requiredSize = outputPhotonSeries.size() + photonsOnDOM[domIndex];
+            if (requiredSize > outputPhotonSeries.capacity())
+                outputPhotonSeries.reserve(std::max(requiredSize, 2*outputPhotonSeries.capacity()));
+
+            segments[k].begin = begin;
+            segments[k].end = begin + photonsOnDOM[domIndex];
+            segments[k].series = &outputPhotonSeries;
+
+            photonsOnDOM[domIndex] = begin;
+            begin = segments[k].end;
         }
-        
-        currentPhotonId++;
+
+        // counting sort by DOM, keeping the order on each DOM
+        for (std::size_t j=0;j<refsOfFrame.size();++j)
+            photonRefs_[photonsOnDOM[refsOfFrame[j].domIndex]++] = refsOfFrame[j];
+
+        // reset the per-DOM counters for the next frame
+        for (std::size_t k=0;k<usedDOMs.size();++k) photonsOnDOM[usedDOMs[k]]=0;
     }
-    
+
+    void FillSegment(const domSegment &segment,
+                     std::map<uint32_t, uint64_t> &photonNumAtOMPerParticle,
+                     std::map<uint32_t, double> &photonWeightSumAtOMPerParticle)
+    {
+        PhotonSeries &outputPhotonSeries = *(segment.series);
+
+        for (std::size_t j=segment.begin;j<segment.end;++j)
+        {
+            const photonRef &ref = photonRefs_[j];
+
+            const I3CLSimPhoton &photon = (*(results_[ref.bunch].photons))[ref.index];
+            const particleCacheEntry &cacheEntry = *(ref.cacheEntry);
+
+            EmitPhoton(photon, ref.photonId, cacheEntry.timeShift,
+                cacheEntry.particleMinorID, cacheEntry.particleMajorID,
+                outputPhotonSeries);
+
+            if (results_[ref.bunch].photonHistories) {
+                const I3CLSimPhotonHistory &photonHistory = (*(results_[ref.bunch].photonHistories))[ref.index];
+                AddHistoryEntries(photonHistory, outputPhotonSeries);
+            }
+
+            if (collectStatistics_)
+            {
+                // collect statistics
+                (photonNumAtOMPerParticle.insert(std::make_pair(photon.identifier, 0)).first->second)++;
+                (photonWeightSumAtOMPerParticle.insert(std::make_pair(photon.identifier, 0.)).first->second)+=photon.GetWeight();
+            }
+        }
+    }
+
+    const ResultList &results_;
+    const std::vector<boost::shared_ptr<OutputMapType> > &photonsForFrameList_;
+    std::vector<int32_t> &currentPhotonIdForFrame_;
+    const std::vector<std::vector<bool> > &maskedDOMsForFrame_;
+    typename I3CLSimModule<OutputMapType>::domIndexLookupTable &domIndexLookup_;
+    bool collectStatistics_;
+
+    // photonRefs_[frameStart_[i]] to photonRefs_[frameStart_[i+1]-1] are the photons of
+    // frame i, after PrepareFrame() without masked DOMs and grouped by DOM
+    std::vector<std::size_t> frameStart_;
+    std::vector<photonRef> photonRefs_;
+
+    std::vector<std::size_t> framesWithPhotons_;
+    std::vector<std::vector<domSegment> > segmentsForFrame_;
+    std::vector<domSegment> segments_;
+
+    boost::mutex mutex_;
+    std::size_t nextItem_;
+    std::string errorMessage_;
+    std::vector<std::map<uint32_t, uint64_t> > photonNumAtOMPerParticleForThread_;
+    std::vector<std::map<uint32_t, double> > photonWeightSumAtOMPerParticleForThread_;
+};
+
+template <typename OutputMapType>
+void AddPhotonsToFrames(const std::deque<I3CLSimStepToPhotonConverter::ConversionResult_t> &results,
+                        const std::vector<boost::shared_ptr<OutputMapType> > &photonsForFrameList_,
+                        std::vector<int32_t> &currentPhotonIdForFrame_,
+                        const std::vector<I3FramePtr> &frameList_,
+                        std::size_t frameListOffset,
+                        const typename I3CLSimModule<OutputMapType>::particleCacheList &particleCache_,
+                        typename I3CLSimModule<OutputMapType>::domIndexLookupTable &domIndexLookup_,
+                        const std::vector<std::vector<bool> > &maskedDOMsForFrame_,
+                        bool collectStatistics_,
+                        I3CLSimHelper::WorkerPool *workerPool,
+                        std::map<uint32_t, uint64_t> &photonNumAtOMPerParticle,
+                        std::map<uint32_t, double> &photonWeightSumAtOMPerParticle
+                        )
+{
+    if (photonsForFrameList_.size() != frameList_.size())
+        log_fatal("Internal error: cache sizes differ. (1)");
+    if (photonsForFrameList_.size() != currentPhotonIdForFrame_.size())
+        log_fatal("Internal error: cache sizes differ. (2)");
+    if (photonsForFrameList_.size() != maskedDOMsForFrame_.size())
+        log_fatal("Internal error: cache sizes differ. (3)");
+    
+    PhotonAssembler<OutputMapType> assembler(results,
+                                             photonsForFrameList_,
+                                             currentPhotonIdForFrame_,
+                                             maskedDOMsForFrame_,
+                                             domIndexLookup_,
+                                             collectStatistics_);
+    
+    assembler.Sort(particleCache_, frameListOffset);
+    assembler.Assemble(workerPool, photonNumAtOMPerParticle, photonWeightSumAtOMPerParticle);
 }
 
 } // namespace
@@ -1068,16 +1582,19 @@ std::size_t I3CLSimModule<OutputMapType>::FlushFrameCache()
     std::vector<boost::shared_ptr<OutputMapType> > photonsForFrameList_old;
     std::vector<int32_t> currentPhotonIdForFrame_old;
     std::vector<I3FramePtr> frameList_old;
-    std::map<uint32_t, particleCacheEntry> particleCache_old;
-    std::vector<std::set<ModuleKey> > maskedOMKeys_old;
+    particleCacheList particleCache_old;
+    std::vector<std::vector<bool> > maskedDOMsForFrame_old;
     std::vector<bool> frameIsBeingWorkedOn_old;
+    std::vector<std::pair<uint32_t, uint32_t> > particleCacheIndicesForFrame_old;
 
     photonsForFrameList_old.swap(photonsForFrameList_);
     currentPhotonIdForFrame_old.swap(currentPhotonIdForFrame_);
     frameList_old.swap(frameList_);
     particleCache_old.swap(particleCache_);
-    maskedOMKeys_old.swap(maskedOMKeys_);
+    particleCache_.Reset(currentParticleCacheIndex_);
+    maskedDOMsForFrame_old.swap(maskedDOMsForFrame_);
     frameIsBeingWorkedOn_old.swap(frameIsBeingWorkedOn_);
+    particleCacheIndicesForFrame_old.swap(particleCacheIndicesForFrame_);
 
     bool startThreadLater = false;
 
@@ -1126,28 +1643,31 @@ std::size_t I3CLSimModule<OutputMapType>::FlushFrameCache()
 
     log_debug("Adding photons to frame.");
     std::size_t totalNumOutPhotons=0;
+    BOOST_FOREACH(const I3CLSimStepToPhotonConverter::ConversionResult_t &res, res_list)
+    {
+        totalNumOutPhotons += res.photons->size();
+    }
 
-    while (!res_list.empty()) 
     {
-        const I3CLSimStepToPhotonConverter::ConversionResult_t &res =
-            res_list.front();
+        // allow other threads to access python
+        ScopedGILRelease scopedGIL;
 
         // convert to I3Photons and add to their respective frames
-        AddPhotonsToFrames(*(res.photons), res.photonHistories,
+        AddPhotonsToFrames(res_list,
                            photonsForFrameList_old,
                            currentPhotonIdForFrame_old,
                            frameList_old,
+                           0,
                            particleCache_old,
-                           maskedOMKeys_old,
+                           domIndexLookup_,
+                           maskedDOMsForFrame_old,
                            collectStatistics_,
+                           photonAssemblyPool_.get(),
                            photonNumAtOMPerParticle,
                            photonWeightSumAtOMPerParticle
                            );
-        
-        totalNumOutPhotons += res.photons->size();
-
-        res_list.pop_front();
     }
+    res_list.clear();
 
 
     log_debug("Got %zu photons in total during flush.", totalNumOutPhotons);
@@ -1169,11 +1689,11 @@ std::size_t I3CLSimModule<OutputMapType>::FlushFrameCache()
             it!=photonNumGeneratedPerParticle_old.end();++it)
         {
             // find identifier in particle cache
-            typename std::map<uint32_t, particleCacheEntry>::iterator it_cache = particleCache_old.find(it->first);
-            if (it_cache == particleCache_old.end())
-                log_error("Internal error: unknown particle id from Geant4: %" PRIu32,
+            const particleCacheEntry *cacheEntryPtr = particleCache_old.Find(it->first);
+            if (!cacheEntryPtr)
+                log_fatal("Internal error: unknown particle id from Geant4: %" PRIu32,
                           it->first);
-            const particleCacheEntry &cacheEntry = it_cache->second;
+            const particleCacheEntry &cacheEntry = *cacheEntryPtr;
             
             if (cacheEntry.frameListEntry >= eventStatisticsForFrame.size())
                 log_fatal("Internal error: particle cache entry uses invalid frame cache position");
@@ -1188,11 +1708,11 @@ std::size_t I3CLSimModule<OutputMapType>::FlushFrameCache()
             it!=photonWeightSumGeneratedPerParticle_old.end();++it)
         {
             // find identifier in particle cache
-            typename std::map<uint32_t, particleCacheEntry>::iterator it_cache = particleCache_old.find(it->first);
-            if (it_cache == particleCache_old.end())
+            const particleCacheEntry *cacheEntryPtr = particleCache_old.Find(it->first);
+            if (!cacheEntryPtr)
                 log_fatal("Internal error: unknown particle id from Geant4: %" PRIu32,
                           it->first);
-            const particleCacheEntry &cacheEntry = it_cache->second;
+            const particleCacheEntry &cacheEntry = *cacheEntryPtr;
             
             if (cacheEntry.frameListEntry >= eventStatisticsForFrame.size())
                 log_fatal("Internal error: particle cache entry uses invalid frame cache position");
@@ -1208,11 +1728,11 @@ std::size_t I3CLSimModule<OutputMapType>::FlushFrameCache()
             it!=photonNumAtOMPerParticle.end();++it)
         {
             // find identifier in particle cache
-            typename std::map<uint32_t, particleCacheEntry>::iterator it_cache = particleCache_old.find(it->first);
-            if (it_cache == particleCache_old.end())
+            const particleCacheEntry *cacheEntryPtr = particleCache_old.Find(it->first);
+            if (!cacheEntryPtr)
                 log_fatal("Internal error: unknown particle id from Geant4: %" PRIu32,
                           it->first);
-            const particleCacheEntry &cacheEntry = it_cache->second;
+            const particleCacheEntry &cacheEntry = *cacheEntryPtr;
             
             if (cacheEntry.frameListEntry >= eventStatisticsForFrame.size())
                 log_fatal("Internal error: particle cache entry uses invalid frame cache position");
@@ -1227,11 +1747,11 @@ std::size_t I3CLSimModule<OutputMapType>::FlushFrameCache()
             it!=photonWeightSumAtOMPerParticle.end();++it)
         {
             // find identifier in particle cache
-            typename std::map<uint32_t, particleCacheEntry>::iterator it_cache = particleCache_old.find(it->first);
-            if (it_cache == particleCache_old.end())
+            const particleCacheEntry *cacheEntryPtr = particleCache_old.Find(it->first);
+            if (!cacheEntryPtr)
                 log_fatal("Internal error: unknown particle id from Geant4: %" PRIu32,
                           it->first);
-            const particleCacheEntry &cacheEntry = it_cache->second;
+            const particleCacheEntry &cacheEntry = *cacheEntryPtr;
             
             if (cacheEntry.frameListEntry >= eventStatisticsForFrame.size())
                 log_fatal("Internal error: particle cache entry uses invalid frame cache position");
@@ -1270,96 +1790,214 @@ std::size_t I3CLSimModule<OutputMapType>::FlushFrameCache()
     return framesPushed;
 }
 
-namespace {
-    bool ParticleHasMuonDaughter(const I3MCTree::const_iterator &particle_it, const I3MCTree &mcTree)
+template <typename OutputMapType>
+void I3CLSimModule<OutputMapType>::AddStreamingStatisticsForParticle(uint32_t identifier,
+                                                                     uint64_t numPhotons,
+                                                                     double weightSum,
+                                                                     bool photonsAtDOMs)
+{
+    // find identifier in particle cache
+    const particleCacheEntry *cacheEntryPtr = particleCache_.Find(identifier);
+    if (!cacheEntryPtr)
+        log_fatal("Internal error: unknown particle id: %" PRIu32,
+                  identifier);
+    const particleCacheEntry &cacheEntry = *cacheEntryPtr;
+    
+    if ((cacheEntry.frameListEntry < frameListOffset_) ||
+        (cacheEntry.frameListEntry - frameListOffset_ >= eventStatisticsForFrame_.size()))
+        log_fatal("Internal error: particle cache entry uses invalid frame cache position");
+    I3CLSimEventStatistics &eventStatistics = *(eventStatisticsForFrame_[cacheEntry.frameListEntry - frameListOffset_]);
+    
+    if (photonsAtDOMs) {
+        eventStatistics.AddNumPhotonsAtDOMsWithWeights(numPhotons, weightSum,
+                                                       cacheEntry.particleMajorID,
+                                                       cacheEntry.particleMinorID);
+    } else {
+        eventStatistics.AddNumPhotonsGeneratedWithWeights(numPhotons, weightSum,
+                                                          cacheEntry.particleMajorID,
+                                                          cacheEntry.particleMinorID);
+    }
+}
+
+template <typename OutputMapType>
+void I3CLSimModule<OutputMapType>::AddStreamingStatistics(const std::map<uint32_t, uint64_t> &photonNumPerParticle,
+                                                          const std::map<uint32_t, double> &photonWeightSumPerParticle,
+                                                          bool photonsAtDOMs)
+{
+    for(std::map<uint32_t, uint64_t>::const_iterator it=photonNumPerParticle.begin();
+        it!=photonNumPerParticle.end();++it)
     {
-        BOOST_FOREACH( const I3Particle & daughter, mcTree.children(*particle_it))
-        {
-            if ((daughter.GetType()==I3Particle::MuMinus) ||
-                (daughter.GetType()==I3Particle::MuPlus))
-                return true;
-        }
-        return false;
+        AddStreamingStatisticsForParticle(it->first, it->second, 0., photonsAtDOMs);
     }
-    
-    // version for point sources
-    double DistToClosestDOM(const I3CLSimSimpleGeometry &geometry, const I3Position &pos)
+
+    for(std::map<uint32_t, double>::const_iterator it=photonWeightSumPerParticle.begin();
+        it!=photonWeightSumPerParticle.end();++it)
     {
-        double closestDist=NAN;
-        
-        const std::vector<double> xVect = geometry.GetPosXVector();
-        const std::vector<double> yVect = geometry.GetPosYVector();
-        const std::vector<double> zVect = geometry.GetPosZVector();
+        AddStreamingStatisticsForParticle(it->first, 0, it->second, photonsAtDOMs);
+    }
+}
 
-        
-        for (std::size_t i=0;i<geometry.size();++i)
-        {
-            const double dx = xVect[i]-pos.GetX();
-            const double dy = yVect[i]-pos.GetY();
-            const double dz = zVect[i]-pos.GetZ();
-            
-            const double thisDist = std::sqrt(dx*dx + dy*dy + dz*dz);
-            
-            if (std::isnan(closestDist)) {
-                closestDist=thisDist;
-            } else {
-                if (thisDist<closestDist) closestDist=thisDist;
+template <typename OutputMapType>
+std::size_t I3CLSimModule<OutputMapType>::PushFinishedStreamingFrames()
+{
+    // frames are pushed in order, so stop at the first one
+    // that is still being worked on
+    std::size_t numFinished=0;
+    while (numFinished < frameList_.size())
+    {
+        if ((frameIsBeingWorkedOn_[numFinished]) &&
+            (frameListOffset_+numFinished >= streamingFramesFinished_)) break;
+        ++numFinished;
+    }
+    
+    if (numFinished==0) return 0;
+    
+    for (std::size_t i=0;i<numFinished;++i)
+    {
+        if (frameIsBeingWorkedOn_[i]) {
+            if (collectStatistics_) {
+                frameList_[i]->Put(statisticsName_, eventStatisticsForFrame_[i]);
             }
+            
+            log_debug("putting photons into frame %zu...", frameListOffset_+i);
+            frameList_[i]->Put(photonSeriesMapName_, photonsForFrameList_[i]);
         }
         
-        if (std::isnan(closestDist)) return 0.;
-        return closestDist;
+        // the particle cache entries of this frame are not needed anymore.
+        // Frames are pushed in order, so these are the oldest ones.
+        if ((particleCacheIndicesForFrame_[i].second > 0) &&
+            (particleCacheIndicesForFrame_[i].first != particleCacheList::AdvanceIndex(particleCache_.firstIndex, particleCache_.numReleased)))
+            log_fatal("Internal error: particle cache entries are not released in order.");
+        particleCache_.ReleaseOldest(particleCacheIndicesForFrame_[i].second);
+        
+        log_debug("pushing frame number %zu...", frameListOffset_+i);
+        PushFrame(frameList_[i]);
     }
+    
+    frameList_.erase(frameList_.begin(), frameList_.begin()+numFinished);
+    photonsForFrameList_.erase(photonsForFrameList_.begin(), photonsForFrameList_.begin()+numFinished);
+    currentPhotonIdForFrame_.erase(currentPhotonIdForFrame_.begin(), currentPhotonIdForFrame_.begin()+numFinished);
+    frameIsBeingWorkedOn_.erase(frameIsBeingWorkedOn_.begin(), frameIsBeingWorkedOn_.begin()+numFinished);
+    maskedDOMsForFrame_.erase(maskedDOMsForFrame_.begin(), maskedDOMsForFrame_.begin()+numFinished);
+    particleCacheIndicesForFrame_.erase(particleCacheIndicesForFrame_.begin(), particleCacheIndicesForFrame_.begin()+numFinished);
+    eventStatisticsForFrame_.erase(eventStatisticsForFrame_.begin(), eventStatisticsForFrame_.begin()+numFinished);
+    frameListOffset_ += numFinished;
+    
+    return numFinished;
+}
 
-    // version for tracks
-    double DistToClosestDOM(const I3CLSimSimpleGeometry &geometry, const I3Position &pos, const I3Direction &dir, double length, bool nostart=false, bool nostop=false)
+template <typename OutputMapType>
+void I3CLSimModule<OutputMapType>::DrainStreamingResults(bool waitForOldestFrame)
+{
+    // Results are handled strictly in the order the thread reported them.
+    // Bunches sent to a single device are returned in order by that device,
+    // so once a flush marker is at the front, all photons for the frames
+    // before that marker have been added.
+    
+    std::size_t framesPushed = PushFinishedStreamingFrames();
+    
+    for (;;)
     {
-        double closestDist=NAN;
-        
-        const std::vector<double> xVect = geometry.GetPosXVector();
-        const std::vector<double> yVect = geometry.GetPosYVector();
-        const std::vector<double> zVect = geometry.GetPosZVector();
+        if ((waitForOldestFrame) && ((framesPushed > 0) || (frameList_.empty()))) return;
         
-        
-        for (std::size_t i=0;i<geometry.size();++i)
+        if (streamingEntriesInProgress_.empty())
         {
-            const double Ax = xVect[i]-pos.GetX();
-            const double Ay = yVect[i]-pos.GetY();
-            const double Az = zVect[i]-pos.GetZ();
-            
-            double d_along = Ax*dir.GetX() + Ay*dir.GetY() + Az*dir.GetZ();
+            streamingQueueEntry entry;
             
-            if (!nostart) {
-                if (d_along < 0.) d_along=0.;         // there is no track before its start
+            if (waitForOldestFrame) {
+                // allow other threads to access python
+                ScopedGILRelease scopedGIL;
+                
+                entry = streamingQueue_->Get();
+            } else {
+                if (!streamingQueue_->GetNonBlocking(entry)) return;
             }
             
-            if (!nostop) {
-                if (d_along > length) d_along=length; // there is no track after its end
+            if ((!entry.isFlushMarker) && (collectStatistics_)) {
+                AddStreamingStatistics(*(entry.photonNumGeneratedPerParticle),
+                                       *(entry.photonWeightSumGeneratedPerParticle),
+                                       false);
             }
             
-            const double p_along_x = pos.GetX() + dir.GetX()*d_along;
-            const double p_along_y = pos.GetY() + dir.GetY()*d_along;
-            const double p_along_z = pos.GetZ() + dir.GetZ()*d_along;
-
-            // distance from point to DOM
+            streamingEntriesInProgress_.push_back(entry);
+        }
+        
+        const streamingQueueEntry &entry = streamingEntriesInProgress_.front();
+        
+        if (entry.isFlushMarker)
+        {
+            if (framesAwaitingFlushMarker_.empty())
+                log_fatal("Internal error: received a flush marker that has never been enqueued.");
             
-            const double dx = xVect[i]-p_along_x;
-            const double dy = yVect[i]-p_along_y;
-            const double dz = zVect[i]-p_along_z;
+            streamingFramesFinished_ = framesAwaitingFlushMarker_.front()+1;
+            framesAwaitingFlushMarker_.pop_front();
+            streamingEntriesInProgress_.pop_front();
             
-            const double thisDist = std::sqrt(dx*dx + dy*dy + dz*dz);
+            framesPushed += PushFinishedStreamingFrames();
+            continue;
+        }
+        
+        I3CLSimStepToPhotonConverterPtr converter = openCLStepsToPhotonsConverters_.at(entry.deviceIndex);
+        
+        I3CLSimStepToPhotonConverter::ConversionResult_t res;
+        if (waitForOldestFrame) {
+            // allow other threads to access python
+            ScopedGILRelease scopedGIL;
             
-            if (std::isnan(closestDist)) {
-                closestDist=thisDist;
-            } else {
-                if (thisDist<closestDist) closestDist=thisDist;
-            }
+            res = converter->GetConversionResult();
+        } else {
+            if (!converter->MorePhotonsAvailable()) return;
+            res = converter->GetConversionResult();
+        }
+        if (!res.photons) log_fatal("Internal error: received NULL photon series from OpenCL.");
+        
+        streamingEntriesInProgress_.pop_front();
+        
+        std::map<uint32_t, uint64_t> photonNumAtOMPerParticle;
+        std::map<uint32_t, double> photonWeightSumAtOMPerParticle;
+        
+        std::deque<I3CLSimStepToPhotonConverter::ConversionResult_t> res_list(1, res);
+        
+        {
+            // allow other threads to access python
+            ScopedGILRelease scopedGIL;
+            
+            // convert to I3Photons and add to their respective frames
+            AddPhotonsToFrames(res_list,
+                               photonsForFrameList_,
+                               currentPhotonIdForFrame_,
+                               frameList_,
+                               frameListOffset_,
+                               particleCache_,
+                               domIndexLookup_,
+                               maskedDOMsForFrame_,
+                               collectStatistics_,
+                               photonAssemblyPool_.get(),
+                               photonNumAtOMPerParticle,
+                               photonWeightSumAtOMPerParticle
+                               );
         }
         
-        if (std::isnan(closestDist)) return 0.;
-        return closestDist;
+        if (collectStatistics_) {
+            AddStreamingStatistics(photonNumAtOMPerParticle,
+                                   photonWeightSumAtOMPerParticle,
+                                   true);
+        }
     }
+}
 
+namespace {
+    bool ParticleHasMuonDaughter(const I3MCTree::const_iterator &particle_it, const I3MCTree &mcTree)
+    {
+        BOOST_FOREACH( const I3Particle & daughter, mcTree.children(*particle_it))
+        {
+            if ((daughter.GetType()==I3Particle::MuMinus) ||
+                (daughter.GetType()==I3Particle::MuPlus))
+                return true;
+        }
+        return false;
+    }
+    
 }
 
 template <typename OutputMapType>
@@ -1410,6 +2048,24 @@ void I3CLSimModule<OutputMapType>::Process()
         log_debug("Energy in Frame = %f GeV", totalLightEnergyInFrame);
     }
     
+    if (streamingMode_)
+    {
+        if (DigestOtherFrame(frame)) {
+            // this frame is finished as soon as the marker has been reached
+            geant4ParticleToStepsConverter_->EnqueueFlushMarker();
+            framesAwaitingFlushMarker_.push_back(frameListOffset_+frameList_.size()-1);
+        }
+        
+        // push whatever is already finished without waiting
+        DrainStreamingResults(false);
+        
+        // wait for the oldest frames in case we hold too many
+        while (frameList_.size() > maxNumParallelEvents_) {
+            DrainStreamingResults(true);
+        }
+        return;
+    }
+    
     // it's either Physics or something else..
     if (frameListPhysicsFrameCounter_ < maxNumParallelEvents_)
     {
@@ -1519,8 +2175,10 @@ bool I3CLSimModule<OutputMapType>::DigestOtherFrame(I3FramePtr frame, bool start
     frameList_.push_back(frame);
     photonsForFrameList_.push_back(boost::make_shared<OutputMapType>());
     currentPhotonIdForFrame_.push_back(0);
-    std::size_t currentFrameListIndex = frameList_.size()-1;
-    maskedOMKeys_.push_back(std::set<ModuleKey>()); // insert an empty ModuleKey mask
+    std::size_t currentFrameListIndex = frameListOffset_+frameList_.size()-1;
+    maskedDOMsForFrame_.push_back(std::vector<bool>()); // insert an empty DOM mask
+    particleCacheIndicesForFrame_.push_back(std::make_pair(currentParticleCacheIndex_, 0));
+    if (streamingMode_) eventStatisticsForFrame_.push_back(I3CLSimEventStatisticsPtr());
     
     // check if we got a geometry before starting to work
     if (!geometryIsConfigured_)
@@ -1581,6 +2239,8 @@ bool I3CLSimModule<OutputMapType>::DigestOtherFrame(I3FramePtr frame, bool start
     
     // work with this frame!
     frameIsBeingWorkedOn_.push_back(true); // this frame will receive results (->Put() will be called later)
+    if ((streamingMode_) && (collectStatistics_))
+        eventStatisticsForFrame_.back() = I3CLSimEventStatisticsPtr(new I3CLSimEventStatistics());
     
     std::deque<I3CLSimLightSource> lightSources;
     std::deque<double> timeOffsets;
@@ -1592,14 +2252,18 @@ bool I3CLSimModule<OutputMapType>::DigestOtherFrame(I3FramePtr frame, bool start
     if (omKeyMask) {
         // assign the current OMKey mask if there is one
         BOOST_FOREACH(const OMKey &key, *omKeyMask) {
-            maskedOMKeys_.back().insert(ModuleKey(key.GetString(), key.GetOM()));
+            const int32_t domIndex = domIndexLookup_.FindOrAdd(key.GetString(), key.GetOM());
+            if (maskedDOMsForFrame_.back().size() < domIndexLookup_.size()) maskedDOMsForFrame_.back().resize(domIndexLookup_.size(), false);
+            maskedDOMsForFrame_.back()[domIndex] = true;
         }
     }
     
     if (moduleKeyMask) {
         // assign the current ModuleKey mask if there is one
         BOOST_FOREACH(const ModuleKey &key, *moduleKeyMask) {
-            maskedOMKeys_.back().insert(key);
+            const int32_t domIndex = domIndexLookup_.FindOrAdd(key.GetString(), key.GetOM());
+            if (maskedDOMsForFrame_.back().size() < domIndexLookup_.size()) maskedDOMsForFrame_.back().resize(domIndexLookup_.size(), false);
+            maskedDOMsForFrame_.back()[domIndex] = true;
         }
     }
    
@@ -1618,11 +2282,10 @@ bool I3CLSimModule<OutputMapType>::DigestOtherFrame(I3FramePtr frame, bool start
         
         geant4ParticleToStepsConverter_->EnqueueLightSource(lightSource, currentParticleCacheIndex_);
 
-        if (particleCache_.find(currentParticleCacheIndex_) != particleCache_.end())
-            log_fatal("Internal error. Particle cache index already used.");
+        if (particleCache_.NextIndex() != currentParticleCacheIndex_)
+            log_fatal("Internal error. Particle cache index out of sequence.");
         
-        particleCacheEntry &cacheEntry = 
-        particleCache_.insert(std::make_pair(currentParticleCacheIndex_, particleCacheEntry())).first->second;
+        particleCacheEntry &cacheEntry = particleCache_.Append();
         
         cacheEntry.frameListEntry = currentFrameListIndex;
         cacheEntry.timeShift = timeOffset;
@@ -1634,6 +2297,8 @@ bool I3CLSimModule<OutputMapType>::DigestOtherFrame(I3FramePtr frame, bool start
             cacheEntry.particleMinorID = 0;
         }
         
+        ++(particleCacheIndicesForFrame_.back().second);
+        
         // make a new index. This will eventually overflow,
         // but at that time, index 0 should be unused again.
         ++currentParticleCacheIndex_;
@@ -1656,6 +2321,15 @@ void I3CLSimModule<OutputMapType>::Finish()
     totalSimulatedEnergyForFlush_=0.;
     totalNumParticlesForFlush_=0;
 
+    if (streamingMode_) {
+        while (!frameList_.empty()) {
+            DrainStreamingResults(true);
+        }
+
+        log_info("Flushing I3Tray..");
+        Flush();
+    }
+
     std::size_t framesPushed = 0;
     while (frameListPhysicsFrameCounter_ > 0) {
         framesPushed = FlushFrameCache();
@@ -1699,6 +2373,7 @@ void I3CLSimModule<OutputMapType>::Finish()
             (*summary)[prefix+"NumKernelCalls"            +postfix] = openCLStepsToPhotonsConverters_[i]->GetNumKernelCalls();
             (*summary)[prefix+"TotalNumPhotonsGenerated"  +postfix] = totalNumPhotonsGenerated;
             (*summary)[prefix+"TotalNumPhotonsAtDOMs"     +postfix] = openCLStepsToPhotonsConverters_[i]->GetTotalNumPhotonsAtDOMs();
+            (*summary)[prefix+"TotalNumPhotonsRerun"      +postfix] = openCLStepsToPhotonsConverters_[i]->GetTotalNumPhotonsRerun();
             
             (*summary)[prefix+"AverageDeviceTimePerPhoton"+postfix] = totalDeviceTime/totalNumPhotonsGenerated;
             (*summary)[prefix+"AverageHostTimePerPhoton"  +postfix] = totalHostTime/totalNumPhotonsGenerated;
@@ -1770,7 +2445,7 @@ void I3CLSimModule<OutputMapType>::ConvertMCTreeToLightSources(const I3MCTree &m
         
         if (!isTrack) 
         {
-            const double distToClosestDOM = DistToClosestDOM(*geometry_, particle_ref.GetPos());
+            const double distToClosestDOM = geometryIndex_->GetDistanceToClosestDOM(particle_ref.GetPos());
             
             if (distToClosestDOM >= closestDOMDistanceCutoff_)
             {
@@ -1800,7 +2475,8 @@ void I3CLSimModule<OutputMapType>::ConvertMCTreeToLightSources(const I3MCTree &m
                 nostop = true;
             }
             
-            const double distToClosestDOM = DistToClosestDOM(*geometry_, particle.GetPos(), particle.GetDir(), particleLength, nostart, nostop);
+            const double distToClosestDOM = geometryIndex_->GetDistanceToClosestDOM(particle.GetPos(), particle.GetDir(), particleLength, nostart, nostop,
+                                                                               closestDOMDistanceCutoff_);
             if (distToClosestDOM >= closestDOMDistanceCutoff_)
             {
                 log_debug("Ignored a track that is always at least %fm (>%fm) away from the closest DOM.",
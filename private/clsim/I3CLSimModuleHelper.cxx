@@ -314,7 +314,15 @@ namespace I3CLSimModuleHelper {
                                                            double fixedNumberOfAbsorptionLengths,
                                                            double pancakeFactor,
                                                            uint32_t photonHistoryEntries,
-                                                           uint32_t limitWorkgroupSize)
+                                                           uint32_t limitWorkgroupSize,
+                                                           bool compressSteps,
+                                                           bool compactPhotons,
+                                                           const std::string &kernelCacheDirectory,
+                                                           I3ExtraGeometryItemConstPtr shadowGeometry,
+                                                           uint32_t photonChunkSize,
+                                                           bool counterBasedRNG,
+                                                           uint64_t counterBasedRNGKey,
+                                                           bool opticalDepthTables)
     {
         I3CLSimStepToPhotonConverterOpenCLPtr conv(new I3CLSimStepToPhotonConverterOpenCL(rng, device.GetUseNativeMath()));
 
@@ -336,6 +344,14 @@ namespace I3CLSimModuleHelper {
         conv->SetDOMPancakeFactor(pancakeFactor);
 
         conv->SetPhotonHistoryEntries(photonHistoryEntries);
+        conv->SetCompressSteps(compressSteps);
+        conv->SetPhotonChunkSize(photonChunkSize);
+        conv->SetCounterBasedRNG(counterBasedRNG);
+        conv->SetCounterBasedRNGKey(counterBasedRNGKey);
+        conv->SetOpticalDepthTables(opticalDepthTables);
+        conv->SetCompactPhotons(compactPhotons);
+        conv->SetKernelCacheDirectory(kernelCacheDirectory);
+        conv->SetShadowGeometry(shadowGeometry);
 
         conv->Compile();
         //log_trace("%s", conv.GetFullSource().c_str());
@@ -367,6 +383,34 @@ namespace I3CLSimModuleHelper {
         return conv;
     }
 
+    I3CLSimStepToPhotonConverterNativePtr initializeNativeCPU(I3RandomServicePtr rng,
+                                                              I3CLSimSimpleGeometryFromI3GeometryPtr geometry,
+                                                              I3CLSimMediumPropertiesConstPtr medium,
+                                                              I3CLSimFunctionConstPtr wavelengthGenerationBias,
+                                                              const std::vector<I3CLSimRandomValueConstPtr> &wavelengthGenerators,
+                                                              uint32_t numThreads,
+                                                              bool stopDetectedPhotons,
+                                                              double pancakeFactor)
+    {
+        I3CLSimStepToPhotonConverterNativePtr conv(new I3CLSimStepToPhotonConverterNative(rng, numThreads));
+
+        conv->SetWlenGenerators(wavelengthGenerators);
+        conv->SetWlenBias(wavelengthGenerationBias);
+
+        conv->SetMediumProperties(medium);
+        conv->SetGeometry(geometry);
+
+        conv->SetStopDetectedPhotons(stopDetectedPhotons);
+        conv->SetDOMPancakeFactor(pancakeFactor);
+
+        log_info("native CPU propagator uses %zu threads", conv->GetNumThreads());
+        log_debug("maximum number of steps per bunch is %zu", conv->GetMaxNumWorkitems());
+
+        conv->Initialize();
+        
+        return conv;
+    }
+
     I3CLSimLightSourceToStepConverterGeant4Ptr initializeGeant4(I3RandomServicePtr rng,
                                                              I3CLSimMediumPropertiesConstPtr medium,
                                                              I3CLSimFunctionConstPtr wavelengthGenerationBias,
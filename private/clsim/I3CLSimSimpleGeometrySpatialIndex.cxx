@@ -0,0 +1,309 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimSimpleGeometrySpatialIndex.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#include "clsim/I3CLSimSimpleGeometrySpatialIndex.h"
+
+#include "icetray/I3Units.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // we do not want to end up with more than this many cells per DOM
+    const std::size_t maxCellsPerDOM = 16;
+
+    // squared distance from a DOM to a track segment (see DistToClosestDOM()
+    // in I3CLSimModule for the original version)
+    inline double SquaredDistToSegment(double x, double y, double z,
+                                       const I3Position &pos, const I3Direction &dir,
+                                       double tStart, double tEnd)
+    {
+        const double Ax = x-pos.GetX();
+        const double Ay = y-pos.GetY();
+        const double Az = z-pos.GetZ();
+
+        double d_along = Ax*dir.GetX() + Ay*dir.GetY() + Az*dir.GetZ();
+        if (d_along < tStart) d_along=tStart; // there is no track before its start
+        if (d_along > tEnd) d_along=tEnd;     // there is no track after its end
+
+        const double dx = Ax-dir.GetX()*d_along;
+        const double dy = Ay-dir.GetY()*d_along;
+        const double dz = Az-dir.GetZ()*d_along;
+
+        return dx*dx + dy*dy + dz*dz;
+    }
+
+    // clips the parameter range [t0,t1] of the line pos+t*dir to the slab [lo,hi]
+    // along one axis. Returns false if the range becomes empty.
+    inline bool ClipToSlab(double p, double d, double lo, double hi, double &t0, double &t1)
+    {
+        if (d==0.) {
+            return ((p >= lo) && (p <= hi));
+        }
+
+        double tLo = (lo-p)/d;
+        double tHi = (hi-p)/d;
+        if (tLo > tHi) std::swap(tLo, tHi);
+
+        if (tLo > t0) t0=tLo;
+        if (tHi < t1) t1=tHi;
+
+        return (t0 <= t1);
+    }
+}
+
+I3CLSimSimpleGeometrySpatialIndex::I3CLSimSimpleGeometrySpatialIndex(const I3CLSimSimpleGeometry &geometry,
+                                                                     double cellSize)
+{
+    const std::size_t numDOMs = geometry.size();
+
+    const std::vector<double> &xVect = geometry.GetPosXVector();
+    const std::vector<double> &yVect = geometry.GetPosYVector();
+    const std::vector<double> &zVect = geometry.GetPosZVector();
+
+    if (numDOMs==0) {
+        cellSize_ = (cellSize > 0.)?cellSize:1.;
+        minX_=0.; minY_=0.; minZ_=0.;
+        numCellsX_=1; numCellsY_=1; numCellsZ_=1;
+        cellStart_.assign(2, 0);
+        return;
+    }
+
+    // bounding box
+    minX_ = *std::min_element(xVect.begin(), xVect.end());
+    minY_ = *std::min_element(yVect.begin(), yVect.end());
+    minZ_ = *std::min_element(zVect.begin(), zVect.end());
+    const double extentX = std::max(*std::max_element(xVect.begin(), xVect.end()) - minX_, 1.*I3Units::m);
+    const double extentY = std::max(*std::max_element(yVect.begin(), yVect.end()) - minY_, 1.*I3Units::m);
+    const double extentZ = std::max(*std::max_element(zVect.begin(), zVect.end()) - minZ_, 1.*I3Units::m);
+
+    if (!(cellSize > 0.)) {
+        // aim for about 4 DOMs per cell
+        cellSize = std::pow(extentX*extentY*extentZ*4./static_cast<double>(numDOMs), 1./3.);
+    }
+
+    // make sure the grid does not get too large for very small cells
+    for (;;)
+    {
+        numCellsX_ = static_cast<std::size_t>(extentX/cellSize)+1;
+        numCellsY_ = static_cast<std::size_t>(extentY/cellSize)+1;
+        numCellsZ_ = static_cast<std::size_t>(extentZ/cellSize)+1;
+
+        const double numCells = static_cast<double>(numCellsX_)*static_cast<double>(numCellsY_)*static_cast<double>(numCellsZ_);
+        if (numCells <= static_cast<double>(maxCellsPerDOM*numDOMs)) break;
+
+        cellSize *= 1.25;
+    }
+    cellSize_ = cellSize;
+
+    // counting sort of all DOMs into their cells
+    std::vector<std::size_t> cellForDOM(numDOMs);
+    cellStart_.assign(numCellsX_*numCellsY_*numCellsZ_+1, 0);
+    for (std::size_t i=0;i<numDOMs;++i)
+    {
+        cellForDOM[i] = CellIndex(ClampedCellCoordinate(xVect[i], minX_, numCellsX_),
+                                  ClampedCellCoordinate(yVect[i], minY_, numCellsY_),
+                                  ClampedCellCoordinate(zVect[i], minZ_, numCellsZ_));
+        ++cellStart_[cellForDOM[i]+1];
+    }
+    for (std::size_t i=1;i<cellStart_.size();++i)
+    {
+        cellStart_[i] += cellStart_[i-1];
+    }
+
+    posX_.resize(numDOMs);
+    posY_.resize(numDOMs);
+    posZ_.resize(numDOMs);
+
+    std::vector<std::size_t> fillLevel(cellStart_.begin(), cellStart_.end()-1);
+    for (std::size_t i=0;i<numDOMs;++i)
+    {
+        const std::size_t j = fillLevel[cellForDOM[i]]++;
+        posX_[j] = xVect[i];
+        posY_[j] = yVect[i];
+        posZ_[j] = zVect[i];
+    }
+}
+
+I3CLSimSimpleGeometrySpatialIndex::~I3CLSimSimpleGeometrySpatialIndex()
+{
+
+}
+
+double I3CLSimSimpleGeometrySpatialIndex::GetDistanceToClosestDOM(const I3Position &pos) const
+{
+    if (posX_.empty()) return 0.;
+
+    const std::size_t cx = ClampedCellCoordinate(pos.GetX(), minX_, numCellsX_);
+    const std::size_t cy = ClampedCellCoordinate(pos.GetY(), minY_, numCellsY_);
+    const std::size_t cz = ClampedCellCoordinate(pos.GetZ(), minZ_, numCellsZ_);
+
+    double closestDistSquared = std::numeric_limits<double>::infinity();
+
+    // search shells of cells with increasing distance around
+    // the starting cell until nothing closer can be found
+    for (std::size_t r=0;;++r)
+    {
+        const std::size_t ixLo = (cx>=r)?cx-r:0;
+        const std::size_t iyLo = (cy>=r)?cy-r:0;
+        const std::size_t izLo = (cz>=r)?cz-r:0;
+        const std::size_t ixHi = std::min(cx+r, numCellsX_-1);
+        const std::size_t iyHi = std::min(cy+r, numCellsY_-1);
+        const std::size_t izHi = std::min(cz+r, numCellsZ_-1);
+
+        for (std::size_t iz=izLo;iz<=izHi;++iz)
+        {
+            const bool zOnShell = (iz+r==cz) || (iz==cz+r);
+            for (std::size_t iy=iyLo;iy<=iyHi;++iy)
+            {
+                const bool yzOnShell = zOnShell || (iy+r==cy) || (iy==cy+r);
+                for (std::size_t ix=ixLo;ix<=ixHi;++ix)
+                {
+                    // only look at the cells on the surface of the current shell
+                    if ((!yzOnShell) && (ix+r!=cx) && (ix!=cx+r)) continue;
+
+                    const std::size_t cell = CellIndex(ix, iy, iz);
+                    for (std::size_t i=cellStart_[cell];i<cellStart_[cell+1];++i)
+                    {
+                        const double dx = posX_[i]-pos.GetX();
+                        const double dy = posY_[i]-pos.GetY();
+                        const double dz = posZ_[i]-pos.GetZ();
+
+                        const double thisDistSquared = dx*dx + dy*dy + dz*dz;
+                        if (thisDistSquared < closestDistSquared) closestDistSquared=thisDistSquared;
+                    }
+                }
+            }
+        }
+
+        // Everything that has not been looked at yet is outside of the
+        // box [ixLo..ixHi]x[iyLo..iyHi]x[izLo..izHi]. Find the distance
+        // from the query point to the closest face of that box that still
+        // has cells behind it.
+        double lowerBound = std::numeric_limits<double>::infinity();
+        if (ixLo > 0)            lowerBound = std::min(lowerBound, pos.GetX() - (minX_ + static_cast<double>(ixLo)*cellSize_));
+        if (ixHi+1 < numCellsX_) lowerBound = std::min(lowerBound, (minX_ + static_cast<double>(ixHi+1)*cellSize_) - pos.GetX());
+        if (iyLo > 0)            lowerBound = std::min(lowerBound, pos.GetY() - (minY_ + static_cast<double>(iyLo)*cellSize_));
+        if (iyHi+1 < numCellsY_) lowerBound = std::min(lowerBound, (minY_ + static_cast<double>(iyHi+1)*cellSize_) - pos.GetY());
+        if (izLo > 0)            lowerBound = std::min(lowerBound, pos.GetZ() - (minZ_ + static_cast<double>(izLo)*cellSize_));
+        if (izHi+1 < numCellsZ_) lowerBound = std::min(lowerBound, (minZ_ + static_cast<double>(izHi+1)*cellSize_) - pos.GetZ());
+
+        if (std::isinf(lowerBound)) break; // all cells have been searched
+        if ((lowerBound > 0.) && (closestDistSquared <= lowerBound*lowerBound)) break;
+    }
+
+    return std::sqrt(closestDistSquared);
+}
+
+double I3CLSimSimpleGeometrySpatialIndex::GetDistanceToClosestDOM(const I3Position &pos,
+                                                                  const I3Direction &dir,
+                                                                  double length,
+                                                                  bool nostart,
+                                                                  bool nostop,
+                                                                  double maxDistance) const
+{
+    if (posX_.empty()) return 0.;
+
+    const double tStart = nostart?-std::numeric_limits<double>::infinity():0.;
+    const double tEnd = nostop?std::numeric_limits<double>::infinity():length;
+
+    const double gridSizeX = static_cast<double>(numCellsX_)*cellSize_;
+    const double gridSizeY = static_cast<double>(numCellsY_)*cellSize_;
+    const double gridSizeZ = static_cast<double>(numCellsZ_)*cellSize_;
+    const double gridDiagonal = std::sqrt(gridSizeX*gridSizeX + gridSizeY*gridSizeY + gridSizeZ*gridSizeZ);
+
+    double closestDistSquared = std::numeric_limits<double>::infinity();
+
+    if (!(maxDistance < gridDiagonal))
+    {
+        // the search radius covers the whole grid anyway, just look at all DOMs
+        for (std::size_t i=0;i<posX_.size();++i)
+        {
+            const double thisDistSquared = SquaredDistToSegment(posX_[i], posY_[i], posZ_[i], pos, dir, tStart, tEnd);
+            if (thisDistSquared < closestDistSquared) closestDistSquared=thisDistSquared;
+        }
+
+        const double closestDist = std::sqrt(closestDistSquared);
+        return (closestDist < maxDistance)?closestDist:maxDistance;
+    }
+
+    // Only the part of the track that is within maxDistance of the
+    // grid can be closer than maxDistance to any DOM.
+    double t0 = tStart;
+    double t1 = tEnd;
+    if ((!ClipToSlab(pos.GetX(), dir.GetX(), minX_-maxDistance, minX_+gridSizeX+maxDistance, t0, t1)) ||
+        (!ClipToSlab(pos.GetY(), dir.GetY(), minY_-maxDistance, minY_+gridSizeY+maxDistance, t0, t1)) ||
+        (!ClipToSlab(pos.GetZ(), dir.GetZ(), minZ_-maxDistance, minZ_+gridSizeZ+maxDistance, t0, t1)))
+    {
+        return maxDistance;
+    }
+
+    // Walk along the track in steps of one cell size. Every point on the
+    // track is at most half a cell size away from one of the sampling points,
+    // so looking at all cells within maxDistance plus half a cell size around
+    // each sampling point finds every DOM within maxDistance of the track.
+    const double searchRadius = maxDistance + 0.5*cellSize_;
+    const std::size_t numSteps = static_cast<std::size_t>(std::ceil((t1-t0)/cellSize_));
+
+    std::vector<bool> cellVisited(cellStart_.size()-1, false);
+
+    for (std::size_t step=0;step<=numSteps;++step)
+    {
+        const double t = std::min(t0 + static_cast<double>(step)*cellSize_, t1);
+        const double px = pos.GetX() + dir.GetX()*t;
+        const double py = pos.GetY() + dir.GetY()*t;
+        const double pz = pos.GetZ() + dir.GetZ()*t;
+
+        const std::size_t ixLo = ClampedCellCoordinate(px-searchRadius, minX_, numCellsX_);
+        const std::size_t ixHi = ClampedCellCoordinate(px+searchRadius, minX_, numCellsX_);
+        const std::size_t iyLo = ClampedCellCoordinate(py-searchRadius, minY_, numCellsY_);
+        const std::size_t iyHi = ClampedCellCoordinate(py+searchRadius, minY_, numCellsY_);
+        const std::size_t izLo = ClampedCellCoordinate(pz-searchRadius, minZ_, numCellsZ_);
+        const std::size_t izHi = ClampedCellCoordinate(pz+searchRadius, minZ_, numCellsZ_);
+
+        for (std::size_t iz=izLo;iz<=izHi;++iz)
+        {
+            for (std::size_t iy=iyLo;iy<=iyHi;++iy)
+            {
+                for (std::size_t ix=ixLo;ix<=ixHi;++ix)
+                {
+                    const std::size_t cell = CellIndex(ix, iy, iz);
+                    if (cellVisited[cell]) continue;
+                    cellVisited[cell]=true;
+
+                    for (std::size_t i=cellStart_[cell];i<cellStart_[cell+1];++i)
+                    {
+                        const double thisDistSquared = SquaredDistToSegment(posX_[i], posY_[i], posZ_[i], pos, dir, tStart, tEnd);
+                        if (thisDistSquared < closestDistSquared) closestDistSquared=thisDistSquared;
+                    }
+                }
+            }
+        }
+    }
+
+    const double closestDist = std::sqrt(closestDistSquared);
+    return (closestDist < maxDistance)?closestDist:maxDistance;
+}
@@ -0,0 +1,1303 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ *
+ * @file I3CLSimStepToPhotonConverterNative.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+// This file is compiled with -ftree-vectorize -fno-math-errno -fno-trapping-math
+// (see CMakeLists.txt) so that the photon batch loops get vectorized. Where
+// the compiler supports it, AVX-512 and AVX2 versions of them are built in
+// addition to the default one and the best one is picked at load time.
+
+#include "clsim/I3CLSimStepToPhotonConverterNative.h"
+
+#include "phys-services/I3GSLRandomService.h"
+#include "dataclasses/I3Constants.h"
+#include "icetray/I3Units.h"
+
+#include "clsim/function/I3CLSimScalarFieldConstant.h"
+#include "clsim/function/I3CLSimVectorTransformConstant.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 6) && defined(__x86_64__) && defined(__linux__)
+#define CLSIM_BATCH_TARGET_CLONES __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define CLSIM_BATCH_TARGET_CLONES
+#endif
+
+struct I3CLSimStepToPhotonConverterNative::Bunch
+{
+    Bunch() : identifier(0), numChunksLeft(0), numPhotonsGenerated(0), deviceTimeInNanoseconds(0) {;}
+
+    uint32_t identifier;
+    I3CLSimStepSeriesConstPtr steps;
+    boost::posix_time::ptime dispatchTime;
+
+    boost::mutex mutex;
+    boost::condition_variable_any finished;
+    std::vector<I3CLSimPhotonSeriesPtr> chunkPhotons;
+    std::size_t numChunksLeft;
+    uint64_t numPhotonsGenerated;
+    uint64_t deviceTimeInNanoseconds;
+};
+
+namespace {
+    // number of wavelength points for the medium property tables
+    const std::size_t numWavelengthTablePoints = 512;
+
+    // photons are created from a step in batches of this size
+    const std::size_t photonBatchSize = 64;
+
+    // the x-y grid for DOM lookups
+    const double minGridCellSize = 20.*I3Units::m;
+    const std::size_t maxGridCellsPerDimension = 1024;
+
+    // photons with fewer absorption lengths left are absorbed
+    const double absLensEpsilon = 1e-8;
+
+    // a bunch is split into about this many chunks per thread
+    const std::size_t chunksPerThread = 4;
+
+    // The state of a batch of photons from the same step, stored as
+    // structure-of-arrays. The photons are propagated together, one
+    // scatter at a time, and absorbed photons are removed from the
+    // batch after each round (see CompactPhotonBatch()).
+    struct PhotonBatch
+    {
+        // inputs of CreatePhotonBatch() and ScatterPhotonBatch()
+        double shift[photonBatchSize];  // distance along the step
+        double cosa[photonBatchSize];   // Cherenkov or scattering angle
+        double cosb[photonBatchSize];   // azimuth around the current direction
+        double sinb[photonBatchSize];
+
+        // the current photon state
+        double posX[photonBatchSize];
+        double posY[photonBatchSize];
+        double posZ[photonBatchSize];
+        double time[photonBatchSize];
+        double dirX[photonBatchSize];
+        double dirY[photonBatchSize];
+        double dirZ[photonBatchSize];
+        double distance[photonBatchSize];  // to the next scatter/absorption
+        double totalPathLength[photonBatchSize];
+        double absLensLeft[photonBatchSize];
+        uint32_t numScatters[photonBatchSize];
+
+        // constant along the photon path
+        double wlen[photonBatchSize];
+        double groupVelocity[photonBatchSize];
+        double invGroupVel[photonBatchSize];
+        double weight[photonBatchSize];
+        double absLensInitial[photonBatchSize];
+        double startPosX[photonBatchSize];
+        double startPosY[photonBatchSize];
+        double startPosZ[photonBatchSize];
+        double startTime[photonBatchSize];
+        float startDirTheta[photonBatchSize];
+        float startDirPhi[photonBatchSize];
+    };
+
+    // Moves a batch of photons along the step and points them along the
+    // step direction (same as createPhotonFromTrack() in the OpenCL
+    // kernel). ScatterPhotonBatch() then applies the Cherenkov angle.
+    CLSIM_BATCH_TARGET_CLONES
+    void CreatePhotonBatch(PhotonBatch &batch,
+                           std::size_t num,
+                           const double *stepPosAndTime,
+                           const double *stepDir,
+                           double inverseParticleSpeed)
+    {
+        const double * __restrict__ shift = batch.shift;
+        double * __restrict__ posX = batch.posX;
+        double * __restrict__ posY = batch.posY;
+        double * __restrict__ posZ = batch.posZ;
+        double * __restrict__ time = batch.time;
+        double * __restrict__ dirX = batch.dirX;
+        double * __restrict__ dirY = batch.dirY;
+        double * __restrict__ dirZ = batch.dirZ;
+
+        const double x0 = stepPosAndTime[0], y0 = stepPosAndTime[1], z0 = stepPosAndTime[2], t0 = stepPosAndTime[3];
+        const double dx = stepDir[0], dy = stepDir[1], dz = stepDir[2];
+
+        for (std::size_t i=0;i<num;++i)
+        {
+            posX[i] = x0 + dx*shift[i];
+            posY[i] = y0 + dy*shift[i];
+            posZ[i] = z0 + dz*shift[i];
+            time[i] = t0 + inverseParticleSpeed*shift[i];
+            dirX[i] = dx;
+            dirY[i] = dy;
+            dirZ[i] = dz;
+        }
+    }
+
+    // Rotates the photon directions by the angles in cosa/cosb/sinb
+    // (same as scatterDirectionByAngle() in the OpenCL kernel). Both
+    // cases of the kernel are calculated for every photon and the right
+    // one is selected afterwards, so that the loop has no branches.
+    CLSIM_BATCH_TARGET_CLONES
+    void ScatterPhotonBatch(PhotonBatch &batch, std::size_t num)
+    {
+        const double * __restrict__ cosa = batch.cosa;
+        const double * __restrict__ cosb = batch.cosb;
+        const double * __restrict__ sinb = batch.sinb;
+        double * __restrict__ dirX = batch.dirX;
+        double * __restrict__ dirY = batch.dirY;
+        double * __restrict__ dirZ = batch.dirZ;
+
+        for (std::size_t i=0;i<num;++i)
+        {
+            const double sina = std::sqrt(std::max(0., 1.-cosa[i]*cosa[i]));
+            const double sinth = std::sqrt(std::max(0., 1.-dirZ[i]*dirZ[i]));
+            const bool alongZ = !(sinth > 0.);
+            const double recip_sinth = 1./(alongZ?1.:sinth);
+
+            double x = dirX[i]*cosa[i]-(dirY[i]*cosb[i]+dirZ[i]*dirX[i]*sinb[i])*sina*recip_sinth;
+            double y = dirY[i]*cosa[i]+(dirX[i]*cosb[i]-dirZ[i]*dirY[i]*sinb[i])*sina*recip_sinth;
+            double z = dirZ[i]*cosa[i]+sina*sinb[i]*sinth;
+
+            x = alongZ?(sina*cosb[i]):x;
+            y = alongZ?(sina*sinb[i]):y;
+            z = alongZ?((dirZ[i]>=0.)?cosa[i]:-cosa[i]):z;
+
+            const double recip_length = 1./std::sqrt(x*x+y*y+z*z);
+            dirX[i] = x*recip_length;
+            dirY[i] = y*recip_length;
+            dirZ[i] = z*recip_length;
+        }
+    }
+
+    // Moves the photons by their distance to the next interaction
+    CLSIM_BATCH_TARGET_CLONES
+    void AdvancePhotonBatch(PhotonBatch &batch, std::size_t num)
+    {
+        const double * __restrict__ distance = batch.distance;
+        const double * __restrict__ dirX = batch.dirX;
+        const double * __restrict__ dirY = batch.dirY;
+        const double * __restrict__ dirZ = batch.dirZ;
+        const double * __restrict__ invGroupVel = batch.invGroupVel;
+        double * __restrict__ posX = batch.posX;
+        double * __restrict__ posY = batch.posY;
+        double * __restrict__ posZ = batch.posZ;
+        double * __restrict__ time = batch.time;
+        double * __restrict__ totalPathLength = batch.totalPathLength;
+
+        for (std::size_t i=0;i<num;++i)
+        {
+            posX[i] += dirX[i]*distance[i];
+            posY[i] += dirY[i]*distance[i];
+            posZ[i] += dirZ[i]*distance[i];
+            time[i] += invGroupVel[i]*distance[i];
+            totalPathLength[i] += distance[i];
+        }
+    }
+
+    // Removes the photons with fewer than minAbsLens absorption lengths
+    // left and moves the others to the front of the batch, keeping their
+    // order. Returns the number of photons left.
+    std::size_t CompactPhotonBatch(PhotonBatch &batch, std::size_t num, double minAbsLens)
+    {
+        std::size_t numLeft=0;
+        for (std::size_t i=0;i<num;++i)
+        {
+            if (batch.absLensLeft[i] < minAbsLens) continue;
+
+            if (i != numLeft) {
+                const std::size_t j=numLeft;
+                batch.posX[j] = batch.posX[i];
+                batch.posY[j] = batch.posY[i];
+                batch.posZ[j] = batch.posZ[i];
+                batch.time[j] = batch.time[i];
+                batch.dirX[j] = batch.dirX[i];
+                batch.dirY[j] = batch.dirY[i];
+                batch.dirZ[j] = batch.dirZ[i];
+                batch.totalPathLength[j] = batch.totalPathLength[i];
+                batch.absLensLeft[j] = batch.absLensLeft[i];
+                batch.numScatters[j] = batch.numScatters[i];
+                batch.wlen[j] = batch.wlen[i];
+                batch.groupVelocity[j] = batch.groupVelocity[i];
+                batch.invGroupVel[j] = batch.invGroupVel[i];
+                batch.weight[j] = batch.weight[i];
+                batch.absLensInitial[j] = batch.absLensInitial[i];
+                batch.startPosX[j] = batch.startPosX[i];
+                batch.startPosY[j] = batch.startPosY[i];
+                batch.startPosZ[j] = batch.startPosZ[i];
+                batch.startTime[j] = batch.startTime[i];
+                batch.startDirTheta[j] = batch.startDirTheta[i];
+                batch.startDirPhi[j] = batch.startDirPhi[i];
+            }
+            ++numLeft;
+        }
+        return numLeft;
+    }
+
+    inline void SphDirFromCar(const double *dir, float &theta, float &phi)
+    {
+        const double r_inv = 1./std::sqrt(dir[0]*dir[0]+dir[1]*dir[1]+dir[2]*dir[2]);
+
+        double theta_ = 0.;
+        if (std::abs(dir[2]*r_inv)<=1.) {
+            theta_=std::acos(dir[2]*r_inv);
+        } else {
+            if (dir[2]<0.) theta_=M_PI;
+        }
+        if (theta_<0.) theta_+=2.*M_PI;
+
+        double phi_=std::atan2(dir[1],dir[0]);
+        if (phi_<0.) phi_+=2.*M_PI;
+
+        theta=static_cast<float>(theta_);
+        phi=static_cast<float>(phi_);
+    }
+
+    // applies an optional direction transform to all photons of a batch
+    inline void ApplyTransform(const I3CLSimVectorTransformConstPtr &transform, PhotonBatch &batch, std::size_t num)
+    {
+        if (!transform) return;
+
+        for (std::size_t i=0;i<num;++i)
+        {
+            double dir[3] = {batch.dirX[i], batch.dirY[i], batch.dirZ[i]};
+            transform->ApplyTransformInPlace(dir);
+            batch.dirX[i]=dir[0]; batch.dirY[i]=dir[1]; batch.dirZ[i]=dir[2];
+        }
+    }
+
+    // linear interpolation in wavelength tables, either per wavelength
+    // point or stored as [wavelength point][layer]
+    struct WlenTableLookup
+    {
+        WlenTableLookup(double wlen, double minWlen, double wlenStep, std::size_t numWlens, uint32_t numLayers_)
+        :
+        numLayers(numLayers_)
+        {
+            double x = (wlen-minWlen)/wlenStep;
+            x = std::min(std::max(x, 0.), static_cast<double>(numWlens-1));
+
+            index = std::min(static_cast<std::size_t>(x), numWlens-2);
+            frac = x-static_cast<double>(index);
+        }
+
+        inline double operator()(const std::vector<double> &table) const
+        {
+            return table[index]*(1.-frac) + table[index+1]*frac;
+        }
+
+        inline double operator()(const std::vector<double> &table, uint32_t layer) const
+        {
+            return table[index*numLayers+layer]*(1.-frac) + table[(index+1)*numLayers+layer]*frac;
+        }
+
+        std::size_t numLayers;
+        std::size_t index;
+        double frac;
+    };
+
+    inline int64_t ElapsedNanoseconds(const boost::posix_time::ptime &from, const boost::posix_time::ptime &to)
+    {
+        return (to-from).total_microseconds()*1000;
+    }
+}
+
+
+I3CLSimStepToPhotonConverterNative::I3CLSimStepToPhotonConverterNative(I3RandomServicePtr randomService,
+                                                                       std::size_t numThreads)
+:
+statistics_total_device_duration_in_nanoseconds_(0),
+statistics_total_host_duration_in_nanoseconds_(0),
+statistics_total_kernel_calls_(0),
+statistics_total_num_photons_generated_(0),
+statistics_total_num_photons_atDOMs_(0),
+queueToNative_(new I3CLSimQueue<ToNativePair_t>(5)),
+queueToWorkers_(new I3CLSimQueue<Chunk>(0)),
+queueToCollector_(new I3CLSimQueue<BunchPtr>(2)),
+queueFromNative_(new I3CLSimQueue<I3CLSimStepToPhotonConverter::ConversionResult_t>(0)),
+randomService_(randomService),
+nextChunkSeed_(0),
+numThreads_(numThreads),
+maxNumWorkitems_(0),
+initialized_(false),
+stopDetectedPhotons_(true),
+pancakeFactor_(1.),
+layersNum_(0),
+layersZStart_(NAN),
+layersHeight_(NAN),
+tableMinWlen_(NAN),
+tableWlenStep_(NAN),
+tableNumWlens_(0),
+omRadius_(NAN),
+gridMinX_(NAN),
+gridMinY_(NAN),
+gridCellSize_(NAN),
+gridNumCellsX_(0),
+gridNumCellsY_(0)
+{
+    if (!randomService_) log_fatal("You need to supply a I3RandomService.");
+
+    if (numThreads_==0) {
+        numThreads_ = boost::thread::hardware_concurrency();
+        if (numThreads_==0) numThreads_=1;
+    }
+
+    // keep all threads busy while the next bunch is being prepared
+    maxNumWorkitems_ = 1024*numThreads_;
+}
+
+I3CLSimStepToPhotonConverterNative::~I3CLSimStepToPhotonConverterNative()
+{
+    std::vector<boost::shared_ptr<boost::thread> > threads(workerThreadObjs_);
+    threads.push_back(dispatcherThreadObj_);
+    threads.push_back(collectorThreadObj_);
+
+    log_debug("Stopping the native worker threads..");
+
+    BOOST_FOREACH(boost::shared_ptr<boost::thread> &thread, threads)
+    {
+        if ((thread) && (thread->joinable())) thread->interrupt();
+    }
+
+    BOOST_FOREACH(boost::shared_ptr<boost::thread> &thread, threads)
+    {
+        if ((thread) && (thread->joinable())) thread->join(); // wait for it indefinitely
+    }
+
+    log_debug("Native worker threads stopped.");
+
+    workerThreadObjs_.clear();
+    dispatcherThreadObj_.reset();
+    collectorThreadObj_.reset();
+}
+
+std::size_t I3CLSimStepToPhotonConverterNative::GetNumThreads() const
+{
+    return numThreads_;
+}
+
+void I3CLSimStepToPhotonConverterNative::SetMaxNumWorkitems(std::size_t val)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterNative already initialized!");
+
+    if (val==0)
+        throw I3CLSimStepToPhotonConverter_exception("Invalid maximum number of work items!");
+
+    maxNumWorkitems_=val;
+}
+
+std::size_t I3CLSimStepToPhotonConverterNative::GetMaxNumWorkitems() const
+{
+    return maxNumWorkitems_;
+}
+
+std::size_t I3CLSimStepToPhotonConverterNative::GetWorkgroupSize() const
+{
+    return 1;
+}
+
+void I3CLSimStepToPhotonConverterNative::SetStopDetectedPhotons(bool value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterNative already initialized!");
+
+    stopDetectedPhotons_=value;
+}
+
+bool I3CLSimStepToPhotonConverterNative::GetStopDetectedPhotons() const
+{
+    return stopDetectedPhotons_;
+}
+
+void I3CLSimStepToPhotonConverterNative::SetDOMPancakeFactor(double value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterNative already initialized!");
+
+    pancakeFactor_=value;
+}
+
+double I3CLSimStepToPhotonConverterNative::GetDOMPancakeFactor() const
+{
+    return pancakeFactor_;
+}
+
+void I3CLSimStepToPhotonConverterNative::SetWlenGenerators(const std::vector<I3CLSimRandomValueConstPtr> &wlenGenerators)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterNative already initialized!");
+
+    wlenGenerators_ = wlenGenerators;
+}
+
+void I3CLSimStepToPhotonConverterNative::SetWlenBias(I3CLSimFunctionConstPtr wlenBias)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterNative already initialized!");
+
+    wlenBias_ = wlenBias;
+}
+
+void I3CLSimStepToPhotonConverterNative::SetMediumProperties(I3CLSimMediumPropertiesConstPtr mediumProperties)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterNative already initialized!");
+
+    mediumProperties_ = mediumProperties;
+}
+
+void I3CLSimStepToPhotonConverterNative::SetGeometry(I3CLSimSimpleGeometryConstPtr geometry)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterNative already initialized!");
+
+    geometry_ = geometry;
+}
+
+bool I3CLSimStepToPhotonConverterNative::IsInitialized() const
+{
+    return initialized_;
+}
+
+void I3CLSimStepToPhotonConverterNative::TabulateMediumProperties()
+{
+    const I3CLSimMediumProperties &medium = *mediumProperties_;
+
+    layersNum_ = medium.GetLayersNum();
+    layersZStart_ = medium.GetLayersZStart();
+    layersHeight_ = medium.GetLayersHeight();
+    if (layersNum_==0) log_fatal("The medium does not have any layers.");
+
+    for (uint32_t i=0;i<layersNum_;++i)
+    {
+        if (!medium.GetAbsorptionLength(i)) log_fatal("absorption length for layer %" PRIu32 " is (null).", i);
+        if (!medium.GetScatteringLength(i)) log_fatal("scattering length for layer %" PRIu32 " is (null).", i);
+        if (!medium.GetPhaseRefractiveIndex(i)) log_fatal("phase refractive index for layer %" PRIu32 " is (null).", i);
+
+        if (!medium.GetAbsorptionLength(i)->HasNativeImplementation())
+            log_fatal("The absorption length for layer %" PRIu32 " has no host implementation.", i);
+        if (!medium.GetScatteringLength(i)->HasNativeImplementation())
+            log_fatal("The scattering length for layer %" PRIu32 " has no host implementation.", i);
+        if (!medium.GetPhaseRefractiveIndex(i)->HasNativeImplementation())
+            log_fatal("The phase refractive index for layer %" PRIu32 " has no host implementation.", i);
+    }
+
+    // the group velocity is taken from layer 0 for all layers, just like
+    // in the OpenCL kernel (which refuses to compile otherwise)
+    I3CLSimFunctionConstPtr groupRefIndexOverride = medium.GetGroupRefractiveIndexOverride(0);
+    for (uint32_t i=1;i<layersNum_;++i)
+    {
+        if (groupRefIndexOverride) {
+            if (!medium.GetGroupRefractiveIndexOverride(i))
+                log_fatal("Medium property error: group refractive index overrides are not set for all layers! (unset for layer %" PRIu32 ")", i);
+            if (!(*medium.GetGroupRefractiveIndexOverride(i) == *groupRefIndexOverride))
+                log_fatal("The group velocity has to be the same in all layers.");
+        } else {
+            if (!(*medium.GetPhaseRefractiveIndex(i) == *medium.GetPhaseRefractiveIndex(0)))
+                log_fatal("The group velocity has to be the same in all layers (the phase refractive index depends on the layer).");
+        }
+    }
+    if ((groupRefIndexOverride) && (!groupRefIndexOverride->HasNativeImplementation()))
+        log_fatal("The group refractive index has no host implementation.");
+
+    const double minWlen = medium.GetMinWavelength();
+    const double maxWlen = medium.GetMaxWavelength();
+    if ((std::isnan(minWlen)) || (std::isnan(maxWlen)) || (maxWlen <= minWlen))
+        log_fatal("The medium has an invalid wavelength range.");
+
+    tableNumWlens_ = numWavelengthTablePoints;
+    tableMinWlen_ = minWlen;
+    tableWlenStep_ = (maxWlen-minWlen)/static_cast<double>(tableNumWlens_-1);
+
+    tableScatteringLength_.assign(tableNumWlens_*layersNum_, NAN);
+    tableAbsorptionLength_.assign(tableNumWlens_*layersNum_, NAN);
+    tablePhaseRefIndex_.assign(tableNumWlens_*layersNum_, NAN);
+    tableGroupVelocity_.assign(tableNumWlens_, NAN);
+
+    const I3CLSimFunction &phaseRefIndex0 = *medium.GetPhaseRefractiveIndex(0);
+
+    for (std::size_t i=0;i<tableNumWlens_;++i)
+    {
+        const double wlen = tableMinWlen_ + static_cast<double>(i)*tableWlenStep_;
+
+        for (uint32_t j=0;j<layersNum_;++j)
+        {
+            tableScatteringLength_[i*layersNum_+j] = medium.GetScatteringLength(j)->GetValue(wlen);
+            tableAbsorptionLength_[i*layersNum_+j] = medium.GetAbsorptionLength(j)->GetValue(wlen);
+            tablePhaseRefIndex_[i*layersNum_+j] = medium.GetPhaseRefractiveIndex(j)->GetValue(wlen);
+        }
+
+        if (groupRefIndexOverride) {
+            tableGroupVelocity_[i] = I3Constants::c/groupRefIndexOverride->GetValue(wlen);
+        } else {
+            // group velocity from dispersion
+            const double n_inv = 1./phaseRefIndex0.GetValue(wlen);
+            const double y = phaseRefIndex0.HasDerivative()?phaseRefIndex0.GetDerivative(wlen):0.;
+
+            tableGroupVelocity_[i] = I3Constants::c * (1. + y*wlen*n_inv) * n_inv;
+        }
+    }
+
+    // these may be skipped if they are known to do nothing
+    iceTiltZShift_ = medium.GetIceTiltZShift();
+    directionalAbsLenCorrection_ = medium.GetDirectionalAbsorptionLengthCorrection();
+    preScatterDirectionTransform_ = medium.GetPreScatterDirectionTransform();
+    postScatterDirectionTransform_ = medium.GetPostScatterDirectionTransform();
+
+    if ((iceTiltZShift_) && (!iceTiltZShift_->HasNativeImplementation()))
+        log_fatal("The ice tilt z-shift has no host implementation.");
+    if ((directionalAbsLenCorrection_) && (!directionalAbsLenCorrection_->HasNativeImplementation()))
+        log_fatal("The directional absorption length correction has no host implementation.");
+    if ((preScatterDirectionTransform_) && (!preScatterDirectionTransform_->HasNativeImplementation()))
+        log_fatal("The pre-scatter direction transform has no host implementation.");
+    if ((postScatterDirectionTransform_) && (!postScatterDirectionTransform_->HasNativeImplementation()))
+        log_fatal("The post-scatter direction transform has no host implementation.");
+
+    if (boost::dynamic_pointer_cast<const I3CLSimScalarFieldConstant>(iceTiltZShift_)) {
+        if (iceTiltZShift_->GetValue(0.,0.,0.) == 0.) iceTiltZShift_.reset();
+    }
+    if (boost::dynamic_pointer_cast<const I3CLSimScalarFieldConstant>(directionalAbsLenCorrection_)) {
+        if (directionalAbsLenCorrection_->GetValue(0.,0.,0.) == 1.) directionalAbsLenCorrection_.reset();
+    }
+    if (boost::dynamic_pointer_cast<const I3CLSimVectorTransformConstant>(preScatterDirectionTransform_))
+        preScatterDirectionTransform_.reset();
+    if (boost::dynamic_pointer_cast<const I3CLSimVectorTransformConstant>(postScatterDirectionTransform_))
+        postScatterDirectionTransform_.reset();
+
+    if (!medium.GetScatteringCosAngleDistribution())
+        log_fatal("scattering angle function is (null).");
+    if (medium.GetScatteringCosAngleDistribution()->NumberOfParameters() != 0)
+        log_fatal("The scattering angle distribution must not have any parameters.");
+}
+
+void I3CLSimStepToPhotonConverterNative::BuildDOMGrid()
+{
+    const I3CLSimSimpleGeometry &geometry = *geometry_;
+    const std::size_t numDOMs = geometry.size();
+
+    omRadius_ = geometry.GetOMRadius();
+
+    double minX=std::numeric_limits<double>::infinity();
+    double maxX=-std::numeric_limits<double>::infinity();
+    double minY=std::numeric_limits<double>::infinity();
+    double maxY=-std::numeric_limits<double>::infinity();
+    for (std::size_t i=0;i<numDOMs;++i)
+    {
+        minX = std::min(minX, geometry.GetPosX(i));
+        maxX = std::max(maxX, geometry.GetPosX(i));
+        minY = std::min(minY, geometry.GetPosY(i));
+        maxY = std::max(maxY, geometry.GetPosY(i));
+    }
+    if (numDOMs==0) {minX=maxX=minY=maxY=0.;}
+
+    gridCellSize_ = std::max(minGridCellSize, 2.*omRadius_);
+    const double maxExtent = std::max(maxX-minX, maxY-minY);
+    if (maxExtent/gridCellSize_ >= static_cast<double>(maxGridCellsPerDimension))
+        gridCellSize_ = maxExtent/static_cast<double>(maxGridCellsPerDimension-1);
+
+    gridMinX_ = minX;
+    gridMinY_ = minY;
+    gridNumCellsX_ = static_cast<std::size_t>((maxX-minX)/gridCellSize_)+1;
+    gridNumCellsY_ = static_cast<std::size_t>((maxY-minY)/gridCellSize_)+1;
+
+    // sort DOMs by cell, then by z
+    std::vector<std::pair<std::pair<std::size_t, double>, std::size_t> > order;
+    order.reserve(numDOMs);
+    for (std::size_t i=0;i<numDOMs;++i)
+    {
+        const std::size_t cellX = std::min(static_cast<std::size_t>((geometry.GetPosX(i)-gridMinX_)/gridCellSize_), gridNumCellsX_-1);
+        const std::size_t cellY = std::min(static_cast<std::size_t>((geometry.GetPosY(i)-gridMinY_)/gridCellSize_), gridNumCellsY_-1);
+
+        order.push_back(std::make_pair(std::make_pair(cellY*gridNumCellsX_+cellX, geometry.GetPosZ(i)), i));
+    }
+    std::sort(order.begin(), order.end());
+
+    gridCellStart_.assign(gridNumCellsX_*gridNumCellsY_+1, 0);
+    domPosX_.resize(numDOMs);
+    domPosY_.resize(numDOMs);
+    domPosZ_.resize(numDOMs);
+    domStringID_.resize(numDOMs);
+    domOMID_.resize(numDOMs);
+
+    for (std::size_t k=0;k<numDOMs;++k)
+    {
+        const std::size_t i = order[k].second;
+
+        const int32_t stringID = geometry.GetStringID(i);
+        const uint32_t domID = geometry.GetDomID(i);
+
+        if ((stringID < std::numeric_limits<int16_t>::min()) ||
+            (stringID > std::numeric_limits<int16_t>::max()))
+            log_fatal("Your detector I3Geometry uses a string ID \"%i\". Large IDs like that are currently not supported by clsim.",
+                      stringID);
+
+        if (domID > std::numeric_limits<uint16_t>::max())
+            log_fatal("Your detector I3Geometry uses a OM ID \"%u\". Large IDs like that are currently not supported by clsim.",
+                      domID);
+
+        domPosX_[k] = geometry.GetPosX(i);
+        domPosY_[k] = geometry.GetPosY(i);
+        domPosZ_[k] = geometry.GetPosZ(i);
+        domStringID_[k] = static_cast<int16_t>(stringID);
+        domOMID_[k] = static_cast<uint16_t>(domID);
+
+        ++gridCellStart_[order[k].first.first+1];
+    }
+
+    for (std::size_t i=1;i<gridCellStart_.size();++i)
+        gridCellStart_[i] += gridCellStart_[i-1];
+
+    log_debug("DOM grid: %zux%zu cells of %fm for %zu DOMs",
+              gridNumCellsX_, gridNumCellsY_, gridCellSize_/I3Units::m, numDOMs);
+}
+
+void I3CLSimStepToPhotonConverterNative::Initialize()
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterNative already initialized!");
+
+    if (wlenGenerators_.empty())
+        throw I3CLSimStepToPhotonConverter_exception("Wavelength generator not set!");
+
+    if (!wlenBias_)
+        throw I3CLSimStepToPhotonConverter_exception("Wavelength bias not set!");
+
+    if (!mediumProperties_)
+        throw I3CLSimStepToPhotonConverter_exception("Medium properties not set!");
+
+    if (!geometry_)
+        throw I3CLSimStepToPhotonConverter_exception("Geometry not set!");
+
+    for (std::size_t i=0;i<wlenGenerators_.size();++i)
+    {
+        if (!wlenGenerators_[i])
+            throw I3CLSimStepToPhotonConverter_exception("Wavelength generator #" + boost::lexical_cast<std::string>(i) + " is (null)!");
+        if (wlenGenerators_[i]->NumberOfParameters() != 0)
+            throw I3CLSimStepToPhotonConverter_exception("Wavelength generator #" + boost::lexical_cast<std::string>(i) + " must not have any parameters!");
+    }
+
+    if (!wlenBias_->HasNativeImplementation())
+        throw I3CLSimStepToPhotonConverter_exception("The wavelength bias has no host implementation!");
+
+    log_debug("Tabulating medium properties..");
+    TabulateMediumProperties();
+
+    log_debug("Building DOM lookup grid..");
+    BuildDOMGrid();
+
+    nextChunkSeed_ = static_cast<uint32_t>(randomService_->Integer(0xffffffff));
+
+    initialized_=true;
+
+    log_debug("Starting %zu native worker threads..", numThreads_);
+
+    for (std::size_t i=0;i<numThreads_;++i)
+    {
+        workerThreadObjs_.push_back(boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&I3CLSimStepToPhotonConverterNative::WorkerThread, this))));
+    }
+    collectorThreadObj_ = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&I3CLSimStepToPhotonConverterNative::CollectorThread, this)));
+    dispatcherThreadObj_ = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&I3CLSimStepToPhotonConverterNative::DispatcherThread, this)));
+}
+
+void I3CLSimStepToPhotonConverterNative::DispatcherThread()
+{
+    // do not interrupt this thread by default
+    boost::this_thread::disable_interruption di;
+
+    try {
+        DispatcherThread_impl(di);
+    } catch(...) { // any exceptions?
+        std::cerr << "Native dispatcher thread died unexpectedly.." << std::endl;
+        exit(0); // get out as quickly as possible, we probably just had a FATAL error anyway..
+        throw; // will never be reached
+    }
+}
+
+void I3CLSimStepToPhotonConverterNative::DispatcherThread_impl(boost::this_thread::disable_interruption &di)
+{
+    for (;;)
+    {
+        ToNativePair_t val;
+        {
+            boost::this_thread::restore_interruption ri(di);
+            try {
+                val = queueToNative_->Get();
+            } catch(boost::thread_interrupted &i) {
+                return;
+            }
+        }
+
+        const std::size_t numSteps = val.second->size();
+        const std::size_t numChunks = std::min(numSteps, numThreads_*chunksPerThread);
+
+        BunchPtr bunch(new Bunch());
+        bunch->identifier = val.first;
+        bunch->steps = val.second;
+        bunch->chunkPhotons.resize(numChunks);
+        bunch->numChunksLeft = numChunks;
+        bunch->dispatchTime = boost::posix_time::microsec_clock::universal_time();
+
+        // the collector needs to know about the bunch before
+        // it is done (this limits the number of bunches in flight)
+        {
+            boost::this_thread::restore_interruption ri(di);
+            try {
+                queueToCollector_->Put(bunch);
+            } catch(boost::thread_interrupted &i) {
+                return;
+            }
+        }
+
+        std::vector<Chunk> chunks(numChunks);
+        for (std::size_t i=0;i<numChunks;++i)
+        {
+            chunks[i].bunch = bunch;
+            chunks[i].chunkIndex = i;
+            chunks[i].firstStep = (i*numSteps)/numChunks;
+            chunks[i].numSteps = ((i+1)*numSteps)/numChunks - chunks[i].firstStep;
+            chunks[i].seed = nextChunkSeed_++;
+        }
+        queueToWorkers_->PutBatch(chunks);
+    }
+}
+
+void I3CLSimStepToPhotonConverterNative::WorkerThread()
+{
+    // do not interrupt this thread by default
+    boost::this_thread::disable_interruption di;
+
+    try {
+        WorkerThread_impl(di);
+    } catch(...) { // any exceptions?
+        std::cerr << "Native worker thread died unexpectedly.." << std::endl;
+        exit(0); // get out as quickly as possible, we probably just had a FATAL error anyway..
+        throw; // will never be reached
+    }
+}
+
+void I3CLSimStepToPhotonConverterNative::WorkerThread_impl(boost::this_thread::disable_interruption &di)
+{
+    for (;;)
+    {
+        Chunk chunk;
+        {
+            boost::this_thread::restore_interruption ri(di);
+            try {
+                chunk = queueToWorkers_->Get();
+            } catch(boost::thread_interrupted &i) {
+                return;
+            }
+        }
+
+        const boost::posix_time::ptime startTime = boost::posix_time::microsec_clock::universal_time();
+
+        I3RandomServicePtr rng(new I3GSLRandomService(chunk.seed));
+        I3CLSimPhotonSeriesPtr photons(new I3CLSimPhotonSeries());
+
+        const uint64_t numPhotonsGenerated =
+        PropagateSteps(&((*chunk.bunch->steps)[chunk.firstStep]), chunk.numSteps, rng, *photons);
+
+        const boost::posix_time::ptime stopTime = boost::posix_time::microsec_clock::universal_time();
+
+        {
+            boost::unique_lock<boost::mutex> guard(chunk.bunch->mutex);
+
+            chunk.bunch->chunkPhotons[chunk.chunkIndex] = photons;
+            chunk.bunch->numPhotonsGenerated += numPhotonsGenerated;
+            chunk.bunch->deviceTimeInNanoseconds += ElapsedNanoseconds(startTime, stopTime);
+            --(chunk.bunch->numChunksLeft);
+        }
+        chunk.bunch->finished.notify_all();
+    }
+}
+
+void I3CLSimStepToPhotonConverterNative::CollectorThread()
+{
+    // do not interrupt this thread by default
+    boost::this_thread::disable_interruption di;
+
+    try {
+        CollectorThread_impl(di);
+    } catch(...) { // any exceptions?
+        std::cerr << "Native collector thread died unexpectedly.." << std::endl;
+        exit(0); // get out as quickly as possible, we probably just had a FATAL error anyway..
+        throw; // will never be reached
+    }
+}
+
+void I3CLSimStepToPhotonConverterNative::CollectorThread_impl(boost::this_thread::disable_interruption &di)
+{
+    boost::posix_time::ptime lastFinishTime;
+
+    for (;;)
+    {
+        BunchPtr bunch;
+        {
+            boost::this_thread::restore_interruption ri(di);
+            try {
+                bunch = queueToCollector_->Get();
+
+                // bunches are returned in the order they were enqueued
+                boost::unique_lock<boost::mutex> guard(bunch->mutex);
+                while (bunch->numChunksLeft > 0)
+                {
+                    bunch->finished.wait(guard);
+                }
+            } catch(boost::thread_interrupted &i) {
+                return;
+            }
+        }
+
+        std::size_t numPhotons=0;
+        BOOST_FOREACH(const I3CLSimPhotonSeriesPtr &chunkPhotons, bunch->chunkPhotons)
+        {
+            numPhotons += chunkPhotons->size();
+        }
+
+        I3CLSimPhotonSeriesPtr photons;
+        if (bunch->chunkPhotons.size()==1) {
+            photons = bunch->chunkPhotons[0];
+        } else {
+            photons = I3CLSimPhotonSeriesPtr(new I3CLSimPhotonSeries());
+            photons->reserve(numPhotons);
+            BOOST_FOREACH(const I3CLSimPhotonSeriesPtr &chunkPhotons, bunch->chunkPhotons)
+            {
+                photons->insert(photons->end(), chunkPhotons->begin(), chunkPhotons->end());
+            }
+        }
+
+        const boost::posix_time::ptime finishTime = boost::posix_time::microsec_clock::universal_time();
+
+        {
+            boost::unique_lock<boost::mutex> guard(statistics_mutex_);
+
+            // count the time during which work was in progress
+            const boost::posix_time::ptime busySince =
+            ((lastFinishTime.is_not_a_date_time()) || (bunch->dispatchTime > lastFinishTime))?bunch->dispatchTime:lastFinishTime;
+
+            statistics_total_device_duration_in_nanoseconds_ += bunch->deviceTimeInNanoseconds;
+            statistics_total_host_duration_in_nanoseconds_ += ElapsedNanoseconds(busySince, finishTime);
+            statistics_total_kernel_calls_++;
+            statistics_total_num_photons_generated_ += bunch->numPhotonsGenerated;
+            statistics_total_num_photons_atDOMs_ += photons->size();
+        }
+        lastFinishTime = finishTime;
+
+        queueFromNative_->Put(ConversionResult_t(bunch->identifier, photons));
+    }
+}
+
+bool I3CLSimStepToPhotonConverterNative::CheckForCollisions(const double *pos,
+                                                            const double *dir,
+                                                            double &segmentLength,
+                                                            std::size_t &hitIndex,
+                                                            std::vector<double> &hitDistances,
+                                                            std::vector<std::size_t> &hitIndices) const
+{
+    const double endX = pos[0]+dir[0]*segmentLength;
+    const double endY = pos[1]+dir[1]*segmentLength;
+    const double endZ = pos[2]+dir[2]*segmentLength;
+
+    // bounding box of the segment, DOM centers further away cannot be hit
+    const double minX = std::min(pos[0], endX)-omRadius_;
+    const double maxX = std::max(pos[0], endX)+omRadius_;
+    const double minY = std::min(pos[1], endY)-omRadius_;
+    const double maxY = std::max(pos[1], endY)+omRadius_;
+    const double minZ = std::min(pos[2], endZ)-omRadius_;
+    const double maxZ = std::max(pos[2], endZ)+omRadius_;
+
+    const double gridMaxX = gridMinX_+static_cast<double>(gridNumCellsX_)*gridCellSize_;
+    const double gridMaxY = gridMinY_+static_cast<double>(gridNumCellsY_)*gridCellSize_;
+    if ((maxX < gridMinX_) || (minX > gridMaxX) || (maxY < gridMinY_) || (minY > gridMaxY)) return false;
+
+    const std::size_t cellX0 = static_cast<std::size_t>(std::max(0., (minX-gridMinX_)/gridCellSize_));
+    const std::size_t cellX1 = std::min(static_cast<std::size_t>(std::max(0., (maxX-gridMinX_)/gridCellSize_)), gridNumCellsX_-1);
+    const std::size_t cellY0 = static_cast<std::size_t>(std::max(0., (minY-gridMinY_)/gridCellSize_));
+    const std::size_t cellY1 = std::min(static_cast<std::size_t>(std::max(0., (maxY-gridMinY_)/gridCellSize_)), gridNumCellsY_-1);
+
+    const double omRadiusSquared = omRadius_*omRadius_;
+    const double recip_pancakeFactor = 1./pancakeFactor_;
+
+    bool hitRecorded=false;
+
+    for (std::size_t cellY=cellY0;cellY<=cellY1;++cellY)
+    {
+        for (std::size_t cellX=cellX0;cellX<=cellX1;++cellX)
+        {
+            const std::size_t cell = cellY*gridNumCellsX_+cellX;
+
+            // DOMs are sorted by z within a cell
+            const double *cellBegin = &(domPosZ_[0])+gridCellStart_[cell];
+            const double *cellEnd = &(domPosZ_[0])+gridCellStart_[cell+1];
+            if (cellBegin==cellEnd) continue;
+
+            const std::size_t first = std::lower_bound(cellBegin, cellEnd, minZ)-&(domPosZ_[0]);
+            const std::size_t last = std::upper_bound(cellBegin, cellEnd, maxZ)-&(domPosZ_[0]);
+
+            for (std::size_t i=first;i<last;++i)
+            {
+                const double drX = domPosX_[i]-pos[0];
+                const double drY = domPosY_[i]-pos[1];
+                const double drZ = domPosZ_[i]-pos[2];
+                const double dr2 = drX*drX+drY*drY+drZ*drZ;
+
+                const double urdot = drX*dir[0]+drY*dir[1]+drZ*dir[2];
+                double discr = urdot*urdot-dr2+omRadiusSquared;
+                if (discr < 0.) continue; // no intersection with this DOM
+
+                discr = std::sqrt(discr)*recip_pancakeFactor;
+
+                // distance from current point along the track to the first intersection.
+                // Photons starting inside a DOM are allowed to leave (necessary for flashers).
+                const double smin1 = urdot-discr;
+                if (smin1 < 0.) continue;
+
+                if (smin1 >= segmentLength) continue;
+
+                if (stopDetectedPhotons_) {
+                    // limit the step length, maybe we hit a closer OM later
+                    segmentLength=smin1;
+                    hitIndex=i;
+                } else {
+                    hitDistances.push_back(smin1);
+                    hitIndices.push_back(i);
+                }
+                hitRecorded=true;
+            }
+        }
+    }
+
+    return hitRecorded;
+}
+
+uint64_t I3CLSimStepToPhotonConverterNative::PropagateSteps(const I3CLSimStep *steps,
+                                                            std::size_t numSteps,
+                                                            const I3RandomServicePtr &rng,
+                                                            I3CLSimPhotonSeries &photons) const
+{
+    const std::vector<double> noParameters;
+    const I3CLSimRandomValue &scatteringCosAngleDistribution = *mediumProperties_->GetScatteringCosAngleDistribution();
+
+    std::vector<double> hitDistances;
+    std::vector<std::size_t> hitIndices;
+
+    PhotonBatch batch;
+    uint64_t numPhotonsGenerated=0;
+
+    for (std::size_t stepIndex=0;stepIndex<numSteps;++stepIndex)
+    {
+        const I3CLSimStep &step = steps[stepIndex];
+        if (step.GetNumPhotons()==0) continue;
+
+        const uint8_t sourceType = step.GetSourceType();
+        if (sourceType >= wlenGenerators_.size())
+            log_fatal("Step has a source type of %u, but there are only %zu wavelength generators.",
+                      static_cast<unsigned int>(sourceType), wlenGenerators_.size());
+        const I3CLSimRandomValue &wlenGenerator = *wlenGenerators_[sourceType];
+
+        const double stepPosAndTime[4] = {step.GetPosX(), step.GetPosY(), step.GetPosZ(), step.GetTime()};
+        double stepDir[3];
+        {
+            const double rho = std::sin(step.GetDirTheta());
+            stepDir[0] = rho*std::cos(step.GetDirPhi());
+            stepDir[1] = rho*std::sin(step.GetDirPhi());
+            stepDir[2] = std::cos(step.GetDirTheta());
+        }
+        const double inverseParticleSpeed = 1./(I3Constants::c*step.GetBeta());
+
+        for (uint32_t photonsLeft=step.GetNumPhotons();photonsLeft>0;)
+        {
+            const std::size_t num = std::min(static_cast<std::size_t>(photonsLeft), photonBatchSize);
+            photonsLeft -= num;
+            numPhotonsGenerated += num;
+
+            // draw all random numbers and sample the wavelengths
+            for (std::size_t i=0;i<num;++i)
+            {
+                batch.shift[i] = step.GetLength()*rng->Uniform();
+                batch.wlen[i] = wlenGenerator.SampleFromDistribution(rng, noParameters);
+
+                if (sourceType==0) {
+                    // sourceType==0 is always Cherenkov light with the correct angle w.r.t. the particle/step
+                    const double photonZ = stepPosAndTime[2]+stepDir[2]*batch.shift[i];
+                    const uint32_t layer = static_cast<uint32_t>(std::min(std::max(static_cast<int>((photonZ-layersZStart_)/layersHeight_), 0), static_cast<int>(layersNum_)-1));
+                    const double phaseRefIndex = WlenTableLookup(batch.wlen[i], tableMinWlen_, tableWlenStep_, tableNumWlens_, layersNum_)(tablePhaseRefIndex_, layer);
+
+                    // cos theta = 1/(beta*n)
+                    batch.cosa[i] = std::min(1., 1./(step.GetBeta()*phaseRefIndex));
+
+                    const double b = 2.0*M_PI*rng->Uniform();
+                    batch.cosb[i] = std::cos(b);
+                    batch.sinb[i] = std::sin(b);
+                } else {
+                    // steps >= 1 are flasher emissions, they do not need cherenkov rotation
+                    batch.cosa[i] = 1.;
+                    batch.cosb[i] = 1.;
+                    batch.sinb[i] = 0.;
+                }
+            }
+
+            CreatePhotonBatch(batch, num, stepPosAndTime, stepDir, inverseParticleSpeed);
+            ScatterPhotonBatch(batch, num);
+
+            for (std::size_t i=0;i<num;++i)
+            {
+                const WlenTableLookup medium(batch.wlen[i], tableMinWlen_, tableWlenStep_, tableNumWlens_, layersNum_);
+
+                batch.groupVelocity[i] = medium(tableGroupVelocity_);
+                batch.invGroupVel[i] = 1./batch.groupVelocity[i];
+                batch.weight[i] = step.GetWeight() / wlenBias_->GetValue(batch.wlen[i]);
+
+                batch.startPosX[i] = batch.posX[i];
+                batch.startPosY[i] = batch.posY[i];
+                batch.startPosZ[i] = batch.posZ[i];
+                batch.startTime[i] = batch.time[i];
+                const double dir[3] = {batch.dirX[i], batch.dirY[i], batch.dirZ[i]};
+                SphDirFromCar(dir, batch.startDirTheta[i], batch.startDirPhi[i]);
+
+                batch.numScatters[i]=0;
+                batch.totalPathLength[i]=0.;
+
+                // the photon needs a lifetime. determine distance to next scatter and absorption
+                // (this is in units of absorption/scattering lengths)
+                batch.absLensInitial[i] = -std::log(1.-rng->Uniform());
+                batch.absLensLeft[i] = batch.absLensInitial[i];
+            }
+
+            // propagate all photons of the batch together, one scatter at a time
+            for (std::size_t numAlive=num;numAlive>0;)
+            {
+                // find the distance to the next scatter or absorption.
+                // This block is along the lines of the PPC kernel.
+                for (std::size_t i=0;i<numAlive;++i)
+                {
+                    const WlenTableLookup medium(batch.wlen[i], tableMinWlen_, tableWlenStep_, tableNumWlens_, layersNum_);
+
+                    // apply ice tilt
+                    const double effective_z = iceTiltZShift_?(batch.posZ[i]-iceTiltZShift_->GetValue(batch.posX[i], batch.posY[i], batch.posZ[i])):batch.posZ[i];
+                    const int currentPhotonLayer = std::min(std::max(static_cast<int>((effective_z-layersZStart_)/layersHeight_), 0), static_cast<int>(layersNum_)-1);
+
+                    const double photon_dz = batch.dirZ[i];
+
+                    // direction-dependent correction to the absorption length (ice anisotropy)
+                    const double abs_len_correction_factor = directionalAbsLenCorrection_?directionalAbsLenCorrection_->GetValue(batch.dirX[i], batch.dirY[i], batch.dirZ[i]):1.;
+                    double abs_lens_left = batch.absLensLeft[i]*abs_len_correction_factor;
+
+                    // the "next" medium boundary (either top or bottom, depending on step direction)
+                    double mediumBoundary = static_cast<double>(currentPhotonLayer)*layersHeight_ + layersZStart_;
+                    if (photon_dz >= 0.) mediumBoundary += layersHeight_;
+
+                    // track this thing to the next scattering point
+                    const double sca_step_left = -std::log(1.-rng->Uniform());
+
+                    double currentScaLen = medium(tableScatteringLength_, currentPhotonLayer);
+                    double currentAbsLen = medium(tableAbsorptionLength_, currentPhotonLayer);
+
+                    double ais = (photon_dz*sca_step_left - (mediumBoundary-effective_z)/currentScaLen)/layersHeight_;
+                    double aia = (photon_dz*abs_lens_left - (mediumBoundary-effective_z)/currentAbsLen)/layersHeight_;
+
+                    // propagate through layers
+                    int j=currentPhotonLayer;
+                    if (photon_dz<0.) {
+                        while ((j>0) && (ais<0.) && (aia<0.))
+                        {
+                            --j;
+                            mediumBoundary -= layersHeight_;
+                            currentScaLen = medium(tableScatteringLength_, j);
+                            currentAbsLen = medium(tableAbsorptionLength_, j);
+                            ais += 1./currentScaLen;
+                            aia += 1./currentAbsLen;
+                        }
+                    } else {
+                        while ((j<static_cast<int>(layersNum_)-1) && (ais>0.) && (aia>0.))
+                        {
+                            ++j;
+                            mediumBoundary += layersHeight_;
+                            currentScaLen = medium(tableScatteringLength_, j);
+                            currentAbsLen = medium(tableAbsorptionLength_, j);
+                            ais -= 1./currentScaLen;
+                            aia -= 1./currentAbsLen;
+                        }
+                    }
+
+                    double distancePropagated, distanceToAbsorption;
+                    if ((currentPhotonLayer==j) || (std::abs(photon_dz)<1e-8)) {
+                        distancePropagated=sca_step_left*currentScaLen;
+                        distanceToAbsorption=abs_lens_left*currentAbsLen;
+                    } else {
+                        const double recip_photon_dz = 1./photon_dz;
+                        distancePropagated=(ais*layersHeight_*currentScaLen+mediumBoundary-effective_z)*recip_photon_dz;
+                        distanceToAbsorption=(aia*layersHeight_*currentAbsLen+mediumBoundary-effective_z)*recip_photon_dz;
+                    }
+
+                    // get overburden for distance
+                    if (distanceToAbsorption<distancePropagated) {
+                        distancePropagated=distanceToAbsorption;
+                        abs_lens_left=0.;
+                    } else {
+                        abs_lens_left=(distanceToAbsorption-distancePropagated)/currentAbsLen;
+                    }
+
+                    // hoist the correction factor back out of the absorption length
+                    batch.absLensLeft[i] = abs_lens_left/abs_len_correction_factor;
+                    batch.distance[i] = distancePropagated;
+                }
+
+                // the photons are now either being absorbed or scattered.
+                // Check for collisions in their way
+                for (std::size_t i=0;i<numAlive;++i)
+                {
+                    const double pos[3] = {batch.posX[i], batch.posY[i], batch.posZ[i]};
+                    const double dir[3] = {batch.dirX[i], batch.dirY[i], batch.dirZ[i]};
+
+                    std::size_t hitIndex=0;
+                    hitDistances.clear();
+                    hitIndices.clear();
+                    const bool collided = CheckForCollisions(pos, dir, batch.distance[i], hitIndex, hitDistances, hitIndices);
+                    if (!collided) continue;
+
+                    if (stopDetectedPhotons_) {
+                        hitDistances.push_back(batch.distance[i]);
+                        hitIndices.push_back(hitIndex);
+                    }
+
+                    float dirTheta, dirPhi;
+                    SphDirFromCar(dir, dirTheta, dirPhi);
+
+                    for (std::size_t k=0;k<hitDistances.size();++k)
+                    {
+                        const double d = hitDistances[k];
+                        const std::size_t domIndex = hitIndices[k];
+
+                        photons.push_back(I3CLSimPhoton());
+                        I3CLSimPhoton &photon = photons.back();
+
+                        photon.SetPosX(pos[0]+d*dir[0]);
+                        photon.SetPosY(pos[1]+d*dir[1]);
+                        photon.SetPosZ(pos[2]+d*dir[2]);
+                        photon.SetTime(batch.time[i]+d*batch.invGroupVel[i]);
+                        photon.SetDirTheta(dirTheta);
+                        photon.SetDirPhi(dirPhi);
+                        photon.SetWavelength(batch.wlen[i]);
+                        photon.SetCherenkovDist(batch.totalPathLength[i]+d);
+                        photon.SetNumScatters(batch.numScatters[i]);
+                        photon.SetWeight(batch.weight[i]);
+                        photon.SetID(step.GetID());
+                        photon.SetStringID(domStringID_[domIndex]);
+                        photon.SetOMID(domOMID_[domIndex]);
+                        photon.SetStartPosX(batch.startPosX[i]);
+                        photon.SetStartPosY(batch.startPosY[i]);
+                        photon.SetStartPosZ(batch.startPosZ[i]);
+                        photon.SetStartTime(batch.startTime[i]);
+                        photon.SetStartDirTheta(batch.startDirTheta[i]);
+                        photon.SetStartDirPhi(batch.startDirPhi[i]);
+                        photon.SetGroupVelocity(batch.groupVelocity[i]);
+                        photon.SetDistInAbsLens(batch.absLensInitial[i]-batch.absLensLeft[i]);
+                    }
+
+                    // get rid of the photon if we detected it
+                    if (stopDetectedPhotons_) batch.absLensLeft[i]=0.;
+                }
+
+                // update the tracks to their next positions
+                AdvancePhotonBatch(batch, numAlive);
+
+                // remove absorbed photons
+                numAlive = CompactPhotonBatch(batch, numAlive, absLensEpsilon);
+                if (numAlive==0) break;
+
+                // the remaining photons were NOT absorbed. scatter them and re-start the loop
+
+                // optional direction transformation (for ice anisotropy)
+                ApplyTransform(preScatterDirectionTransform_, batch, numAlive);
+
+                // choose the scattering angles
+                for (std::size_t i=0;i<numAlive;++i)
+                {
+                    batch.cosa[i] = scatteringCosAngleDistribution.SampleFromDistribution(rng, noParameters);
+
+                    const double b = 2.0*M_PI*rng->Uniform();
+                    batch.cosb[i] = std::cos(b);
+                    batch.sinb[i] = std::sin(b);
+
+                    ++batch.numScatters[i];
+                }
+
+                // change the current directions by these angles
+                ScatterPhotonBatch(batch, numAlive);
+
+                // optional direction transformation (for ice anisotropy)
+                ApplyTransform(postScatterDirectionTransform_, batch, numAlive);
+            }
+        }
+    }
+
+    return numPhotonsGenerated;
+}
+
+void I3CLSimStepToPhotonConverterNative::EnqueueSteps(I3CLSimStepSeriesConstPtr steps, uint32_t identifier)
+{
+    if (!initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterNative is not initialized!");
+
+    if (!steps)
+        throw I3CLSimStepToPhotonConverter_exception("Steps pointer is (null)!");
+
+    if (steps->empty())
+        throw I3CLSimStepToPhotonConverter_exception("Steps are empty!");
+
+    if (steps->size() > maxNumWorkitems_)
+        throw I3CLSimStepToPhotonConverter_exception("Number of steps is greater than maximum number of work items!");
+
+    queueToNative_->Put(make_pair(identifier, steps));
+}
+
+std::size_t I3CLSimStepToPhotonConverterNative::QueueSize() const
+{
+    if (!initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterNative is not initialized!");
+
+    return queueToNative_->size();
+}
+
+bool I3CLSimStepToPhotonConverterNative::MorePhotonsAvailable() const
+{
+    if (!initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterNative is not initialized!");
+
+    return (!queueFromNative_->empty());
+}
+
+I3CLSimStepToPhotonConverter::ConversionResult_t I3CLSimStepToPhotonConverterNative::GetConversionResult()
+{
+    if (!initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterNative is not initialized!");
+
+    return queueFromNative_->Get();
+}
@@ -31,10 +31,13 @@
 
 #include <algorithm>
 #include <cmath>
+#include <vector>
 
 #include "clsim/dom/I3PhotonToMCPEConverter.h"
 
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 
 #include "simclasses/I3Photon.h"
 #include "simclasses/I3CompressedPhoton.h"
@@ -49,9 +52,32 @@
 
 #include "dataclasses/I3Constants.h"
 
+#include "clsim/I3CLSimLightSourceToStepConverterUtils.h"
+#include "clsim/I3CLSimHelperWorkerPool.h"
+
 // The module
 I3_MODULE(I3PhotonToMCPEConverter);
 
+namespace {
+    class ScopedGILRelease
+    {
+    public:
+        inline ScopedGILRelease()
+        {
+            m_thread_state = PyEval_SaveThread();
+        }
+        
+        inline ~ScopedGILRelease()
+        {
+            PyEval_RestoreThread(m_thread_state);
+            m_thread_state = NULL;
+        }
+        
+    private:
+        PyThreadState *m_thread_state;
+    };
+}
+
 I3PhotonToMCPEConverter::I3PhotonToMCPEConverter(const I3Context& context) 
 : I3ConditionalModule(context)
 {
@@ -117,6 +143,13 @@ I3PhotonToMCPEConverter::I3PhotonToMCPEConverter(const I3Context& context)
                  "Make photon position/radius check a warning only (instead of a fatal condition)",
                  onlyWarnAboutInvalidPhotonPositions_);
 
+    numThreads_=1;
+    AddParameter("NumThreads",
+                 "Number of threads the DOMs of each frame are distributed over.\n"
+                 "Every DOM gets its own random number stream, so the output does not\n"
+                 "depend on the number of threads. Set to 0 to use one thread per CPU core.",
+                 numThreads_);
+
     // add an outbox
     AddOutBox("OutBox");
     
@@ -151,6 +184,7 @@ void I3PhotonToMCPEConverter::Configure()
     GetParameter("IgnoreDOMsWithoutDetectorStatusEntry", ignoreDOMsWithoutDetectorStatusEntry_);
 
     GetParameter("OnlyWarnAboutInvalidPhotonPositions", onlyWarnAboutInvalidPhotonPositions_);
+    GetParameter("NumThreads", numThreads_);
 
     if (DOMOversizeFactor_ != DOMPancakeFactor_)
         log_warn("You chose \"DOMOversizeFactor\" and \"DOMPancakeFactor\" to be different. Be sure you know whot you are doing! You probably don't want this.");
@@ -175,6 +209,19 @@ void I3PhotonToMCPEConverter::Configure()
         log_fatal("The angular acceptance function must have a native (i.e. non-OpenCL) implementation!");
     
     
+    if (numThreads_==0) {
+        numThreads_ = boost::thread::hardware_concurrency();
+        if (numThreads_==0) numThreads_=1;
+    }
+    
+    // the threads are kept around for all frames
+    workerPool_.reset();
+    if (numThreads_ > 1)
+        workerPool_.reset(new I3CLSimHelper::WorkerPool(numThreads_));
+    workArrays_.clear();
+    for (unsigned int i=0;i<numThreads_;++i)
+        workArrays_.push_back(boost::shared_ptr<WorkArrays>(new WorkArrays()));
+    
     if (!randomService_) {
         log_info("No random service provided as a parameter, trying to get one from the context..");
         randomService_ = context_.Get<I3RandomServicePtr>();
@@ -195,6 +242,7 @@ void I3PhotonToMCPEConverter::DetectorStatus(I3FramePtr frame)
     
     // store it for later
     status_ = detectorStatus;
+    domInfo_.clear();
 
     PushFrame(frame);
 }
@@ -209,6 +257,7 @@ void I3PhotonToMCPEConverter::Calibration(I3FramePtr frame)
     
     // store it for later
     calibration_ = calibration;
+    domInfo_.clear();
     
     PushFrame(frame);
 }
@@ -246,269 +295,521 @@ namespace {
     }
 }
 
-template <typename PhotonMapType>
-I3MCPESeriesMapPtr
-I3PhotonToMCPEConverter::Convert(I3FramePtr frame)
+const I3PhotonToMCPEConverter::DOMInfo &
+I3PhotonToMCPEConverter::GetDOMInfo(const ModuleKey &module_key,
+                                    const I3OMGeoMap &omgeo,
+                                    const I3ModuleGeoMap &modulegeo)
 {
-    // First we need to get our geometry
-    I3OMGeoMapConstPtr omgeo = frame->Get<I3OMGeoMapConstPtr>("I3OMGeoMap");
-    I3ModuleGeoMapConstPtr modulegeo = frame->Get<I3ModuleGeoMapConstPtr>("I3ModuleGeoMap");
+    std::map<ModuleKey, DOMInfo>::const_iterator info_it = domInfo_.find(module_key);
+    if (info_it != domInfo_.end()) return info_it->second;
     
-    if (!omgeo)
-        log_fatal("Missing geometry information! (No \"I3OMGeoMap\")");
-    if (!modulegeo)
-        log_fatal("Missing geometry information! (No \"I3ModuleGeoMap\")");
+    DOMInfo &info = domInfo_[module_key];
+    info.ignore = false;
     
-    boost::shared_ptr<const PhotonMapType> inputPhotonSeriesMap = frame->Get<boost::shared_ptr<const PhotonMapType> >(inputPhotonSeriesMapName_);
+    // assume this is IceCube (i.e. one PMT with index 0 per DOM)
+    const OMKey key(module_key.GetString(), module_key.GetOM(), 0);        
+
+    if (ignoreDOMsWithoutDetectorStatusEntry_) {
+        std::map<OMKey, I3DOMStatus>::const_iterator om_stat = status_->domStatus.find(key);
+        if (om_stat==status_->domStatus.end()) {info.ignore=true; return info;} // ignore it
+        if (om_stat->second.pmtHV==0.) {info.ignore=true; return info;} // ignore pmtHV==0
+    }
     
-    // allocate the output hitSeriesMap
-    I3MCPESeriesMapPtr outputMCPESeriesMap(new I3MCPESeriesMap());
+    // Find the current OM in the omgeo map
+    I3OMGeoMap::const_iterator geo_it = omgeo.find(key);
+    if (geo_it == omgeo.end())
+        log_fatal("OM (%i/%u%u) not found in the current geometry map!",
+                  key.GetString(), key.GetOM(), static_cast<unsigned int>(key.GetPMT()));
+    const I3OMGeo &om = geo_it->second;
+
+    // Find the current OM in the module map
+    I3ModuleGeoMap::const_iterator module_geo_it = modulegeo.find(module_key);
+    if (module_geo_it == modulegeo.end())
+        log_fatal("ModuleKey (%i/%u) not found in the current geometry map!",
+                  module_key.GetString(), module_key.GetOM());
+    const I3ModuleGeo &module = module_geo_it->second;
+
+    // this module assumes that all DOMs are IceCube-style with a single PMT per DOM
+    if ((std::abs(om.position.GetX() - module.GetPos().GetX()) > .01*I3Units::mm) ||
+        (std::abs(om.position.GetY() - module.GetPos().GetY()) > .01*I3Units::mm) ||
+        (std::abs(om.position.GetZ() - module.GetPos().GetZ()) > .01*I3Units::mm))
+        log_fatal("Module(%i/%u) has a PMT that is not in the center of the DOM!",
+                  module_key.GetString(), module_key.GetOM());
     
-    typedef PhotonMapType PhotonSeriesMap;
-    typedef typename PhotonSeriesMap::mapped_type PhotonSeries;
-    typedef typename PhotonSeries::value_type Photon;
-    BOOST_FOREACH(const typename PhotonSeriesMap::value_type &it, *inputPhotonSeriesMap)
-    {
-        const ModuleKey &module_key = it.first;
-        // assume this is IceCube (i.e. one PMT with index 0 per DOM)
-        const OMKey key(module_key.GetString(), module_key.GetOM(), 0);        
-        const PhotonSeries &photons = it.second;
-
-        if (ignoreDOMsWithoutDetectorStatusEntry_) {
-            std::map<OMKey, I3DOMStatus>::const_iterator om_stat = status_->domStatus.find(key);
-            if (om_stat==status_->domStatus.end()) continue; // ignore it
-            if (om_stat->second.pmtHV==0.) continue; // ignore pmtHV==0
-        }
-        
-        // Find the current OM in the omgeo map
-        I3OMGeoMap::const_iterator geo_it = omgeo->find(key);
-        if (geo_it == omgeo->end())
-            log_fatal("OM (%i/%u%u) not found in the current geometry map!",
-                      key.GetString(), key.GetOM(), static_cast<unsigned int>(key.GetPMT()));
-        const I3OMGeo &om = geo_it->second;
-
-        // Find the current OM in the module map
-        I3ModuleGeoMap::const_iterator module_geo_it = modulegeo->find(module_key);
-        if (module_geo_it == modulegeo->end())
-            log_fatal("ModuleKey (%i/%u) not found in the current geometry map!",
-                      module_key.GetString(), module_key.GetOM());
-        const I3ModuleGeo &module = module_geo_it->second;
-
-        // this module assumes that all DOMs are IceCube-style with a single PMT per DOM
-        if ((std::abs(om.position.GetX() - module.GetPos().GetX()) > .01*I3Units::mm) ||
-            (std::abs(om.position.GetY() - module.GetPos().GetY()) > .01*I3Units::mm) ||
-            (std::abs(om.position.GetZ() - module.GetPos().GetZ()) > .01*I3Units::mm))
-            log_fatal("Module(%i/%u) has a PMT that is not in the center of the DOM!",
-                      module_key.GetString(), module_key.GetOM());
-        
-        const I3Direction pmtDir = om.GetDirection();
-        const I3Direction domDir = module.GetDir();
-        
-        const double DOMDir_x = pmtDir.GetX();
-        const double DOMDir_y = pmtDir.GetY();
-        const double DOMDir_z = pmtDir.GetZ();
-        
-        if ((std::abs(DOMDir_x - domDir.GetX()) > 1e-5) ||
-            (std::abs(DOMDir_y - domDir.GetY()) > 1e-5) ||
-            (std::abs(DOMDir_z - domDir.GetZ()) > 1e-5))
-            log_fatal("PMT and DOM directions are not aligned!");
-        
-        // Find the current OM in the calibration map
-        
-        // relative DOM efficiency from calibration
-        double efficiency_from_calibration=NAN;
+    const I3Direction pmtDir = om.GetDirection();
+    const I3Direction domDir = module.GetDir();
+    
+    const double DOMDir_x = pmtDir.GetX();
+    const double DOMDir_y = pmtDir.GetY();
+    const double DOMDir_z = pmtDir.GetZ();
+    
+    if ((std::abs(DOMDir_x - domDir.GetX()) > 1e-5) ||
+        (std::abs(DOMDir_y - domDir.GetY()) > 1e-5) ||
+        (std::abs(DOMDir_z - domDir.GetZ()) > 1e-5))
+        log_fatal("PMT and DOM directions are not aligned!");
+    
+    // Find the current OM in the calibration map
+    
+    // relative DOM efficiency from calibration
+    double efficiency_from_calibration=NAN;
 
-        if (replaceRelativeDOMEfficiencyWithDefault_)
-        {
-            efficiency_from_calibration=defaultRelativeDOMEfficiency_;
-        }
-        else 
-        {
-            if (!calibration_) {
+    if (replaceRelativeDOMEfficiencyWithDefault_)
+    {
+        efficiency_from_calibration=defaultRelativeDOMEfficiency_;
+    }
+    else 
+    {
+        if (!calibration_) {
+            if (std::isnan(defaultRelativeDOMEfficiency_)) {
+                log_fatal("There is no valid calibration! (Consider setting \"DefaultRelativeDOMEfficiency\" != NaN)");
+            } else {
+                efficiency_from_calibration = defaultRelativeDOMEfficiency_;
+                log_debug("OM (%i/%u): efficiency_from_calibration=%g (default (I3Calibration not found))",
+                          key.GetString(), key.GetOM(),
+                          efficiency_from_calibration);
+            }
+        } else {
+            std::map<OMKey, I3DOMCalibration>::const_iterator cal_it = calibration_->domCal.find(key);
+            if (cal_it == calibration_->domCal.end()) {
                 if (std::isnan(defaultRelativeDOMEfficiency_)) {
-                    log_fatal("There is no valid calibration! (Consider setting \"DefaultRelativeDOMEfficiency\" != NaN)");
+                    log_fatal("OM (%i/%u) not found in the current calibration map! (Consider setting \"DefaultRelativeDOMEfficiency\" != NaN)", key.GetString(), key.GetOM());
                 } else {
                     efficiency_from_calibration = defaultRelativeDOMEfficiency_;
-                    log_debug("OM (%i/%u): efficiency_from_calibration=%g (default (I3Calibration not found))",
+                    log_debug("OM (%i/%u): efficiency_from_calibration=%g (default (no calib))",
                               key.GetString(), key.GetOM(),
                               efficiency_from_calibration);
                 }
             } else {
-                std::map<OMKey, I3DOMCalibration>::const_iterator cal_it = calibration_->domCal.find(key);
-                if (cal_it == calibration_->domCal.end()) {
+                const I3DOMCalibration &domCalibration = cal_it->second;
+                efficiency_from_calibration=domCalibration.GetRelativeDomEff();
+                
+                if (std::isnan(efficiency_from_calibration)) {
                     if (std::isnan(defaultRelativeDOMEfficiency_)) {
-                        log_fatal("OM (%i/%u) not found in the current calibration map! (Consider setting \"DefaultRelativeDOMEfficiency\" != NaN)", key.GetString(), key.GetOM());
-                    } else {
+                        log_fatal("OM (%i/%u) found in the current calibration map, but it is NaN! (Consider setting \"DefaultRelativeDOMEfficiency\" != NaN)", key.GetString(), key.GetOM());
+                    } else {                
                         efficiency_from_calibration = defaultRelativeDOMEfficiency_;
-                        log_debug("OM (%i/%u): efficiency_from_calibration=%g (default (no calib))",
+                        log_debug("OM (%i/%u): efficiency_from_calibration=%g (default (was: NaN))",
                                   key.GetString(), key.GetOM(),
                                   efficiency_from_calibration);
                     }
                 } else {
-                    const I3DOMCalibration &domCalibration = cal_it->second;
-                    efficiency_from_calibration=domCalibration.GetRelativeDomEff();
-                    
-                    if (std::isnan(efficiency_from_calibration)) {
-                        if (std::isnan(defaultRelativeDOMEfficiency_)) {
-                            log_fatal("OM (%i/%u) found in the current calibration map, but it is NaN! (Consider setting \"DefaultRelativeDOMEfficiency\" != NaN)", key.GetString(), key.GetOM());
-                        } else {                
-                            efficiency_from_calibration = defaultRelativeDOMEfficiency_;
-                            log_debug("OM (%i/%u): efficiency_from_calibration=%g (default (was: NaN))",
-                                      key.GetString(), key.GetOM(),
-                                      efficiency_from_calibration);
-                        }
-                    } else {
-                        log_debug("OM (%i/%u): efficiency_from_calibration=%g",
-                                  key.GetString(), key.GetOM(),
-                                  efficiency_from_calibration);
-                    }
+                    log_debug("OM (%i/%u): efficiency_from_calibration=%g",
+                              key.GetString(), key.GetOM(),
+                              efficiency_from_calibration);
                 }
             }
         }
-        
-        // a pointer to the output vector. The vector will be allocated 
-        // by the map, this is merely a pointer to it in case we have multiple
-        // hits per OM.
-        I3MCPESeries *hits = NULL;
+    }
+    
+    info.posX = om.position.GetX();
+    info.posY = om.position.GetY();
+    info.posZ = om.position.GetZ();
+    info.dirX = DOMDir_x;
+    info.dirY = DOMDir_y;
+    info.dirZ = DOMDir_z;
+    info.efficiency = efficiency_from_calibration;
+    
+    return info;
+}
 
-        BOOST_FOREACH(const Photon &photon, photons)
+namespace {
+    // Multiply-with-carry generator for the photons on a single DOM. Its
+    // state only depends on the frame seed and the DOM, so the hits on a DOM
+    // do not depend on the thread that converts it or on the other DOMs.
+    class DOMRandomStream
+    {
+    public:
+        DOMRandomStream(uint64_t frameSeed, const OMKey &key)
         {
-            double hitProbability = photon.GetWeight();
-            if (hitProbability < 0.) log_fatal("Photon with negative weight found.");
-            if (hitProbability == 0.) continue;
-
-            const double dx=photon.GetDir().GetX();
-            const double dy=photon.GetDir().GetY();
-            const double dz=photon.GetDir().GetZ();
-            const double px=om.position.GetX()-photon.GetPos().GetX();
-            const double py=om.position.GetY()-photon.GetPos().GetY();
-            const double pz=om.position.GetZ()-photon.GetPos().GetZ();
-            const double pr2 = px*px + py*py + pz*pz;
-            
-            double photonCosAngle = -(dx * DOMDir_x +
-                                      dy * DOMDir_y +
-                                      dz * DOMDir_z);
-            photonCosAngle = std::max(-1., std::min(1., photonCosAngle));
+            uint64_t seed = frameSeed ^
+                ((static_cast<uint64_t>(static_cast<uint32_t>(key.GetString())) << 32) |
+                 static_cast<uint64_t>(key.GetOM()));
             
-            const double distFromDOMCenter = std::sqrt(pr2);
+            // same constraints as mwcRngInitState()
+            do {
+                state_ = SplitMix64(seed);
+            } while ((state_==0) |
+                     (static_cast<uint32_t>(state_>>32) >= (rngA-1)) |
+                     (static_cast<uint32_t>(state_) >= 0xfffffffful));
+        }
+        
+        inline double Uniform()
+        {
+            return I3CLSimLightSourceToStepConverterUtils::mwcRngRandomNumber_co(state_, rngA);
+        }
+        
+    private:
+        static const uint32_t rngA = 4294957665u; // taken from Numerical Recipies
+        
+        static inline uint64_t SplitMix64(uint64_t &x)
+        {
+            uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        }
+        
+        uint64_t state_;
+    };
+}
 
-            // do this only if DOMs are spherical
-            if (DOMPancakeFactor_ == 1.)
+struct I3PhotonToMCPEConverter::WorkArrays
+{
+    std::vector<std::size_t> candidates;
+    std::vector<double> wavelengths;
+    std::vector<double> cosAngles;
+    std::vector<double> dots;
+    std::vector<double> distances;
+    std::vector<double> wavelengthAcceptances;
+    std::vector<double> angularAcceptances;
+};
+
+template <typename PhotonSeries>
+class I3PhotonToMCPEConverter::ConversionJob
+{
+public:
+    ConversionJob(const I3PhotonToMCPEConverter &module, uint64_t frameSeed)
+    :
+    module_(module),
+    frameSeed_(frameSeed),
+    workArrays_(NULL),
+    nextDOM_(0)
+    {
+    }
+    
+    void Add(const OMKey &key, const PhotonSeries &photons, const DOMInfo &dom)
+    {
+        keys_.push_back(key);
+        photons_.push_back(&photons);
+        doms_.push_back(&dom);
+    }
+    
+    // Converts all DOMs on the threads of the pool (or on the calling
+    // thread if there is no pool). Worker i uses workArrays[i]. Errors
+    // are collected instead of thrown, so the caller can report them
+    // after re-acquiring the GIL.
+    void Run(I3CLSimHelper::WorkerPool *pool,
+             std::vector<boost::shared_ptr<WorkArrays> > &workArrays)
+    {
+        hits_.resize(keys_.size());
+        
+        nextDOM_=0;
+        errorMessage_.clear();
+        workArrays_ = &workArrays;
+        
+        std::size_t numWorkers = pool ? pool->GetNumThreads() : 1;
+        if (numWorkers > keys_.size()) numWorkers = keys_.size();
+        if (numWorkers > workArrays.size()) numWorkers = workArrays.size();
+        
+        if ((!pool) || (numWorkers <= 1)) {
+            WorkerThread(0);
+        } else {
+            pool->Run(boost::bind(&ConversionJob<PhotonSeries>::WorkerThread, this, _1), numWorkers);
+        }
+        
+        workArrays_ = NULL;
+    }
+    
+    // empty if all DOMs were converted
+    const std::string &GetErrorMessage() const {return errorMessage_;}
+    
+    // Moves the hits into the output map and returns their number. DOMs
+    // were added in map order, so this always appends to the map.
+    uint64_t MoveHitsTo(I3MCPESeriesMap &output)
+    {
+        uint64_t numHits=0;
+        for (std::size_t i=0;i<keys_.size();++i)
+        {
+            if (hits_[i].empty()) continue;
+            numHits += static_cast<uint64_t>(hits_[i].size());
+            
+            I3MCPESeries &hits = output.insert(output.end(), std::make_pair(keys_[i], I3MCPESeries()))->second;
+            hits.swap(hits_[i]);
+        }
+        return numHits;
+    }
+    
+private:
+    void WorkerThread(std::size_t workerIndex)
+    {
+        WorkArrays &work = *(*workArrays_)[workerIndex];
+        
+        try
+        {
+            for (;;)
             {
-                // sanity check: are photons on the OM's surface?
-                if (std::abs(distFromDOMCenter - DOMOversizeFactor_*DOMRadiusWithoutOversize_) > 3.*I3Units::cm) {
-                    if (onlyWarnAboutInvalidPhotonPositions_) {
-                        log_warn("distance not %f*%f=%fmm.. it is %fmm (diff=%gmm) (OMKey=(%i,%u) (photon @ pos=(%g,%g,%g)m) (DOM @ pos=(%g,%g,%g)m)",
-                                 DOMOversizeFactor_,
-                                 DOMRadiusWithoutOversize_/I3Units::mm,
-                                 DOMOversizeFactor_*DOMRadiusWithoutOversize_/I3Units::mm,
-                                 distFromDOMCenter/I3Units::mm,
-                                 (distFromDOMCenter-DOMOversizeFactor_*DOMRadiusWithoutOversize_)/I3Units::mm,
-                                 key.GetString(), key.GetOM(),
-                                 photon.GetPos().GetX()/I3Units::m,
-                                 photon.GetPos().GetY()/I3Units::m,
-                                 photon.GetPos().GetZ()/I3Units::m,
-                                 om.position.GetX()/I3Units::m,
-                                 om.position.GetY()/I3Units::m,
-                                 om.position.GetZ()/I3Units::m
-                                 );
-                    } else {
-                        log_fatal("distance not %f*%f=%fmm.. it is %fmm (diff=%gmm) (OMKey=(%i,%u) (photon @ pos=(%g,%g,%g)m) (DOM @ pos=(%g,%g,%g)m)",
-                                  DOMOversizeFactor_,
-                                  DOMRadiusWithoutOversize_/I3Units::mm,
-                                  DOMOversizeFactor_*DOMRadiusWithoutOversize_/I3Units::mm,
-                                  distFromDOMCenter/I3Units::mm,
-                                  (distFromDOMCenter-DOMOversizeFactor_*DOMRadiusWithoutOversize_)/I3Units::mm,
-                                  key.GetString(), key.GetOM(),
-                                  photon.GetPos().GetX()/I3Units::m,
-                                  photon.GetPos().GetY()/I3Units::m,
-                                  photon.GetPos().GetZ()/I3Units::m,
-                                  om.position.GetX()/I3Units::m,
-                                  om.position.GetY()/I3Units::m,
-                                  om.position.GetZ()/I3Units::m
-                                  );
-                    }
+                std::size_t i;
+                {
+                    boost::unique_lock<boost::mutex> guard(mutex_);
+                    if (nextDOM_ >= keys_.size()) break;
+                    i = nextDOM_++;
                 }
-            }
-            
-            CheckSanity(photon);
-            
-#ifndef NDEBUG
-            const double photonAngle = std::acos(photonCosAngle);
-            log_trace("Photon (lambda=%fnm, angle=%fdeg, dist=%fm) has weight %g",
-                     photon.GetWavelength()/I3Units::nanometer,
-                     photonAngle/I3Units::deg,
-                     distFromDOMCenter/I3Units::m,
-                     hitProbability);
-#endif
-            
-            hitProbability *= wavelengthAcceptance_->GetValue(photon.GetWavelength());
-            log_trace("After wlen acceptance: prob=%g (wlen acceptance is %f)",
-                     hitProbability, wavelengthAcceptance_->GetValue(photon.GetWavelength()));
-
-            hitProbability *= angularAcceptance_->GetValue(photonCosAngle);
-            log_trace("After wlen&angular acceptance: prob=%g (angular acceptance is %f)",
-                      hitProbability, angularAcceptance_->GetValue(photonCosAngle));
-
-            hitProbability *= efficiency_from_calibration;
-            log_trace("After efficiency from calibration: prob=%g (efficiency_from_calibration=%f)",
-                      hitProbability, efficiency_from_calibration);
-
-            if (hitProbability > 1.) {
-                log_warn("hitProbability==%f > 1: your hit weights are too high. (hitProbability-1=%f)", hitProbability, hitProbability-1.);
-
-                double hitProbability = photon.GetWeight();
-
-                const double photonAngle = std::acos(photonCosAngle);
-                log_warn("Photon (lambda=%fnm, angle=%fdeg, dist=%fm) has weight %g, 1/weight %g",
-                         photon.GetWavelength()/I3Units::nanometer,
-                         photonAngle/I3Units::deg,
-                         distFromDOMCenter/I3Units::m,
-                         hitProbability,
-                         1./hitProbability);
-
-                hitProbability *= wavelengthAcceptance_->GetValue(photon.GetWavelength());
-                log_warn("After wlen acceptance: prob=%g (wlen acceptance is %f)",
-                         hitProbability, wavelengthAcceptance_->GetValue(photon.GetWavelength()));
-
-                hitProbability *= angularAcceptance_->GetValue(photonCosAngle);
-                log_warn("After wlen&angular acceptance: prob=%g (angular acceptance is %f)",
-                          hitProbability, angularAcceptance_->GetValue(photonCosAngle));
-
-                hitProbability *= efficiency_from_calibration;
-                log_warn("After efficiency from calibration: prob=%g (efficiency_from_calibration=%f)",
-                          hitProbability, efficiency_from_calibration);
                 
-                log_fatal("cannot continue.");
+                // every DOM has its own output series, so no locking is needed
+                module_.ConvertDOM(keys_[i], *photons_[i], *doms_[i], frameSeed_, work, hits_[i]);
             }
-            
-            // does it survive?
-            if (hitProbability <= randomService_->Uniform()) continue;
+        }
+        catch (std::exception &e)
+        {
+            boost::unique_lock<boost::mutex> guard(mutex_);
+            if (errorMessage_.empty()) errorMessage_ = e.what();
+            nextDOM_ = keys_.size(); // stop the other threads
+        }
+    }
+    
+    const I3PhotonToMCPEConverter &module_;
+    const uint64_t frameSeed_;
+    
+    std::vector<OMKey> keys_;
+    std::vector<const PhotonSeries *> photons_;
+    std::vector<const DOMInfo *> doms_;
+    std::vector<I3MCPESeries> hits_;
+    
+    // per-worker buffers owned by the module
+    std::vector<boost::shared_ptr<WorkArrays> > *workArrays_;
+    
+    boost::mutex mutex_;
+    std::size_t nextDOM_;
+    std::string errorMessage_;
+};
+
+template <typename PhotonSeries>
+void
+I3PhotonToMCPEConverter::ConvertDOM(const OMKey &key,
+                                    const PhotonSeries &photons,
+                                    const DOMInfo &dom,
+                                    uint64_t frameSeed,
+                                    WorkArrays &work,
+                                    I3MCPESeries &hits) const
+{
+    typedef typename PhotonSeries::value_type Photon;
+    
+    // Collect all photons that can make a hit along with the wavelengths
+    // and angles the acceptances are evaluated at
+    work.candidates.clear();
+    work.wavelengths.clear();
+    work.cosAngles.clear();
+    work.dots.clear();
+    work.distances.clear();
+    
+    for (std::size_t j=0;j<photons.size();++j)
+    {
+        const Photon &photon = photons[j];
+        
+        const double weight = photon.GetWeight();
+        if (weight < 0.) log_fatal("Photon with negative weight found.");
+        if (weight == 0.) continue;
+        
+        const I3Direction photonDir = photon.GetDir();
+        const I3Position photonPos = photon.GetPos();
+        
+        const double dx=photonDir.GetX();
+        const double dy=photonDir.GetY();
+        const double dz=photonDir.GetZ();
+        const double px=dom.posX-photonPos.GetX();
+        const double py=dom.posY-photonPos.GetY();
+        const double pz=dom.posZ-photonPos.GetZ();
+        const double pr2 = px*px + py*py + pz*pz;
         
-            // allocate the output vector if not already done
-            if (!hits) hits = &(outputMCPESeriesMap->insert(std::make_pair(key, I3MCPESeries())).first->second);
+        double photonCosAngle = -(dx * dom.dirX +
+                                  dy * dom.dirY +
+                                  dz * dom.dirZ);
+        photonCosAngle = std::max(-1., std::min(1., photonCosAngle));
+        
+        const double distFromDOMCenter = std::sqrt(pr2);
 
-            // correct timing for oversized DOMs
-            double correctedTime = photon.GetTime();
-            {
-                const double dot = px*dx + py*dy + pz*dz;
-                const double bringForward = dot*(1.-DOMPancakeFactor_/DOMOversizeFactor_);
-                correctedTime += bringForward/photon.GetGroupVelocity();
+        // do this only if DOMs are spherical
+        if (DOMPancakeFactor_ == 1.)
+        {
+            // sanity check: are photons on the OM's surface?
+            if (std::abs(distFromDOMCenter - DOMOversizeFactor_*DOMRadiusWithoutOversize_) > 3.*I3Units::cm) {
+                if (onlyWarnAboutInvalidPhotonPositions_) {
+                    log_warn("distance not %f*%f=%fmm.. it is %fmm (diff=%gmm) (OMKey=(%i,%u) (photon @ pos=(%g,%g,%g)m) (DOM @ pos=(%g,%g,%g)m)",
+                             DOMOversizeFactor_,
+                             DOMRadiusWithoutOversize_/I3Units::mm,
+                             DOMOversizeFactor_*DOMRadiusWithoutOversize_/I3Units::mm,
+                             distFromDOMCenter/I3Units::mm,
+                             (distFromDOMCenter-DOMOversizeFactor_*DOMRadiusWithoutOversize_)/I3Units::mm,
+                             key.GetString(), key.GetOM(),
+                             photonPos.GetX()/I3Units::m,
+                             photonPos.GetY()/I3Units::m,
+                             photonPos.GetZ()/I3Units::m,
+                             dom.posX/I3Units::m,
+                             dom.posY/I3Units::m,
+                             dom.posZ/I3Units::m
+                             );
+                } else {
+                    log_fatal("distance not %f*%f=%fmm.. it is %fmm (diff=%gmm) (OMKey=(%i,%u) (photon @ pos=(%g,%g,%g)m) (DOM @ pos=(%g,%g,%g)m)",
+                              DOMOversizeFactor_,
+                              DOMRadiusWithoutOversize_/I3Units::mm,
+                              DOMOversizeFactor_*DOMRadiusWithoutOversize_/I3Units::mm,
+                              distFromDOMCenter/I3Units::mm,
+                              (distFromDOMCenter-DOMOversizeFactor_*DOMRadiusWithoutOversize_)/I3Units::mm,
+                              key.GetString(), key.GetOM(),
+                              photonPos.GetX()/I3Units::m,
+                              photonPos.GetY()/I3Units::m,
+                              photonPos.GetZ()/I3Units::m,
+                              dom.posX/I3Units::m,
+                              dom.posY/I3Units::m,
+                              dom.posZ/I3Units::m
+                              );
+                }
             }
-            
-            // add a new hit
-            hits->emplace_back(photon.GetParticleID(), 1, correctedTime);
         }
         
-        if (hits) {
-            // sort the photons in each hit series by time
-            std::sort(hits->begin(), hits->end(), MCPETimeLess);
+        CheckSanity(photon);
+        
+        work.candidates.push_back(j);
+        work.wavelengths.push_back(photon.GetWavelength());
+        work.cosAngles.push_back(photonCosAngle);
+        work.dots.push_back(px*dx + py*dy + pz*dz);
+        work.distances.push_back(distFromDOMCenter);
+    }
+    
+    const std::size_t numCandidates = work.candidates.size();
+    if (numCandidates == 0) return;
+    
+    // evaluate the acceptances for all photons on this DOM at once
+    work.wavelengthAcceptances.resize(numCandidates);
+    work.angularAcceptances.resize(numCandidates);
+    wavelengthAcceptance_->GetValues(&work.wavelengths[0], &work.wavelengthAcceptances[0], numCandidates);
+    angularAcceptance_->GetValues(&work.cosAngles[0], &work.angularAcceptances[0], numCandidates);
+    
+    DOMRandomStream rng(frameSeed, key);
+    
+    for (std::size_t i=0;i<numCandidates;++i)
+    {
+        const Photon &photon = photons[work.candidates[i]];
+        
+        double hitProbability = photon.GetWeight();
+        
+#ifndef NDEBUG
+        log_trace("Photon (lambda=%fnm, angle=%fdeg, dist=%fm) has weight %g",
+                 work.wavelengths[i]/I3Units::nanometer,
+                 std::acos(work.cosAngles[i])/I3Units::deg,
+                 work.distances[i]/I3Units::m,
+                 hitProbability);
+#endif
+        
+        hitProbability *= work.wavelengthAcceptances[i];
+        log_trace("After wlen acceptance: prob=%g (wlen acceptance is %f)",
+                 hitProbability, work.wavelengthAcceptances[i]);
+
+        hitProbability *= work.angularAcceptances[i];
+        log_trace("After wlen&angular acceptance: prob=%g (angular acceptance is %f)",
+                  hitProbability, work.angularAcceptances[i]);
+
+        hitProbability *= dom.efficiency;
+        log_trace("After efficiency from calibration: prob=%g (efficiency_from_calibration=%f)",
+                  hitProbability, dom.efficiency);
+
+        if (hitProbability > 1.) {
+            log_warn("hitProbability==%f > 1: your hit weights are too high. (hitProbability-1=%f)", hitProbability, hitProbability-1.);
+
+            double hitProbability = photon.GetWeight();
+
+            const double photonAngle = std::acos(work.cosAngles[i]);
+            log_warn("Photon (lambda=%fnm, angle=%fdeg, dist=%fm) has weight %g, 1/weight %g",
+                     work.wavelengths[i]/I3Units::nanometer,
+                     photonAngle/I3Units::deg,
+                     work.distances[i]/I3Units::m,
+                     hitProbability,
+                     1./hitProbability);
+
+            hitProbability *= work.wavelengthAcceptances[i];
+            log_warn("After wlen acceptance: prob=%g (wlen acceptance is %f)",
+                     hitProbability, work.wavelengthAcceptances[i]);
+
+            hitProbability *= work.angularAcceptances[i];
+            log_warn("After wlen&angular acceptance: prob=%g (angular acceptance is %f)",
+                      hitProbability, work.angularAcceptances[i]);
+
+            hitProbability *= dom.efficiency;
+            log_warn("After efficiency from calibration: prob=%g (efficiency_from_calibration=%f)",
+                      hitProbability, dom.efficiency);
             
-            // keep track of the number of hits generated
-            numGeneratedHits_ += static_cast<uint64_t>(hits->size());
+            log_fatal("cannot continue.");
         }
+        
+        // does it survive?
+        if (hitProbability <= rng.Uniform()) continue;
+    
+        // correct timing for oversized DOMs
+        double correctedTime = photon.GetTime();
+        {
+            const double bringForward = work.dots[i]*(1.-DOMPancakeFactor_/DOMOversizeFactor_);
+            correctedTime += bringForward/photon.GetGroupVelocity();
+        }
+        
+        // add a new hit
+        hits.emplace_back(photon.GetParticleID(), 1, correctedTime);
+    }
+    
+    // sort the photons in each hit series by time
+    std::sort(hits.begin(), hits.end(), MCPETimeLess);
+}
+
+template <typename PhotonMapType>
+I3MCPESeriesMapPtr
+I3PhotonToMCPEConverter::Convert(I3FramePtr frame)
+{
+    // First we need to get our geometry
+    I3OMGeoMapConstPtr omgeo = frame->Get<I3OMGeoMapConstPtr>("I3OMGeoMap");
+    I3ModuleGeoMapConstPtr modulegeo = frame->Get<I3ModuleGeoMapConstPtr>("I3ModuleGeoMap");
+    
+    if (!omgeo)
+        log_fatal("Missing geometry information! (No \"I3OMGeoMap\")");
+    if (!modulegeo)
+        log_fatal("Missing geometry information! (No \"I3ModuleGeoMap\")");
+    
+    if ((omgeo != domInfoOMGeo_) || (modulegeo != domInfoModuleGeo_)) {
+        domInfo_.clear();
+        domInfoOMGeo_ = omgeo;
+        domInfoModuleGeo_ = modulegeo;
+    }
+    
+    boost::shared_ptr<const PhotonMapType> inputPhotonSeriesMap = frame->Get<boost::shared_ptr<const PhotonMapType> >(inputPhotonSeriesMapName_);
+    
+    // allocate the output hitSeriesMap
+    I3MCPESeriesMapPtr outputMCPESeriesMap(new I3MCPESeriesMap());
+    
+    typedef PhotonMapType PhotonSeriesMap;
+    typedef typename PhotonSeriesMap::mapped_type PhotonSeries;
+    
+    // a single draw from the random service per frame; every DOM
+    // derives its own random stream from it
+    uint64_t frameSeed = static_cast<uint32_t>(randomService_->Integer(0xffffffff));
+    frameSeed = frameSeed<<32;
+    frameSeed += static_cast<uint32_t>(randomService_->Integer(0xffffffff));
+    
+    ConversionJob<PhotonSeries> job(*this, frameSeed);
+    
+    // look up all DOMs first, this fills the cache and may not
+    // be done from the worker threads
+    BOOST_FOREACH(const typename PhotonSeriesMap::value_type &it, *inputPhotonSeriesMap)
+    {
+        const ModuleKey &module_key = it.first;
+        
+        const DOMInfo &dom = GetDOMInfo(module_key, *omgeo, *modulegeo);
+        if (dom.ignore) continue;
+        if (it.second.empty()) continue;
+        
+        // assume this is IceCube (i.e. one PMT with index 0 per DOM)
+        job.Add(OMKey(module_key.GetString(), module_key.GetOM(), 0), it.second, dom);
+    }
+    
+    {
+        // the workers do not need python, let other python threads run
+        ScopedGILRelease scopedGIL;
+        job.Run(workerPool_.get(), workArrays_);
     }
     
+    if (!job.GetErrorMessage().empty())
+        log_fatal("Hit generation failed: %s", job.GetErrorMessage().c_str());
+    
+    // keep track of the number of hits generated
+    numGeneratedHits_ += job.MoveHitsTo(*outputMCPESeriesMap);
+    
     return outputMCPESeriesMap;
 }
 
@@ -37,6 +37,14 @@ I3CLSimFunction::~I3CLSimFunction()
 
 }
 
+void I3CLSimFunction::GetValues(const double *wlens, double *values, std::size_t num) const
+{
+    for (std::size_t i=0;i<num;++i)
+    {
+        values[i] = GetValue(wlens[i]);
+    }
+}
+
 template <class Archive>
 void I3CLSimFunction::serialize(Archive &ar, unsigned version)
 {
@@ -32,6 +32,7 @@
 
 #include <typeinfo>
 #include <cmath>
+#include <algorithm>
 #include <math.h>
 #include <stdexcept>
 
@@ -65,8 +66,13 @@ storeDataAsHalfPrecision_(storeDataAsHalfPrecision)
 {
     if (wlens_.size() < 2) throw std::range_error("wlens must contain at least 2 elements!");
     if (wlens_.size() != values_.size()) throw std::range_error("wlens and values must have the same size!");
+    for (std::size_t i=1;i<wlens_.size();++i) {
+        if (wlens_[i] < wlens_[i-1]) throw std::range_error("wlens must not decrease!");
+    }
 
     startWlen_ = wlens_[0];
+    
+    InitWlenIndex();
 }
 
 I3CLSimFunctionFromTable::
@@ -101,6 +107,62 @@ namespace {
     {
         return min+(max-min)*t;
     }
+    
+    // cap on the number of grid cells per bin for very uneven spacings
+    const std::size_t maxWlenIndexCellsPerBin = 8;
+}
+
+void I3CLSimFunctionFromTable::InitWlenIndex()
+{
+    wlenIndex_.clear();
+    wlenIndexInvCellWidth_ = NAN;
+    if (equalSpacingMode_) return;
+    
+    const std::size_t numBins = wlens_.size()-1;
+    const double range = wlens_[numBins]-wlens_[0];
+    if (!(range > 0.)) {
+        // all wavelengths are the same, so no wavelength is ever
+        // in range and FindWlenBin() will not be used
+        wlenIndex_.assign(1, 0);
+        wlenIndexInvCellWidth_ = 0.;
+        return;
+    }
+    
+    // use cells no wider than the narrowest bin (so that each cell
+    // contains at most one bin edge), within limits
+    double smallestBinWidth = range;
+    for (std::size_t i=0;i<numBins;++i) {
+        const double width = wlens_[i+1]-wlens_[i];
+        if ((width > 0.) && (width < smallestBinWidth)) smallestBinWidth = width;
+    }
+    const std::size_t numCells =
+    std::min(std::max(static_cast<std::size_t>(std::ceil(range/smallestBinWidth)), numBins),
+             maxWlenIndexCellsPerBin*numBins);
+    
+    wlenIndexInvCellWidth_ = static_cast<double>(numCells)/range;
+    wlenIndex_.resize(numCells);
+    
+    std::size_t bin=0;
+    for (std::size_t i=0;i<numCells;++i)
+    {
+        const double cellStart = wlens_[0] + static_cast<double>(i)/wlenIndexInvCellWidth_;
+        while ((bin<numBins-1) && (cellStart > wlens_[bin+1])) ++bin;
+        wlenIndex_[i] = static_cast<unsigned int>(bin);
+    }
+}
+
+inline std::size_t I3CLSimFunctionFromTable::FindWlenBin(double wlen) const
+{
+    const std::size_t cell =
+    std::min(static_cast<std::size_t>((wlen-wlens_[0])*wlenIndexInvCellWidth_), wlenIndex_.size()-1);
+    
+    // the grid gives the starting point, the actual bin is
+    // usually the same one or the one after it
+    std::size_t bin = wlenIndex_[cell];
+    while ((bin>0) && (wlen <= wlens_[bin])) --bin;
+    while (wlen > wlens_[bin+1]) ++bin;
+    
+    return bin;
 }
 
 double I3CLSimFunctionFromTable::GetValue(double wlen) const
@@ -127,22 +189,64 @@ double I3CLSimFunctionFromTable::GetValue(double wlen) const
             return values_[0];
         }
 
-        std::size_t bin;
-        double fraction;
-        for (std::size_t i=1;i<wlens_.size();++i) {
-            if (wlen <= wlens_[i]) {
-                // got it!
-                bin=i-1;
-                fraction = (wlen-wlens_[i-1])/(wlens_[i]-wlens_[i-1]);
-
-                return mix(values_[bin], 
-                           values_[bin+1],
-                           fraction);
-            }
+        if (!(wlen <= wlens_[wlens_.size()-1])) {
+            // nothing in range
+            return values_[wlens_.size()-1];
         }
 
-        // nothing in range
-        return values_[wlens_.size()-1];
+        const std::size_t bin = FindWlenBin(wlen);
+        const double fraction = (wlen-wlens_[bin])/(wlens_[bin+1]-wlens_[bin]);
+
+        return mix(values_[bin], 
+                   values_[bin+1],
+                   fraction);
+    }
+}
+
+void I3CLSimFunctionFromTable::GetValues(const double *wlens, double *values, std::size_t num) const
+{
+    const double *data = &(values_[0]);
+    const std::size_t numEntries = values_.size();
+    
+    if (equalSpacingMode_) {
+        for (std::size_t i=0;i<num;++i)
+        {
+            double fbin;
+            double fraction = modf((wlens[i]-startWlen_)/wlenStep_, &fbin);
+            int ibin=static_cast<int>(fbin);
+            
+            if ((ibin<0) || ((ibin==0) && (fraction<0)))  {
+                ibin=0;
+                fraction=0.;
+            } else if (static_cast<std::size_t>(ibin)>=numEntries-1) {
+                ibin=numEntries-2;
+                fraction=1.;
+            }
+            
+            values[i] = mix(data[ibin], data[ibin+1], fraction);
+        }
+    } else {
+        const double *wlenData = &(wlens_[0]);
+        
+        for (std::size_t i=0;i<num;++i)
+        {
+            const double wlen = wlens[i];
+            
+            if (wlen <= wlenData[0]) {
+                values[i] = data[0];
+                continue;
+            }
+            
+            if (!(wlen <= wlenData[numEntries-1])) {
+                // nothing in range
+                values[i] = data[numEntries-1];
+                continue;
+            }
+            
+            const std::size_t bin = FindWlenBin(wlen);
+            const double fraction = (wlen-wlenData[bin])/(wlenData[bin+1]-wlenData[bin]);
+            values[i] = mix(data[bin], data[bin+1], fraction);
+        }
     }
 }
 
@@ -166,12 +270,11 @@ double I3CLSimFunctionFromTable::GetMaxWlen() const
 
 std::string I3CLSimFunctionFromTable::GetOpenCLFunction(const std::string &functionName) const
 {
-    if (!equalSpacingMode_)
-        log_fatal("GetOpenCLFunction() has not yet been implemented for non-equal bin spacings.");
-
     // some names
     const std::string dataName = functionName + "_data";
     const std::string interpHelperName = functionName + "_getInterpolationBinAndFraction";
+    const std::string wlensName = functionName + "_wlens";
+    const std::string wlenIndexName = functionName + "_wlenIndex";
 
 #ifndef USE_OPENCL_HALF_PRECISION
     double smallestEntry=0., largestEntry=0.;
@@ -237,27 +340,80 @@ std::string I3CLSimFunctionFromTable::GetOpenCLFunction(const std::string &funct
         dataDef += "};\n\n";
     }
 
+    if (!equalSpacingMode_)
+    {
+        // the wavelengths and the index grid (see InitWlenIndex())
+        dataDef = dataDef +
+        "__constant float " + wlensName + "[" + boost::lexical_cast<std::string>(wlens_.size()) + "] = {\n";
+        BOOST_FOREACH(const double &val, wlens_)
+        {
+            dataDef += ToFloatString(val) + ", ";
+        }
+        dataDef += "\n";
+        dataDef += "};\n\n";
+        
+        dataDef = dataDef +
+        "__constant unsigned int " + wlenIndexName + "[" + boost::lexical_cast<std::string>(wlenIndex_.size()) + "] = {\n";
+        BOOST_FOREACH(const unsigned int &val, wlenIndex_)
+        {
+            dataDef += boost::lexical_cast<std::string>(val) + ", ";
+        }
+        dataDef += "\n";
+        dataDef += "};\n\n";
+    }
+
     std::string interpHelperDef =
     std::string("inline void ") + interpHelperName + "(float wavelength, int *bin, float *fraction)";
 
-    std::string interpHelperBody =
-    "{\n"
-    "    float fbin;\n"
-    "    *fraction = modf((wavelength - " + ToFloatString(startWlen_) + ")/" + ToFloatString(wlenStep_) + ", &fbin);\n"
-    "    \n"
-    "    int ibin=(int)fbin;\n"
-    "    \n"
-    "    if ((ibin<0) || ((ibin==0) && (*fraction<0))) {\n"
-    "        ibin=0;\n"
-    "        *fraction=0.f;\n"
-    "    } else if (ibin>=" + boost::lexical_cast<std::string>(values_.size()) + "-1) {\n"
-    "        ibin=" + boost::lexical_cast<std::string>(values_.size()) + "-2;\n"
-    "        *fraction=1.f;\n"
-    "    }\n"
-    "    \n"
-    "    *bin = ibin;\n"
-    "}\n\n"
-    ;
+    std::string interpHelperBody;
+    if (!equalSpacingMode_)
+    {
+        const std::string numEntriesString = boost::lexical_cast<std::string>(wlens_.size());
+        
+        interpHelperBody =
+        "{\n"
+        "    if (wavelength <= " + wlensName + "[0]) {\n"
+        "        *bin=0;\n"
+        "        *fraction=0.f;\n"
+        "        return;\n"
+        "    } else if (!(wavelength <= " + wlensName + "[" + numEntriesString + "-1])) {\n"
+        "        *bin=" + numEntriesString + "-2;\n"
+        "        *fraction=1.f;\n"
+        "        return;\n"
+        "    }\n"
+        "    \n"
+        "    // the index grid gives the starting point, the actual bin is\n"
+        "    // usually the same one or the one after it\n"
+        "    int ibin = " + wlenIndexName + "[min(convert_int_rtz((wavelength - " + wlensName + "[0])*" + ToFloatString(wlenIndexInvCellWidth_) + "), " + boost::lexical_cast<std::string>(wlenIndex_.size()) + "-1)];\n"
+        "    while ((ibin>0) && (wavelength <= " + wlensName + "[ibin])) --ibin;\n"
+        "    while (wavelength > " + wlensName + "[ibin+1]) ++ibin;\n"
+        "    \n"
+        "    *bin = ibin;\n"
+        "    *fraction = (wavelength - " + wlensName + "[ibin])/(" + wlensName + "[ibin+1] - " + wlensName + "[ibin]);\n"
+        "}\n\n"
+        ;
+    }
+    else
+    {
+        interpHelperBody =
+        "{\n"
+        "    float fbin;\n"
+        "    *fraction = modf((wavelength - " + ToFloatString(startWlen_) + ")/" + ToFloatString(wlenStep_) + ", &fbin);\n"
+        "    \n"
+        "    int ibin=(int)fbin;\n"
+        "    \n"
+        "    if ((ibin<0) || ((ibin==0) && (*fraction<0))) {\n"
+        "        ibin=0;\n"
+        "        *fraction=0.f;\n"
+        "    } else if (ibin>=" + boost::lexical_cast<std::string>(values_.size()) + "-1) {\n"
+        "        ibin=" + boost::lexical_cast<std::string>(values_.size()) + "-2;\n"
+        "        *fraction=1.f;\n"
+        "    }\n"
+        "    \n"
+        "    *bin = ibin;\n"
+        "}\n\n"
+        ;
+    }
 
     std::string funcDef = 
     std::string("inline float ") + functionName + std::string("(float wavelength)\n");
@@ -355,6 +511,11 @@ void I3CLSimFunctionFromTable::serialize(Archive &ar, unsigned version)
     ar & make_nvp("wlens", wlens_);
     ar & make_nvp("values", values_);
     ar & make_nvp("equalSpacingMode", equalSpacingMode_);
+    
+    if (Archive::is_loading::value)
+    {
+        InitWlenIndex();
+    }
 }
 
 
@@ -30,6 +30,7 @@
 
 #include <typeinfo>
 #include <cmath>
+#include <algorithm>
 
 #include "clsim/I3CLSimHelperToFloatString.h"
 using namespace I3CLSimHelper;
@@ -101,6 +102,34 @@ double I3CLSimFunctionPolynomial::GetValue(double wlen) const
 }
 
 
+void I3CLSimFunctionPolynomial::GetValues(const double *wlens, double *values, std::size_t num) const
+{
+    if (coefficients_.size()==0) {
+        std::fill(values, values+num, 0.);
+        return;
+    }
+    
+    const double *coefficients = &(coefficients_[0]);
+    const std::size_t numCoefficients = coefficients_.size();
+    
+    // same arithmetic as GetValue(), but without a virtual call per value
+    for (std::size_t j=0;j<num;++j)
+    {
+        const double wlen = wlens[j];
+        
+        double sum=coefficients[0];
+        double multiplier=1.;
+        for (std::size_t i=1;i<numCoefficients;++i)
+        {
+            multiplier *= wlen;
+            sum += coefficients[i]*multiplier;
+        }
+        
+        values[j] = (wlen < rangemin_) ? underflow_ : ((wlen > rangemax_) ? overflow_ : sum);
+    }
+}
+
+
 std::string I3CLSimFunctionPolynomial::GetOpenCLFunction(const std::string &functionName) const
 {
     std::ostringstream output(std::ostringstream::out);
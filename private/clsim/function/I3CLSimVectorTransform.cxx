@@ -27,6 +27,8 @@
 #include <icetray/serialization.h>
 #include <clsim/function/I3CLSimVectorTransform.h>
 
+#include <algorithm>
+
 I3CLSimVectorTransform::I3CLSimVectorTransform()
 { 
     
@@ -37,6 +39,15 @@ I3CLSimVectorTransform::~I3CLSimVectorTransform()
 
 }
 
+void I3CLSimVectorTransform::ApplyTransformInPlace(double *vec) const
+{
+    const std::vector<double> out_vec = ApplyTransform(std::vector<double>(vec, vec+3));
+    if (out_vec.size() != 3)
+        throw std::range_error("transformed vector must contain excatly 3 elements!");
+
+    std::copy(out_vec.begin(), out_vec.end(), vec);
+}
+
 template <class Archive>
 void I3CLSimVectorTransform::serialize(Archive &ar, unsigned version)
 {
@@ -55,6 +55,11 @@ std::vector<double> I3CLSimVectorTransformConstant::ApplyTransform(const std::ve
     return vec;
 }
 
+void I3CLSimVectorTransformConstant::ApplyTransformInPlace(double *vec) const
+{
+    // does nothing
+}
+
 std::string I3CLSimVectorTransformConstant::GetOpenCLFunction(const std::string &functionName) const
 {
     // the OpenCL interface takes a pointer to a float4, but ignores the fourth component
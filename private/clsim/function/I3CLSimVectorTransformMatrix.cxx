@@ -98,6 +98,25 @@ std::vector<double> I3CLSimVectorTransformMatrix::ApplyTransform(const std::vect
     return out_vec;
 }
 
+void I3CLSimVectorTransformMatrix::ApplyTransformInPlace(double *vec) const
+{
+    double out_vec[3];
+    for (std::size_t i=0;i<3;++i)
+    {
+        out_vec[i] = matrix_(i,0)*vec[0] + matrix_(i,1)*vec[1] + matrix_(i,2)*vec[2];
+    }
+
+    double norm=1.;
+    if (renormalize_) {
+        norm = std::sqrt(out_vec[0]*out_vec[0] + out_vec[1]*out_vec[1] + out_vec[2]*out_vec[2]);
+    }
+
+    for (std::size_t i=0;i<3;++i)
+    {
+        vec[i] = out_vec[i]/norm;
+    }
+}
+
 std::string I3CLSimVectorTransformMatrix::GetOpenCLFunction(const std::string &functionName) const
 {
     // the OpenCL interface takes a pointer to a float4, but ignores the fourth component
@@ -35,6 +35,7 @@
 #include <vector>
 #include <cmath>
 #include <limits>
+#include <algorithm>
 
 I3CLSimRandomValueInterpolatedDistribution::
 I3CLSimRandomValueInterpolatedDistribution(const std::vector<double> &x,
@@ -89,9 +90,15 @@ double I3CLSimRandomValueInterpolatedDistribution::SampleFromDistribution(const
 
     const double randomNumber = random->Uniform();
 
-    unsigned int k=0;
-    //double this_acu = data_acu_[0];
-    double this_acu = 0.; //this is 0 by definition!
+    // start the search at the guide table entry (this is expected
+    // to be at most a bin or two away from the result)
+    const std::size_t guideBin =
+    std::min(static_cast<std::size_t>(randomNumber*static_cast<double>(data_guide_.size())),
+             data_guide_.size()-1);
+    unsigned int k=data_guide_[guideBin];
+    while ((k>0) && (data_acu_[k] >= randomNumber)) --k;
+
+    double this_acu = data_acu_[k]; // data_acu_[0] is 0 by definition
     for (;;)
     {
         double next_acu = data_acu_[k+1];
@@ -174,6 +181,17 @@ void I3CLSimRandomValueInterpolatedDistribution::InitTables()
         data_acu_[j] = data_acu_[j]/data_acu_[numEntries-1];
     }
     
+    // guide table with one entry per bin: the first bin
+    // whose upper edge is at or above the entry's lower edge
+    const sizeType numBins=numEntries-1;
+    data_guide_.resize(numBins);
+    sizeType k=0;
+    for (sizeType i=0;i<numBins;++i)
+    {
+        const double u = static_cast<double>(i)/static_cast<double>(numBins);
+        while ((k<numBins-1) && (data_acu_[k+1] < u)) ++k;
+        data_guide_[i]=static_cast<unsigned int>(k);
+    }
 
 }
 
@@ -199,6 +217,7 @@ std::string I3CLSimRandomValueInterpolatedDistribution::WriteTableCode(const std
     
     
     output << "#define " << prefix << "NUM_DIST_ENTRIES " << numEntries << std::endl;
+    output << "#define " << prefix << "NUM_GUIDE_ENTRIES " << data_guide_.size() << std::endl;
     output << std::endl;
     
     output.setf(std::ios::scientific,std::ios::floatfield);
@@ -228,6 +247,13 @@ std::string I3CLSimRandomValueInterpolatedDistribution::WriteTableCode(const std
     output << "};" << std::endl;
     output << std::endl;
     
+    output << "__constant uint " << prefix << "distGuideTable[" << prefix << "NUM_GUIDE_ENTRIES] = {" << std::endl;
+    for (sizeType j=0;j<data_guide_.size();++j){     
+        output << "  " << data_guide_[j] << ", " << std::endl;
+    }
+    output << "};" << std::endl;
+    output << std::endl;
+    
     // return the code we just generated to the caller
     return output.str();
 }
@@ -247,6 +273,8 @@ std::string I3CLSimRandomValueInterpolatedDistribution::GetOpenCLFunction
     const std::string distXValuesName = std::string("_") + functionName + "distXValues";
     const std::string distYValuesName = std::string("_") + functionName + "distYValues";
     const std::string distYCumulativeValuesName = std::string("_") + functionName + "distYCumulativeValues";
+    const std::string distGuideTableName = std::string("_") + functionName + "distGuideTable";
+    const std::string numGuideEntriesName = std::string("_") + functionName + "NUM_GUIDE_ENTRIES";
 
     std::string constantXSpacingValueString;
     std::string firstXValueString;
@@ -274,9 +302,11 @@ std::string I3CLSimRandomValueInterpolatedDistribution::GetOpenCLFunction
     "{\n"
     "    const float randomNumber = " + uniformRandomCall_oc + ";\n"
     "    \n"
-    "    unsigned int k=0;\n"
-    "    //float this_acu = " + distYCumulativeValuesName + "[0];\n"
-    "    float this_acu = 0.f; //this is 0 by definition!\n"
+    "    // start the search at the guide table entry\n"
+    "    unsigned int k = " + distGuideTableName + "[min(convert_uint_rtz(randomNumber*(float)" + numGuideEntriesName + "), (uint)(" + numGuideEntriesName + "-1))];\n"
+    "    while ((k>0) && (" + distYCumulativeValuesName + "[k] >= randomNumber)) --k;\n"
+    "    \n"
+    "    float this_acu = " + distYCumulativeValuesName + "[k]; // [0] is 0 by definition\n"
     "    for (;;)\n"
     "    {\n"
     "        float next_acu = " + distYCumulativeValuesName + "[k+1];\n"
@@ -0,0 +1,316 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ *
+ * @file I3ExtraGeometryBVH.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#include <limits>
+#include <algorithm>
+#include <cmath>
+
+#include <clsim/shadow/I3ExtraGeometryBVH.h>
+#include <clsim/shadow/I3ExtraGeometryItemUnion.h>
+#include <clsim/shadow/I3ExtraGeometryItemMove.h>
+
+#include <boost/foreach.hpp>
+
+namespace {
+    inline double GetCoordinate(const I3Position &pos, unsigned int axis)
+    {
+        if (axis==0) return pos.GetX();
+        if (axis==1) return pos.GetY();
+        return pos.GetZ();
+    }
+    
+    // orders items by the center of their bounding box along one axis
+    struct CenterIsLess
+    {
+        CenterIsLess(const std::vector<std::pair<I3Position, I3Position> > &boxes, unsigned int axis)
+        : boxes_(boxes), axis_(axis) {;}
+        
+        bool operator()(std::size_t a, std::size_t b) const
+        {
+            return (GetCoordinate(boxes_[a].first, axis_)+GetCoordinate(boxes_[a].second, axis_)) <
+                   (GetCoordinate(boxes_[b].first, axis_)+GetCoordinate(boxes_[b].second, axis_));
+        }
+        
+        const std::vector<std::pair<I3Position, I3Position> > &boxes_;
+        unsigned int axis_;
+    };
+    
+    // slab test of the line segment start+t*dir (with 0<=t<=1)
+    // against an axis-aligned box
+    inline bool DoesLineIntersectBox(const double start[3], const double dir[3],
+                                     const double lower[3], const double upper[3])
+    {
+        double tmin=0.;
+        double tmax=1.;
+        
+        for (unsigned int i=0;i<3;++i)
+        {
+            if (dir[i]==0.) {
+                // parallel to the slab
+                if ((start[i] < lower[i]) || (start[i] > upper[i])) return false;
+                continue;
+            }
+            
+            const double recip = 1./dir[i];
+            double t0 = (lower[i]-start[i])*recip;
+            double t1 = (upper[i]-start[i])*recip;
+            if (t0 > t1) std::swap(t0, t1);
+            
+            if (t0 > tmin) tmin=t0;
+            if (t1 < tmax) tmax=t1;
+            if (tmin > tmax) return false;
+        }
+        
+        return true;
+    }
+}
+
+I3ExtraGeometryBVH::I3ExtraGeometryBVH(I3ExtraGeometryItemConstPtr geometry,
+                                       std::size_t maxItemsPerLeaf)
+:
+maxItemsPerLeaf_(maxItemsPerLeaf),
+maxDepth_(0)
+{
+    if (maxItemsPerLeaf_==0)
+        log_fatal("maxItemsPerLeaf has to be > 0");
+    
+    Flatten(geometry, I3Position(0.,0.,0.));
+    
+    if (items_.empty()) return;
+    
+    if (items_.size() > std::numeric_limits<uint32_t>::max())
+        log_fatal("Too many extra geometry items (%zu).", items_.size());
+    
+    Build(0, items_.size(), 1);
+    
+    log_debug("BVH with %zu nodes (depth %zu) for %zu extra geometry items.",
+              nodes_.size(), maxDepth_, items_.size());
+}
+
+I3ExtraGeometryBVH::~I3ExtraGeometryBVH()
+{
+}
+
+void I3ExtraGeometryBVH::Flatten(const I3ExtraGeometryItemConstPtr &item,
+                                 const I3Position &offset)
+{
+    if (!item) return;
+    
+    const bool hasOffset =
+    (offset.GetX()!=0.) || (offset.GetY()!=0.) || (offset.GetZ()!=0.);
+    
+    if (I3ExtraGeometryItemUnionConstPtr itemUnion =
+        boost::dynamic_pointer_cast<const I3ExtraGeometryItemUnion>(item))
+    {
+        BOOST_FOREACH(const I3ExtraGeometryItemConstPtr &element, itemUnion->GetElements())
+        {
+            Flatten(element, offset);
+        }
+        return;
+    }
+    
+    if (I3ExtraGeometryItemMoveConstPtr itemMove =
+        boost::dynamic_pointer_cast<const I3ExtraGeometryItemMove>(item))
+    {
+        Flatten(itemMove->GetElement(), offset+itemMove->GetOffset());
+        return;
+    }
+    
+    I3ExtraGeometryItemConstPtr leaf;
+    I3ExtraGeometryItemCylinderConstPtr cylinder =
+    boost::dynamic_pointer_cast<const I3ExtraGeometryItemCylinder>(item);
+    
+    if (cylinder) {
+        if (hasOffset) {
+            cylinder = I3ExtraGeometryItemCylinderConstPtr
+            (new I3ExtraGeometryItemCylinder(cylinder->GetFrom()+offset,
+                                             cylinder->GetTo()+offset,
+                                             cylinder->GetRadius()));
+        }
+        leaf = cylinder;
+    } else {
+        // anything else is used as-is
+        if (hasOffset) {
+            leaf = I3ExtraGeometryItemConstPtr(new I3ExtraGeometryItemMove(item, offset));
+        } else {
+            leaf = item;
+        }
+    }
+    
+    items_.push_back(leaf);
+    cylinders_.push_back(cylinder);
+    boxes_.push_back(leaf->GetBoundingBox());
+}
+
+uint32_t I3ExtraGeometryBVH::Build(std::size_t begin, std::size_t end, std::size_t depth)
+{
+    if (depth > maxDepth_) maxDepth_=depth;
+    
+    const uint32_t nodeIndex = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(Node());
+    
+    // bounds of all items and of their centers
+    double lower[3], upper[3], centerLower[3], centerUpper[3];
+    for (unsigned int i=0;i<3;++i) {
+        lower[i]=centerLower[i]=std::numeric_limits<double>::infinity();
+        upper[i]=centerUpper[i]=-std::numeric_limits<double>::infinity();
+    }
+    
+    for (std::size_t j=begin;j<end;++j)
+    {
+        for (unsigned int i=0;i<3;++i) {
+            const double low = std::min(GetCoordinate(boxes_[j].first, i), GetCoordinate(boxes_[j].second, i));
+            const double high = std::max(GetCoordinate(boxes_[j].first, i), GetCoordinate(boxes_[j].second, i));
+            const double center = (low+high)/2.;
+            
+            lower[i] = std::min(lower[i], low);
+            upper[i] = std::max(upper[i], high);
+            centerLower[i] = std::min(centerLower[i], center);
+            centerUpper[i] = std::max(centerUpper[i], center);
+        }
+    }
+    
+    for (unsigned int i=0;i<3;++i) {
+        nodes_[nodeIndex].lower[i]=lower[i];
+        nodes_[nodeIndex].upper[i]=upper[i];
+    }
+    
+    // split along the axis with the largest spread of item centers
+    unsigned int axis=0;
+    for (unsigned int i=1;i<3;++i) {
+        if (centerUpper[i]-centerLower[i] > centerUpper[axis]-centerLower[axis]) axis=i;
+    }
+    
+    const std::size_t num = end-begin;
+    if ((num <= maxItemsPerLeaf_) || (!(centerUpper[axis] > centerLower[axis])))
+    {
+        nodes_[nodeIndex].index=static_cast<uint32_t>(begin);
+        nodes_[nodeIndex].numItems=static_cast<uint32_t>(num);
+        return nodeIndex;
+    }
+    
+    // median split: sort the item indices and re-order everything
+    std::vector<std::size_t> order(num);
+    for (std::size_t j=0;j<num;++j) order[j]=begin+j;
+    const std::size_t middle = num/2;
+    std::nth_element(order.begin(), order.begin()+middle, order.end(), CenterIsLess(boxes_, axis));
+    
+    {
+        std::vector<I3ExtraGeometryItemConstPtr> items(num);
+        std::vector<I3ExtraGeometryItemCylinderConstPtr> cylinders(num);
+        std::vector<std::pair<I3Position, I3Position> > boxes(num);
+        for (std::size_t j=0;j<num;++j) {
+            items[j]=items_[order[j]];
+            cylinders[j]=cylinders_[order[j]];
+            boxes[j]=boxes_[order[j]];
+        }
+        std::copy(items.begin(), items.end(), items_.begin()+begin);
+        std::copy(cylinders.begin(), cylinders.end(), cylinders_.begin()+begin);
+        std::copy(boxes.begin(), boxes.end(), boxes_.begin()+begin);
+    }
+    
+    Build(begin, begin+middle, depth+1);
+    const uint32_t rightChild = Build(begin+middle, end, depth+1);
+    
+    nodes_[nodeIndex].index=rightChild;
+    nodes_[nodeIndex].numItems=0;
+    return nodeIndex;
+}
+
+bool I3ExtraGeometryBVH::DoesLineIntersect(const I3Position &lineStart,
+                                           const I3Position &lineEnd,
+                                           std::vector<uint32_t> &stack) const
+{
+    if (nodes_.empty()) return false;
+    
+    const double start[3] = {lineStart.GetX(), lineStart.GetY(), lineStart.GetZ()};
+    const double dir[3] = {lineEnd.GetX()-lineStart.GetX(),
+                           lineEnd.GetY()-lineStart.GetY(),
+                           lineEnd.GetZ()-lineStart.GetZ()};
+    
+    stack.clear();
+    stack.push_back(0);
+    while (!stack.empty())
+    {
+        const uint32_t nodeIndex = stack.back();
+        stack.pop_back();
+        const Node &node = nodes_[nodeIndex];
+        
+        if (!DoesLineIntersectBox(start, dir, node.lower, node.upper)) continue;
+        
+        if (node.numItems==0) {
+            stack.push_back(node.index);
+            stack.push_back(nodeIndex+1);
+            continue;
+        }
+        
+        for (uint32_t j=node.index;j<node.index+node.numItems;++j)
+        {
+            if (items_[j]->DoesLineIntersect(lineStart, lineEnd)) return true;
+        }
+    }
+    
+    return false;
+}
+
+bool I3ExtraGeometryBVH::DoesLineIntersect(const I3Position &lineStart,
+                                           const I3Position &lineEnd) const
+{
+    std::vector<uint32_t> stack;
+    stack.reserve(2*maxDepth_);
+    return DoesLineIntersect(lineStart, lineEnd, stack);
+}
+
+void I3ExtraGeometryBVH::DoLinesIntersect(const std::vector<I3Position> &lineStarts,
+                                          const std::vector<I3Position> &lineEnds,
+                                          std::vector<bool> &results) const
+{
+    if (lineStarts.size() != lineEnds.size())
+        log_fatal("Got %zu line starts but %zu line ends.",
+                  lineStarts.size(), lineEnds.size());
+    
+    results.assign(lineStarts.size(), false);
+    if (nodes_.empty()) return;
+    
+    // the traversal stack is shared by all segments
+    std::vector<uint32_t> stack;
+    stack.reserve(2*maxDepth_);
+    
+    for (std::size_t i=0;i<lineStarts.size();++i)
+    {
+        results[i] = DoesLineIntersect(lineStarts[i], lineEnds[i], stack);
+    }
+}
+
+bool I3ExtraGeometryBVH::ConsistsOfCylindersOnly() const
+{
+    BOOST_FOREACH(const I3ExtraGeometryItemCylinderConstPtr &cylinder, cylinders_)
+    {
+        if (!cylinder) return false;
+    }
+    return true;
+}
@@ -25,6 +25,8 @@
  */
 
 #include <limits>
+#include <algorithm>
+#include <cmath>
 
 #include <icetray/serialization.h>
 #include <icetray/I3Units.h>
@@ -54,9 +56,27 @@ void I3ExtraGeometryItemCylinder::CalculateBoundingBox() const
 {
     if (boundingBoxCalculated_) return;
     
+    // the end caps are discs perpendicular to the cylinder axis,
+    // their extent along each coordinate axis is r*sqrt(1-w_i^2)
+    // (w being the normalized cylinder direction)
+    double Wx = to_.GetX() - from_.GetX();
+    double Wy = to_.GetY() - from_.GetY();
+    double Wz = to_.GetZ() - from_.GetZ();
+    const double W_len = std::sqrt(Wx*Wx + Wy*Wy + Wz*Wz);
+    if (W_len > 0.) {
+        Wx /= W_len; Wy /= W_len; Wz /= W_len;
+    }
+    
+    const double extentX = radius_*std::sqrt(std::max(0., 1.-Wx*Wx));
+    const double extentY = radius_*std::sqrt(std::max(0., 1.-Wy*Wy));
+    const double extentZ = radius_*std::sqrt(std::max(0., 1.-Wz*Wz));
     
-    boundingBoxLower_=I3Position();
-    boundingBoxUpper_=I3Position();
+    boundingBoxLower_=I3Position(std::min(from_.GetX(), to_.GetX())-extentX,
+                                 std::min(from_.GetY(), to_.GetY())-extentY,
+                                 std::min(from_.GetZ(), to_.GetZ())-extentZ);
+    boundingBoxUpper_=I3Position(std::max(from_.GetX(), to_.GetX())+extentX,
+                                 std::max(from_.GetY(), to_.GetY())+extentY,
+                                 std::max(from_.GetZ(), to_.GetZ())+extentZ);
     
     boundingBoxCalculated_=true;
 }
@@ -125,9 +145,9 @@ unsigned int I3ExtraGeometryItemCylinder::FindIntersections(const I3Position &li
     }
     
     // diff from line origin to cylinder center
-    const double cylOrigin_x = from_.GetX() + Wx;
-    const double cylOrigin_y = from_.GetY() + Wy;
-    const double cylOrigin_z = from_.GetZ() + Wz;
+    const double cylOrigin_x = from_.GetX() + Wx*halfHeight;
+    const double cylOrigin_y = from_.GetY() + Wy*halfHeight;
+    const double cylOrigin_z = from_.GetZ() + Wz*halfHeight;
     
     const double diff_x = lineStart.GetX() - cylOrigin_x;
     const double diff_y = lineStart.GetY() - cylOrigin_y;
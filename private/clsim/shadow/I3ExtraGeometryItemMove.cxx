@@ -104,6 +104,13 @@ void I3ExtraGeometryItemMove::load(Archive &ar, unsigned version)
         ar >> make_nvp("element", element_nonconst);
         element_ = element_nonconst;
     }
+    
+    // version 0 did not store the offset
+    if (version >= 1) {
+        ar >> make_nvp("offset", offset_);
+    } else {
+        offset_ = I3Position(0.,0.,0.);
+    }
 }
 
 
@@ -112,6 +119,7 @@ void I3ExtraGeometryItemMove::save(Archive &ar, unsigned version) const
 {
     ar << make_nvp("I3ExtraGeometryItem", base_object<I3ExtraGeometryItem>(*this));
     ar << make_nvp("element", element_);
+    ar << make_nvp("offset", offset_);
 }
 
 
@@ -35,9 +35,11 @@
 
 #include "dataclasses/I3Constants.h"
 
-I3ShadowedPhotonRemover::I3ShadowedPhotonRemover() //(I3ExtraGeometry extraGeometry) 
-//:
-//extraGeometry_(extraGeometry)
+#include <boost/foreach.hpp>
+
+I3ShadowedPhotonRemover::I3ShadowedPhotonRemover(I3ExtraGeometryItemConstPtr extraGeometry)
+:
+bvh_(new I3ExtraGeometryBVH(extraGeometry))
 {
     log_trace("%s", __PRETTY_FUNCTION__);
 
@@ -49,10 +51,65 @@ I3ShadowedPhotonRemover::~I3ShadowedPhotonRemover()
 }
 
 
+void I3ShadowedPhotonRemover::AppendPathSegments(const I3Photon &photon,
+                                                 std::vector<I3Position> &segmentStarts,
+                                                 std::vector<I3Position> &segmentEnds)
+{
+    // The position list starts with the emission point and ends with
+    // the detection point. Scattering points in between are only
+    // available if they have been recorded (there are NULL entries
+    // otherwise).
+    const uint32_t numEntries = photon.GetNumPositionListEntries();
+    
+    I3PositionConstPtr previous;
+    for (uint32_t i=0;i<numEntries;++i)
+    {
+        I3PositionConstPtr current = photon.GetPositionListEntry(i);
+        
+        if ((previous) && (current)) {
+            segmentStarts.push_back(*previous);
+            segmentEnds.push_back(*current);
+        }
+        
+        previous = current;
+    }
+}
 
 bool I3ShadowedPhotonRemover::IsPhotonShadowed(const I3Photon &photon) const
 {
-
+    std::vector<I3Position> segmentStarts;
+    std::vector<I3Position> segmentEnds;
+    AppendPathSegments(photon, segmentStarts, segmentEnds);
+    
+    for (std::size_t i=0;i<segmentStarts.size();++i)
+    {
+        if (bvh_->DoesLineIntersect(segmentStarts[i], segmentEnds[i])) return true;
+    }
     
     return false;
 }
+
+void I3ShadowedPhotonRemover::FindShadowedPhotons(const I3PhotonSeries &photons,
+                                                  std::vector<bool> &isShadowed) const
+{
+    isShadowed.assign(photons.size(), false);
+    
+    // collect the segments of all photons and query them in one go
+    std::vector<I3Position> segmentStarts;
+    std::vector<I3Position> segmentEnds;
+    std::vector<std::size_t> segmentPhoton;
+    
+    for (std::size_t i=0;i<photons.size();++i)
+    {
+        AppendPathSegments(photons[i], segmentStarts, segmentEnds);
+        segmentPhoton.resize(segmentStarts.size(), i);
+    }
+    
+    std::vector<bool> segmentIsShadowed;
+    bvh_->DoLinesIntersect(segmentStarts, segmentEnds, segmentIsShadowed);
+    
+    for (std::size_t i=0;i<segmentIsShadowed.size();++i)
+    {
+        if (segmentIsShadowed[i]) isShadowed[segmentPhoton[i]]=true;
+    }
+}
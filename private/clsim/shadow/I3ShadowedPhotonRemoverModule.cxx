@@ -42,9 +42,6 @@
 // The module
 I3_MODULE(I3ShadowedPhotonRemoverModule);
 
-/**
- * This module is not ready for use yet.
- */
 I3ShadowedPhotonRemoverModule::I3ShadowedPhotonRemoverModule(const I3Context& context) 
 : I3ConditionalModule(context)
 {
@@ -58,6 +55,13 @@ I3ShadowedPhotonRemoverModule::I3ShadowedPhotonRemoverModule(const I3Context& co
                  "Name of the output I3PhotonSeriesMap frame object.",
                  outputPhotonSeriesMapName_);
 
+    extraGeometry_=I3ExtraGeometryItemConstPtr();
+    AddParameter("ExtraGeometry",
+                 "An I3ExtraGeometryItem (usually a union of cylinders) describing\n"
+                 "cables and other objects shadowing the DOMs. Photons with paths\n"
+                 "intersecting any of them will be removed.",
+                 extraGeometry_);
+
     // add an outbox
     AddOutBox("OutBox");
 
@@ -75,9 +79,12 @@ void I3ShadowedPhotonRemoverModule::Configure()
 
     GetParameter("InputPhotonSeriesMapName", inputPhotonSeriesMapName_);
     GetParameter("OutputPhotonSeriesMapName", outputPhotonSeriesMapName_);
+    GetParameter("ExtraGeometry", extraGeometry_);
+
+    if (!extraGeometry_) log_fatal("You have to specify the \"ExtraGeometry\" parameter!");
 
     // set up the worker class
-    shadowedPhotonRemover_ = I3ShadowedPhotonRemoverPtr(new I3ShadowedPhotonRemover());
+    shadowedPhotonRemover_ = I3ShadowedPhotonRemoverPtr(new I3ShadowedPhotonRemover(extraGeometry_));
 
 }
 
@@ -95,6 +102,8 @@ void I3ShadowedPhotonRemoverModule::DAQ(I3FramePtr frame)
     // allocate the output hitSeriesMap
     I3PhotonSeriesMapPtr outputPhotonSeriesMap(new I3PhotonSeriesMap());
     
+    std::vector<bool> isShadowed;
+    
     BOOST_FOREACH(const I3PhotonSeriesMap::value_type &it, *inputPhotonSeriesMap)
     {
         const ModuleKey &key = it.first;
@@ -112,20 +121,18 @@ void I3ShadowedPhotonRemoverModule::DAQ(I3FramePtr frame)
         // photons per OM.
         I3PhotonSeries *out_photons = NULL;
 
-        BOOST_FOREACH(const I3Photon &photon, photons)
-        {
-            
-            I3Photon out_photon = photon;
-            const bool isShadowed = 
-            shadowedPhotonRemover_->IsPhotonShadowed(out_photon);
+        // check all photons of this OM at once
+        shadowedPhotonRemover_->FindShadowedPhotons(photons, isShadowed);
 
-            if (isShadowed) continue;
+        for (std::size_t i=0;i<photons.size();++i)
+        {
+            if (isShadowed[i]) continue;
 
             // allocate the output vector if not already done
             if (!out_photons) out_photons = &(outputPhotonSeriesMap->insert(std::make_pair(key, I3PhotonSeries())).first->second);
 
             // add a new copy of the input photon to the output list
-            out_photons->push_back(out_photon);
+            out_photons->push_back(photons[i]);
         }
         
         
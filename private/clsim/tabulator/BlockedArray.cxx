@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) 2015
+ * Jakob van Santen <jvansanten@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file BlockedArray.cxx
+ * @version $LastChangedRevision$
+ * @date $Date$
+ * @author Jakob van Santen
+ */
+
+#include "clsim/tabulator/BlockedArray.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace clsim {
+
+namespace tabulator {
+
+BlockedArray::BlockedArray(size_t size, size_t blockSize)
+    : size_(size), blockSize_(blockSize)
+{
+	if (blockSize_ == 0)
+		throw std::invalid_argument("Block size must be > 0");
+	blocks_.resize((size_ + blockSize_ - 1)/blockSize_);
+}
+
+size_t
+BlockedArray::GetBlockLength(size_t i) const
+{
+	return std::min(blockSize_, size_ - i*blockSize_);
+}
+
+size_t
+BlockedArray::GetNAllocatedBlocks() const
+{
+	size_t n = 0;
+	for (size_t i = 0; i < blocks_.size(); i++)
+		if (!blocks_[i].empty())
+			n++;
+	return n;
+}
+
+void
+BlockedArray::Add(size_t offset, const float *values, size_t count)
+{
+	if (offset + count > size_)
+		throw std::out_of_range("Range exceeds the size of the array");
+	
+	while (count > 0) {
+		const size_t blockIndex = offset/blockSize_;
+		const size_t start = offset % blockSize_;
+		const size_t n = std::min(count, GetBlockLength(blockIndex) - start);
+		
+		std::vector<float> &block = blocks_[blockIndex];
+		for (size_t i = 0; i < n; i++) {
+			if (values[i] == 0.f)
+				continue;
+			if (block.empty())
+				block.resize(GetBlockLength(blockIndex), 0.f);
+			block[start+i] += values[i];
+		}
+		
+		offset += n;
+		values += n;
+		count -= n;
+	}
+}
+
+void
+BlockedArray::Scale(size_t offset, size_t count, float factor)
+{
+	if (offset + count > size_)
+		throw std::out_of_range("Range exceeds the size of the array");
+	
+	while (count > 0) {
+		const size_t blockIndex = offset/blockSize_;
+		const size_t start = offset % blockSize_;
+		const size_t n = std::min(count, GetBlockLength(blockIndex) - start);
+		
+		std::vector<float> &block = blocks_[blockIndex];
+		if (!block.empty()) {
+			for (size_t i = start; i < start+n; i++)
+				block[i] *= factor;
+		}
+		
+		offset += n;
+		count -= n;
+	}
+}
+
+void
+BlockedArray::Clear()
+{
+	for (size_t i = 0; i < blocks_.size(); i++)
+		std::vector<float>().swap(blocks_[i]);
+}
+
+}
+
+}
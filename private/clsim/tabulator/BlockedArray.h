@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2015
+ * Jakob van Santen <jvansanten@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file BlockedArray.h
+ * @version $LastChangedRevision$
+ * @date $Date$
+ * @author Jakob van Santen
+ */
+
+#ifndef CLSIM_TABULATOR_BLOCKEDARRAY_H_INCLUDED
+#define CLSIM_TABULATOR_BLOCKEDARRAY_H_INCLUDED
+
+#include <vector>
+#include <cstddef>
+
+namespace clsim {
+
+namespace tabulator {
+
+/// A flat array of floats that is split into fixed-size blocks. Blocks
+/// are only allocated once a non-zero value is added to them, so the
+/// memory used by a mostly empty table scales with the number of
+/// occupied blocks rather than with its nominal size. Unallocated
+/// blocks read as zero.
+class BlockedArray {
+public:
+	BlockedArray(size_t size=0, size_t blockSize=4096);
+	
+	/// Number of elements in the (dense) array
+	size_t size() const { return size_; }
+	
+	size_t GetBlockSize() const { return blockSize_; }
+	size_t GetNBlocks() const { return blocks_.size(); }
+	/// Number of blocks that are currently allocated
+	size_t GetNAllocatedBlocks() const;
+	
+	/// Pointer to the contents of block i, or NULL if it was never filled.
+	/// The last block may be shorter than the block size.
+	const float* GetBlock(size_t i) const
+	{ return blocks_[i].empty() ? NULL : &blocks_[i][0]; }
+	/// Number of elements in block i
+	size_t GetBlockLength(size_t i) const;
+	
+	float Get(size_t index) const
+	{
+		const std::vector<float> &block = blocks_[index/blockSize_];
+		return block.empty() ? 0.f : block[index % blockSize_];
+	}
+	
+	void Add(size_t index, float value)
+	{
+		std::vector<float> &block = blocks_[index/blockSize_];
+		if (block.empty()) {
+			if (value == 0.f)
+				return;
+			block.resize(GetBlockLength(index/blockSize_), 0.f);
+		}
+		block[index % blockSize_] += value;
+	}
+	
+	/// Add a dense range of values starting at offset. Blocks that would
+	/// only receive zeros stay unallocated.
+	void Add(size_t offset, const float *values, size_t count);
+	
+	/// Multiply the elements [offset, offset+count) by factor
+	void Scale(size_t offset, size_t count, float factor);
+	
+	/// Release all blocks
+	void Clear();
+	
+private:
+	size_t size_, blockSize_;
+	std::vector<std::vector<float> > blocks_;
+};
+
+}
+
+}
+
+#endif // CLSIM_TABULATOR_BLOCKEDARRAY_H_INCLUDED
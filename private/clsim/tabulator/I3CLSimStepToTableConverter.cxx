@@ -38,9 +38,6 @@
 #include "clsim/I3CLSimHelperToFloatString.h"
 #include "clsim/cl.hpp"
 
-#include <fitsio.h>
-#include <fitsio2.h>
-
 #include <boost/foreach.hpp>
 #include <boost/make_shared.hpp>
 
@@ -122,10 +119,14 @@ I3CLSimStepToTableConverter::I3CLSimStepToTableConverter(I3CLSimOpenCLDevice dev
     I3CLSimMediumPropertiesConstPtr mediumProperties, I3CLSimSpectrumTableConstPtr spectrumTable,
     double referenceArea,
     I3CLSimFunctionConstPtr wavelengthAcceptance, I3CLSimFunctionConstPtr angularAcceptance,
-    I3RandomServicePtr rng) : entriesPerStream_(entriesPerStream), stepQueue_(1), run_(true),
+    I3RandomServicePtr rng, bool accumulateOnDevice) : entriesPerStream_(entriesPerStream),
+    accumulateOnDevice_(accumulateOnDevice), stepQueue_(4), heldOffset_(0), run_(true),
+    finished_(false),
     domArea_(referenceArea), stepLength_(1.), axes_(axes),
-    numPhotons_(0), sumOfPhotonWeights_(0.)
+    table_(*axes, storeSquaredWeights)
 {
+	checkpoint_.pending = false;
+	
 	std::vector<I3CLSimRandomValueConstPtr> wavelengthGenerators;
 	
 	wavelengthGenerators.push_back(I3CLSimModuleHelper::makeCherenkovWavelengthGenerator
@@ -183,7 +184,13 @@ I3CLSimStepToTableConverter::I3CLSimStepToTableConverter(I3CLSimOpenCLDevice dev
 	;
 	if (axes_->GetNDim() > 4)
 		preamble << "#define TABULATE_IMPACT_ANGLE\n";
-	preamble << "#define TABLE_ENTRIES_PER_STREAM " << entriesPerStream_ << "\n";
+	if (accumulateOnDevice_) {
+		preamble << "#define TABULATE_ACCUMULATE\n";
+		if (storeSquaredWeights)
+			preamble << "#define TABULATE_SQUARED_WEIGHTS\n";
+	} else {
+		preamble << "#define TABLE_ENTRIES_PER_STREAM " << entriesPerStream_ << "\n";
+	}
 	preamble << "#define VOLUME_MODE_STEP "<<I3CLSimHelper::ToFloatString(stepLength_)<<"\n";
 	minimumRefractiveIndex_ = GetMinimumRefractiveIndex(*mediumProperties);
 	
@@ -201,12 +208,13 @@ I3CLSimStepToTableConverter::I3CLSimStepToTableConverter(I3CLSimOpenCLDevice dev
 	sources.push_back(angularAcceptance->GetOpenCLFunction("getAngularAcceptance"));
 	
 	sources.push_back(loadKernel("propagation_kernel", true));
+	sources.push_back(loadKernel("medium_propagation", true));
 	sources.push_back(axes_->GenerateBinningCode());
+	sources.push_back(loadKernel("medium_propagation", false));
 	sources.push_back(loadKernel("propagation_kernel", false));
 	
-	binContent_.resize(axes_->GetNBins(), 0);
-	if (storeSquaredWeights)
-		squaredWeights_.resize(axes->GetNBins(), 0);
+	table_.SetNormalization(stepLength_, domArea_, spectralBiasFactor_,
+	    minimumRefractiveIndex_.first, minimumRefractiveIndex_.second);
 	
 #ifndef NDEBUG
 	std::stringstream source;
@@ -253,10 +261,19 @@ I3CLSimStepToTableConverter::I3CLSimStepToTableConverter(I3CLSimOpenCLDevice dev
 		
 		cl::Kernel kernel(program, "propKernel");
 		
-		maxNumWorkitems_ = std::min(kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device), size_t(1));
+		maxNumWorkitems_ = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+		// the entry buffers grow with the number of work items
+		if (!accumulateOnDevice_)
+			maxNumWorkitems_ = std::min(maxNumWorkitems_, size_t(1));
 		log_debug_stream("max work group size " << maxNumWorkitems_);
 		log_debug_stream(device.getInfo<CL_DEVICE_NAME>() << " max memory "<<device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>());
 		
+		if (accumulateOnDevice_ && (axes_->GetNBins()*sizeof(float) > device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>()))
+			log_fatal_stream("The table has " << axes_->GetNBins() << " bins, which is more than "
+			    << device.getInfo<CL_DEVICE_NAME>() << " can allocate in a single buffer ("
+			    << device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() << " bytes). "
+			    "Disable on-device accumulation for this table.");
+		
 		harvesterThread_ = boost::thread(boost::bind(&I3CLSimStepToTableConverter::FetchSteps, this, kernel, rng));
 	}
 	
@@ -272,10 +289,8 @@ I3CLSimStepToTableConverter::EnqueueSteps(I3CLSimStepSeriesConstPtr steps, I3Par
 {
 	if (!steps)
 		return;
-	BOOST_FOREACH(const I3CLSimStep &step, *steps) {
-		numPhotons_ += step.GetNumPhotons();
-		sumOfPhotonWeights_ += step.GetNumPhotons()*step.GetWeight();
-	}
+	if (!run_)
+		log_fatal("Steps enqueued after Finish()");
 	
 	stepQueue_.Put(bunch_t(steps, reference));
 }
@@ -286,6 +301,11 @@ I3CLSimStepToTableConverter::Finish()
 	if (harvesterThread_.joinable()) {
 		run_ = false;
 		log_debug("Finish");
+		// the harvester exits once it gets here, i.e. after binning
+		// everything enqueued before
+		bunch_t finish;
+		finish.finish = true;
+		stepQueue_.Put(finish);
 		harvesterThread_.join();
 	}
 }
@@ -296,17 +316,26 @@ struct DeviceBuffers {
 	DeviceBuffers() {};
 	DeviceBuffers(cl::Context, I3RandomServicePtr, size_t streams,
 	    size_t entriesPerStream);
+	DeviceBuffers(cl::Context, cl::CommandQueue, I3RandomServicePtr, size_t streams,
+	    size_t nBins, bool storeSquaredWeights);
 	struct {
 		cl::Buffer x, a;
 	} mwc; 
 	cl::Buffer inputSteps;
 	cl::Buffer referenceSource;
+	// entry-list mode
 	cl::Buffer outputEntries;
 	cl::Buffer numEntries;
+	// on-device accumulation
+	cl::Buffer binContent;
+	cl::Buffer squaredWeights;
+private:
+	void Init(cl::Context, I3RandomServicePtr, size_t streams);
 };
 
-DeviceBuffers::DeviceBuffers(cl::Context context,
-    I3RandomServicePtr rng, size_t streams, size_t entriesPerStream)
+void
+DeviceBuffers::Init(cl::Context context,
+    I3RandomServicePtr rng, size_t streams)
 {
 	std::vector<uint64_t> xv(streams);
 	std::vector<uint32_t> av(streams);
@@ -322,7 +351,13 @@ DeviceBuffers::DeviceBuffers(cl::Context context,
 	inputSteps = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
 	    streams*sizeof(I3CLSimStep));
 	referenceSource = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
-	    sizeof(I3CLSimReferenceParticle));
+	    streams*sizeof(I3CLSimReferenceParticle));
+}
+
+DeviceBuffers::DeviceBuffers(cl::Context context,
+    I3RandomServicePtr rng, size_t streams, size_t entriesPerStream)
+{
+	Init(context, rng, streams);
 	try {
 	outputEntries = cl::Buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
 	    streams*entriesPerStream*sizeof(I3CLSimTableEntry));
@@ -335,6 +370,46 @@ DeviceBuffers::DeviceBuffers(cl::Context context,
 
 }
 
+DeviceBuffers::DeviceBuffers(cl::Context context, cl::CommandQueue queue,
+    I3RandomServicePtr rng, size_t streams, size_t nBins, bool storeSquaredWeights)
+{
+	Init(context, rng, streams);
+	try {
+	binContent = cl::Buffer(context, CL_MEM_READ_WRITE, nBins*sizeof(float));
+	queue.enqueueFillBuffer<float>(binContent, 0.f, 0, nBins*sizeof(float));
+	if (storeSquaredWeights) {
+		squaredWeights = cl::Buffer(context, CL_MEM_READ_WRITE, nBins*sizeof(float));
+		queue.enqueueFillBuffer<float>(squaredWeights, 0.f, 0, nBins*sizeof(float));
+	}
+	queue.finish();
+	} catch (cl::Error &err) {
+		log_error_stream(err.what() << " " << err.errstr());
+		throw;
+	}
+}
+
+/*
+ * Add the contents of a device-side histogram to the host table. This is
+ * done in chunks so that there is never a dense copy of the table on the
+ * host. If reset is set, the device histogram is zeroed afterwards.
+ */
+void DownloadTable(cl::CommandQueue &queue, cl::Buffer &buffer,
+    clsim::tabulator::BlockedArray &table, bool reset)
+{
+	const size_t chunkSize = 256*table.GetBlockSize();
+	std::vector<float> chunk(std::min(chunkSize, table.size()));
+	for (size_t offset = 0; offset < table.size(); offset += chunkSize) {
+		const size_t n = std::min(chunkSize, table.size()-offset);
+		queue.enqueueReadBuffer(buffer, CL_TRUE,
+		    offset*sizeof(float), n*sizeof(float), &chunk[0]);
+		table.Add(offset, &chunk[0], n);
+	}
+	if (reset) {
+		queue.enqueueFillBuffer<float>(buffer, 0.f, 0, table.size()*sizeof(float));
+		queue.finish();
+	}
+}
+
 struct KernelStatistics {
 	
 	KernelStatistics() : last_timestamp_(boost::posix_time::microsec_clock::universal_time()),
@@ -384,6 +459,10 @@ struct KernelStatistics {
 void
 I3CLSimStepToTableConverter::FetchSteps(cl::Kernel kernel, I3RandomServicePtr rng)
 {
+	if (accumulateOnDevice_) {
+		AccumulateSteps(kernel, rng);
+		return;
+	}
 	
 	DeviceBuffers buffers(context_, rng, maxNumWorkitems_, entriesPerStream_);
 
@@ -396,46 +475,54 @@ I3CLSimStepToTableConverter::FetchSteps(cl::Kernel kernel, I3RandomServicePtr rn
 	kernel.setArg(args++, buffers.mwc.x);
 	kernel.setArg(args++, buffers.mwc.a);
 	
+	clsim::tabulator::BlockedArray &binContent = table_.GetBinContent();
+	clsim::tabulator::BlockedArray &squaredWeights = table_.GetSquaredWeights();
+	
 	I3CLSimStepSeries osteps(maxNumWorkitems_);
 	std::vector<uint32_t> numEntries(maxNumWorkitems_);
 	std::vector<I3CLSimTableEntry> tableEntries(maxNumWorkitems_*entriesPerStream_);
 	
 	KernelStatistics stats;
 	
-	bunch_t bunch;
+	// steps that ran out of space in the last launch go first
+	I3CLSimStepSeries steps;
+	std::vector<I3ParticleConstPtr> references;
+	std::vector<I3CLSimReferenceParticle> refs;
+	bool control = false;
 	while (1) {
 	
-		// Work on either the remainder of the last bunch or the next bunch
-		// in the queue
-		if (!bunch.first && !stepQueue_.GetNonBlocking(bunch)) {
-			if (run_) {
-				continue;
-			} else {
+		if (!control)
+			control = GatherSteps(steps, references);
+		if (steps.empty()) {
+			references.clear();
+			// everything dequeued so far is binned, so the table is consistent
+			if (CheckpointRequested())
+				CompleteCheckpoint();
+			control = false;
+			if (finished_)
 				return;
-			}
+			else
+				continue;
 		}
 		
 		size_t n_photons = 0;
-		size_t real_steps = 0;
-		BOOST_FOREACH(const I3CLSimStep &step, *bunch.first) {
-			if (step.GetNumPhotons() > 0) {
-				n_photons += step.GetNumPhotons();
-				real_steps++;
-			}
-		}
+		BOOST_FOREACH(const I3CLSimStep &step, steps)
+			n_photons += step.GetNumPhotons();
 		
 		VECTOR_CLASS<cl::Event> buffersFilled(3);
 		VECTOR_CLASS<cl::Event> kernelFinished(1);
 		VECTOR_CLASS<cl::Event> buffersRead(3);
 		
-		const size_t items = bunch.first->size();
+		const size_t items = steps.size();
 		assert(items <= maxNumWorkitems_);
 		commandQueue_.enqueueWriteBuffer(buffers.inputSteps, CL_FALSE, 0,
-		    items*sizeof(I3CLSimStep), &(*bunch.first)[0], NULL, &buffersFilled[0]);
+		    items*sizeof(I3CLSimStep), &steps[0], NULL, &buffersFilled[0]);
 		
-		I3CLSimReferenceParticle ref(*bunch.second);
+		refs.clear();
+		BOOST_FOREACH(const I3ParticleConstPtr &reference, references)
+			refs.push_back(I3CLSimReferenceParticle(*reference));
 		commandQueue_.enqueueWriteBuffer(buffers.referenceSource, CL_FALSE, 0,
-		    sizeof(I3CLSimReferenceParticle), &ref, NULL, &buffersFilled[1]);
+		    refs.size()*sizeof(I3CLSimReferenceParticle), &refs[0], NULL, &buffersFilled[1]);
 		
 		commandQueue_.enqueueFillBuffer<uint32_t>(buffers.numEntries, 0u /*pattern*/,
 		    0 /*offset*/, items*sizeof(uint32_t) /*size*/, NULL, &buffersFilled[2]);
@@ -443,7 +530,7 @@ I3CLSimStepToTableConverter::FetchSteps(cl::Kernel kernel, I3RandomServicePtr rn
 		
 		try {
 		commandQueue_.enqueueNDRangeKernel(kernel, cl::NullRange,
-		    cl::NDRange(items), cl::NDRange(maxNumWorkitems_),
+		    cl::NDRange(items), cl::NullRange,
 		    &buffersFilled, &kernelFinished[0]);
 		} catch (cl::Error &err) {
 			log_error_stream(err.what() << " " << err.errstr());
@@ -461,223 +548,235 @@ I3CLSimStepToTableConverter::FetchSteps(cl::Kernel kernel, I3RandomServicePtr rn
 	
 		cl::Event::waitForEvents(buffersRead);
 		
-		I3CLSimStepSeriesPtr rsteps;
-		size_t misses = 0;
+		// If any steps ran out of space, carry them over to the next
+		// launch along with the reference particles they need
+		std::vector<I3ParticleConstPtr> rreferences;
+		std::vector<int> slot(references.size(), -1);
+		steps.clear();
 		for (size_t i = 0; i < items; i++) {
-			// If any steps ran out of space, return them to the work list
 			if (osteps[i].GetNumPhotons() > 0) {
 				log_trace_stream(osteps[i].GetNumPhotons() << " left");
-				if (!rsteps)
-					rsteps = I3CLSimStepSeriesPtr(new I3CLSimStepSeries);
-				rsteps->push_back(osteps[i]);
+				const uint32_t id = osteps[i].GetID();
+				if (slot[id] < 0) {
+					slot[id] = rreferences.size();
+					rreferences.push_back(references[id]);
+				}
+				steps.push_back(osteps[i]);
+				steps.back().SetID(slot[id]);
 				n_photons -= osteps[i].GetNumPhotons();
-				misses++;
 			}
 		}
-		
-		if (rsteps && rsteps->size() > 0) {
-			assert(rsteps->size() <= maxNumWorkitems_);
-			// Pad out to workgroup size
-			I3CLSimStep dummy = rsteps->front();
-			dummy.SetNumPhotons(0);
-			while (rsteps->size() < maxNumWorkitems_)
-				rsteps->push_back(dummy);
-			bunch.first = rsteps;
-		} else {
-			// No steps ran out of space; reset the work list.
-			bunch.first.reset();
-		}
-		
+		const size_t misses = steps.size();
+		references.swap(rreferences);
 
 		for (size_t i = 0; i < items; i++) {
 			size_t size = numEntries[i];
 			size_t offset = i*entriesPerStream_;
 			for (size_t j = 0; j < size; j++) {
-				binContent_[tableEntries[offset+j].index] += tableEntries[offset+j].weight;
+				binContent.Add(tableEntries[offset+j].index, tableEntries[offset+j].weight);
 			}
-			if (squaredWeights_.size() > 0) {
+			if (table_.HasSquaredWeights()) {
 				for (size_t j = 0; j < size; j++) {
-					squaredWeights_[tableEntries[offset+j].index] += std::pow(tableEntries[offset+j].weight, 2);
+					squaredWeights.Add(tableEntries[offset+j].index, std::pow(tableEntries[offset+j].weight, 2));
 				}
 			}
 		}
 		
-		stats.Record(kernelFinished[0], n_photons, real_steps, misses);
+		stats.Record(kernelFinished[0], n_photons, items, misses);
 	} // while (1)
 }
 
 void
-I3CLSimStepToTableConverter::Normalize()
+I3CLSimStepToTableConverter::AccumulateSteps(cl::Kernel kernel, I3RandomServicePtr rng)
 {
-	const unsigned ndim = axes_->GetNDim();
-	const std::vector<size_t> shape = axes_->GetShape();
-	const std::vector<size_t> strides = axes_->GetStrides();
-	std::vector<size_t> idxs(ndim, 0);
-
-	// NB: assume that the first 3 dimensions are spatial
-	const size_t spatial_stride = strides[2];
-	for (size_t offset = 0; offset < binContent_.size(); offset += spatial_stride) {
-		// unravel index
-		for (unsigned j=0; j < ndim; j++) {
-			// each dimension has an under- and an overflow bin.
-			idxs[j] = std::min(std::max(int(offset/strides[j] % shape[j])-1, 0), int(shape[j]-3));
-			assert(idxs[j] < shape[j]-2);
+	// The histogram lives on the device for the entire run. The kernel
+	// bins directly into it, so steps can never run out of space and
+	// nothing has to be read back until a checkpoint or the end.
+	const bool storeSquaredWeights = table_.HasSquaredWeights();
+	DeviceBuffers buffers(context_, commandQueue_, rng, maxNumWorkitems_,
+	    axes_->GetNBins(), storeSquaredWeights);
+	
+	uint args = 0;
+	kernel.setArg(args++, buffers.inputSteps);
+	kernel.setArg(args++, buffers.referenceSource);
+	kernel.setArg(args++, buffers.binContent);
+	if (storeSquaredWeights)
+		kernel.setArg(args++, buffers.squaredWeights);
+	kernel.setArg(args++, buffers.mwc.x);
+	kernel.setArg(args++, buffers.mwc.a);
+	
+	KernelStatistics stats;
+	
+	I3CLSimStepSeries steps;
+	std::vector<I3ParticleConstPtr> references;
+	std::vector<I3CLSimReferenceParticle> refs;
+	while (1) {
+		const bool control = GatherSteps(steps, references);
+		
+		if (!steps.empty()) {
+			size_t n_photons = 0;
+			BOOST_FOREACH(const I3CLSimStep &step, steps)
+				n_photons += step.GetNumPhotons();
+			
+			VECTOR_CLASS<cl::Event> buffersFilled(2);
+			VECTOR_CLASS<cl::Event> kernelFinished(1);
+			
+			const size_t items = steps.size();
+			assert(items <= maxNumWorkitems_);
+			commandQueue_.enqueueWriteBuffer(buffers.inputSteps, CL_FALSE, 0,
+			    items*sizeof(I3CLSimStep), &steps[0], NULL, &buffersFilled[0]);
+			
+			refs.clear();
+			BOOST_FOREACH(const I3ParticleConstPtr &reference, references)
+				refs.push_back(I3CLSimReferenceParticle(*reference));
+			commandQueue_.enqueueWriteBuffer(buffers.referenceSource, CL_FALSE, 0,
+			    refs.size()*sizeof(I3CLSimReferenceParticle), &refs[0], NULL, &buffersFilled[1]);
+			commandQueue_.flush();
+			
+			try {
+			commandQueue_.enqueueNDRangeKernel(kernel, cl::NullRange,
+			    cl::NDRange(items), cl::NullRange,
+			    &buffersFilled, &kernelFinished[0]);
+			} catch (cl::Error &err) {
+				log_error_stream(err.what() << " " << err.errstr());
+				throw;
+			}
+			commandQueue_.flush();
+			
+			// the host copies of the steps and reference particles are
+			// reused for the next launch
+			cl::Event::waitForEvents(kernelFinished);
+			
+			stats.Record(kernelFinished[0], n_photons, items, 0);
+			steps.clear();
+			references.clear();
 		}
-		assert(idxs[ndim-1] == 0);
 		
-		// apply volume normalization to each spatial cell
-		double norm = axes_->GetBinVolume(idxs)/(stepLength_*domArea_);
-		for (size_t i=0; i < spatial_stride; i++)
-			binContent_[i+offset] /= norm;
-		// apply to squared weights as well if needed
-		if (squaredWeights_.size() > 0) {
-			norm *= norm;
-			for (size_t i=0; i < spatial_stride; i++)
-				squaredWeights_[i+offset] /= norm;
+		if (control) {
+			if (CheckpointRequested()) {
+				// move everything binned so far over to the host
+				DownloadTable(commandQueue_, buffers.binContent, table_.GetBinContent(), true);
+				if (storeSquaredWeights)
+					DownloadTable(commandQueue_, buffers.squaredWeights, table_.GetSquaredWeights(), true);
+				CompleteCheckpoint();
+			}
+			if (finished_)
+				break;
 		}
 	}
+	
+	// download the accumulated histogram once
+	DownloadTable(commandQueue_, buffers.binContent, table_.GetBinContent(), false);
+	if (storeSquaredWeights)
+		DownloadTable(commandQueue_, buffers.squaredWeights, table_.GetSquaredWeights(), false);
 }
 
-namespace {
+void
+I3CLSimStepToTableConverter::CountPhotons(const I3CLSimStepSeries &steps)
+{
+	uint64_t numPhotons = 0;
+	double sumOfPhotonWeights = 0.;
+	BOOST_FOREACH(const I3CLSimStep &step, steps) {
+		numPhotons += step.GetNumPhotons();
+		sumOfPhotonWeights += step.GetNumPhotons()*step.GetWeight();
+	}
+	table_.AddPhotons(numPhotons, sumOfPhotonWeights);
+}
 
-std::string error_text(int error)
+bool
+I3CLSimStepToTableConverter::GatherSteps(I3CLSimStepSeries &steps,
+    std::vector<I3ParticleConstPtr> &references)
 {
-	std::string text(30, '\0');
-	if (error != 0) {
-		fits_get_errstatus(error, &text[0]);
+	while (steps.size() < maxNumWorkitems_) {
+		if (!heldBunch_.steps) {
+			// Wait for the first bunch, but launch whatever is
+			// already gathered rather than waiting for more
+			if (steps.empty())
+				heldBunch_ = stepQueue_.Get();
+			else if (!stepQueue_.GetNonBlocking(heldBunch_))
+				break;
+			if (!heldBunch_.steps) {
+				if (heldBunch_.finish)
+					finished_ = true;
+				return true;
+			}
+			CountPhotons(*heldBunch_.steps);
+			heldOffset_ = 0;
+		}
+		
+		// only take a reference slot if a step of this bunch is
+		// actually launched (bunches may consist of padding only)
+		uint32_t id = 0;
+		bool haveReference = false;
+		
+		const I3CLSimStepSeries &bunch = *heldBunch_.steps;
+		for ( ; heldOffset_ < bunch.size() && steps.size() < maxNumWorkitems_; heldOffset_++) {
+			// skip padding
+			if (bunch[heldOffset_].GetNumPhotons() == 0)
+				continue;
+			if (!haveReference) {
+				id = references.size();
+				references.push_back(heldBunch_.reference);
+				haveReference = true;
+			}
+			steps.push_back(bunch[heldOffset_]);
+			steps.back().SetID(id);
+		}
+		if (heldOffset_ == bunch.size())
+			heldBunch_ = bunch_t();
 	}
 	
-	return text;
+	return false;
 }
 
-/*
- * Create the bin content array with transposed axis
- * counts, like PyFITS does.
- */
-void create_image(fitsfile *fits, std::vector<size_t> &shape, std::string name=std::string())
+void
+I3CLSimStepToTableConverter::SetTableHeader(boost::python::dict tableHeader)
 {
-	int error(0);
-	std::vector<long> naxes(shape.size());
-	std::reverse_copy(shape.begin(), shape.end(), naxes.begin());
-	fits_create_img(fits, FLOAT_IMG, shape.size(), &naxes[0], &error);
-	if (error != 0) {
-		log_fatal_stream("Could not create image: " << error_text(error));
-	}
-	if (name.size() > 0) {
-		fits_write_key(fits, TSTRING, "EXTNAME", (void*)(name.c_str()),
-		    NULL, &error);
-	}
-	if (error != 0) {
-		log_fatal_stream("Could name HDU "<<name<<": " << error_text(error));
-	}
+	table_.SetHeader(tableHeader);
 }
 
-void write_pixels(fitsfile *fits, std::vector<size_t> &shape,
-    std::vector<float> &pixels)
+void
+I3CLSimStepToTableConverter::WriteCheckpoint(const std::string &path)
 {
-	int error(0);
-	std::vector<long> fpixel(shape.size(), 1);
-	fits_write_pix(fits, TFLOAT, &fpixel[0], pixels.size(),
-	    &pixels[0], &error);
-	if (error != 0) {
-		log_fatal_stream("Could not fill image: " << error_text(error));
+	{
+		boost::unique_lock<boost::mutex> lock(checkpoint_.mutex);
+		if (!harvesterThread_.joinable()) {
+			// nothing is running that could change the table
+			table_.WriteCheckpoint(path);
+			return;
+		}
+		checkpoint_.path = path;
+		checkpoint_.pending = true;
 	}
+	
+	// wake the harvester if it is waiting for steps
+	stepQueue_.Put(bunch_t());
+	
+	boost::unique_lock<boost::mutex> lock(checkpoint_.mutex);
+	while (checkpoint_.pending)
+		checkpoint_.cv.wait(lock);
 }
 
+bool
+I3CLSimStepToTableConverter::CheckpointRequested()
+{
+	boost::unique_lock<boost::mutex> lock(checkpoint_.mutex);
+	return checkpoint_.pending;
 }
 
+void
+I3CLSimStepToTableConverter::CompleteCheckpoint()
+{
+	boost::unique_lock<boost::mutex> lock(checkpoint_.mutex);
+	table_.WriteCheckpoint(checkpoint_.path);
+	log_debug_stream("Wrote checkpoint " << checkpoint_.path << " ("
+	    << table_.GetNumPhotons() << " photons)");
+	checkpoint_.pending = false;
+	checkpoint_.cv.notify_all();
+}
 
 void I3CLSimStepToTableConverter::WriteFITSFile(const std::string &path, boost::python::dict tableHeader)
 {
-	fitsfile *fits;
-	int error = 0;
-
-	fits_create_diskfile(&fits, path.c_str(), &error);
-	if (error != 0) {
-		log_fatal_stream("Could not create " << path << ": " << error_text(error));
-	}
-	
-	/*
-	 * Write bin content
-	 */
-	this->Normalize();
-	{
-		std::vector<size_t> shape(axes_->GetShape());
-		create_image(fits, shape);
-		write_pixels(fits, shape, binContent_);
-	}
-	
-	// Fill in things that only we know
-	tableHeader["n_photons"] = spectralBiasFactor_*sumOfPhotonWeights_;
-	tableHeader["n_group"] = minimumRefractiveIndex_.first;
-	tableHeader["n_phase"] = minimumRefractiveIndex_.second;
-	// Write header keywords
-	{
-		namespace bp = boost::python;
-
-		bp::list keys = tableHeader.keys();
-		for (int i = 0; i < bp::len(keys); i++) {
-			bp::object key = keys[i];
-			bp::object value = tableHeader[key];
-			
-			std::ostringstream name;
-			name << "hierarch _i3_" << bp::extract<std::string>(key)();
-			
-			bp::extract<int> inty(value);
-			bp::extract<double> doubly(value);
-			if (inty.check()) {
-				int v = inty();
-				fits_write_key(fits, TINT, name.str().c_str(), &v,
-				    NULL, &error);
-			} else if (doubly.check()) {
-				double v = doubly();
-				fits_write_key(fits, TDOUBLE, name.str().c_str(), &v,
-				    NULL, &error);
-			}
-			if (error != 0) {
-				log_fatal_stream("Could not write header keyword "<<name.str()<<": " << error_text(error));
-			}
-		}
-	}
-	
-	/*
-	 * Write squared weights
-	 */
-	if (squaredWeights_.size() > 0) {
-		std::vector<size_t> shape(axes_->GetShape());
-		create_image(fits, shape, "ERRORS");
-		write_pixels(fits, shape, squaredWeights_);
-	}
-	
-	/*
-	 * Write each of the bin edge vectors in an extension HDU
-	 */
-	for (unsigned i = 0; i < axes_->GetNDim(); i++) {
-		std::ostringstream name;
-		name << "EDGES" << i;
-		long fpixel = 1;
-		std::vector<double> edges = axes_->at(i)->GetBinEdges();
-		long size = edges.size();
-		
-		fits_create_img(fits, DOUBLE_IMG, 1, &size, &error);
-		if (error != 0) {
-			log_fatal_stream("Could not create edge array "<<i<<": " << error_text(error));
-		}
-		fits_write_key(fits, TSTRING, "EXTNAME", (void*)(name.str().c_str()),
-		    NULL, &error);
-		if (error != 0) {
-			log_fatal_stream("Could not name HDU "<<name.str()<<": " << error_text(error));
-		}
-		
-		fits_write_pix(fits, TDOUBLE, &fpixel, size,
-		    &edges[0], &error);
-		if (error != 0) {
-			log_fatal_stream("Could not write edge array "<<i<<": " << error_text(error));
-		}
-	}
-	
-	fits_close_file(fits, &error);
-	if (error != 0) {
-		log_fatal_stream("Could not close " << path << ": " << error_text(error));
-	}
+	table_.SetHeader(tableHeader);
+	table_.WriteFITSFile(path);
 }
@@ -36,10 +36,13 @@
 #include "dataclasses/physics/I3Particle.h"
 
 #include "clsim/tabulator/Axes.h"
+#include "clsim/tabulator/RawTable.h"
 
 #define __CL_ENABLE_EXCEPTIONS
 #include "clsim/cl.hpp"
 
+#include <atomic>
+
 #include <boost/noncopyable.hpp>
 #include <boost/thread.hpp>
 
@@ -53,30 +56,71 @@ public:
 	    double referenceArea,
 	    I3CLSimFunctionConstPtr wavelengthAcceptance,
 	    I3CLSimFunctionConstPtr angularAcceptance,
-	    I3RandomServicePtr rng);
+	    I3RandomServicePtr rng,
+	    bool accumulateOnDevice=false);
 	virtual ~I3CLSimStepToTableConverter();
 	void EnqueueSteps(I3CLSimStepSeriesConstPtr, I3ParticleConstPtr);
 	void Finish();
 	
 	size_t GetBunchSize() const { return maxNumWorkitems_; }
 	
+	/// Set the keywords to store in checkpoints and the FITS header.
+	/// Must be called before the first call to EnqueueSteps().
+	void SetTableHeader(boost::python::dict tableHeader);
+	
+	/// Write the unnormalized table and photon counts for all steps
+	/// that have been processed so far. Blocks until the file has been
+	/// written.
+	void WriteCheckpoint(const std::string &fname);
+	
+	/// Write the normalized table. Call Finish() first.
 	void WriteFITSFile(const std::string &fname,
 	    boost::python::dict tableHeader);
 private:
 	
 	void FetchSteps(cl::Kernel, I3RandomServicePtr);
+	void AccumulateSteps(cl::Kernel, I3RandomServicePtr);
 	
-	float GetBinVolume(size_t i);
-	void Normalize();
+	/// Fill steps up to the launch size from the queue, blocking only while
+	/// there is nothing to launch. Each step's identifier is set to the index
+	/// of its source in references. Returns true if a control message (a
+	/// bunch without steps) was dequeued.
+	bool GatherSteps(I3CLSimStepSeries &steps,
+	    std::vector<I3ParticleConstPtr> &references);
+	
+	void CountPhotons(const I3CLSimStepSeries &);
+	bool CheckpointRequested();
+	void CompleteCheckpoint();
 	
 	cl::Context context_;
 	cl::CommandQueue commandQueue_;
 	size_t maxWorkgroupSize_, maxNumWorkitems_, entriesPerStream_;
+	/// keep the histogram in device memory and bin there, rather than
+	/// downloading the individual entries after every bunch
+	bool accumulateOnDevice_;
 	
-	typedef std::pair<I3CLSimStepSeriesConstPtr, I3ParticleConstPtr> bunch_t;
+	/// Steps and their reference particle. Bunches without steps are
+	/// control messages that wake the harvester, e.g. for a checkpoint.
+	/// The one with finish set is sent by Finish() after all steps.
+	struct bunch_t {
+		bunch_t() : finish(false) {}
+		bunch_t(I3CLSimStepSeriesConstPtr s, I3ParticleConstPtr r)
+		    : steps(s), reference(r), finish(false) {}
+		
+		I3CLSimStepSeriesConstPtr steps;
+		I3ParticleConstPtr reference;
+		bool finish;
+	};
 	I3CLSimQueue<bunch_t> stepQueue_;
+	/// a bunch that did not fit into the last launch, and the first of its
+	/// steps that has not been launched yet
+	bunch_t heldBunch_;
+	size_t heldOffset_;
 	boost::thread harvesterThread_;
-	bool run_;
+	/// cleared by Finish(), no steps may be enqueued after that
+	std::atomic<bool> run_;
+	/// set by the harvester once it has dequeued the finish message
+	bool finished_;
 	
 	double domArea_;
 	double stepLength_;
@@ -84,11 +128,17 @@ private:
 	std::pair<double, double> minimumRefractiveIndex_;
 	
 	clsim::tabulator::AxesConstPtr axes_;
-	std::vector<float> binContent_;
-	std::vector<float> squaredWeights_;
-	// double rather than an integer because steps have weights
-	uint64_t numPhotons_;
-	double sumOfPhotonWeights_;
+	/// bin contents and photon counts, only filled by the harvester thread
+	clsim::tabulator::RawTable table_;
+	
+	/// checkpoint requests are handled by the harvester thread between bunches
+	struct {
+		boost::mutex mutex;
+		boost::condition_variable cv;
+		std::string path;
+		bool pending;
+	} checkpoint_;
+	
 	/// number of Photonics photons represented by each clsim photon
 	double spectralBiasFactor_;
 	
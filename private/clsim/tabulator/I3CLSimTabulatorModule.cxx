@@ -32,7 +32,7 @@
 #include "clsim/I3CLSimLightSourceParameterization.h"
 #include "clsim/I3CLSimMediumProperties.h"
 #include "clsim/I3CLSimSpectrumTable.h"
-#include "clsim/I3CLSimLightSourceToStepConverter.h"
+#include "clsim/I3CLSimLightSourceToStepConverterGeant4.h"
 #include "clsim/function/I3CLSimFunction.h"
 #include "clsim/I3CLSimModuleHelper.h"
 #include "clsim/tabulator/I3CLSimStepToTableConverter.h"
@@ -71,21 +71,28 @@ private:
 	double referenceArea_;
 	size_t photonsPerBunch_, entriesPerPhoton_;
 	bool recordErrors_;
+	bool accumulateOnDevice_;
 	
-	I3CLSimLightSourceToStepConverterPtr particleToStepsConverter_;
+	I3CLSimLightSourceToStepConverterGeant4Ptr particleToStepsConverter_;
 	boost::scoped_ptr<I3CLSimStepToTableConverter> tabulator_;
 	
 	std::string tablePath_;
+	std::string checkpointPath_;
+	unsigned checkpointInterval_;
+	uint64_t numFrames_;
 	boost::python::dict tableHeader_;
 	clsim::tabulator::AxesPtr axes_;
 	
 	boost::thread stepHarvester_;
+	// Reference sources of the frames whose steps are still being
+	// generated, by light source identifier. Each frame is followed by a
+	// flush marker, and its entry is removed once the marker comes out
+	// of Geant4.
 	struct {
 		boost::mutex mutex;
-		boost::condition_variable cv;
-	} semaphore;
-	I3CLSimQueue<I3ParticleConstPtr> sourceQueue_;
-	bool run_;
+		std::map<uint32_t, I3ParticleConstPtr> sources;
+	} references_;
+	uint32_t nextIdentifier_;
 	
 	SET_LOGGER("I3CLSimTabulatorModule");
 };
@@ -93,7 +100,7 @@ private:
 I3_MODULE(I3CLSimTabulatorModule);
 
 I3CLSimTabulatorModule::I3CLSimTabulatorModule(const I3Context &ctx)
-    : I3Module(ctx), run_(true)
+    : I3Module(ctx), numFrames_(0), nextIdentifier_(0)
 {
 	AddOutBox("OutBox");
 	
@@ -111,7 +118,14 @@ I3CLSimTabulatorModule::I3CLSimTabulatorModule(const I3Context &ctx)
 	AddParameter("EntriesPerPhoton", "", 3000);
 	AddParameter("Filename", "", "");
 	AddParameter("RecordErrors", "", false);
+	AddParameter("AccumulateOnDevice", "Keep the table in device memory and fill it there "
+	    "instead of downloading individual entries (EntriesPerPhoton is ignored)", false);
 	AddParameter("TableHeader", "", boost::python::dict());
+	AddParameter("CheckpointFilename", "Write the unnormalized table to this file "
+	    "periodically and at the end. Checkpoints can be merged with "
+	    "clsim.tabulator.RawTable. The file must not exist yet.", "");
+	AddParameter("CheckpointInterval", "Write a checkpoint every this many "
+	    "frames (0 to only write one at the end)", 0u);
 	AddParameter("Axes", "", axes_);
 }
 
@@ -131,19 +145,37 @@ void I3CLSimTabulatorModule::Configure()
 	GetParameter("EntriesPerPhoton", entriesPerPhoton_);
 	GetParameter("Filename", tablePath_);
 	GetParameter("RecordErrors", recordErrors_);
+	GetParameter("AccumulateOnDevice", accumulateOnDevice_);
 	GetParameter("TableHeader", tableHeader_);
+	GetParameter("CheckpointFilename", checkpointPath_);
+	GetParameter("CheckpointInterval", checkpointInterval_);
 	GetParameter("Axes", axes_);
 	
-	if (tablePath_.empty())
+	if (tablePath_.empty() && checkpointPath_.empty())
 		log_fatal("You must specify an output filename!");
-	else if (fs::exists(tablePath_))
-		log_fatal_stream(tablePath_ << " already exists!");
-	try {
-		std::ofstream f(tablePath_.c_str());
-	} catch (...) {
-		log_fatal_stream("Could not open " << tablePath_ << " for writing");
+	if (!tablePath_.empty()) {
+		if (fs::exists(tablePath_))
+			log_fatal_stream(tablePath_ << " already exists!");
+		try {
+			std::ofstream f(tablePath_.c_str());
+		} catch (...) {
+			log_fatal_stream("Could not open " << tablePath_ << " for writing");
+		}
+		fs::remove(tablePath_);
+	}
+	if (!checkpointPath_.empty()) {
+		// never overwrite a checkpoint of an earlier job
+		if (fs::exists(checkpointPath_))
+			log_fatal_stream(checkpointPath_ << " already exists!");
+		try {
+			std::ofstream f(checkpointPath_.c_str());
+		} catch (...) {
+			log_fatal_stream("Could not open " << checkpointPath_ << " for writing");
+		}
+		fs::remove(checkpointPath_);
 	}
-	fs::remove(tablePath_);
+	if (checkpointInterval_ > 0 && checkpointPath_.empty())
+		log_fatal("CheckpointInterval is set, but there is no CheckpointFilename");
 	
 	if (openCLDeviceList_.size() == 0)
 		log_fatal_stream("No OpenCL devices provided. Does your OpenCL runtime support CPUs?");
@@ -153,7 +185,9 @@ void I3CLSimTabulatorModule::Configure()
 	    openCLDeviceList_[0], axes_, entriesPerPhoton_*photonsPerBunch_,
 	    recordErrors_,
 	    mediumProperties_, spectrumTable_, referenceArea_,
-	    wavelengthGenerationBias_, angularAcceptance_, randomService_));
+	    wavelengthGenerationBias_, angularAcceptance_, randomService_,
+	    accumulateOnDevice_));
+	tabulator_->SetTableHeader(tableHeader_);
 	
 	particleToStepsConverter_ =
 	    I3CLSimModuleHelper::initializeGeant4(randomService_,
@@ -196,7 +230,6 @@ namespace {
 void I3CLSimTabulatorModule::Finish()
 {
 	log_trace("finish called");
-	run_ = false;
 	if (!particleToStepsConverter_->BarrierActive())
 		particleToStepsConverter_->EnqueueBarrier();
 	{
@@ -206,7 +239,10 @@ void I3CLSimTabulatorModule::Finish()
 		tabulator_->Finish();
 	}
 	
-	tabulator_->WriteFITSFile(tablePath_, tableHeader_);
+	if (!checkpointPath_.empty())
+		tabulator_->WriteCheckpoint(checkpointPath_);
+	if (!tablePath_.empty())
+		tabulator_->WriteFITSFile(tablePath_, tableHeader_);
 }
 
 I3CLSimTabulatorModule::~I3CLSimTabulatorModule()
@@ -217,30 +253,53 @@ I3CLSimTabulatorModule::~I3CLSimTabulatorModule()
 /// Harvest steps and feed them to the tabulator
 void I3CLSimTabulatorModule::HarvestSteps()
 {
-	// Get the first reference source. This will block until something is
-	// added to the queue.
-	I3ParticleConstPtr reference = sourceQueue_.Get();
 	for (;;) {
 		I3CLSimStepSeriesConstPtr steps;
 		bool barrierWasJustReset=false;
-		steps = particleToStepsConverter_->GetConversionResultWithBarrierInfo(barrierWasJustReset);
+		bool flushMarkerWasReached=false;
+		steps = particleToStepsConverter_->GetConversionResultWithFlushInfo(barrierWasJustReset, flushMarkerWasReached);
 		
 		if (steps && !steps->empty()) {
-			// Do stuff
-			tabulator_->EnqueueSteps(I3CLSimStepSeriesPtr(new I3CLSimStepSeries(*steps)), reference);
-			log_trace_stream("enqueued " << steps->size() << " steps");
+			// A bunch may contain steps from more than one frame. Split it
+			// up, since each bunch is binned relative to a single source.
+			// Padding steps (without photons) are dropped.
+			std::map<uint32_t, I3CLSimStepSeriesPtr> bunches;
+			BOOST_FOREACH(const I3CLSimStep &step, *steps) {
+				if (step.GetNumPhotons() == 0)
+					continue;
+				I3CLSimStepSeriesPtr &bunch = bunches[step.GetID()];
+				if (!bunch)
+					bunch = boost::make_shared<I3CLSimStepSeries>();
+				bunch->push_back(step);
+			}
+			
+			typedef std::map<uint32_t, I3CLSimStepSeriesPtr>::value_type bunch_pair;
+			BOOST_FOREACH(const bunch_pair &bunch, bunches) {
+				I3ParticleConstPtr reference;
+				{
+					boost::unique_lock<boost::mutex> lock(references_.mutex);
+					std::map<uint32_t, I3ParticleConstPtr>::const_iterator it =
+					    references_.sources.find(bunch.first);
+					if (it == references_.sources.end())
+						log_fatal_stream("Got steps for unknown light source " << bunch.first);
+					reference = it->second;
+				}
+				tabulator_->EnqueueSteps(bunch.second, reference);
+				log_trace_stream("enqueued " << bunch.second->size() << " steps");
+			}
+		}
+		
+		if (flushMarkerWasReached) {
+			// the oldest frame is done
+			boost::unique_lock<boost::mutex> lock(references_.mutex);
+			if (references_.sources.empty())
+				log_fatal("Flush marker reached, but no frame is being processed");
+			references_.sources.erase(references_.sources.begin());
 		}
 		
 		if (barrierWasJustReset) {
-			if (!run_) {
-				log_trace("Exiting on barrier");
-				return;
-			} else {
-				// Signal main thread to continue
-				semaphore.cv.notify_one();
-				// Get the reference source for the next frame
-				reference = sourceQueue_.Get();
-			}
+			log_trace("Exiting on barrier");
+			return;
 		}
 	}
 	
@@ -254,30 +313,45 @@ void I3CLSimTabulatorModule::DAQ(I3FramePtr frame)
 	if (!reference)
 		log_fatal("Frame does not contain an I3Particle 'ReferenceParticle'!");
 	
+	// Frames are not waited for. Their light sources carry the frame's
+	// identifier, and steps are matched to the reference source with it.
+	const uint32_t identifier = nextIdentifier_++;
 	{
-		// Release the Python interpreter lock
-		ScopedGILRelease release;
-		// Wait for steps from the previous event to be consumed
-		boost::unique_lock<boost::mutex> lock(semaphore.mutex);
-		while (particleToStepsConverter_->BarrierActive())
-			semaphore.cv.wait(lock);
+		// Store a copy to ensure that the deleter does not invoke the Python interpreter
+		boost::unique_lock<boost::mutex> lock(references_.mutex);
+		references_.sources[identifier] = I3ParticlePtr(new I3Particle(*reference));
 	}
 	
-	// Enqueue a copy to ensure that the deleter does not invoke the Python interpreter
-	sourceQueue_.Put(I3ParticlePtr(new I3Particle(*reference)));
-	if ((mctree = frame->Get<I3MCTreeConstPtr>(mctreeName_))) {
-		BOOST_FOREACH(const I3Particle &p, *mctree) {
-			if (p.GetShape() != I3Particle::Dark && p.GetLocationType() == I3Particle::InIce)
-				particleToStepsConverter_->EnqueueLightSource(I3CLSimLightSource(p), 0);
+	mctree = frame->Get<I3MCTreeConstPtr>(mctreeName_);
+	flashers = frame->Get<I3CLSimFlasherPulseSeriesConstPtr>(flasherPulseSeriesName_);
+	{
+		// Release the Python interpreter lock, enqueueing blocks
+		// while Geant4 is busy
+		ScopedGILRelease release;
+		
+		if (mctree) {
+			BOOST_FOREACH(const I3Particle &p, *mctree) {
+				if (p.GetShape() != I3Particle::Dark && p.GetLocationType() == I3Particle::InIce)
+					particleToStepsConverter_->EnqueueLightSource(I3CLSimLightSource(p), identifier);
+			}
 		}
-	}
-	if ((flashers = frame->Get<I3CLSimFlasherPulseSeriesConstPtr>(flasherPulseSeriesName_))) {
-		BOOST_FOREACH(const I3CLSimFlasherPulse &p, *flashers) {
-			particleToStepsConverter_->EnqueueLightSource(I3CLSimLightSource(p), 0);
-			log_trace_stream("enqueued a pulse of "<<p.GetNumberOfPhotonsNoBias()<<" photons");
+		if (flashers) {
+			BOOST_FOREACH(const I3CLSimFlasherPulse &p, *flashers) {
+				particleToStepsConverter_->EnqueueLightSource(I3CLSimLightSource(p), identifier);
+				log_trace_stream("enqueued a pulse of "<<p.GetNumberOfPhotonsNoBias()<<" photons");
+			}
 		}
+		
+		particleToStepsConverter_->EnqueueFlushMarker();
+	}
+	
+	numFrames_++;
+	if (checkpointInterval_ > 0 && numFrames_ % checkpointInterval_ == 0) {
+		// Only steps that have already been binned are included. Their
+		// photons are counted when they are binned, so the checkpoint is
+		// consistent.
+		ScopedGILRelease release;
+		tabulator_->WriteCheckpoint(checkpointPath_);
 	}
-
-	particleToStepsConverter_->EnqueueBarrier();
 }
 
@@ -0,0 +1,557 @@
+/**
+ * Copyright (c) 2015
+ * Jakob van Santen <jvansanten@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file RawTable.cxx
+ * @version $LastChangedRevision$
+ * @date $Date$
+ * @author Jakob van Santen
+ */
+
+#include "clsim/tabulator/RawTable.h"
+
+#include "icetray/I3Logging.h"
+
+#include <fitsio.h>
+#include <fitsio2.h>
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include <boost/python.hpp>
+
+/*
+ * Checkpoint layout (native byte order, everything is written as-is):
+ *
+ *  char[8]   magic "CLSIMTAB"
+ *  uint32    format version
+ *  uint32    number of dimensions N
+ *  uint64[N] shape, including under- and overflow bins
+ *  for each dimension: uint64 number of edges, double[] edges
+ *  uint64    number of spatial cells, double[] cell volumes
+ *  double    step length, reference area, spectral bias factor, n_group, n_phase
+ *  uint64    number of photons
+ *  double    sum of photon weights
+ *  uint32    number of int header keys, then (uint32 length, char[], int32)
+ *  uint32    number of float header keys, then (uint32 length, char[], double)
+ *  uint8     1 if squared weights follow
+ *  blocks of the bin content [and squared weights]:
+ *    uint64  block size, uint64 number of stored blocks
+ *    for each stored block: uint64 block index, float[] contents
+ */
+
+namespace clsim {
+
+namespace tabulator {
+
+namespace {
+
+const char checkpointMagic[8] = {'C','L','S','I','M','T','A','B'};
+const uint32_t checkpointVersion = 1;
+
+template <typename T>
+void write_value(std::ostream &out, const T &value)
+{
+	out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+void write_vector(std::ostream &out, const std::vector<T> &values)
+{
+	write_value<uint64_t>(out, values.size());
+	if (!values.empty())
+		out.write(reinterpret_cast<const char*>(&values[0]), values.size()*sizeof(T));
+}
+
+void write_string(std::ostream &out, const std::string &value)
+{
+	write_value<uint32_t>(out, value.size());
+	out.write(value.data(), value.size());
+}
+
+void write_blocks(std::ostream &out, const BlockedArray &array)
+{
+	write_value<uint64_t>(out, array.GetBlockSize());
+	write_value<uint64_t>(out, array.GetNAllocatedBlocks());
+	for (size_t i = 0; i < array.GetNBlocks(); i++) {
+		const float *block = array.GetBlock(i);
+		if (!block)
+			continue;
+		write_value<uint64_t>(out, i);
+		out.write(reinterpret_cast<const char*>(block), array.GetBlockLength(i)*sizeof(float));
+	}
+}
+
+template <typename T>
+T read_value(std::istream &in, const std::string &path)
+{
+	T value;
+	in.read(reinterpret_cast<char*>(&value), sizeof(T));
+	if (!in)
+		log_fatal_stream(path << " is truncated");
+	return value;
+}
+
+template <typename T>
+std::vector<T> read_vector(std::istream &in, const std::string &path)
+{
+	std::vector<T> values(read_value<uint64_t>(in, path));
+	if (!values.empty())
+		in.read(reinterpret_cast<char*>(&values[0]), values.size()*sizeof(T));
+	if (!in)
+		log_fatal_stream(path << " is truncated");
+	return values;
+}
+
+std::string read_string(std::istream &in, const std::string &path)
+{
+	std::string value(read_value<uint32_t>(in, path), '\0');
+	if (!value.empty())
+		in.read(&value[0], value.size());
+	if (!in)
+		log_fatal_stream(path << " is truncated");
+	return value;
+}
+
+}
+
+RawTable::RawTable(const Axes &axes, bool storeSquaredWeights)
+    : shape_(axes.GetShape()), binContent_(axes.GetNBins()),
+    numPhotons_(0), sumOfPhotonWeights_(0.),
+    stepLength_(0.), referenceArea_(0.), spectralBiasFactor_(0.),
+    nGroup_(0.), nPhase_(0.), normalized_(false)
+{
+	if (storeSquaredWeights)
+		squaredWeights_ = BlockedArray(axes.GetNBins());
+	
+	for (unsigned i = 0; i < axes.GetNDim(); i++)
+		binEdges_.push_back(axes.at(i)->GetBinEdges());
+	
+	// NB: assume that the first 3 dimensions are spatial
+	const unsigned ndim = axes.GetNDim();
+	const std::vector<size_t> strides = axes.GetStrides();
+	const size_t spatial_stride = strides[2];
+	std::vector<size_t> idxs(ndim, 0);
+	for (size_t offset = 0; offset < axes.GetNBins(); offset += spatial_stride) {
+		// unravel index
+		for (unsigned j=0; j < ndim; j++) {
+			// each dimension has an under- and an overflow bin.
+			idxs[j] = std::min(std::max(int(offset/strides[j] % shape_[j])-1, 0), int(shape_[j]-3));
+			assert(idxs[j] < shape_[j]-2);
+		}
+		assert(idxs[ndim-1] == 0);
+		cellVolumes_.push_back(axes.GetBinVolume(idxs));
+	}
+}
+
+RawTable::RawTable(const std::string &path)
+    : numPhotons_(0), sumOfPhotonWeights_(0.),
+    stepLength_(0.), referenceArea_(0.), spectralBiasFactor_(0.),
+    nGroup_(0.), nPhase_(0.), normalized_(false)
+{
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in)
+		log_fatal_stream("Could not open " << path);
+	
+	ReadHeader(in, path, true);
+	ReadBlocks(in, path, binContent_);
+	if (HasSquaredWeights())
+		ReadBlocks(in, path, squaredWeights_);
+}
+
+void
+RawTable::SetNormalization(double stepLength, double referenceArea,
+    double spectralBiasFactor, double nGroup, double nPhase)
+{
+	stepLength_ = stepLength;
+	referenceArea_ = referenceArea;
+	spectralBiasFactor_ = spectralBiasFactor;
+	nGroup_ = nGroup;
+	nPhase_ = nPhase;
+}
+
+void
+RawTable::SetHeader(boost::python::dict header)
+{
+	namespace bp = boost::python;
+	
+	intKeys_.clear();
+	floatKeys_.clear();
+	
+	bp::list keys = header.keys();
+	for (int i = 0; i < bp::len(keys); i++) {
+		bp::object value = header[keys[i]];
+		std::string key = bp::extract<std::string>(keys[i]);
+		
+		bp::extract<int> inty(value);
+		bp::extract<double> doubly(value);
+		if (inty.check())
+			intKeys_[key] = inty();
+		else if (doubly.check())
+			floatKeys_[key] = doubly();
+	}
+}
+
+boost::python::dict
+RawTable::GetHeader() const
+{
+	boost::python::dict header;
+	for (std::map<std::string, int>::const_iterator it = intKeys_.begin(); it != intKeys_.end(); it++)
+		header[it->first] = it->second;
+	for (std::map<std::string, double>::const_iterator it = floatKeys_.begin(); it != floatKeys_.end(); it++)
+		header[it->first] = it->second;
+	
+	return header;
+}
+
+void
+RawTable::WriteCheckpoint(const std::string &path) const
+{
+	if (normalized_)
+		log_fatal("The table has already been normalized");
+	
+	const std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out)
+			log_fatal_stream("Could not open " << tmpPath << " for writing");
+		
+		out.write(checkpointMagic, sizeof(checkpointMagic));
+		write_value<uint32_t>(out, checkpointVersion);
+		write_value<uint32_t>(out, shape_.size());
+		for (size_t i = 0; i < shape_.size(); i++)
+			write_value<uint64_t>(out, shape_[i]);
+		for (size_t i = 0; i < binEdges_.size(); i++)
+			write_vector(out, binEdges_[i]);
+		write_vector(out, cellVolumes_);
+		
+		write_value(out, stepLength_);
+		write_value(out, referenceArea_);
+		write_value(out, spectralBiasFactor_);
+		write_value(out, nGroup_);
+		write_value(out, nPhase_);
+		write_value(out, numPhotons_);
+		write_value(out, sumOfPhotonWeights_);
+		
+		write_value<uint32_t>(out, intKeys_.size());
+		for (std::map<std::string, int>::const_iterator it = intKeys_.begin(); it != intKeys_.end(); it++) {
+			write_string(out, it->first);
+			write_value<int32_t>(out, it->second);
+		}
+		write_value<uint32_t>(out, floatKeys_.size());
+		for (std::map<std::string, double>::const_iterator it = floatKeys_.begin(); it != floatKeys_.end(); it++) {
+			write_string(out, it->first);
+			write_value<double>(out, it->second);
+		}
+		
+		write_value<uint8_t>(out, HasSquaredWeights());
+		write_blocks(out, binContent_);
+		if (HasSquaredWeights())
+			write_blocks(out, squaredWeights_);
+		
+		out.flush();
+		if (!out)
+			log_fatal_stream("Could not write " << tmpPath);
+	}
+	
+	if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+		log_fatal_stream("Could not move " << tmpPath << " to " << path);
+}
+
+void
+RawTable::ReadHeader(std::istream &in, const std::string &path, bool adopt)
+{
+	char magic[sizeof(checkpointMagic)];
+	in.read(magic, sizeof(magic));
+	if (!in || std::memcmp(magic, checkpointMagic, sizeof(magic)) != 0)
+		log_fatal_stream(path << " is not a table checkpoint");
+	uint32_t version = read_value<uint32_t>(in, path);
+	if (version != checkpointVersion)
+		log_fatal_stream(path << " has checkpoint format version " << version
+		    << ", but only version " << checkpointVersion << " is supported");
+	
+	std::vector<size_t> shape(read_value<uint32_t>(in, path));
+	for (size_t i = 0; i < shape.size(); i++)
+		shape[i] = read_value<uint64_t>(in, path);
+	std::vector<std::vector<double> > binEdges;
+	for (size_t i = 0; i < shape.size(); i++)
+		binEdges.push_back(read_vector<double>(in, path));
+	std::vector<double> cellVolumes = read_vector<double>(in, path);
+	
+	double normalization[5];
+	for (unsigned i = 0; i < 5; i++)
+		normalization[i] = read_value<double>(in, path);
+	uint64_t numPhotons = read_value<uint64_t>(in, path);
+	double sumOfPhotonWeights = read_value<double>(in, path);
+	
+	std::map<std::string, int> intKeys;
+	for (uint32_t i = read_value<uint32_t>(in, path); i > 0; i--) {
+		std::string key = read_string(in, path);
+		intKeys[key] = read_value<int32_t>(in, path);
+	}
+	std::map<std::string, double> floatKeys;
+	for (uint32_t i = read_value<uint32_t>(in, path); i > 0; i--) {
+		std::string key = read_string(in, path);
+		floatKeys[key] = read_value<double>(in, path);
+	}
+	const bool hasSquaredWeights = read_value<uint8_t>(in, path);
+	
+	if (adopt) {
+		size_t nBins = 1;
+		for (size_t i = 0; i < shape.size(); i++)
+			nBins *= shape[i];
+		shape_ = shape;
+		binEdges_ = binEdges;
+		cellVolumes_ = cellVolumes;
+		binContent_ = BlockedArray(nBins);
+		if (hasSquaredWeights)
+			squaredWeights_ = BlockedArray(nBins);
+		SetNormalization(normalization[0], normalization[1],
+		    normalization[2], normalization[3], normalization[4]);
+		intKeys_ = intKeys;
+		floatKeys_ = floatKeys;
+	} else {
+		// The tables have to describe the same thing to be summed
+		if (shape != shape_ || binEdges != binEdges_)
+			log_fatal_stream(path << " has a different binning");
+		if (hasSquaredWeights != HasSquaredWeights())
+			log_fatal_stream(path << (hasSquaredWeights ? " has" : " does not have")
+			    << " squared weights, but the table" << (HasSquaredWeights() ? " has" : " does not have"));
+		if (normalization[0] != stepLength_ || normalization[1] != referenceArea_ ||
+		    normalization[2] != spectralBiasFactor_ || normalization[3] != nGroup_ ||
+		    normalization[4] != nPhase_)
+			log_fatal_stream(path << " was made with a different step length, "
+			    "receiver area, acceptance or medium");
+	}
+	
+	AddPhotons(numPhotons, sumOfPhotonWeights);
+}
+
+void
+RawTable::ReadBlocks(std::istream &in, const std::string &path, BlockedArray &array)
+{
+	const uint64_t blockSize = read_value<uint64_t>(in, path);
+	const uint64_t nBlocks = read_value<uint64_t>(in, path);
+	if (blockSize == 0)
+		log_fatal_stream(path << " is corrupt");
+	
+	std::vector<float> buffer(blockSize);
+	for (uint64_t i = 0; i < nBlocks; i++) {
+		const uint64_t offset = read_value<uint64_t>(in, path)*blockSize;
+		if (offset >= array.size())
+			log_fatal_stream(path << " is corrupt");
+		const size_t n = std::min<uint64_t>(blockSize, array.size()-offset);
+		in.read(reinterpret_cast<char*>(&buffer[0]), n*sizeof(float));
+		if (!in)
+			log_fatal_stream(path << " is truncated");
+		array.Add(offset, &buffer[0], n);
+	}
+}
+
+void
+RawTable::MergeCheckpoint(const std::string &path)
+{
+	if (normalized_)
+		log_fatal("The table has already been normalized");
+	
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in)
+		log_fatal_stream("Could not open " << path);
+	
+	ReadHeader(in, path, false);
+	ReadBlocks(in, path, binContent_);
+	if (HasSquaredWeights())
+		ReadBlocks(in, path, squaredWeights_);
+}
+
+void
+RawTable::Normalize()
+{
+	const size_t spatial_stride = binContent_.size()/cellVolumes_.size();
+	for (size_t i = 0; i < cellVolumes_.size(); i++) {
+		// apply volume normalization to each spatial cell
+		double norm = cellVolumes_[i]/(stepLength_*referenceArea_);
+		binContent_.Scale(i*spatial_stride, spatial_stride, 1./norm);
+		// apply to squared weights as well if needed
+		if (HasSquaredWeights()) {
+			norm *= norm;
+			squaredWeights_.Scale(i*spatial_stride, spatial_stride, 1./norm);
+		}
+	}
+	normalized_ = true;
+}
+
+namespace {
+
+std::string error_text(int error)
+{
+	std::string text(30, '\0');
+	if (error != 0) {
+		fits_get_errstatus(error, &text[0]);
+	}
+	
+	return text;
+}
+
+/*
+ * Create the bin content array with transposed axis
+ * counts, like PyFITS does.
+ */
+void create_image(fitsfile *fits, const std::vector<size_t> &shape, std::string name=std::string())
+{
+	int error(0);
+	std::vector<long> naxes(shape.size());
+	std::reverse_copy(shape.begin(), shape.end(), naxes.begin());
+	fits_create_img(fits, FLOAT_IMG, shape.size(), &naxes[0], &error);
+	if (error != 0) {
+		log_fatal_stream("Could not create image: " << error_text(error));
+	}
+	if (name.size() > 0) {
+		fits_write_key(fits, TSTRING, "EXTNAME", (void*)(name.c_str()),
+		    NULL, &error);
+	}
+	if (error != 0) {
+		log_fatal_stream("Could name HDU "<<name<<": " << error_text(error));
+	}
+}
+
+/*
+ * Write the image block by block. Empty blocks are written as zeros,
+ * so the image is dense on disk but never in memory.
+ */
+void write_pixels(fitsfile *fits, const BlockedArray &pixels)
+{
+	int error(0);
+	const std::vector<float> zeros(pixels.GetBlockSize(), 0.f);
+	for (size_t i = 0; i < pixels.GetNBlocks(); i++) {
+		const float *block = pixels.GetBlock(i);
+		fits_write_img(fits, TFLOAT, LONGLONG(i*pixels.GetBlockSize()+1),
+		    LONGLONG(pixels.GetBlockLength(i)),
+		    const_cast<float*>(block ? block : &zeros[0]), &error);
+		if (error != 0) {
+			log_fatal_stream("Could not fill image: " << error_text(error));
+		}
+	}
+}
+
+void write_key(fitsfile *fits, const std::string &key, int value)
+{
+	int error = 0;
+	std::ostringstream name;
+	name << "hierarch _i3_" << key;
+	fits_write_key(fits, TINT, name.str().c_str(), &value, NULL, &error);
+	if (error != 0) {
+		log_fatal_stream("Could not write header keyword "<<name.str()<<": " << error_text(error));
+	}
+}
+
+void write_key(fitsfile *fits, const std::string &key, double value)
+{
+	int error = 0;
+	std::ostringstream name;
+	name << "hierarch _i3_" << key;
+	fits_write_key(fits, TDOUBLE, name.str().c_str(), &value, NULL, &error);
+	if (error != 0) {
+		log_fatal_stream("Could not write header keyword "<<name.str()<<": " << error_text(error));
+	}
+}
+
+}
+
+void
+RawTable::WriteFITSFile(const std::string &path)
+{
+	if (normalized_)
+		log_fatal("The table has already been normalized");
+	
+	fitsfile *fits;
+	int error = 0;
+
+	fits_create_diskfile(&fits, path.c_str(), &error);
+	if (error != 0) {
+		log_fatal_stream("Could not create " << path << ": " << error_text(error));
+	}
+	
+	/*
+	 * Write bin content
+	 */
+	this->Normalize();
+	create_image(fits, shape_);
+	write_pixels(fits, binContent_);
+	
+	// Fill in things that only we know
+	std::map<std::string, double> floatKeys(floatKeys_);
+	floatKeys["n_photons"] = spectralBiasFactor_*sumOfPhotonWeights_;
+	floatKeys["n_group"] = nGroup_;
+	floatKeys["n_phase"] = nPhase_;
+	// Write header keywords
+	for (std::map<std::string, int>::const_iterator it = intKeys_.begin(); it != intKeys_.end(); it++) {
+		if (floatKeys.find(it->first) == floatKeys.end())
+			write_key(fits, it->first, it->second);
+	}
+	for (std::map<std::string, double>::const_iterator it = floatKeys.begin(); it != floatKeys.end(); it++)
+		write_key(fits, it->first, it->second);
+	
+	/*
+	 * Write squared weights
+	 */
+	if (HasSquaredWeights()) {
+		create_image(fits, shape_, "ERRORS");
+		write_pixels(fits, squaredWeights_);
+	}
+	
+	/*
+	 * Write each of the bin edge vectors in an extension HDU
+	 */
+	for (unsigned i = 0; i < binEdges_.size(); i++) {
+		std::ostringstream name;
+		name << "EDGES" << i;
+		long fpixel = 1;
+		std::vector<double> edges = binEdges_[i];
+		long size = edges.size();
+		
+		fits_create_img(fits, DOUBLE_IMG, 1, &size, &error);
+		if (error != 0) {
+			log_fatal_stream("Could not create edge array "<<i<<": " << error_text(error));
+		}
+		fits_write_key(fits, TSTRING, "EXTNAME", (void*)(name.str().c_str()),
+		    NULL, &error);
+		if (error != 0) {
+			log_fatal_stream("Could not name HDU "<<name.str()<<": " << error_text(error));
+		}
+		
+		fits_write_pix(fits, TDOUBLE, &fpixel, size,
+		    &edges[0], &error);
+		if (error != 0) {
+			log_fatal_stream("Could not write edge array "<<i<<": " << error_text(error));
+		}
+	}
+	
+	fits_close_file(fits, &error);
+	if (error != 0) {
+		log_fatal_stream("Could not close " << path << ": " << error_text(error));
+	}
+}
+
+}
+
+}
@@ -0,0 +1,122 @@
+/**
+ * Copyright (c) 2015
+ * Jakob van Santen <jvansanten@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file RawTable.h
+ * @version $LastChangedRevision$
+ * @date $Date$
+ * @author Jakob van Santen
+ */
+
+#ifndef CLSIM_TABULATOR_RAWTABLE_H_INCLUDED
+#define CLSIM_TABULATOR_RAWTABLE_H_INCLUDED
+
+#include "icetray/I3PointerTypedefs.h"
+#include "clsim/tabulator/Axes.h"
+#include "clsim/tabulator/BlockedArray.h"
+
+#include <vector>
+#include <string>
+#include <map>
+#include <iosfwd>
+
+#include <boost/python/dict.hpp>
+
+namespace clsim {
+
+namespace tabulator {
+
+/// The unnormalized contents of a photon table, together with everything
+/// needed to normalize it and write it out without the Axes and medium
+/// properties it was made with. RawTables can be written to and read from
+/// checkpoint files, and checkpoints of tables with the same binning can be
+/// summed. Normalization happens only once, when the FITS file is written.
+class RawTable {
+public:
+	/// Create an empty table with the binning of axes
+	RawTable(const Axes &axes, bool storeSquaredWeights);
+	/// Load a table from a checkpoint file
+	explicit RawTable(const std::string &checkpointPath);
+	
+	/// Set the constants used to normalize the table: the sampling step
+	/// length, the area of the receiver, the number of Photonics photons
+	/// represented by each photon, and the group and phase refractive
+	/// indices used to calculate time residuals
+	void SetNormalization(double stepLength, double referenceArea,
+	    double spectralBiasFactor, double nGroup, double nPhase);
+	/// Set the keywords to write into the FITS header. Only int and float
+	/// values are kept.
+	void SetHeader(boost::python::dict header);
+	boost::python::dict GetHeader() const;
+	
+	BlockedArray& GetBinContent() { return binContent_; }
+	BlockedArray& GetSquaredWeights() { return squaredWeights_; }
+	bool HasSquaredWeights() const { return squaredWeights_.size() > 0; }
+	
+	void AddPhotons(uint64_t numPhotons, double sumOfPhotonWeights)
+	{
+		numPhotons_ += numPhotons;
+		sumOfPhotonWeights_ += sumOfPhotonWeights;
+	}
+	uint64_t GetNumPhotons() const { return numPhotons_; }
+	double GetSumOfPhotonWeights() const { return sumOfPhotonWeights_; }
+	
+	/// Write the unnormalized table. The file is written under a
+	/// temporary name and then renamed, so an interrupted write never
+	/// replaces a good checkpoint.
+	void WriteCheckpoint(const std::string &path) const;
+	/// Add the contents of a checkpoint file to this table. The file is
+	/// read one block at a time.
+	void MergeCheckpoint(const std::string &path);
+	
+	/// Normalize the table and write it to a FITS file. The table can not
+	/// be checkpointed or merged afterwards.
+	void WriteFITSFile(const std::string &path);
+	
+private:
+	void ReadHeader(std::istream &, const std::string &path, bool adopt);
+	void ReadBlocks(std::istream &, const std::string &path, BlockedArray &);
+	void Normalize();
+	
+	std::vector<size_t> shape_;
+	std::vector<std::vector<double> > binEdges_;
+	/// volume of each spatial cell (the first 3 dimensions)
+	std::vector<double> cellVolumes_;
+	
+	BlockedArray binContent_;
+	BlockedArray squaredWeights_;
+	uint64_t numPhotons_;
+	double sumOfPhotonWeights_;
+	
+	double stepLength_, referenceArea_, spectralBiasFactor_;
+	double nGroup_, nPhase_;
+	
+	std::map<std::string, int> intKeys_;
+	std::map<std::string, double> floatKeys_;
+	
+	bool normalized_;
+};
+
+I3_POINTER_TYPEDEFS(RawTable);
+
+}
+
+}
+
+#endif // CLSIM_TABULATOR_RAWTABLE_H_INCLUDED
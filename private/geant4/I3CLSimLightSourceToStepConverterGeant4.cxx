@@ -241,6 +241,7 @@ void I3CLSimLightSourceToStepConverterGeant4::Initialize()
     log_debug("Starting the Geant4 thread..");
     geant4Started_=false;
     barrier_is_enqueued_=false;
+    pendingFlushIsBarrier_.clear();
 
     geant4ThreadObj_ = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&I3CLSimLightSourceToStepConverterGeant4::Geant4Thread, this)));
 
@@ -687,9 +688,13 @@ void I3CLSimLightSourceToStepConverterGeant4::Geant4Thread_impl(boost::this_thre
                     log_debug("NULL result from parameterization GetConversionResult(). ignoring.");
                 } else {
                     // add steps from the parameterization to the step store
+                    // (numbering them consecutively per photon multiplicity)
                     BOOST_FOREACH(const I3CLSimStep &step, *res)
                     {
-                        stepStore->insert_copy(step.GetNumPhotons(), step);
+                        const uint32_t serial = static_cast<uint32_t>(stepStore->num_inserted(step.GetNumPhotons()));
+                        I3CLSimStep &newStep = stepStore->insert_new(step.GetNumPhotons());
+                        newStep = step;
+                        newStep.SetSerial(serial);
                     }
                 }
                 
@@ -840,6 +845,7 @@ void I3CLSimLightSourceToStepConverterGeant4::EnqueueBarrier()
             throw I3CLSimLightSourceToStepConverter_exception("A barrier is already enqueued!");
         
         barrier_is_enqueued_=true;
+        pendingFlushIsBarrier_.push_back(true);
 
         // we use a NULL pointer as the barrier
         queueToGeant4_->Put(std::make_pair(0, I3CLSimLightSourceConstPtr()));
@@ -848,6 +854,28 @@ void I3CLSimLightSourceToStepConverterGeant4::EnqueueBarrier()
     LogGeant4Messages();
 }
 
+void I3CLSimLightSourceToStepConverterGeant4::EnqueueFlushMarker()
+{
+    LogGeant4Messages();
+
+    if (!initialized_)
+        throw I3CLSimLightSourceToStepConverter_exception("I3CLSimLightSourceToStepConverterGeant4 is not initialized!");
+
+    {
+        boost::unique_lock<boost::mutex> guard(barrier_is_enqueued_mutex_);
+        if (barrier_is_enqueued_)
+            throw I3CLSimLightSourceToStepConverter_exception("A barrier is enqueued! You must receive all steps before enqueuing a flush marker.");
+
+        pendingFlushIsBarrier_.push_back(false);
+
+        // the Geant4 thread flushes its step store for markers
+        // exactly like it does for barriers
+        queueToGeant4_->Put(std::make_pair(0, I3CLSimLightSourceConstPtr()));
+    }
+    
+    LogGeant4Messages();
+}
+
 bool I3CLSimLightSourceToStepConverterGeant4::BarrierActive() const
 {
     LogGeant4Messages();
@@ -873,6 +901,12 @@ bool I3CLSimLightSourceToStepConverterGeant4::MoreStepsAvailable() const
 }
 
 I3CLSimStepSeriesConstPtr I3CLSimLightSourceToStepConverterGeant4::GetConversionResultWithBarrierInfo(bool &barrierWasReset, double timeout)
+{
+    bool flushMarkerWasReached;
+    return GetConversionResultWithFlushInfo(barrierWasReset, flushMarkerWasReached, timeout);
+}
+
+I3CLSimStepSeriesConstPtr I3CLSimLightSourceToStepConverterGeant4::GetConversionResultWithFlushInfo(bool &barrierWasReset, bool &flushMarkerWasReached, double timeout)
 {
     LogGeant4Messages();
 
@@ -880,6 +914,7 @@ I3CLSimStepSeriesConstPtr I3CLSimLightSourceToStepConverterGeant4::GetConversion
         throw I3CLSimLightSourceToStepConverter_exception("I3CLSimLightSourceToStepConverterGeant4 is not initialized!");
 
     barrierWasReset=false;
+    flushMarkerWasReached=false;
     
     FromGeant4Pair_t ret;
     if (!std::isnan(timeout))
@@ -891,10 +926,22 @@ I3CLSimStepSeriesConstPtr I3CLSimLightSourceToStepConverterGeant4::GetConversion
     {
         {
             boost::unique_lock<boost::mutex> guard(barrier_is_enqueued_mutex_);
-            if (!barrier_is_enqueued_)
+            if (pendingFlushIsBarrier_.empty())
+            {
                 log_error("Internal logic error. Barrier is not set as enqueued, yet a finalization message was received.");
-            barrierWasReset=true;
-            barrier_is_enqueued_=false;
+            }
+            else
+            {
+                const bool isBarrier = pendingFlushIsBarrier_.front();
+                pendingFlushIsBarrier_.pop_front();
+                
+                if (isBarrier) {
+                    barrierWasReset=true;
+                    barrier_is_enqueued_=false;
+                } else {
+                    flushMarkerWasReached=true;
+                }
+            }
         }
     }
     
@@ -212,6 +212,7 @@ TrkCerenkov::PostStepDoIt(const G4Track& aTrack, const G4Step& aStep)
 
     {
         // insert a new step
+        const uint32_t serial = static_cast<uint32_t>(stepStore->num_inserted(NumPhotons));
         I3CLSimStep &newStep = stepStore->insert_new(NumPhotons); // insert @ NumPhotons
     
         // set all values
@@ -227,6 +228,7 @@ TrkCerenkov::PostStepDoIt(const G4Track& aTrack, const G4Step& aStep)
         newStep.SetBeta(beta);
         newStep.SetID(eventInformation->currentExternalParticleID);
         newStep.SetSourceType(0); // cherenkov emission
+        newStep.SetSerial(serial);
     }
     
     // if the store size is large enough, flush some events to the external queue
@@ -0,0 +1,76 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimHelperCompactPhotons.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#include "opencl/I3CLSimHelperCompactPhotons.h"
+#include "opencl/ieeehalfprecision.h"
+
+#include <limits>
+
+namespace I3CLSimHelper
+{
+    void DecodeCompactPhotons(const std::vector<I3CLSimCompactPhoton> &compactPhotons,
+                              const std::vector<std::vector<I3Position> > &domPositionsPerStringIndex,
+                              I3CLSimPhotonSeries &photons)
+    {
+        photons.resize(compactPhotons.size());
+        
+        for (std::size_t i=0;i<compactPhotons.size();++i)
+        {
+            const I3CLSimCompactPhoton &compactPhoton = compactPhotons[i];
+            I3CLSimPhoton &photon = photons[i];
+            
+            // relPosX, relPosY, relPosZ, dirTheta, dirPhi, wavelength, groupVelocity
+            float values[7];
+            halfp2singles(values, &(compactPhoton.relPosX), 7);
+            
+            const I3Position &domPos =
+                domPositionsPerStringIndex.at(compactPhoton.stringID).at(compactPhoton.omID);
+            
+            photon.SetPosX(domPos.GetX()+values[0]);
+            photon.SetPosY(domPos.GetY()+values[1]);
+            photon.SetPosZ(domPos.GetZ()+values[2]);
+            photon.SetTime(compactPhoton.time);
+            photon.SetDirTheta(values[3]);
+            photon.SetDirPhi(values[4]);
+            photon.SetWavelength(values[5]*1e-9f); // the kernel stores nm
+            photon.SetCherenkovDist(std::numeric_limits<float>::quiet_NaN());
+            photon.SetNumScatters(compactPhoton.numScatters);
+            photon.SetWeight(compactPhoton.weight);
+            photon.SetID(compactPhoton.identifier);
+            photon.SetStringID(compactPhoton.stringID);
+            photon.SetOMID(compactPhoton.omID);
+            photon.SetStartPosX(std::numeric_limits<float>::quiet_NaN());
+            photon.SetStartPosY(std::numeric_limits<float>::quiet_NaN());
+            photon.SetStartPosZ(std::numeric_limits<float>::quiet_NaN());
+            photon.SetStartTime(std::numeric_limits<float>::quiet_NaN());
+            photon.SetStartDirTheta(std::numeric_limits<float>::quiet_NaN());
+            photon.SetStartDirPhi(std::numeric_limits<float>::quiet_NaN());
+            photon.SetGroupVelocity(values[6]);
+            photon.SetDistInAbsLens(std::numeric_limits<float>::quiet_NaN());
+        }
+    }
+    
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimHelperCompactPhotons.h
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#ifndef I3CLSIMHELPERCOMPACTPHOTONS_H_INCLUDED
+#define I3CLSIMHELPERCOMPACTPHOTONS_H_INCLUDED
+
+#include <vector>
+
+#include "dataclasses/I3Position.h"
+
+#include "clsim/I3CLSimPhoton.h"
+
+namespace I3CLSimHelper
+{
+    /**
+     * @brief A reduced-precision version of I3CLSimPhoton as written
+     * by the kernel if COMPACT_PHOTONS is defined. The position is
+     * stored relative to the hit DOM. The start position/direction,
+     * the Cherenkov distance and the distance in absorption lengths
+     * are not available. Must match the definition in
+     * propagation_kernel.h.cl.
+     */
+    struct I3CLSimCompactPhoton
+    {
+        cl_float time;
+        cl_float weight;
+        cl_uint identifier;
+        cl_short stringID;
+        cl_ushort omID;
+        cl_ushort relPosX;          // half, [m] relative to the DOM center
+        cl_ushort relPosY;          // half
+        cl_ushort relPosZ;          // half
+        cl_ushort dirTheta;         // half
+        cl_ushort dirPhi;           // half
+        cl_ushort wavelength;       // half, [nm]
+        cl_ushort groupVelocity;    // half, [m/ns]
+        cl_ushort numScatters;      // saturates at 0xFFFF
+    } __attribute__ ((packed)); // 32 bytes
+
+    /**
+     * Converts compact photons back to I3CLSimPhotons. String and DOM
+     * ids are left as indices, just like for photons in the full format.
+     */
+    void DecodeCompactPhotons(const std::vector<I3CLSimCompactPhoton> &compactPhotons,
+                              const std::vector<std::vector<I3Position> > &domPositionsPerStringIndex,
+                              I3CLSimPhotonSeries &photons);
+
+};
+
+#endif //I3CLSIMHELPERCOMPACTPHOTONS_H_INCLUDED
@@ -0,0 +1,148 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimHelperCompressSteps.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#include "opencl/I3CLSimHelperCompressSteps.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+namespace I3CLSimHelper
+{
+    namespace {
+        // quantizes an offset, returns false if it does not fit into 16 bits
+        inline bool QuantizeOffset(double offset, double quantum, cl_short &result)
+        {
+            const double quantized = std::floor(offset/quantum + 0.5);
+            if (!(std::fabs(quantized) <= static_cast<double>(std::numeric_limits<int16_t>::max()))) return false; // also catches NaN
+            
+            result = static_cast<cl_short>(quantized);
+            return true;
+        }
+        
+        // quantizes an angle (periodic ones wrap around)
+        inline cl_ushort QuantizeAngle(double angle, double quantum, bool periodic)
+        {
+            double quantized = std::floor(angle/quantum + 0.5);
+            if (periodic) {
+                quantized -= 65536.*std::floor(quantized/65536.);
+            }
+            return static_cast<cl_ushort>(std::min(std::max(quantized, 0.), 65535.));
+        }
+        
+        // steps can share a header if everything except for position,
+        // time, direction, length and number of photons is identical
+        inline bool CanShareHeader(const I3CLSimStep &step, const I3CLSimStepGroupHeader &header)
+        {
+            return (step.identifier == header.identifier) &&
+                   (step.sourceType == header.sourceType) &&
+                   (std::memcmp(&step.weight, &(((const cl_float *)&header.betaAndWeight)[1]), sizeof(cl_float))==0) &&
+                   (std::memcmp(&(((const cl_float *)&step.dirAndLengthAndBeta)[3]), &(((const cl_float *)&header.betaAndWeight)[0]), sizeof(cl_float))==0);
+        }
+        
+        inline bool EncodeStep(const I3CLSimStep &step, const I3CLSimStepGroupHeader &header, I3CLSimCompressedStep &compressedStep)
+        {
+            const cl_float *headerPosAndTime = (const cl_float *)&header.posAndTime;
+            cl_short *delta = (cl_short *)&compressedStep.posAndTimeDelta;
+            
+            if (!QuantizeOffset(static_cast<double>(step.GetPosX())-static_cast<double>(headerPosAndTime[0]), compressedStepPosQuantum, delta[0])) return false;
+            if (!QuantizeOffset(static_cast<double>(step.GetPosY())-static_cast<double>(headerPosAndTime[1]), compressedStepPosQuantum, delta[1])) return false;
+            if (!QuantizeOffset(static_cast<double>(step.GetPosZ())-static_cast<double>(headerPosAndTime[2]), compressedStepPosQuantum, delta[2])) return false;
+            if (!QuantizeOffset(static_cast<double>(step.GetTime())-static_cast<double>(headerPosAndTime[3]), compressedStepTimeQuantum, delta[3])) return false;
+            
+            cl_ushort *dir = (cl_ushort *)&compressedStep.dir;
+            dir[0] = QuantizeAngle(step.GetDirTheta(), compressedStepThetaQuantum, false);
+            dir[1] = QuantizeAngle(step.GetDirPhi(), compressedStepPhiQuantum, true);
+            
+            compressedStep.numPhotons = step.numPhotons;
+            compressedStep.length = step.GetLength();
+            return true;
+        }
+        
+        // the serial of a step must follow from its position in the group
+        inline bool HasConsecutiveSerial(const I3CLSimStep &step, std::size_t stepIndex, const I3CLSimStepGroupHeader &header)
+        {
+            const uint32_t headerSerial = (static_cast<uint32_t>(header.dummy1)<<16) | static_cast<uint32_t>(header.dummy2);
+            return step.GetSerial() == ((headerSerial + static_cast<uint32_t>(stepIndex-header.firstStep)) & 0xffffff);
+        }
+        
+        inline void StartGroup(const I3CLSimStep &step, std::size_t stepIndex, I3CLSimStepGroupHeader &header)
+        {
+            header.posAndTime = step.posAndTime;
+            
+            cl_float *betaAndWeight = (cl_float *)&header.betaAndWeight;
+            betaAndWeight[0] = step.GetBeta();
+            betaAndWeight[1] = step.GetWeight();
+            
+            header.identifier = step.identifier;
+            header.firstStep = static_cast<cl_uint>(stepIndex);
+            header.sourceType = step.sourceType;
+            header.dummy1 = step.dummy1; // the serial of the first step
+            header.dummy2 = step.dummy2;
+        }
+    }
+    
+    bool CompressSteps(const I3CLSimStepSeries &steps,
+                       std::vector<I3CLSimCompressedStep> &compressedSteps,
+                       std::vector<I3CLSimStepGroupHeader> &groupHeaders,
+                       bool keepSerials)
+    {
+        compressedSteps.resize(steps.size());
+        groupHeaders.clear();
+        
+        if (steps.empty()) return false;
+        if (steps.size() > static_cast<std::size_t>(std::numeric_limits<uint32_t>::max())) return false;
+        
+        const std::size_t plainSize = steps.size()*sizeof(I3CLSimStep);
+        const std::size_t compressedStepsSize = steps.size()*sizeof(I3CLSimCompressedStep);
+        
+        for (std::size_t i=0;i<steps.size();++i)
+        {
+            const I3CLSimStep &step = steps[i];
+            
+            if ((!groupHeaders.empty()) &&
+                (CanShareHeader(step, groupHeaders.back())) &&
+                ((!keepSerials) || (HasConsecutiveSerial(step, i, groupHeaders.back()))) &&
+                (EncodeStep(step, groupHeaders.back(), compressedSteps[i]))) continue;
+            
+            // no luck, start a new group
+            groupHeaders.push_back(I3CLSimStepGroupHeader());
+            StartGroup(step, i, groupHeaders.back());
+            
+            // the first step of a group has zero offsets and always fits
+            if (!EncodeStep(step, groupHeaders.back(), compressedSteps[i]))
+                log_fatal("Internal error: could not encode the first step of a group.");
+            
+            // give up as soon as compression does not pay off
+            if (compressedStepsSize + groupHeaders.size()*sizeof(I3CLSimStepGroupHeader) >= plainSize)
+                return false;
+        }
+        
+        return true;
+    }
+    
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimHelperCompressSteps.h
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#ifndef I3CLSIMHELPERCOMPRESSSTEPS_H_INCLUDED
+#define I3CLSIMHELPERCOMPRESSSTEPS_H_INCLUDED
+
+#include <vector>
+#include <cmath>
+
+#include "clsim/I3CLSimStep.h"
+
+namespace I3CLSimHelper
+{
+    // Resolution of the quantized per-step position and time
+    // offsets in the compressed step format. (The first step of
+    // each group has zero offsets.)
+    static const double compressedStepPosQuantum = 1e-3;   // [m]
+    static const double compressedStepTimeQuantum = 1e-2;  // [ns]
+
+    // Resolution of the quantized per-step direction (theta in
+    // [0,pi], phi modulo 2pi; about 5e-5 rad each).
+    static const double compressedStepThetaQuantum = M_PI/65535.;
+    static const double compressedStepPhiQuantum = 2.*M_PI/65536.;
+
+    /**
+     * @brief The header shared by a group of consecutive steps
+     * with the same identifier, beta, weight and source type.
+     * Must match the definition in propagation_kernel.h.cl.
+     */
+    struct I3CLSimStepGroupHeader
+    {
+        cl_float4 posAndTime;           // x,y,z,time of the first step in the group
+        cl_float2 betaAndWeight;        // beta,weight
+        cl_uint identifier;
+        cl_uint firstStep;              // index of the first step in the group
+        cl_uchar sourceType;
+        cl_uchar dummy1;
+        cl_ushort dummy2;
+    } __attribute__ ((packed)); // 36 bytes
+
+    /**
+     * @brief A single step in the compressed format. Position and
+     * time are stored relative to the group header in units of
+     * compressedStepPosQuantum and compressedStepTimeQuantum, the
+     * direction in units of compressedStepThetaQuantum and
+     * compressedStepPhiQuantum. Must match the definition in
+     * propagation_kernel.h.cl.
+     */
+    struct I3CLSimCompressedStep
+    {
+        cl_short4 posAndTimeDelta;      // x,y,z,time
+        cl_ushort2 dir;                 // theta,phi
+        cl_uint numPhotons;
+        cl_float length;
+    } __attribute__ ((packed)); // 20 bytes
+
+    /**
+     * Encodes steps into groups of steps sharing a header. Returns false
+     * (and leaves the output in an undefined state) if the compressed
+     * representation would not be smaller than the plain one.
+     * With keepSerials, steps only share a header if their serials
+     * (I3CLSimStep::GetSerial()) are consecutive, so that the kernel
+     * can recover them from the serial of the first step (stored in
+     * the header's dummy1/dummy2).
+     */
+    bool CompressSteps(const I3CLSimStepSeries &steps,
+                       std::vector<I3CLSimCompressedStep> &compressedSteps,
+                       std::vector<I3CLSimStepGroupHeader> &groupHeaders,
+                       bool keepSerials=false);
+
+};
+
+#endif //I3CLSIMHELPERCOMPRESSSTEPS_H_INCLUDED
@@ -32,6 +32,8 @@
 
 #include <vector>
 #include <cmath>
+#include <cstdlib>
+#include <limits>
 #include <set>
 
 #include "dataclasses/I3Constants.h"
@@ -59,18 +61,21 @@ namespace I3CLSimHelper
                                              const double omRadius,
                                              std::vector<cl_ushort> &geoLayerToOMNumIndexPerStringSetBuffer,
                                              std::vector<int> &stringIndexToStringIDBuffer,
-                                             std::vector<std::vector<unsigned int> > &domIndexToDomIDBuffer_perStringIndex
+                                             std::vector<std::vector<unsigned int> > &domIndexToDomIDBuffer_perStringIndex,
+                                             std::vector<std::vector<I3Position> > &domPositionsPerStringIndex
                                              );
     
     // the main converter
     std::string GenerateGeometrySource(const I3CLSimSimpleGeometry &geometry,
                                        std::vector<unsigned short> &geoLayerToOMNumIndexPerStringSetBuffer,
                                        std::vector<int> &stringIndexToStringIDBuffer,
-                                       std::vector<std::vector<unsigned int> > &domIndexToDomIDBuffer_perStringIndex)
+                                       std::vector<std::vector<unsigned int> > &domIndexToDomIDBuffer_perStringIndex,
+                                       std::vector<std::vector<I3Position> > &domPositionsPerStringIndex)
     {
         geoLayerToOMNumIndexPerStringSetBuffer.clear();
         stringIndexToStringIDBuffer.clear();
         domIndexToDomIDBuffer_perStringIndex.clear();
+        domPositionsPerStringIndex.clear();
         
         std::ostringstream code;
         
@@ -95,7 +100,8 @@ namespace I3CLSimHelper
                                                 geometry.GetOMRadius(),
                                                 geoLayerToOMNumIndexPerStringSetBuffer,
                                                 stringIndexToStringIDBuffer,
-                                                domIndexToDomIDBuffer_perStringIndex
+                                                domIndexToDomIDBuffer_perStringIndex,
+                                                domPositionsPerStringIndex
                                                 );
             
             if (!ret)
@@ -496,7 +502,19 @@ namespace I3CLSimHelper
         
     }
     
-    std::string generate_get_dom_position_code(const std::vector<stringStruct> &strings)
+    // the value the OpenCL compiler will see for a float literal
+    // written to a stream formatted like the ones below
+    double float_literal_value(double value)
+    {
+        std::ostringstream literal(std::ostringstream::out);
+        literal.setf(std::ios::scientific,std::ios::floatfield);
+        literal.precision(std::numeric_limits<float>::digits10+4);
+        literal << value;
+        return static_cast<double>(std::strtof(literal.str().c_str(), NULL));
+    }
+    
+    std::string generate_get_dom_position_code(const std::vector<stringStruct> &strings,
+                                               std::vector<std::vector<I3Position> > &domPositionsPerStringIndex)
     {
         std::vector<double> stringMeanPosX(strings.size(), 0.);
         std::vector<double> stringMeanPosY(strings.size(), 0.);
@@ -702,6 +720,36 @@ namespace I3CLSimHelper
         
         
         
+        // the DOM positions exactly as geometryGetDomPosition() will return
+        // them (up to float rounding), i.e. including the quantization
+        domPositionsPerStringIndex.resize(strings.size());
+        for (std::size_t i=0;i<strings.size();++i)
+        {
+            const std::size_t startIndex = templateIndexIntoFlatList[stringInTemplate[i]];
+            const double meanX = float_literal_value(stringMeanPosX[i]);
+            const double meanY = float_literal_value(stringMeanPosY[i]);
+
+            domPositionsPerStringIndex[i].resize(strings[i].doms.size());
+            for (std::size_t j=0;j<strings[i].doms.size();++j)
+            {
+                const std::size_t index = startIndex+j;
+                double x, y;
+                
+                if (useShortsInsteadOfFloats) {
+                    const short valueX = static_cast<short>(templatePositionsX_flat[index]/(geoDomPosMaxAbsX_inTemplate/32767.));
+                    const short valueY = static_cast<short>(templatePositionsY_flat[index]/(geoDomPosMaxAbsY_inTemplate/32767.));
+                    x = static_cast<double>(valueX)*float_literal_value(geoDomPosMaxAbsX_inTemplate/32767.) + meanX;
+                    y = static_cast<double>(valueY)*float_literal_value(geoDomPosMaxAbsY_inTemplate/32767.) + meanY;
+                } else {
+                    x = float_literal_value(templatePositionsX_flat[index]) + meanX;
+                    y = float_literal_value(templatePositionsY_flat[index]) + meanY;
+                }
+                
+                domPositionsPerStringIndex[i][j] =
+                I3Position(x, y, float_literal_value(templatePositionsZ_flat[index]));
+            }
+        }
+        
         output << "// end of auto-generated code created by generate_get_dom_position_code()" << std::endl;
         output << std::endl;
         return output.str();
@@ -719,7 +767,8 @@ namespace I3CLSimHelper
                                              const double omRadius,
                                              std::vector<cl_ushort> &geoLayerToOMNumIndexPerStringSetBuffer,
                                              std::vector<int> &stringIndexToStringIDBuffer,
-                                             std::vector<std::vector<unsigned int> > &domIndexToDomIDBuffer_perStringIndex
+                                             std::vector<std::vector<unsigned int> > &domIndexToDomIDBuffer_perStringIndex,
+                                             std::vector<std::vector<I3Position> > &domPositionsPerStringIndex
                                              )
     {
         typedef std::vector<int>::size_type sizeType;
@@ -1146,7 +1195,7 @@ namespace I3CLSimHelper
         
 
         // the dom position lookup code (i.e. (stringNum,domNum)->(posX, posY, posZ) )
-        output << generate_get_dom_position_code(strings);
+        output << generate_get_dom_position_code(strings, domPositionsPerStringIndex);
         
         
         // all the other data
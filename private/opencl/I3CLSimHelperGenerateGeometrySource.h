@@ -30,17 +30,22 @@
 #include <string>
 #include <vector>
 
+#include "dataclasses/I3Position.h"
+
 #include "clsim/I3CLSimSimpleGeometry.h"
 
 namespace I3CLSimHelper
 {
     /**
      * generates the OpenCL source code for a given I3CLSimSimpleGeometry object.
+     * domPositionsPerStringIndex receives the DOM positions as seen by
+     * the generated code, i.e. after the reduced-precision storage.
      */
     std::string GenerateGeometrySource(const I3CLSimSimpleGeometry &geometry,
                                        std::vector<unsigned short> &geoLayerToOMNumIndexPerStringSetBuffer,
                                        std::vector<int> &stringIndexToStringIDBuffer,
-                                       std::vector<std::vector<unsigned int> > &domIndexToDomIDBuffer_perStringIndex);
+                                       std::vector<std::vector<unsigned int> > &domIndexToDomIDBuffer_perStringIndex,
+                                       std::vector<std::vector<I3Position> > &domPositionsPerStringIndex);
 
 };
 
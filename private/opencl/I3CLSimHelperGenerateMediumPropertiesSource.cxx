@@ -128,7 +128,8 @@ namespace I3CLSimHelper
     std::string GenerateLayeredWlenDependentFunctions(const std::vector<I3CLSimFunctionConstPtr> &layeredFunction,
                                                       const std::string &fullName,
                                                       const std::string &functionName,
-                                                      std::string derivativeFunctionName="")
+                                                      std::string derivativeFunctionName="",
+                                                      bool generateDepthTables=false)
     {
         // first, check if one of the optimizers work
         if (derivativeFunctionName=="")
@@ -139,13 +140,15 @@ namespace I3CLSimHelper
             ret = GenerateOptimizedCodeFor_I3CLSimFunctionAbsLenIceCube(layeredFunction,
                                                                                   fullName,
                                                                                   functionName,
-                                                                                  worked);
+                                                                                  worked,
+                                                                                  generateDepthTables);
             if (worked) return ret;
 
             ret = GenerateOptimizedCodeFor_I3CLSimFunctionScatLenIceCube(layeredFunction,
                                                                                    fullName,
                                                                                    functionName,
-                                                                                   worked);
+                                                                                   worked,
+                                                                                   generateDepthTables);
             if (worked) return ret;
             
         }        
@@ -204,7 +207,8 @@ namespace I3CLSimHelper
     }
     
     
-    std::string GenerateMediumPropertiesSource(const I3CLSimMediumProperties &mediumProperties)
+    std::string GenerateMediumPropertiesSource(const I3CLSimMediumProperties &mediumProperties,
+                                               bool opticalDepthTables)
     {
         std::ostringstream code;
         
@@ -308,14 +312,39 @@ namespace I3CLSimHelper
         }
     
         // scattering length
-        code << GenerateLayeredWlenDependentFunctions(mediumProperties.GetScatteringLengths(),
-                                                      "scattering length",
-                                                      "getScatteringLength");
+        const std::string scatteringLengthCode =
+        GenerateLayeredWlenDependentFunctions(mediumProperties.GetScatteringLengths(),
+                                              "scattering length",
+                                              "getScatteringLength",
+                                              "",
+                                              opticalDepthTables);
+        code << scatteringLengthCode;
         
         // absorption length
-        code << GenerateLayeredWlenDependentFunctions(mediumProperties.GetAbsorptionLengths(),
-                                                      "absorption length",
-                                                      "getAbsorptionLength");
+        const std::string absorptionLengthCode =
+        GenerateLayeredWlenDependentFunctions(mediumProperties.GetAbsorptionLengths(),
+                                              "absorption length",
+                                              "getAbsorptionLength",
+                                              "",
+                                              opticalDepthTables);
+        code << absorptionLengthCode;
+        
+        if (opticalDepthTables)
+        {
+            // the kernel can only use the tables if both lengths have them
+            if ((scatteringLengthCode.find("FUNCTION_getScatteringLength_HAS_DEPTH_TABLES") == std::string::npos) ||
+                (absorptionLengthCode.find("FUNCTION_getAbsorptionLength_HAS_DEPTH_TABLES") == std::string::npos))
+            {
+                log_warn("Optical depth tables have been requested, but the scattering and absorption lengths are not "
+                         "both IceCube-style parameterizations. Falling back to the layer-by-layer propagation.");
+            }
+            else
+            {
+                code << "// the propagation kernel uses cumulative optical depths\n";
+                code << "#define MEDIUM_OPTICAL_DEPTH_TABLES\n";
+                code << "\n";
+            }
+        }
         
         
         // scattering angle distribution
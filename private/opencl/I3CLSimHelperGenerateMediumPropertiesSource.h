@@ -35,8 +35,15 @@ namespace I3CLSimHelper
 {
     /**
      * generates the OpenCL source code for a given mediumProperties object.
+     *
+     * If opticalDepthTables is set and both the scattering and the
+     * absorption lengths can be written as layer tables (this is the case
+     * for the IceCube parameterizations), the code will also contain
+     * the cumulative vertical optical depths at all layer boundaries
+     * and MEDIUM_OPTICAL_DEPTH_TABLES will be defined.
      */
-    std::string GenerateMediumPropertiesSource(const I3CLSimMediumProperties &mediumProperties);
+    std::string GenerateMediumPropertiesSource(const I3CLSimMediumProperties &mediumProperties,
+                                               bool opticalDepthTables=false);
     
     std::string GenerateWavelengthGeneratorSource(const std::vector<I3CLSimRandomValueConstPtr>&);
 
@@ -114,6 +114,49 @@ namespace I3CLSimHelper
 
         BOOST_PP_SEQ_FOR_EACH(GEN_VISITOR, ~, CHECK_THESE_FOR_CONSTNESS_ABSLEN)
         BOOST_PP_SEQ_FOR_EACH(GEN_VISITOR, ~, CHECK_THESE_FOR_CONSTNESS_SCATLEN)
+        
+        void WriteConstantArray(std::ostringstream &code,
+                                const std::string &name,
+                                const std::vector<double> &values)
+        {
+            code << "__constant float " << name << "[" << values.size() << "] = {\n";
+            BOOST_FOREACH(const double &value, values)
+            {
+                code << "    " << ToFloatString(value) << ",\n";
+            }
+            code << "};\n";
+            code << "\n";
+        }
+        
+        // For inverse lengths of the form
+        //   1/L(layer, wlen) = w1(wlen)*term1[layer] + w2(wlen)*term2[layer]
+        // writes both terms and their cumulative sums over the layers
+        // (in units of the layer thickness). The vertical optical depth
+        // between the bottom of the medium and the bottom of layer k is
+        // then MEDIUM_LAYER_THICKNESS*(w1*depthTerm1[k] + w2*depthTerm2[k]),
+        // for any wavelength. The caller writes the weight function
+        // <functionName>_depthWeights(wlen), returning (w1,w2).
+        void WriteOpticalDepthTables(std::ostringstream &code,
+                                     const std::string &functionName,
+                                     const std::vector<double> &term1,
+                                     const std::vector<double> &term2)
+        {
+            std::vector<double> depthTerm1(1, 0.);
+            std::vector<double> depthTerm2(1, 0.);
+            for (std::size_t i=0;i<term1.size();++i)
+            {
+                depthTerm1.push_back(depthTerm1.back()+term1[i]);
+                depthTerm2.push_back(depthTerm2.back()+term2[i]);
+            }
+            
+            code << "#define FUNCTION_" << functionName << "_HAS_DEPTH_TABLES\n";
+            code << "\n";
+            WriteConstantArray(code, functionName+"_invLengthTerm1", term1);
+            WriteConstantArray(code, functionName+"_invLengthTerm2", term2);
+            WriteConstantArray(code, functionName+"_depthTerm1", depthTerm1);
+            WriteConstantArray(code, functionName+"_depthTerm2", depthTerm2);
+            code << "inline float2 " << functionName << "_depthWeights(float wlen);\n\n";
+        }
     }
     
     
@@ -123,7 +166,8 @@ namespace I3CLSimHelper
     std::string GenerateOptimizedCodeFor_I3CLSimFunctionAbsLenIceCube(const std::vector<I3CLSimFunctionConstPtr> &layeredFunction,
                                                                                 const std::string &fullName,
                                                                                 const std::string &functionName,
-                                                                                bool &worked)
+                                                                                bool &worked,
+                                                                                bool generateDepthTables)
     {
         // are all of them of type I3CLSimFunctionAbsLenIceCube?
         const std::vector<I3CLSimFunctionAbsLenIceCubeConstPtr> layeredFunctionIceCube =
@@ -182,6 +226,34 @@ namespace I3CLSimHelper
         code << "}\n";
         code << "\n";
         
+        if (generateDepthTables)
+        {
+            // 1/L = (D*aDust400+E)/m * x^-kappa + (1+0.01*deltaTau)/m * A*exp(-B/x)
+            std::vector<double> term1, term2;
+            BOOST_FOREACH(const I3CLSimFunctionAbsLenIceCubeConstPtr &function, layeredFunctionIceCube)
+            {
+                term1.push_back(function->GetD()*function->GetADust400()+function->GetE());
+                term2.push_back(1.+0.01*function->GetDeltaTau());
+            }
+            WriteOpticalDepthTables(code, functionName, term1, term2);
+            
+            code << "inline float2 " << functionName << "_depthWeights(float wlen)\n";
+            code << "{\n";
+            code << "    const float kappa = " << ToFloatString(layeredFunctionIceCube[0]->GetKappa()) << ";\n";
+            code << "    const float A = " << ToFloatString(layeredFunctionIceCube[0]->GetA()) << ";\n";
+            code << "    const float B = " << ToFloatString(layeredFunctionIceCube[0]->GetB()) << ";\n";
+            code << "    \n";
+            code << "    const float x = wlen/" << ToFloatString(I3Units::nanometer) << ";\n";
+            code << "    \n";
+            code << "#ifdef USE_NATIVE_MATH\n";
+            code << "    return (float2)(native_powr(x, -kappa), A*native_exp(-B/x)) * " << ToFloatString(1./I3Units::meter) << ";\n";
+            code << "#else\n";
+            code << "    return (float2)(powr(x, -kappa), A*exp(-B/x)) * " << ToFloatString(1./I3Units::meter) << ";\n";
+            code << "#endif\n";
+            code << "}\n";
+            code << "\n";
+        }
+        
         code << "///////////////// END " << fullName << " (optimized) ////////////////\n";
         code << "\n";        
 
@@ -195,7 +267,8 @@ namespace I3CLSimHelper
     std::string GenerateOptimizedCodeFor_I3CLSimFunctionScatLenIceCube(const std::vector<I3CLSimFunctionConstPtr> &layeredFunction,
                                                                                  const std::string &fullName,
                                                                                  const std::string &functionName,
-                                                                                 bool &worked)
+                                                                                 bool &worked,
+                                                                                 bool generateDepthTables)
     {
         // are all of them of type I3CLSimFunctionScatLenIceCube?
         const std::vector<I3CLSimFunctionScatLenIceCubeConstPtr> layeredFunctionIceCube =
@@ -242,6 +315,30 @@ namespace I3CLSimHelper
         code << "}\n";
         code << "\n";
         
+        if (generateDepthTables)
+        {
+            // 1/L = b400/m * (wlen/400nm)^-alpha (there is no second term)
+            std::vector<double> term1, term2;
+            BOOST_FOREACH(const I3CLSimFunctionScatLenIceCubeConstPtr &function, layeredFunctionIceCube)
+            {
+                term1.push_back(function->GetB400());
+                term2.push_back(0.);
+            }
+            WriteOpticalDepthTables(code, functionName, term1, term2);
+            
+            code << "inline float2 " << functionName << "_depthWeights(float wlen)\n";
+            code << "{\n";
+            code << "    const float alpha = " << ToFloatString(layeredFunctionIceCube[0]->GetAlpha()) << ";\n";
+            code << "    \n";
+            code << "#ifdef USE_NATIVE_MATH\n";
+            code << "    return (float2)(native_powr(wlen*" + refWlenAsString + ", -alpha) * " << ToFloatString(1./I3Units::meter) << ", 0.f);\n";
+            code << "#else\n";
+            code << "    return (float2)(powr(wlen*" + refWlenAsString + ", -alpha) * " << ToFloatString(1./I3Units::meter) << ", 0.f);\n";
+            code << "#endif\n";
+            code << "}\n";
+            code << "\n";
+        }
+        
         code << "///////////////// END " << fullName << " (optimized) ////////////////\n";
         code << "\n";        
 
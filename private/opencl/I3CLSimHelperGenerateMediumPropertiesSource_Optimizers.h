@@ -38,15 +38,22 @@ namespace I3CLSimHelper
     // optimizers (special converters for functions
     // where we can generate more optimized code
     // for layered values)
+    //
+    // If generateDepthTables is set, they also write tables of the
+    // vertical optical depth at each layer boundary (see
+    // WriteOpticalDepthTables() in the implementation) and define
+    // FUNCTION_<functionName>_HAS_DEPTH_TABLES.
     std::string GenerateOptimizedCodeFor_I3CLSimFunctionAbsLenIceCube(const std::vector<I3CLSimFunctionConstPtr> &layeredFunction,
                                                                                 const std::string &fullName,
                                                                                 const std::string &functionName,
-                                                                                bool &worked);
+                                                                                bool &worked,
+                                                                                bool generateDepthTables=false);
 
     std::string GenerateOptimizedCodeFor_I3CLSimFunctionScatLenIceCube(const std::vector<I3CLSimFunctionConstPtr> &layeredFunction,
                                                                                  const std::string &fullName,
                                                                                  const std::string &functionName,
-                                                                                 bool &worked);
+                                                                                 bool &worked,
+                                                                                 bool generateDepthTables=false);
     
 
 };
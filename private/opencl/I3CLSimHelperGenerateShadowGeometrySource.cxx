@@ -0,0 +1,128 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ *
+ * @file I3CLSimHelperGenerateShadowGeometrySource.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#include "opencl/I3CLSimHelperGenerateShadowGeometrySource.h"
+
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <cmath>
+
+#include "clsim/I3CLSimHelperToFloatString.h"
+
+namespace I3CLSimHelper
+{
+    namespace {
+        // the bounds are stored as floats, make sure rounding
+        // never makes them smaller
+        inline double WidenBound(double value, bool upper)
+        {
+            const double margin = std::fabs(value)*1e-6 + 1e-6;
+            return upper?(value+margin):(value-margin);
+        }
+    }
+    
+    std::string GenerateShadowGeometrySource(const I3ExtraGeometryBVH &bvh)
+    {
+        if (bvh.GetNumItems()==0)
+            throw std::runtime_error("The shadowing geometry is empty.");
+        
+        if (!bvh.ConsistsOfCylindersOnly())
+            throw std::runtime_error("The shadowing geometry may only consist of I3ExtraGeometryItemCylinders (optionally inside unions and moves) when used during propagation.");
+        
+        const std::vector<I3ExtraGeometryItemCylinderConstPtr> &cylinders = bvh.GetCylinders();
+        const std::vector<I3ExtraGeometryBVH::Node> &nodes = bvh.GetNodes();
+        
+        std::ostringstream code;
+        
+        code << "\n";
+        code << "///////////////// BEGIN shadowing geometry ////////////\n";
+        code << "\n";
+        code << "// cables and other shadowing objects, auto-generated by\n";
+        code << "// I3CLSimHelper::GenerateShadowGeometrySource()\n";
+        code << "\n";
+        code << "#define SHADOW_GEOMETRY\n";
+        code << "#define SHADOW_NUM_CYLINDERS " << cylinders.size() << "\n";
+        code << "#define SHADOW_NUM_BVH_NODES " << nodes.size() << "\n";
+        code << "#define SHADOW_BVH_STACK_SIZE " << bvh.GetMaxDepth()+1 << "\n";
+        code << "\n";
+        
+        // (from.xyz, axis.xyz, length, radius) for each cylinder
+        code << "__constant float shadowCylinders[SHADOW_NUM_CYLINDERS*8] = {\n";
+        for (std::size_t i=0;i<cylinders.size();++i)
+        {
+            const I3Position &from = cylinders[i]->GetFrom();
+            const I3Position &to = cylinders[i]->GetTo();
+            
+            double ax = to.GetX()-from.GetX();
+            double ay = to.GetY()-from.GetY();
+            double az = to.GetZ()-from.GetZ();
+            const double length = std::sqrt(ax*ax + ay*ay + az*az);
+            if (length > 0.) {
+                ax/=length; ay/=length; az/=length;
+            }
+            
+            code << "    "
+            << ToFloatString(from.GetX()) << ", " << ToFloatString(from.GetY()) << ", " << ToFloatString(from.GetZ()) << ", "
+            << ToFloatString(ax) << ", " << ToFloatString(ay) << ", " << ToFloatString(az) << ", "
+            << ToFloatString(length) << ", " << ToFloatString(cylinders[i]->GetRadius()) << ",\n";
+        }
+        code << "};\n";
+        code << "\n";
+        
+        // (lower.xyz, upper.xyz) for each node
+        code << "__constant float shadowBVHNodeBounds[SHADOW_NUM_BVH_NODES*6] = {\n";
+        for (std::size_t i=0;i<nodes.size();++i)
+        {
+            code << "    "
+            << ToFloatString(WidenBound(nodes[i].lower[0], false)) << ", "
+            << ToFloatString(WidenBound(nodes[i].lower[1], false)) << ", "
+            << ToFloatString(WidenBound(nodes[i].lower[2], false)) << ", "
+            << ToFloatString(WidenBound(nodes[i].upper[0], true)) << ", "
+            << ToFloatString(WidenBound(nodes[i].upper[1], true)) << ", "
+            << ToFloatString(WidenBound(nodes[i].upper[2], true)) << ",\n";
+        }
+        code << "};\n";
+        code << "\n";
+        
+        // (first cylinder or right child, number of cylinders) for each node
+        code << "__constant uint shadowBVHNodeIndex[SHADOW_NUM_BVH_NODES*2] = {\n";
+        for (std::size_t i=0;i<nodes.size();++i)
+        {
+            code << "    " << nodes[i].index << ", " << nodes[i].numItems << ",\n";
+        }
+        code << "};\n";
+        code << "\n";
+        
+        code << "///////////////// END shadowing geometry ////////////\n";
+        code << "\n";
+        
+        return code.str();
+    }
+    
+};
@@ -0,0 +1,46 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ *
+ * @file I3CLSimHelperGenerateShadowGeometrySource.h
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#ifndef I3CLSIMHELPERGENERATESHADOWGEOMETRYSOURCE_H_INCLUDED
+#define I3CLSIMHELPERGENERATESHADOWGEOMETRYSOURCE_H_INCLUDED
+
+#include <string>
+
+#include "clsim/shadow/I3ExtraGeometryBVH.h"
+
+namespace I3CLSimHelper
+{
+    /**
+     * generates the OpenCL source code for the cylinders and the
+     * bounding volume hierarchy of an I3ExtraGeometryBVH object.
+     * Throws if the hierarchy contains anything but cylinders.
+     */
+    std::string GenerateShadowGeometrySource(const I3ExtraGeometryBVH &bvh);
+
+};
+
+#endif //I3CLSIMHELPERGENERATESHADOWGEOMETRYSOURCE_H_INCLUDED
@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ *
+ * @file I3CLSimHelperKernelCache.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#include "opencl/I3CLSimHelperKernelCache.h"
+
+#include "icetray/I3Logging.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdint.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace I3CLSimHelper
+{
+    namespace {
+        // identifies cache files (bump the version if the format changes)
+        const std::string cacheFileMagic = "clsim-kernel-binary-v1";
+
+        // 64 bit FNV-1a with an adjustable offset basis
+        inline uint64_t FNV1a64(const std::string &data, uint64_t hash)
+        {
+            const uint64_t prime = 0x100000001b3ULL;
+            for (std::string::const_iterator it=data.begin();it!=data.end();++it)
+            {
+                hash ^= static_cast<uint64_t>(static_cast<unsigned char>(*it));
+                hash *= prime;
+            }
+            return hash;
+        }
+
+        // improves the avalanche behaviour of the last bytes
+        inline uint64_t Finalize64(uint64_t x)
+        {
+            x ^= x >> 33;
+            x *= 0xff51afd7ed558ccdULL;
+            x ^= x >> 33;
+            x *= 0xc4ceb9fe1a85ec53ULL;
+            x ^= x >> 33;
+            return x;
+        }
+
+        inline fs::path CacheFilePath(const std::string &cacheDirectory, const std::string &key)
+        {
+            return fs::path(cacheDirectory) / ("clsim_kernel_" + key + ".bin");
+        }
+    }
+
+    std::string KernelCacheKey(const std::string &source,
+                               const std::string &buildOptions,
+                               const std::string &deviceIdentity)
+    {
+        // the lengths keep e.g. ("ab","c") and ("a","bc") apart
+        std::ostringstream input;
+        input << source.size() << '\n' << source
+              << buildOptions.size() << '\n' << buildOptions
+              << deviceIdentity.size() << '\n' << deviceIdentity;
+        const std::string data = input.str();
+
+        // two independent 64 bit hashes
+        const uint64_t hash1 = Finalize64(FNV1a64(data, 0xcbf29ce484222325ULL));
+        const uint64_t hash2 = Finalize64(FNV1a64(data, 0x84222325cbf29ce4ULL) ^ static_cast<uint64_t>(data.size()));
+
+        std::ostringstream key;
+        key << std::hex << std::setfill('0') << std::setw(16) << hash1 << std::setw(16) << hash2;
+        return key.str();
+    }
+
+    bool LoadKernelBinary(const std::string &cacheDirectory,
+                          const std::string &key,
+                          std::vector<unsigned char> &binary)
+    {
+        const fs::path filename = CacheFilePath(cacheDirectory, key);
+
+        std::ifstream ifs(filename.string().c_str(), std::ios::in | std::ios::binary);
+        if (!ifs.good()) return false;
+
+        // header: magic, key and binary size on separate lines
+        std::string magic, fileKey, sizeString;
+        std::getline(ifs, magic);
+        std::getline(ifs, fileKey);
+        std::getline(ifs, sizeString);
+        if ((!ifs.good()) || (magic != cacheFileMagic) || (fileKey != key)) {
+            log_warn("Ignoring invalid kernel cache file \"%s\".", filename.string().c_str());
+            return false;
+        }
+
+        std::size_t size=0;
+        try {
+            size = boost::lexical_cast<std::size_t>(sizeString);
+        } catch (boost::bad_lexical_cast &) {
+            log_warn("Ignoring invalid kernel cache file \"%s\".", filename.string().c_str());
+            return false;
+        }
+        if (size==0) return false;
+
+        binary.resize(size);
+        ifs.read(reinterpret_cast<char *>(&(binary[0])), size);
+        if (static_cast<std::size_t>(ifs.gcount()) != size) {
+            log_warn("Ignoring truncated kernel cache file \"%s\".", filename.string().c_str());
+            binary.clear();
+            return false;
+        }
+
+        return true;
+    }
+
+    void StoreKernelBinary(const std::string &cacheDirectory,
+                           const std::string &key,
+                           const std::vector<unsigned char> &binary)
+    {
+        if (binary.empty()) return;
+
+        const fs::path filename = CacheFilePath(cacheDirectory, key);
+
+        // unique for every writer (other processes as well as other
+        // converters in this process)
+        boost::system::error_code uniqueError;
+        const fs::path tempFilename = fs::unique_path(fs::path(filename.string() + ".tmp-%%%%-%%%%-%%%%-%%%%"), uniqueError);
+        if (uniqueError) {
+            log_warn("Could not store the compiled kernel in the cache: %s", uniqueError.message().c_str());
+            return;
+        }
+
+        try {
+            fs::create_directories(fs::path(cacheDirectory));
+
+            {
+                std::ofstream ofs(tempFilename.string().c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+                ofs << cacheFileMagic << '\n' << key << '\n' << binary.size() << '\n';
+                ofs.write(reinterpret_cast<const char *>(&(binary[0])), binary.size());
+                ofs.close();
+                if (ofs.fail()) {
+                    log_warn("Could not write kernel cache file \"%s\".", tempFilename.string().c_str());
+                    fs::remove(tempFilename);
+                    return;
+                }
+            }
+
+            // atomic (on POSIX file systems)
+            fs::rename(tempFilename, filename);
+        } catch (fs::filesystem_error &err) {
+            log_warn("Could not store the compiled kernel in the cache: %s", err.what());
+
+            boost::system::error_code ec;
+            fs::remove(tempFilename, ec);
+            return;
+        }
+
+        log_debug("compiled kernel stored as \"%s\"", filename.string().c_str());
+    }
+}
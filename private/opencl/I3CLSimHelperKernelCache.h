@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ *
+ * @file I3CLSimHelperKernelCache.h
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#ifndef I3CLSIMHELPERKERNELCACHE_H_INCLUDED
+#define I3CLSIMHELPERKERNELCACHE_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+namespace I3CLSimHelper
+{
+    /**
+     * Returns the cache key (32 hex digits) for a compiled kernel.
+     * The key is a hash of the full kernel source, the build options
+     * and a string identifying the device and driver. Any change
+     * to any of them (medium, geometry, options, driver update..)
+     * gives a new key.
+     */
+    std::string KernelCacheKey(const std::string &source,
+                               const std::string &buildOptions,
+                               const std::string &deviceIdentity);
+
+    /**
+     * Loads a kernel binary from the cache directory. Returns
+     * false if there is no (valid) entry for the key.
+     */
+    bool LoadKernelBinary(const std::string &cacheDirectory,
+                          const std::string &key,
+                          std::vector<unsigned char> &binary);
+
+    /**
+     * Stores a kernel binary in the cache directory (which is
+     * created if necessary). The file is written under a
+     * temporary name and renamed, so jobs sharing a cache
+     * directory never see partially written entries.
+     * Failures are logged, but never fatal.
+     */
+    void StoreKernelBinary(const std::string &cacheDirectory,
+                           const std::string &key,
+                           const std::vector<unsigned char> &binary);
+}
+
+#endif //I3CLSIMHELPERKERNELCACHE_H_INCLUDED
@@ -54,6 +54,12 @@
 #include "opencl/I3CLSimHelperLoadProgramSource.h"
 #include "opencl/I3CLSimHelperGenerateMediumPropertiesSource.h"
 #include "opencl/I3CLSimHelperGenerateGeometrySource.h"
+#include "opencl/I3CLSimHelperCompressSteps.h"
+#include "opencl/I3CLSimHelperCompactPhotons.h"
+#include "opencl/I3CLSimHelperKernelCache.h"
+#include "opencl/I3CLSimHelperGenerateShadowGeometrySource.h"
+
+#include "clsim/shadow/I3ExtraGeometryBVH.h"
 
 #include "opencl/mwcrng_init.h"
 
@@ -73,6 +79,7 @@ statistics_total_host_duration_in_nanoseconds_(0),
 statistics_total_kernel_calls_(0),
 statistics_total_num_photons_generated_(0),
 statistics_total_num_photons_atDOMs_(0),
+statistics_total_num_photons_rerun_(0),
 openCLStarted_(false),
 queueToOpenCL_(new I3CLSimQueue<ToOpenCLPair_t>(5)),
 queueFromOpenCL_(new I3CLSimQueue<I3CLSimStepToPhotonConverter::ConversionResult_t>(0)),
@@ -89,6 +96,14 @@ saveAllPhotonsPrescale_(0.001), // only save .1% of all photons when in "AllPhot
 fixedNumberOfAbsorptionLengths_(NAN),
 pancakeFactor_(1.),
 photonHistoryEntries_(0),
+compressSteps_(false),
+photonChunkSize_(0),
+counterBasedRNG_(false),
+counterBasedRNGKey_(0),
+opticalDepthTables_(false),
+compactPhotons_(false),
+kernelCacheDirectory_(""),
+shadowGeometry_(),
 maxWorkgroupSize_(0),
 workgroupSize_(0),
 maxNumWorkitems_(10240)
@@ -101,6 +116,7 @@ maxNumWorkitems_(10240)
     
     try {
         mwcrngKernelSource_ = I3CLSimHelper::LoadProgramSource(kernelBaseDir+"/mwcrng_kernel.cl");
+        philoxKernelSource_ = I3CLSimHelper::LoadProgramSource(kernelBaseDir+"/philox_kernel.cl");
     } catch (std::runtime_error &e) {
         throw I3CLSimStepToPhotonConverter_exception((std::string("Could not load kernel: ") + e.what()).c_str());
     }
@@ -133,6 +149,9 @@ I3CLSimStepToPhotonConverterOpenCL::~I3CLSimStepToPhotonConverterOpenCL()
     deviceBuffer_OutputPhotons.clear();
     deviceBuffer_CurrentNumOutputPhotons.clear();
     deviceBuffer_PhotonHistory.clear();
+    deviceBuffer_InputStepGroups.clear();
+    deviceBuffer_StepChunkStart.clear();
+    deviceBuffer_PhotonChunkCounter.clear();
 
     deviceBuffer_GeoLayerToOMNumIndexPerStringSet.reset();
     
@@ -247,14 +266,16 @@ void I3CLSimStepToPhotonConverterOpenCL::Initialize()
         maxNumOutputPhotons_ = static_cast<uint32_t>(std::min(maxNumWorkitems_*sizeIncreaseFactor, static_cast<std::size_t>(std::numeric_limits<uint32_t>::max())));
     }
     
-    // set up rng
-    log_debug("Setting up RNG for %zu workitems.", maxNumWorkitems_);
-    
-    MWC_RNG_x.resize(maxNumWorkitems_);
-    MWC_RNG_a.resize(maxNumWorkitems_);
-    
-    if (init_MWC_RNG(&(MWC_RNG_x[0]), &(MWC_RNG_a[0]), maxNumWorkitems_, randomService_)!=0) 
-        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+    // set up rng (the counter-based generator has no state)
+    if (!counterBasedRNG_) {
+        log_debug("Setting up RNG for %zu workitems.", maxNumWorkitems_);
+        
+        MWC_RNG_x.resize(maxNumWorkitems_);
+        MWC_RNG_a.resize(maxNumWorkitems_);
+        
+        if (init_MWC_RNG(&(MWC_RNG_x[0]), &(MWC_RNG_a[0]), maxNumWorkitems_, randomService_)!=0) 
+            throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+    }
     
     log_debug("RNG is set up..");
     
@@ -267,15 +288,20 @@ void I3CLSimStepToPhotonConverterOpenCL::Initialize()
     deviceBuffer_OutputPhotons.clear();
     deviceBuffer_PhotonHistory.clear();
     deviceBuffer_CurrentNumOutputPhotons.clear();
+    deviceBuffer_InputStepGroups.clear();
+    deviceBuffer_StepChunkStart.clear();
+    deviceBuffer_PhotonChunkCounter.clear();
     deviceBuffer_GeoLayerToOMNumIndexPerStringSet.reset();
     
     
     // set up device buffers from existing host buffers
-    deviceBuffer_MWC_RNG_x = boost::shared_ptr<cl::Buffer>
-    (new cl::Buffer(*context_, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, MWC_RNG_x.size() * sizeof(uint64_t), &(MWC_RNG_x[0])));
-    
-    deviceBuffer_MWC_RNG_a = boost::shared_ptr<cl::Buffer>
-    (new cl::Buffer(*context_, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, MWC_RNG_a.size() * sizeof(uint32_t), &(MWC_RNG_a[0])));
+    if (!counterBasedRNG_) {
+        deviceBuffer_MWC_RNG_x = boost::shared_ptr<cl::Buffer>
+        (new cl::Buffer(*context_, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, MWC_RNG_x.size() * sizeof(uint64_t), &(MWC_RNG_x[0])));
+        
+        deviceBuffer_MWC_RNG_a = boost::shared_ptr<cl::Buffer>
+        (new cl::Buffer(*context_, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, MWC_RNG_a.size() * sizeof(uint32_t), &(MWC_RNG_a[0])));
+    }
     
     if (!saveAllPhotons_) {
         // no need for a geometry buffer if all photons are saved and no
@@ -286,6 +312,11 @@ void I3CLSimStepToPhotonConverterOpenCL::Initialize()
     
     const unsigned int numBuffers = disableDoubleBuffering_?1:2;
     
+    maxNumOutputPhotonsPerBuffer_.assign(numBuffers, maxNumOutputPhotons_);
+    numInputStepGroups_.assign(numBuffers, 0);
+    numInputSteps_.assign(numBuffers, 0);
+    numPhotonChunks_.assign(numBuffers, 0);
+    
     // allocate empty buffers on the device
     for (unsigned int i=0;i<numBuffers;++i)
     {
@@ -293,11 +324,26 @@ void I3CLSimStepToPhotonConverterOpenCL::Initialize()
         (new cl::Buffer(*context_, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, maxNumWorkitems_*sizeof(I3CLSimStep), NULL)));
         
         deviceBuffer_OutputPhotons.push_back(boost::shared_ptr<cl::Buffer>
-        (new cl::Buffer(*context_, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, maxNumOutputPhotons_*sizeof(I3CLSimPhoton), NULL)));
+        (new cl::Buffer(*context_, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, maxNumOutputPhotons_*(compactPhotons_?sizeof(I3CLSimCompactPhoton):sizeof(I3CLSimPhoton)), NULL)));
         
         deviceBuffer_CurrentNumOutputPhotons.push_back(boost::shared_ptr<cl::Buffer>
         (new cl::Buffer(*context_, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sizeof(uint32_t), NULL)));
 
+        if (compressSteps_) {
+            // compressed bunches are only uploaded if they are smaller than
+            // the plain ones, so there are always fewer headers than steps
+            deviceBuffer_InputStepGroups.push_back(boost::shared_ptr<cl::Buffer>
+            (new cl::Buffer(*context_, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, maxNumWorkitems_*sizeof(I3CLSimStepGroupHeader), NULL)));
+        }
+
+        if (photonChunkSize_>0) {
+            deviceBuffer_StepChunkStart.push_back(boost::shared_ptr<cl::Buffer>
+            (new cl::Buffer(*context_, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, (maxNumWorkitems_+1)*sizeof(uint32_t), NULL)));
+
+            deviceBuffer_PhotonChunkCounter.push_back(boost::shared_ptr<cl::Buffer>
+            (new cl::Buffer(*context_, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sizeof(uint32_t), NULL)));
+        }
+
         if (photonHistoryEntries_>0) {
             deviceBuffer_PhotonHistory.push_back
             (boost::shared_ptr<cl::Buffer>
@@ -316,25 +362,7 @@ void I3CLSimStepToPhotonConverterOpenCL::Initialize()
     log_debug("Configuring kernel.");
     for (unsigned int i=0;i<numBuffers;++i)
     {
-        unsigned argN=0;
-        
-        kernel_[i]->setArg(argN++, *(deviceBuffer_CurrentNumOutputPhotons[i]));     // hit counter
-        kernel_[i]->setArg(argN++, maxNumOutputPhotons_);                           // maximum number of possible hits
-        
-        if (!saveAllPhotons_) {
-            kernel_[i]->setArg(argN++, *deviceBuffer_GeoLayerToOMNumIndexPerStringSet); // additional geometry information (did not fit into constant memory)
-        }
-        
-        kernel_[i]->setArg(argN++, *(deviceBuffer_InputSteps[i]));                  // the input steps
-        kernel_[i]->setArg(argN++, *(deviceBuffer_OutputPhotons[i]));               // the output photons
-
-        if (photonHistoryEntries_>0) {
-            kernel_[i]->setArg(argN++, *(deviceBuffer_PhotonHistory[i]));           // the photon history (the last N points where the photon scattered)
-        }
-
-        kernel_[i]->setArg(argN++, *deviceBuffer_MWC_RNG_x);                    // rng state
-        kernel_[i]->setArg(argN++, *deviceBuffer_MWC_RNG_a);                    // rng state
-
+        SetKernelArgs(i);
     }
     log_debug("Kernel configured.");
     
@@ -385,6 +413,30 @@ std::string I3CLSimStepToPhotonConverterOpenCL::GetPreambleSource()
     }
     
     
+    // steps may be uploaded in the compressed format
+    if (compressSteps_) {
+        preamble = preamble + "#define COMPRESSED_STEPS\n";
+        preamble = preamble + "#define COMPRESSED_STEP_POS_QUANTUM " + ToFloatString(compressedStepPosQuantum) + "\n";
+        preamble = preamble + "#define COMPRESSED_STEP_TIME_QUANTUM " + ToFloatString(compressedStepTimeQuantum) + "\n";
+        preamble = preamble + "#define COMPRESSED_STEP_THETA_QUANTUM " + ToFloatString(compressedStepThetaQuantum) + "\n";
+        preamble = preamble + "#define COMPRESSED_STEP_PHI_QUANTUM " + ToFloatString(compressedStepPhiQuantum) + "\n";
+    }
+    
+    // random numbers are a function of the step and the photon index
+    if (counterBasedRNG_) {
+        preamble = preamble + "#define COUNTER_BASED_RNG\n";
+    }
+    
+    // work items pull chunks of photons instead of propagating one step each
+    if (photonChunkSize_>0) {
+        preamble = preamble + "#define PHOTON_CHUNK_SIZE " + boost::lexical_cast<std::string>(photonChunkSize_) + "\n";
+    }
+    
+    // photons may be written in the reduced-precision format
+    if (compactPhotons_) {
+        preamble = preamble + "#define COMPACT_PHOTONS\n";
+    }
+    
     // should the photon history be saved?
     if (photonHistoryEntries_>0) {
         preamble = preamble + "#define SAVE_PHOTON_HISTORY\n";
@@ -426,21 +478,40 @@ std::string I3CLSimStepToPhotonConverterOpenCL::GetWlenBiasSource()
 
 std::string I3CLSimStepToPhotonConverterOpenCL::GetMediumPropertiesSource()
 {
-    return I3CLSimHelper::GenerateMediumPropertiesSource(*mediumProperties_);
+    return I3CLSimHelper::GenerateMediumPropertiesSource(*mediumProperties_, opticalDepthTables_);
 }
 
 std::string I3CLSimStepToPhotonConverterOpenCL::GetGeometrySource()
 {
     if (!saveAllPhotons_) {
-        return I3CLSimHelper::GenerateGeometrySource(*geometry_,
-                                                      geoLayerToOMNumIndexPerStringSetInfo_,
-                                                      stringIndexToStringIDBuffer_,
-                                                      domIndexToDomIDBuffer_perStringIndex_);
+        const std::string source =
+        I3CLSimHelper::GenerateGeometrySource(*geometry_,
+                                              geoLayerToOMNumIndexPerStringSetInfo_,
+                                              stringIndexToStringIDBuffer_,
+                                              domIndexToDomIDBuffer_perStringIndex_,
+                                              domPositionsPerStringIndex_);
+        
+        // compact photons are stored relative to their DOM as
+        // seen by the kernel, keep those positions to decode them
+        if (!compactPhotons_) domPositionsPerStringIndex_.clear();
+        
+        return source;
     } else {
         return std::string("");
     }
 }
 
+std::string I3CLSimStepToPhotonConverterOpenCL::GetShadowGeometrySource()
+{
+    const I3ExtraGeometryBVH bvh(shadowGeometry_);
+    
+    try {
+        return I3CLSimHelper::GenerateShadowGeometrySource(bvh);
+    } catch (std::runtime_error &e) {
+        throw I3CLSimStepToPhotonConverter_exception(e.what());
+    }
+}
+
 static std::string 
 loadKernel(const std::string& name, bool header)
 {
@@ -480,6 +551,9 @@ void I3CLSimStepToPhotonConverterOpenCL::Compile()
     if ((saveAllPhotons_) && (stopDetectedPhotons_))
         throw I3CLSimStepToPhotonConverter_exception("Internal error: both the saveAllPhotons and stopDetectedPhotons options are set at the same time.");
     
+    if ((compactPhotons_) && ((saveAllPhotons_) || (photonHistoryEntries_>0)))
+        throw I3CLSimStepToPhotonConverter_exception("The compact photon format cannot be used with saveAllPhotons or photon histories.");
+    
     prependSource_ = this->GetPreambleSource();
     wlenGeneratorSource_ = this->GetWlenGeneratorSource();
     wlenBiasSource_ = this->GetWlenBiasSource();
@@ -492,11 +566,22 @@ void I3CLSimStepToPhotonConverterOpenCL::Compile()
         geometrySource_ = "";
     }
     
+    if (shadowGeometry_) {
+        shadowGeometrySource_ = this->GetShadowGeometrySource();
+    } else {
+        shadowGeometrySource_ = "";
+    }
+    
     propagationKernelSource_  = loadKernel("propagation_kernel", true);
+    propagationKernelSource_ += loadKernel("medium_propagation", true);
     if (!saveAllPhotons_) {
         propagationKernelSource_ += this->GetCollisionDetectionSource(true);
         propagationKernelSource_ += this->GetCollisionDetectionSource(false);
     }
+    if (shadowGeometry_) {
+        propagationKernelSource_ += loadKernel("shadow_geometry", false);
+    }
+    propagationKernelSource_ += loadKernel("medium_propagation", false);
     propagationKernelSource_ += loadKernel("propagation_kernel", false);
     
     SetupQueueAndKernel(*(device_->GetPlatformHandle()),
@@ -510,11 +595,12 @@ std::string I3CLSimStepToPhotonConverterOpenCL::GetFullSource()
     std::ostringstream code;
     
     code << prependSource_;
-    code << mwcrngKernelSource_;
+    code << (counterBasedRNG_?philoxKernelSource_:mwcrngKernelSource_);
     code << wlenGeneratorSource_;
     code << wlenBiasSource_;
     code << mediumPropertiesSource_;
     code << geometrySource_;
+    code << shadowGeometrySource_;
     code << propagationKernelSource_;
     
     return code.str();
@@ -622,62 +708,110 @@ void I3CLSimStepToPhotonConverterOpenCL::SetupQueueAndKernel(const cl::Platform
         BuildOptions += "-DNO_FLASHER ";
     }
 
+    // combine into a single string first to work around Intel OpenCL
+    // compiler issues (as found on OSX 10.11 for example)
+    std::string combined_source;
+    combined_source += prependSource_ + "\n";
+    combined_source += (counterBasedRNG_?philoxKernelSource_:mwcrngKernelSource_) + "\n";
+    combined_source += wlenGeneratorSource_ + "\n";
+    combined_source += wlenBiasSource_ + "\n";
+    combined_source += mediumPropertiesSource_ + "\n";
+    if (!saveAllPhotons_) {
+        combined_source += geometrySource_ + "\n";
+    }
+    combined_source += shadowGeometrySource_ + "\n";
+    combined_source += propagationKernelSource_ + "\n";
+    
     cl::Program program;
-    try {
-        // build the program
-
-        // combine into a single string first to work around Intel OpenCL
-        // compiler issues (as found on OSX 10.11 for example)
-        std::string combined_source;
-        combined_source += prependSource_ + "\n";
-        combined_source += mwcrngKernelSource_ + "\n";
-        combined_source += wlenGeneratorSource_ + "\n";
-        combined_source += wlenBiasSource_ + "\n";
-        combined_source += mediumPropertiesSource_ + "\n";
-        if (!saveAllPhotons_) {
-            combined_source += geometrySource_ + "\n";
-        }
-        combined_source += propagationKernelSource_ + "\n";
+    bool programBuilt=false;
+    
+    // try the binary cache first. The key covers the full source (i.e. the
+    // medium, geometry and all options), the build options and the driver.
+    std::string kernelCacheKey;
+    if (!kernelCacheDirectory_.empty()) {
+        const std::string deviceIdentity =
+        device_->GetPlatformName() + "\n" + device_->GetDeviceName() + "\n" +
+        device_->GetDeviceVersion() + "\n" + device_->GetDriverVersion();
+        kernelCacheKey = I3CLSimHelper::KernelCacheKey(combined_source, BuildOptions, deviceIdentity);
         
-        cl::Program::Sources source;
-        source.push_back(std::make_pair(combined_source.c_str(),combined_source.size()));
+        std::vector<unsigned char> binary;
+        if (I3CLSimHelper::LoadKernelBinary(kernelCacheDirectory_, kernelCacheKey, binary)) {
+            try {
+                cl::Program::Binaries binaries(1, std::make_pair(static_cast<const void *>(&(binary[0])), binary.size()));
+                program = cl::Program(*context_, devices, binaries);
+                program.build(devices, BuildOptions.c_str());
+                programBuilt=true;
+                log_info("Using the cached kernel binary %s", kernelCacheKey.c_str());
+            } catch (cl::Error &err) {
+                log_warn("Could not use the cached kernel binary %s (%s (%i)), compiling from source.",
+                         kernelCacheKey.c_str(), err.what(), err.err());
+            }
+        } else {
+            log_info("No cached kernel binary for %s, compiling from source.", kernelCacheKey.c_str());
+        }
+    }
+    
+    if (!programBuilt) {
+        try {
+            // build the program
+            cl::Program::Sources source;
+            source.push_back(std::make_pair(combined_source.c_str(),combined_source.size()));
         
-        program = cl::Program(*context_, source);
-        log_debug("building...");
-        program.build(devices, BuildOptions.c_str());
-        log_debug("...building finished.");
+            program = cl::Program(*context_, source);
+            log_debug("building...");
+            program.build(devices, BuildOptions.c_str());
+            log_debug("...building finished.");
         
-        if (nvidiaVerboseCompile) {
-            std::string deviceName = device.getInfo<CL_DEVICE_NAME>();
+            if (nvidiaVerboseCompile) {
+                std::string deviceName = device.getInfo<CL_DEVICE_NAME>();
 #ifdef I3_LOG4CPLUS_LOGGING
-            // using LOG_IMPL will make this work even in Release build mode:
-            LOG_IMPL(INFO, "  * build status on %s\"", deviceName.c_str());
-            LOG_IMPL(INFO, "==============================");
-            LOG_IMPL(INFO, "Build Status: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device)).c_str());
-            LOG_IMPL(INFO, "Build Options: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(device)).c_str());
-            LOG_IMPL(INFO, "Build Log: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device)).c_str());
-            LOG_IMPL(INFO, "==============================");
+                // using LOG_IMPL will make this work even in Release build mode:
+                LOG_IMPL(INFO, "  * build status on %s\"", deviceName.c_str());
+                LOG_IMPL(INFO, "==============================");
+                LOG_IMPL(INFO, "Build Status: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device)).c_str());
+                LOG_IMPL(INFO, "Build Options: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(device)).c_str());
+                LOG_IMPL(INFO, "Build Log: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device)).c_str());
+                LOG_IMPL(INFO, "==============================");
 #else
-            log_info("  * build status on %s\"", deviceName.c_str());
-            log_info("==============================");
-            log_info("Build Status: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device)).c_str());
-            log_info("Build Options: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(device)).c_str());
-            log_info("Build Log: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device)).c_str());
-            log_info("==============================");
+                log_info("  * build status on %s\"", deviceName.c_str());
+                log_info("==============================");
+                log_info("Build Status: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device)).c_str());
+                log_info("Build Options: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(device)).c_str());
+                log_info("Build Log: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device)).c_str());
+                log_info("==============================");
 #endif
-        }
-    } catch (cl::Error &err) {
-        log_error("OpenCL ERROR (compile): %s (%i)", err.what(), err.err());
+            }
+        } catch (cl::Error &err) {
+            log_error("OpenCL ERROR (compile): %s (%i)", err.what(), err.err());
         
-        std::string deviceName = device.getInfo<CL_DEVICE_NAME>();
-        log_error("  * build status on %s\"", deviceName.c_str());
-        log_error("==============================");
-        log_error("Build Status: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device)).c_str());
-        log_error("Build Options: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(device)).c_str());
-        log_error("Build Log: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device)).c_str());
-        log_error("==============================");
+            std::string deviceName = device.getInfo<CL_DEVICE_NAME>();
+            log_error("  * build status on %s\"", deviceName.c_str());
+            log_error("==============================");
+            log_error("Build Status: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device)).c_str());
+            log_error("Build Options: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(device)).c_str());
+            log_error("Build Log: %s", boost::lexical_cast<std::string>(program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device)).c_str());
+            log_error("==============================");
         
-        throw I3CLSimStepToPhotonConverter_exception("OpenCL error: could build the OpenCL program!");;
+            throw I3CLSimStepToPhotonConverter_exception("OpenCL error: could build the OpenCL program!");;
+        }
+        
+        if (!kernelCacheDirectory_.empty()) {
+            // a single device, so there is a single binary
+            std::size_t binarySize=0;
+            cl_int err = clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(std::size_t), &binarySize, NULL);
+            if ((err == CL_SUCCESS) && (binarySize > 0)) {
+                std::vector<unsigned char> binary(binarySize);
+                unsigned char *binaryPtr = &(binary[0]);
+                err = clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(unsigned char *), &binaryPtr, NULL);
+                if (err == CL_SUCCESS) {
+                    I3CLSimHelper::StoreKernelBinary(kernelCacheDirectory_, kernelCacheKey, binary);
+                } else {
+                    log_warn("Could not retrieve the compiled kernel binary (%i), not caching it.", err);
+                }
+            } else {
+                log_warn("The OpenCL driver does not provide a kernel binary (%i), not caching it.", err);
+            }
+        }
     }
     log_debug("code compiled.");
     
@@ -733,6 +867,82 @@ void I3CLSimStepToPhotonConverterOpenCL::SetupQueueAndKernel(const cl::Platform
 }
 
 
+void I3CLSimStepToPhotonConverterOpenCL::SetKernelArgs(unsigned int bufferIndex)
+{
+    unsigned argN=0;
+    
+    kernel_[bufferIndex]->setArg(argN++, *(deviceBuffer_CurrentNumOutputPhotons[bufferIndex]));     // hit counter
+    kernel_[bufferIndex]->setArg(argN++, maxNumOutputPhotonsPerBuffer_[bufferIndex]);               // maximum number of possible hits
+    
+    if (!saveAllPhotons_) {
+        kernel_[bufferIndex]->setArg(argN++, *deviceBuffer_GeoLayerToOMNumIndexPerStringSet); // additional geometry information (did not fit into constant memory)
+    }
+    
+    kernel_[bufferIndex]->setArg(argN++, *(deviceBuffer_InputSteps[bufferIndex]));                  // the input steps
+    if (compressSteps_) {
+        kernel_[bufferIndex]->setArg(argN++, *(deviceBuffer_InputStepGroups[bufferIndex]));         // the step group headers
+        kernel_[bufferIndex]->setArg(argN++, numInputStepGroups_[bufferIndex]);                     // the number of step group headers (0: steps are not compressed)
+    }
+    if (photonChunkSize_>0) {
+        kernel_[bufferIndex]->setArg(argN++, *(deviceBuffer_StepChunkStart[bufferIndex]));          // the first photon chunk of each step
+        kernel_[bufferIndex]->setArg(argN++, numInputSteps_[bufferIndex]);                          // the number of steps
+        kernel_[bufferIndex]->setArg(argN++, *(deviceBuffer_PhotonChunkCounter[bufferIndex]));      // the next photon chunk to propagate
+    }
+    kernel_[bufferIndex]->setArg(argN++, *(deviceBuffer_OutputPhotons[bufferIndex]));               // the output photons
+
+    if (photonHistoryEntries_>0) {
+        kernel_[bufferIndex]->setArg(argN++, *(deviceBuffer_PhotonHistory[bufferIndex]));           // the photon history (the last N points where the photon scattered)
+    }
+
+    if (counterBasedRNG_) {
+        kernel_[bufferIndex]->setArg(argN++, static_cast<cl_uint>(counterBasedRNGKey_ & 0xfffffffful)); // rng key
+        kernel_[bufferIndex]->setArg(argN++, static_cast<cl_uint>(counterBasedRNGKey_ >> 32));          // rng key
+    } else {
+        kernel_[bufferIndex]->setArg(argN++, *deviceBuffer_MWC_RNG_x);                    // rng state
+        kernel_[bufferIndex]->setArg(argN++, *deviceBuffer_MWC_RNG_a);                    // rng state
+    }
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::GrowOutputBuffers(unsigned int bufferIndex, uint32_t minNumOutputPhotons)
+{
+    // leave some headroom so the next large bunch does not immediately overflow again
+    const uint64_t newSizeWithHeadroom = static_cast<uint64_t>(minNumOutputPhotons) + static_cast<uint64_t>(minNumOutputPhotons)/2;
+    const uint32_t newSize = static_cast<uint32_t>(std::min(newSizeWithHeadroom, static_cast<uint64_t>(std::numeric_limits<uint32_t>::max())));
+
+#ifdef I3_LOG4CPLUS_LOGGING
+    LOG_IMPL(INFO, "[%u] growing the output buffer from %" PRIu32 " to %" PRIu32 " photons",
+             bufferIndex, maxNumOutputPhotonsPerBuffer_[bufferIndex], newSize);
+#else
+    log_info("[%u] growing the output buffer from %" PRIu32 " to %" PRIu32 " photons",
+             bufferIndex, maxNumOutputPhotonsPerBuffer_[bufferIndex], newSize);
+#endif
+
+    try {
+        // release the old buffers first
+        deviceBuffer_OutputPhotons[bufferIndex].reset();
+        if (photonHistoryEntries_>0) deviceBuffer_PhotonHistory[bufferIndex].reset();
+
+        deviceBuffer_OutputPhotons[bufferIndex] = boost::shared_ptr<cl::Buffer>
+        (new cl::Buffer(*context_, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, static_cast<std::size_t>(newSize)*(compactPhotons_?sizeof(I3CLSimCompactPhoton):sizeof(I3CLSimPhoton)), NULL));
+
+        if (photonHistoryEntries_>0) {
+            deviceBuffer_PhotonHistory[bufferIndex] = boost::shared_ptr<cl::Buffer>
+            (new cl::Buffer(*context_,
+                            CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                            static_cast<std::size_t>(newSize)*static_cast<std::size_t>(photonHistoryEntries_)*sizeof(cl_float4),
+                            NULL
+                           )
+            );
+        }
+
+        maxNumOutputPhotonsPerBuffer_[bufferIndex] = newSize;
+        SetKernelArgs(bufferIndex);
+    } catch (cl::Error &err) {
+        log_fatal("[%u] OpenCL ERROR (growing the output buffer to %" PRIu32 " photons): %s (%i)",
+                  bufferIndex, newSize, err.what(), err.err());
+    }
+}
+
 void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread()
 {
     // do not interrupt this thread by default
@@ -864,11 +1074,65 @@ bool I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_uploadSteps(boost::th
     out_totalNumberOfPhotons = 0;
 #endif //DUMP_STATISTICS
     
+    // compress the steps if that is enabled and worth it. These
+    // need to stay around until the copy has finished.
+    std::vector<I3CLSimCompressedStep> compressedSteps;
+    std::vector<I3CLSimStepGroupHeader> stepGroupHeaders;
+    bool useCompressedSteps = false;
+    if (compressSteps_) {
+        useCompressedSteps = CompressSteps(*steps, compressedSteps, stepGroupHeaders, counterBasedRNG_);
+        
+        const uint32_t numInputStepGroups = useCompressedSteps?static_cast<uint32_t>(stepGroupHeaders.size()):0;
+        if (numInputStepGroups != numInputStepGroups_[bufferIndex]) {
+            numInputStepGroups_[bufferIndex] = numInputStepGroups;
+            SetKernelArgs(bufferIndex);
+        }
+        
+        log_trace("[%u] %zu steps, %s (%zu groups)", bufferIndex, steps->size(),
+                  useCompressedSteps?"compressed":"not compressed", stepGroupHeaders.size());
+    }
+    
+    // split the photons of all steps into chunks. The kernel finds the step
+    // of a chunk using the index of the first chunk of each step.
+    std::vector<uint32_t> stepChunkStart;
+    if (photonChunkSize_>0) {
+        stepChunkStart.resize(steps->size()+1);
+        uint32_t numPhotonChunks=0;
+        for (std::size_t j=0;j<steps->size();++j)
+        {
+            const uint32_t numPhotons = (*steps)[j].numPhotons;
+            stepChunkStart[j]=numPhotonChunks;
+            numPhotonChunks += numPhotons/photonChunkSize_ + ((numPhotons%photonChunkSize_ != 0)?1:0);
+        }
+        stepChunkStart[steps->size()]=numPhotonChunks;
+        numPhotonChunks_[bufferIndex]=numPhotonChunks;
+        
+        const uint32_t numInputSteps = static_cast<uint32_t>(steps->size());
+        if (numInputSteps != numInputSteps_[bufferIndex]) {
+            numInputSteps_[bufferIndex] = numInputSteps;
+            SetKernelArgs(bufferIndex);
+        }
+        
+        log_trace("[%u] %zu steps, %" PRIu32 " photon chunks", bufferIndex, steps->size(), numPhotonChunks);
+    }
+    
     log_trace("[%u] copy steps to device", bufferIndex);
     // copy steps to device
     try {
         queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_CurrentNumOutputPhotons[bufferIndex], CL_FALSE, 0, sizeof(uint32_t), &zeroCounterBufferSource, NULL, &(bufferWriteEvents[0]));
-        queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_InputSteps[bufferIndex], CL_FALSE, 0, steps->size()*sizeof(I3CLSimStep), &((*steps)[0]), NULL, &(bufferWriteEvents[1]));
+        if (useCompressedSteps) {
+            bufferWriteEvents.resize(3);
+            queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_InputSteps[bufferIndex], CL_FALSE, 0, compressedSteps.size()*sizeof(I3CLSimCompressedStep), &(compressedSteps[0]), NULL, &(bufferWriteEvents[1]));
+            queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_InputStepGroups[bufferIndex], CL_FALSE, 0, stepGroupHeaders.size()*sizeof(I3CLSimStepGroupHeader), &(stepGroupHeaders[0]), NULL, &(bufferWriteEvents[2]));
+        } else {
+            queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_InputSteps[bufferIndex], CL_FALSE, 0, steps->size()*sizeof(I3CLSimStep), &((*steps)[0]), NULL, &(bufferWriteEvents[1]));
+        }
+        if (photonChunkSize_>0) {
+            const std::size_t firstEvent = bufferWriteEvents.size();
+            bufferWriteEvents.resize(firstEvent+2);
+            queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_StepChunkStart[bufferIndex], CL_FALSE, 0, stepChunkStart.size()*sizeof(uint32_t), &(stepChunkStart[0]), NULL, &(bufferWriteEvents[firstEvent]));
+            queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_PhotonChunkCounter[bufferIndex], CL_FALSE, 0, sizeof(uint32_t), &zeroCounterBufferSource, NULL, &(bufferWriteEvents[firstEvent+1]));
+        }
         queue_[bufferIndex]->flush(); // make sure it starts executing on the device
         
         log_trace("[%u] waiting for copy to finish", bufferIndex);
@@ -887,6 +1151,16 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_runKernel(unsigned in
                                                                      cl::Event &kernelFinishEvent,
                                                                      std::size_t numberOfInputSteps)
 {
+    // With photon chunks, start as many work items as there are chunks
+    // (rounded up to whole work groups), but no more than we have RNG
+    // states for. Each of them keeps pulling chunks until all are done.
+    std::size_t numberOfWorkitems = numberOfInputSteps;
+    if (photonChunkSize_>0) {
+        const std::size_t numChunkWorkitems =
+            ((static_cast<std::size_t>(numPhotonChunks_[bufferIndex])+workgroupSize_-1)/workgroupSize_)*workgroupSize_;
+        numberOfWorkitems = std::max(workgroupSize_, std::min(maxNumWorkitems_, numChunkWorkitems));
+    }
+    
     // run the kernel
     log_trace("[%u] enqueuing kernel..", bufferIndex);
 
@@ -894,7 +1168,7 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_runKernel(unsigned in
         // configure which input buffers to use
         queue_[bufferIndex]->enqueueNDRangeKernel(*(kernel_[bufferIndex]), 
                                                   cl::NullRange,    // current implementations force this to be NULL
-                                                  cl::NDRange(numberOfInputSteps),  // number of work items
+                                                  cl::NDRange(numberOfWorkitems),  // number of work items
                                                   cl::NDRange(workgroupSize_),
                                                   NULL, //&(bufferWriteEvents),  // wait for buffers to be filled
                                                   &kernelFinishEvent); // signal when finished
@@ -967,21 +1241,77 @@ namespace {
 void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_downloadPhotons(boost::this_thread::disable_interruption &di,
                                                                            bool &shouldBreak,
                                                                            unsigned int bufferIndex,
-                                                                           uint32_t stepsIdentifier)
+                                                                           uint32_t stepsIdentifier,
+                                                                           uint64_t totalNumberOfPhotons,
+                                                                           std::size_t numberOfInputSteps)
 {
     shouldBreak=false;
    
     I3CLSimPhotonSeriesPtr photons;
     I3CLSimPhotonHistorySeriesPtr photonHistories;
     boost::shared_ptr<std::vector<cl_float4> > photonHistoriesRaw;
+    std::vector<I3CLSimCompactPhoton> compactPhotons;
     
     try {
         uint32_t numberOfGeneratedPhotons;
+        for (;;)
         {
-            cl::Event copyComplete;
-            queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_CurrentNumOutputPhotons[bufferIndex], CL_FALSE, 0, sizeof(uint32_t), &numberOfGeneratedPhotons, NULL, &copyComplete);
-            queue_[bufferIndex]->flush(); // make sure it starts executing on the device
-            waitForOpenCLEventYield(copyComplete);
+            {
+                cl::Event copyComplete;
+                queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_CurrentNumOutputPhotons[bufferIndex], CL_FALSE, 0, sizeof(uint32_t), &numberOfGeneratedPhotons, NULL, &copyComplete);
+                queue_[bufferIndex]->flush(); // make sure it starts executing on the device
+                waitForOpenCLEventYield(copyComplete);
+            }
+            
+            if (numberOfGeneratedPhotons <= maxNumOutputPhotonsPerBuffer_[bufferIndex]) break;
+            
+            // The kernel dropped all photons that did not fit into the output buffer.
+            // Discard the whole result, grow the buffer and run the kernel on the same
+            // steps again. (They are still on the device, the kernel does not modify them.)
+            // Keeping the photons that did fit would bias the result.
+            log_warn("[%u] Maximum number of photons exceeded (%" PRIu32 " of %" PRIu32 " photons fit into the output buffer), re-running the kernel with a larger buffer",
+                     bufferIndex, maxNumOutputPhotonsPerBuffer_[bufferIndex], numberOfGeneratedPhotons);
+            
+            GrowOutputBuffers(bufferIndex, numberOfGeneratedPhotons);
+            
+            {
+                const uint32_t zeroCounterBufferSource=0;
+                cl::Event copyComplete;
+                queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_CurrentNumOutputPhotons[bufferIndex], CL_FALSE, 0, sizeof(uint32_t), &zeroCounterBufferSource, NULL, &copyComplete);
+                cl::Event chunkCounterCopyComplete;
+                if (photonChunkSize_>0) {
+                    // all chunks need to be propagated again
+                    queue_[bufferIndex]->enqueueWriteBuffer(*deviceBuffer_PhotonChunkCounter[bufferIndex], CL_FALSE, 0, sizeof(uint32_t), &zeroCounterBufferSource, NULL, &chunkCounterCopyComplete);
+                }
+                queue_[bufferIndex]->flush(); // make sure it starts executing on the device
+                waitForOpenCLEventYield(copyComplete);
+                if (photonChunkSize_>0) waitForOpenCLEventYield(chunkCounterCopyComplete);
+            }
+            
+            cl::Event kernelFinishEvent;
+            OpenCLThread_impl_runKernel(bufferIndex, kernelFinishEvent, numberOfInputSteps);
+            waitForOpenCLEventYield(kernelFinishEvent);
+            queue_[bufferIndex]->finish();
+
+#ifdef DUMP_STATISTICS
+            {
+                // the re-run propagated all photons of the bunch again,
+                // count it like any other kernel call. (The host time is
+                // part of the interval measured by DumpStatistics() anyway.)
+                uint64_t timeStart, timeEnd;
+                kernelFinishEvent.getProfilingInfo(CL_PROFILING_COMMAND_START, &timeStart);
+                kernelFinishEvent.getProfilingInfo(CL_PROFILING_COMMAND_END, &timeEnd);
+                
+                const uint64_t kernel_duration_in_nanoseconds = (timeStart==timeEnd)?
+                (device_->GetDeviceHandle())->getInfo<CL_DEVICE_PROFILING_TIMER_RESOLUTION>():(timeEnd-timeStart);
+                
+                boost::unique_lock<boost::mutex> guard(statistics_mutex_);
+                statistics_total_device_duration_in_nanoseconds_ += kernel_duration_in_nanoseconds;
+                statistics_total_kernel_calls_++;
+                statistics_total_num_photons_generated_ += totalNumberOfPhotons;
+                statistics_total_num_photons_rerun_ += totalNumberOfPhotons;
+            }
+#endif
         }
         
 #ifdef I3_LOG4CPLUS_LOGGING
@@ -997,13 +1327,6 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_downloadPhotons(boost
         }
 #endif
         
-        if (numberOfGeneratedPhotons > maxNumOutputPhotons_)
-        {
-            log_error("Maximum number of photons exceeded, only receiving %" PRIu32 " of %" PRIu32 " photons",
-                      maxNumOutputPhotons_, numberOfGeneratedPhotons);
-            numberOfGeneratedPhotons = maxNumOutputPhotons_;
-        }
-        
         if (numberOfGeneratedPhotons>0)
         {
             VECTOR_CLASS<cl::Event> copyComplete((photonHistoryEntries_>0)?2:1);
@@ -1014,7 +1337,12 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_downloadPhotons(boost
                 photonHistoriesRaw = boost::shared_ptr<std::vector<cl_float4> >(new std::vector<cl_float4>(numberOfGeneratedPhotons*static_cast<std::size_t>(photonHistoryEntries_)));
             }
             
-            queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_OutputPhotons[bufferIndex], CL_FALSE, 0, numberOfGeneratedPhotons*sizeof(I3CLSimPhoton), &((*photons)[0]), NULL, &copyComplete[0]);
+            if (compactPhotons_) {
+                compactPhotons.resize(numberOfGeneratedPhotons);
+                queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_OutputPhotons[bufferIndex], CL_FALSE, 0, numberOfGeneratedPhotons*sizeof(I3CLSimCompactPhoton), &(compactPhotons[0]), NULL, &copyComplete[0]);
+            } else {
+                queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_OutputPhotons[bufferIndex], CL_FALSE, 0, numberOfGeneratedPhotons*sizeof(I3CLSimPhoton), &((*photons)[0]), NULL, &copyComplete[0]);
+            }
             
             if (photonHistoryEntries_>0) {
                 queue_[bufferIndex]->enqueueReadBuffer(*deviceBuffer_PhotonHistory[bufferIndex], CL_FALSE, 0, numberOfGeneratedPhotons*static_cast<std::size_t>(photonHistoryEntries_)*sizeof(cl_float4), &((*photonHistoriesRaw)[0]), NULL, &copyComplete[1]);
@@ -1023,6 +1351,11 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl_downloadPhotons(boost
             queue_[bufferIndex]->flush(); // make sure it starts executing on the device
             waitForOpenCLEventsYield(copyComplete); // wait for the buffer(s) to be copied
 
+            // convert compact photons to the full format
+            if (compactPhotons_) {
+                DecodeCompactPhotons(compactPhotons, domPositionsPerStringIndex_, *photons);
+            }
+
             // convert the histories to the external representation
             if (photonHistoriesRaw) {
                 photonHistories = ConvertPhotonHistories(*photonHistoriesRaw, *photons, photonHistoryEntries_);
@@ -1155,8 +1488,10 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl(boost::this_thread::d
     if (!saveAllPhotons_) {
         if (!deviceBuffer_GeoLayerToOMNumIndexPerStringSet) log_fatal("Internal error: deviceBuffer_GeoLayerToOMNumIndexPerStringSet is (null)");
     }
-    if (!deviceBuffer_MWC_RNG_x) log_fatal("Internal error: deviceBuffer_MWC_RNG_x is (null)");
-    if (!deviceBuffer_MWC_RNG_a) log_fatal("Internal error: deviceBuffer_MWC_RNG_a is (null)");
+    if (!counterBasedRNG_) {
+        if (!deviceBuffer_MWC_RNG_x) log_fatal("Internal error: deviceBuffer_MWC_RNG_x is (null)");
+        if (!deviceBuffer_MWC_RNG_a) log_fatal("Internal error: deviceBuffer_MWC_RNG_a is (null)");
+    }
     
     // notify the main thread that everything is set up
     {
@@ -1273,7 +1608,7 @@ void I3CLSimStepToPhotonConverterOpenCL::OpenCLThread_impl(boost::this_thread::d
         log_trace("[%u] receiving results..!", thisBuffer);
         {
             bool shouldBreak;
-            OpenCLThread_impl_downloadPhotons(di, shouldBreak, thisBuffer, stepsIdentifier[thisBuffer]);
+            OpenCLThread_impl_downloadPhotons(di, shouldBreak, thisBuffer, stepsIdentifier[thisBuffer], totalNumberOfPhotons[thisBuffer], numberOfSteps[thisBuffer]);
             if (shouldBreak) break; // is thread termination being requested?
         }
         log_trace("[%u] results received.", thisBuffer);
@@ -1409,6 +1744,135 @@ uint32_t I3CLSimStepToPhotonConverterOpenCL::GetPhotonHistoryEntries() const
     return photonHistoryEntries_;
 }
 
+void I3CLSimStepToPhotonConverterOpenCL::SetCompressSteps(bool value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+    
+    compiled_=false;
+    kernel_.clear();
+    queue_.clear();
+    
+    compressSteps_=value;
+}
+
+bool I3CLSimStepToPhotonConverterOpenCL::GetCompressSteps() const
+{
+    return compressSteps_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetPhotonChunkSize(uint32_t value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+    
+    compiled_=false;
+    kernel_.clear();
+    queue_.clear();
+    
+    photonChunkSize_=value;
+}
+
+uint32_t I3CLSimStepToPhotonConverterOpenCL::GetPhotonChunkSize() const
+{
+    return photonChunkSize_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetCounterBasedRNG(bool value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+    
+    compiled_=false;
+    kernel_.clear();
+    queue_.clear();
+    
+    counterBasedRNG_=value;
+}
+
+bool I3CLSimStepToPhotonConverterOpenCL::GetCounterBasedRNG() const
+{
+    return counterBasedRNG_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetCounterBasedRNGKey(uint64_t value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+    
+    // the key is a kernel argument, no need to re-compile
+    counterBasedRNGKey_=value;
+}
+
+uint64_t I3CLSimStepToPhotonConverterOpenCL::GetCounterBasedRNGKey() const
+{
+    return counterBasedRNGKey_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetOpticalDepthTables(bool value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+    
+    compiled_=false;
+    kernel_.clear();
+    queue_.clear();
+    
+    opticalDepthTables_=value;
+}
+
+bool I3CLSimStepToPhotonConverterOpenCL::GetOpticalDepthTables() const
+{
+    return opticalDepthTables_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetCompactPhotons(bool value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+    
+    compiled_=false;
+    kernel_.clear();
+    queue_.clear();
+    
+    compactPhotons_=value;
+}
+
+bool I3CLSimStepToPhotonConverterOpenCL::GetCompactPhotons() const
+{
+    return compactPhotons_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetKernelCacheDirectory(const std::string &value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+    
+    kernelCacheDirectory_=value;
+}
+
+const std::string &I3CLSimStepToPhotonConverterOpenCL::GetKernelCacheDirectory() const
+{
+    return kernelCacheDirectory_;
+}
+
+void I3CLSimStepToPhotonConverterOpenCL::SetShadowGeometry(I3ExtraGeometryItemConstPtr value)
+{
+    if (initialized_)
+        throw I3CLSimStepToPhotonConverter_exception("I3CLSimStepToPhotonConverterOpenCL already initialized!");
+    
+    compiled_=false;
+    kernel_.clear();
+    queue_.clear();
+    
+    shadowGeometry_=value;
+}
+
+I3ExtraGeometryItemConstPtr I3CLSimStepToPhotonConverterOpenCL::GetShadowGeometry() const
+{
+    return shadowGeometry_;
+}
+
 
 void I3CLSimStepToPhotonConverterOpenCL::SetFixedNumberOfAbsorptionLengths(double value)
 {
@@ -235,6 +235,7 @@ void register_I3CLSimLightSourceToStepConverter()
            )
          )
         .def("SetUseCascadeExtension", &I3CLSimLightSourceToStepConverterPPC::SetUseCascadeExtension)
+        .def("SetNumFeederThreads", &I3CLSimLightSourceToStepConverterPPC::SetNumFeederThreads)
         ;
     }
     
@@ -50,6 +50,9 @@ void register_I3ModuleHelper()
 	bp::arg("stopDetectedPhotons")=true, bp::arg("saveAllPhotons")=false,
 	bp::arg("saveAllPhotonsPrescale")=0.01, bp::arg("fixedNumberOfAbsorptionLengths")=NAN,
 	bp::arg("pancakeFactor")=1., bp::arg("photonHistoryEntries")=0,
-	bp::arg("limitWorkgroupSize")=0));
+	bp::arg("limitWorkgroupSize")=0, bp::arg("compressSteps")=false, bp::arg("compactPhotons")=false,
+	bp::arg("kernelCacheDirectory")="", bp::arg("shadowGeometry")=I3ExtraGeometryItemConstPtr(),
+	bp::arg("photonChunkSize")=0, bp::arg("counterBasedRNG")=false,
+	bp::arg("counterBasedRNGKey")=0, bp::arg("opticalDepthTables")=false));
     
 }
@@ -28,6 +28,7 @@
 
 #include <clsim/I3CLSimStepToPhotonConverter.h>
 #include <clsim/I3CLSimStepToPhotonConverterOpenCL.h>
+#include <clsim/I3CLSimStepToPhotonConverterNative.h>
 
 #include <boost/preprocessor/seq.hpp>
 
@@ -183,6 +184,23 @@ void register_I3CLSimStepToPhotonConverter()
         .def("SetDOMPancakeFactor", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetDOMPancakeFactor)
         .def("GetDOMPancakeFactor", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetDOMPancakeFactor)
 
+        .def("SetCompressSteps", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetCompressSteps)
+        .def("GetCompressSteps", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetCompressSteps)
+        .def("SetPhotonChunkSize", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetPhotonChunkSize)
+        .def("GetPhotonChunkSize", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetPhotonChunkSize)
+        .def("SetCounterBasedRNG", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetCounterBasedRNG)
+        .def("GetCounterBasedRNG", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetCounterBasedRNG)
+        .def("SetCounterBasedRNGKey", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetCounterBasedRNGKey)
+        .def("GetCounterBasedRNGKey", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetCounterBasedRNGKey)
+        .def("SetOpticalDepthTables", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetOpticalDepthTables)
+        .def("GetOpticalDepthTables", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetOpticalDepthTables)
+        .def("SetCompactPhotons", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetCompactPhotons)
+        .def("GetCompactPhotons", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetCompactPhotons)
+        .def("SetKernelCacheDirectory", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetKernelCacheDirectory)
+        .def("GetKernelCacheDirectory", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetKernelCacheDirectory, bp::return_value_policy<bp::copy_const_reference>())
+        .def("SetShadowGeometry", &I3CLSimStepToPhotonConverterOpenCLWrapper::SetShadowGeometry)
+        .def("GetShadowGeometry", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetShadowGeometry)
+
         
         .add_property("workgroupSize", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetWorkgroupSize, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetWorkgroupSize)
         .add_property("maxNumWorkitems", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetMaxNumWorkitems, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetMaxNumWorkitems)
@@ -194,6 +212,14 @@ void register_I3CLSimStepToPhotonConverter()
         .add_property("photonHistoryEntries", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetPhotonHistoryEntries, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetPhotonHistoryEntries)
         .add_property("fixedNumberOfAbsorptionLengths", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetFixedNumberOfAbsorptionLengths, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetFixedNumberOfAbsorptionLengths)
         .add_property("DOMPancakeFactor", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetDOMPancakeFactor, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetDOMPancakeFactor)
+        .add_property("compressSteps", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetCompressSteps, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetCompressSteps)
+        .add_property("photonChunkSize", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetPhotonChunkSize, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetPhotonChunkSize)
+        .add_property("counterBasedRNG", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetCounterBasedRNG, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetCounterBasedRNG)
+        .add_property("counterBasedRNGKey", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetCounterBasedRNGKey, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetCounterBasedRNGKey)
+        .add_property("opticalDepthTables", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetOpticalDepthTables, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetOpticalDepthTables)
+        .add_property("compactPhotons", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetCompactPhotons, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetCompactPhotons)
+        .add_property("kernelCacheDirectory", bp::make_function(&I3CLSimStepToPhotonConverterOpenCLWrapper::GetKernelCacheDirectory, bp::return_value_policy<bp::copy_const_reference>()), &I3CLSimStepToPhotonConverterOpenCLWrapper::SetKernelCacheDirectory)
+        .add_property("shadowGeometry", &I3CLSimStepToPhotonConverterOpenCLWrapper::GetShadowGeometry, &I3CLSimStepToPhotonConverterOpenCLWrapper::SetShadowGeometry)
         ;
     }
     
@@ -201,4 +227,47 @@ void register_I3CLSimStepToPhotonConverter()
     bp::implicitly_convertible<boost::shared_ptr<I3CLSimStepToPhotonConverterOpenCLWrapper>, boost::shared_ptr<I3CLSimStepToPhotonConverter> >();
     bp::implicitly_convertible<boost::shared_ptr<I3CLSimStepToPhotonConverterOpenCLWrapper>, boost::shared_ptr<const I3CLSimStepToPhotonConverter> >();
     
+    
+    // I3CLSimStepToPhotonConverterNative
+    {
+        bp::class_<
+        I3CLSimStepToPhotonConverterNative, 
+        boost::shared_ptr<I3CLSimStepToPhotonConverterNative>, 
+        bases<I3CLSimStepToPhotonConverter>,
+        boost::noncopyable
+        >
+        (
+         "I3CLSimStepToPhotonConverterNative",
+         bp::init<
+         I3RandomServicePtr,std::size_t
+         >(
+           (
+            bp::arg("RandomService"),
+            bp::arg("NumThreads")=0
+           )
+          )
+        )
+        .def("GetNumThreads", &I3CLSimStepToPhotonConverterNative::GetNumThreads)
+        .def("GetWorkgroupSize", &I3CLSimStepToPhotonConverterNative::GetWorkgroupSize)
+        .def("GetMaxNumWorkitems", &I3CLSimStepToPhotonConverterNative::GetMaxNumWorkitems)
+        .def("SetMaxNumWorkitems", &I3CLSimStepToPhotonConverterNative::SetMaxNumWorkitems)
+
+        .def("SetStopDetectedPhotons", &I3CLSimStepToPhotonConverterNative::SetStopDetectedPhotons)
+        .def("GetStopDetectedPhotons", &I3CLSimStepToPhotonConverterNative::GetStopDetectedPhotons)
+
+        .def("SetDOMPancakeFactor", &I3CLSimStepToPhotonConverterNative::SetDOMPancakeFactor)
+        .def("GetDOMPancakeFactor", &I3CLSimStepToPhotonConverterNative::GetDOMPancakeFactor)
+
+        .add_property("numThreads", &I3CLSimStepToPhotonConverterNative::GetNumThreads)
+        .add_property("workgroupSize", &I3CLSimStepToPhotonConverterNative::GetWorkgroupSize)
+        .add_property("maxNumWorkitems", &I3CLSimStepToPhotonConverterNative::GetMaxNumWorkitems, &I3CLSimStepToPhotonConverterNative::SetMaxNumWorkitems)
+        .add_property("stopDetectedPhotons", &I3CLSimStepToPhotonConverterNative::GetStopDetectedPhotons, &I3CLSimStepToPhotonConverterNative::SetStopDetectedPhotons)
+        .add_property("DOMPancakeFactor", &I3CLSimStepToPhotonConverterNative::GetDOMPancakeFactor, &I3CLSimStepToPhotonConverterNative::SetDOMPancakeFactor)
+        ;
+    }
+    
+    bp::implicitly_convertible<boost::shared_ptr<I3CLSimStepToPhotonConverterNative>, boost::shared_ptr<const I3CLSimStepToPhotonConverterNative> >();
+    bp::implicitly_convertible<boost::shared_ptr<I3CLSimStepToPhotonConverterNative>, boost::shared_ptr<I3CLSimStepToPhotonConverter> >();
+    bp::implicitly_convertible<boost::shared_ptr<I3CLSimStepToPhotonConverterNative>, boost::shared_ptr<const I3CLSimStepToPhotonConverter> >();
+    
 }
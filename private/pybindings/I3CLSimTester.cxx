@@ -76,6 +76,26 @@ bp::list I3CLSimVectorTransformTester_EvaluateReferenceFunction(
     return retList;
 }
 
+bp::list I3CLSimMediumPropertiesTester_EvaluatePropagation(
+    I3CLSimMediumPropertiesTester &tester,
+    I3VectorFloatConstPtr wavelengths,
+    I3VectorFloatConstPtr zPositions,
+    I3VectorFloatConstPtr zDirections,
+    I3VectorFloatConstPtr scatteringLengths,
+    I3VectorFloatConstPtr absorptionLengths,
+    bool useOpticalDepthTables)
+{
+    const std::vector<I3VectorFloatPtr> retval =
+        tester.EvaluatePropagation(wavelengths, zPositions, zDirections,
+                                   scatteringLengths, absorptionLengths,
+                                   useOpticalDepthTables);
+
+    bp::list retList;
+    for (std::size_t i=0;i<retval.size();++i)
+        retList.append(retval[i]);
+    return retList;
+}
+
 
 void register_I3CLSimTester()
 {
@@ -228,6 +248,8 @@ void register_I3CLSimTester()
         .def("EvaluateGroupVelocity", &I3CLSimMediumPropertiesTester::EvaluateGroupVelocity, bp::arg("xValues"), bp::arg("layer"))
         .def("EvaluateAbsorptionLength", &I3CLSimMediumPropertiesTester::EvaluateAbsorptionLength, bp::arg("xValues"), bp::arg("layer"))
         .def("EvaluateScatteringLength", &I3CLSimMediumPropertiesTester::EvaluateScatteringLength, bp::arg("xValues"), bp::arg("layer"))
+        .def("EvaluatePropagation", &I3CLSimMediumPropertiesTester_EvaluatePropagation, bp::arg("wavelengths"), bp::arg("zPositions"), bp::arg("zDirections"), bp::arg("scatteringLengths"), bp::arg("absorptionLengths"), bp::arg("useOpticalDepthTables"))
+        .def("HasOpticalDepthTables", &I3CLSimMediumPropertiesTester::HasOpticalDepthTables)
         ;
     }
     bp::implicitly_convertible<boost::shared_ptr<I3CLSimMediumPropertiesTester>, boost::shared_ptr<const I3CLSimMediumPropertiesTester> >();
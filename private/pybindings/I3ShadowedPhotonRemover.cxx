@@ -33,6 +33,24 @@
 using namespace boost::python;
 namespace bp = boost::python;
 
+namespace I3ShadowedPhotonRemover_utils
+{
+    static bp::list FindShadowedPhotons(const I3ShadowedPhotonRemover &remover, const I3PhotonSeries &photons)
+    {
+        std::vector<bool> isShadowed;
+        remover.FindShadowedPhotons(photons, isShadowed);
+        
+        bp::list result;
+        for (std::size_t i=0;i<isShadowed.size();++i)
+        {
+            result.append(static_cast<bool>(isShadowed[i]));
+        }
+        return result;
+    }
+};
+
+using namespace I3ShadowedPhotonRemover_utils;
+
 
 void register_I3ShadowedPhotonRemover()
 {
@@ -40,20 +58,16 @@ void register_I3ShadowedPhotonRemover()
         bp::scope I3ShadowedPhotonRemover_scope = 
         bp::class_<I3ShadowedPhotonRemover, boost::shared_ptr<I3ShadowedPhotonRemover>, boost::noncopyable>
         ("I3ShadowedPhotonRemover", 
-         bp::init<>()
-         //(
-         // (
-         //  bp::arg("random"),
-         //  bp::arg("DOMRadius"),
-         //  bp::arg("holeRadius"),
-         //  bp::arg("mediumProperties"),
-         //  bp::arg("holeIceAbsorptionLength"),
-         //  bp::arg("holeIceScatteringLength")
-         // )
-         //)
+         bp::init<I3ExtraGeometryItemConstPtr>
+         (
+          (
+           bp::arg("extraGeometry")
+          )
+         )
         )
 
         .def("IsPhotonShadowed", &I3ShadowedPhotonRemover::IsPhotonShadowed)
+        .def("FindShadowedPhotons", &FindShadowedPhotons)
         ;
     }
     
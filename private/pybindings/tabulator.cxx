@@ -26,6 +26,7 @@
 
 #include "clsim/tabulator/Axis.h"
 #include "clsim/tabulator/Axes.h"
+#include "clsim/tabulator/RawTable.h"
 
 namespace bp = boost::python;
 
@@ -70,6 +71,33 @@ void register_Axes()
 	;
 }
 
+static clsim::tabulator::RawTablePtr
+make_RawTable(const clsim::tabulator::Axes &axes, bool storeSquaredWeights)
+{
+	return clsim::tabulator::RawTablePtr(new clsim::tabulator::RawTable(axes, storeSquaredWeights));
+}
+
+void register_RawTable()
+{
+	using namespace clsim::tabulator;
+	
+	bp::class_<RawTable, RawTablePtr, boost::noncopyable>
+	    ("RawTable", bp::init<const std::string&>((bp::arg("checkpoint")),
+	     "Load an unnormalized table from a checkpoint file"))
+	    .def("__init__", bp::make_constructor(&make_RawTable, bp::default_call_policies(),
+	        (bp::arg("axes"), bp::arg("squared_weights")=false)),
+	     "Create an empty table with the binning of *axes*")
+	    .def("merge_checkpoint", &RawTable::MergeCheckpoint, bp::arg("path"),
+	     "Add the contents of a checkpoint file to this table")
+	    .def("write_checkpoint", &RawTable::WriteCheckpoint, bp::arg("path"))
+	    .def("write_fits", &RawTable::WriteFITSFile, bp::arg("path"),
+	     "Normalize the table and write it to a FITS file")
+	    .add_property("header", &RawTable::GetHeader, &RawTable::SetHeader)
+	    .add_property("n_photons", &RawTable::GetNumPhotons)
+	    .add_property("sum_of_photon_weights", &RawTable::GetSumOfPhotonWeights)
+	;
+}
+
 void register_tabulator()
 {
 	// Put all tabulator-related classes in a submodule
@@ -82,5 +110,6 @@ void register_tabulator()
 	
 	register_Axis();
 	register_Axes();
+	register_RawTable();
 }
 
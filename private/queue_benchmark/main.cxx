@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file main.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+// Microbenchmark for I3CLSimQueue. Compares the current implementation
+// to the previous one (a std::queue with a mutex and a single condition
+// variable) for the producer/consumer configurations used in clsim.
+//
+// usage: clsim-queue_benchmark [items per configuration]
+
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <vector>
+#include <string>
+
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "clsim/I3CLSimQueue.h"
+
+namespace {
+
+// the queue as it was before the ring buffer was introduced
+template <typename T>
+class LegacyQueue : private boost::noncopyable
+{
+public:
+    LegacyQueue(std::size_t max_size) : max_size_(max_size) {}
+
+    void Put(const T &msg)
+    {
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        while ((max_size_ > 0) && (queue_.size() >= max_size_))
+        {
+            cond_.wait(guard);
+        }
+        queue_.push(msg);
+        cond_.notify_one();
+    }
+
+    void PutBatch(const std::vector<T> &msgs)
+    {
+        for (std::size_t i=0;i<msgs.size();++i) Put(msgs[i]);
+    }
+
+    T Get()
+    {
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        while (queue_.empty())
+        {
+            cond_.wait(guard);
+        }
+        T msg = queue_.front();
+        queue_.pop();
+        cond_.notify_one();
+        return msg;
+    }
+
+    std::size_t GetBatch(std::vector<T> &msgs, std::size_t maxNum)
+    {
+        if (maxNum==0) return 0;
+        msgs.push_back(Get());
+        return 1;
+    }
+
+private:
+    boost::mutex mutex_;
+    boost::condition_variable_any cond_;
+    std::queue<T> queue_;
+    std::size_t max_size_;
+};
+
+// light-weight payload, just like the real ones
+typedef boost::shared_ptr<std::size_t> payload_t;
+
+template <typename QueueType>
+void Producer(QueueType *queue, std::size_t numItems, std::size_t batchSize)
+{
+    std::vector<payload_t> batch;
+    for (std::size_t i=0;i<numItems;)
+    {
+        if (batchSize <= 1) {
+            queue->Put(boost::make_shared<std::size_t>(i));
+            ++i;
+            continue;
+        }
+
+        batch.clear();
+        for (std::size_t j=0;(j<batchSize) && (i<numItems);++j,++i)
+            batch.push_back(boost::make_shared<std::size_t>(i));
+        queue->PutBatch(batch);
+    }
+}
+
+template <typename QueueType>
+void Consumer(QueueType *queue, std::size_t numItems, std::size_t batchSize)
+{
+    std::vector<payload_t> batch;
+    for (std::size_t i=0;i<numItems;)
+    {
+        if (batchSize <= 1) {
+            queue->Get();
+            ++i;
+            continue;
+        }
+
+        batch.clear();
+        i += queue->GetBatch(batch, std::min(batchSize, numItems-i));
+    }
+}
+
+// returns the throughput in items per second
+template <typename QueueType>
+double RunConfiguration(std::size_t maxSize, std::size_t numProducers, std::size_t numConsumers,
+                        std::size_t numItems, std::size_t batchSize)
+{
+    QueueType queue(maxSize);
+
+    // make the total number of items divisible by
+    // the number of producers and consumers
+    const std::size_t itemsPerProducer = numItems/(numProducers*numConsumers)*numConsumers;
+    const std::size_t itemsPerConsumer = itemsPerProducer*numProducers/numConsumers;
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    boost::thread_group threads;
+    for (std::size_t i=0;i<numConsumers;++i)
+        threads.create_thread(boost::bind(&Consumer<QueueType>, &queue, itemsPerConsumer, batchSize));
+    for (std::size_t i=0;i<numProducers;++i)
+        threads.create_thread(boost::bind(&Producer<QueueType>, &queue, itemsPerProducer, batchSize));
+    threads.join_all();
+
+    const boost::posix_time::ptime stop = boost::posix_time::microsec_clock::universal_time();
+    const double seconds = static_cast<double>((stop-start).total_microseconds())/1e6;
+
+    return static_cast<double>(itemsPerProducer*numProducers)/seconds;
+}
+
+struct configuration_t
+{
+    const char *description;
+    std::size_t maxSize;
+    std::size_t numProducers;
+    std::size_t numConsumers;
+    std::size_t batchSize;
+};
+
+}
+
+int main(int argc, char const *argv[])
+{
+    std::size_t numItems = 1000000;
+    if (argc > 1) numItems = static_cast<std::size_t>(std::atol(argv[1]));
+    if (numItems == 0) {
+        std::fprintf(stderr, "usage: %s [items per configuration]\n", argv[0]);
+        return 1;
+    }
+
+    std::size_t numFeeders = boost::thread::hardware_concurrency();
+    if (numFeeders < 2) numFeeders = 2;
+
+    const configuration_t configurations[] = {
+        {"Geant4 -> module, module -> OpenCL (size 5)",     5, 1, 1, 1},
+        {"OpenCL -> module (unbounded, 1P/1C)",             0, 1, 1, 1},
+        {"PPC feeders -> converter (size 10, NP/1C)",      10, numFeeders, 1, 1},
+        {"tabulator steps (size 1, 1P/1C)",                 1, 1, 1, 1},
+        {"bounded, batches of 16 (size 64, NP/1C)",        64, numFeeders, 1, 16},
+        {"unbounded, batches of 16 (NP/1C)",                0, numFeeders, 1, 16},
+    };
+    const std::size_t numConfigurations = sizeof(configurations)/sizeof(configurations[0]);
+
+    std::printf("%zu items per configuration, N=%zu\n", numItems, numFeeders);
+    std::printf("%-45s %15s %15s %8s\n", "configuration", "legacy [1/s]", "current [1/s]", "ratio");
+    for (std::size_t i=0;i<numConfigurations;++i)
+    {
+        const configuration_t &c = configurations[i];
+
+        const double legacy = RunConfiguration<LegacyQueue<payload_t> >(c.maxSize, c.numProducers, c.numConsumers, numItems, c.batchSize);
+        const double current = RunConfiguration<I3CLSimQueue<payload_t> >(c.maxSize, c.numProducers, c.numConsumers, numItems, c.batchSize);
+
+        std::printf("%-45s %15.0f %15.0f %8.2f\n", c.description, legacy, current, current/legacy);
+    }
+
+    return 0;
+}
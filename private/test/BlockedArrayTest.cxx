@@ -0,0 +1,184 @@
+/**
+ * Copyright (c) 2015
+ * Jakob van Santen <jvansanten@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file BlockedArrayTest.cxx
+ * @version $LastChangedRevision$
+ * @date $Date$
+ * @author Jakob van Santen
+ */
+
+#include <I3Test.h>
+
+#include "clsim/tabulator/BlockedArray.h"
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+
+#include <vector>
+#include <stdexcept>
+
+using clsim::tabulator::BlockedArray;
+
+TEST_GROUP(BlockedArray);
+
+namespace {
+
+void
+CompareToDense(const BlockedArray &array, const std::vector<float> &dense)
+{
+	ENSURE_EQUAL(array.size(), dense.size(), "sizes match");
+	for (size_t i = 0; i < dense.size(); i++)
+		ENSURE_EQUAL(array.Get(i), dense[i], "contents match a dense array");
+	
+	// the raw blocks agree with Get()
+	size_t offset = 0;
+	for (size_t b = 0; b < array.GetNBlocks(); b++) {
+		const float *block = array.GetBlock(b);
+		for (size_t i = 0; i < array.GetBlockLength(b); i++)
+			ENSURE_EQUAL(block ? block[i] : 0.f, dense[offset+i], "blocks match a dense array");
+		offset += array.GetBlockLength(b);
+	}
+	ENSURE_EQUAL(offset, dense.size(), "the blocks cover the array");
+}
+
+}
+
+TEST(Geometry)
+{
+	// the last block is shorter
+	BlockedArray array(1000, 64);
+	ENSURE_EQUAL(array.size(), 1000u, "size");
+	ENSURE_EQUAL(array.GetBlockSize(), 64u, "block size");
+	ENSURE_EQUAL(array.GetNBlocks(), 16u, "number of blocks");
+	ENSURE_EQUAL(array.GetBlockLength(0), 64u, "full block");
+	ENSURE_EQUAL(array.GetBlockLength(15), 1000u-15u*64u, "partial last block");
+	ENSURE_EQUAL(array.GetNAllocatedBlocks(), 0u, "nothing allocated yet");
+	
+	BlockedArray empty;
+	ENSURE_EQUAL(empty.size(), 0u, "empty array");
+	ENSURE_EQUAL(empty.GetNBlocks(), 0u, "empty array has no blocks");
+	
+	try {
+		BlockedArray invalid(10, 0);
+	} catch (std::invalid_argument &) {
+		return;
+	}
+	FAIL("a block size of 0 should be rejected");
+}
+
+TEST(BlocksAreAllocatedLazily)
+{
+	BlockedArray array(1000, 64);
+	
+	array.Add(5, 0.f);
+	ENSURE_EQUAL(array.GetNAllocatedBlocks(), 0u, "adding zero does not allocate");
+	ENSURE(array.GetBlock(0) == NULL, "unallocated blocks are NULL");
+	
+	array.Add(5, 1.5f);
+	array.Add(63, 2.f);
+	ENSURE_EQUAL(array.GetNAllocatedBlocks(), 1u, "one block allocated");
+	ENSURE(array.GetBlock(0) != NULL, "the block is allocated");
+	ENSURE_EQUAL(array.Get(5), 1.5f, "value was added");
+	ENSURE_EQUAL(array.Get(6), 0.f, "the rest of the block is zero");
+	
+	array.Add(999, 3.f);
+	ENSURE_EQUAL(array.GetNAllocatedBlocks(), 2u, "last block allocated");
+	ENSURE_EQUAL(array.Get(999), 3.f, "value in the partial last block");
+	
+	// a dense range of mostly zeros only allocates where needed
+	std::vector<float> values(300, 0.f);
+	values[250] = 4.f;
+	array.Add(100, &values[0], values.size());
+	ENSURE_EQUAL(array.GetNAllocatedBlocks(), 3u, "only the block with a non-zero value was allocated");
+	ENSURE_EQUAL(array.Get(350), 4.f, "value was added");
+	
+	array.Clear();
+	ENSURE_EQUAL(array.GetNAllocatedBlocks(), 0u, "Clear() releases all blocks");
+	ENSURE_EQUAL(array.Get(350), 0.f, "cleared arrays read as zero");
+	ENSURE_EQUAL(array.size(), 1000u, "Clear() keeps the size");
+}
+
+TEST(MatchesADenseArray)
+{
+	boost::random::mt19937 rng(2015);
+	boost::random::uniform_int_distribution<size_t> index(0, 9999);
+	boost::random::uniform_int_distribution<size_t> length(0, 700);
+	boost::random::uniform_real_distribution<float> value(-1.f, 1.f);
+	
+	BlockedArray array(10000, 512);
+	std::vector<float> dense(10000, 0.f);
+	
+	for (unsigned i = 0; i < 20000; i++) {
+		const size_t j = index(rng);
+		const float v = (i % 4 == 0) ? 0.f : value(rng);
+		array.Add(j, v);
+		dense[j] += v;
+	}
+	
+	// ranges crossing block boundaries
+	for (unsigned i = 0; i < 50; i++) {
+		const size_t offset = index(rng);
+		const size_t count = std::min(length(rng), dense.size()-offset);
+		std::vector<float> values(count+1);
+		for (size_t k = 0; k < count; k++)
+			values[k] = (k % 3 == 0) ? value(rng) : 0.f;
+		array.Add(offset, &values[0], count);
+		for (size_t k = 0; k < count; k++)
+			dense[offset+k] += values[k];
+	}
+	
+	for (unsigned i = 0; i < 20; i++) {
+		const size_t offset = index(rng);
+		const size_t count = std::min(length(rng), dense.size()-offset);
+		const float factor = value(rng);
+		array.Scale(offset, count, factor);
+		for (size_t k = 0; k < count; k++)
+			dense[offset+k] *= factor;
+	}
+	
+	CompareToDense(array, dense);
+}
+
+TEST(RangesAreChecked)
+{
+	BlockedArray array(100, 16);
+	std::vector<float> values(10, 1.f);
+	
+	bool thrown = false;
+	try {
+		array.Add(95, &values[0], values.size());
+	} catch (std::out_of_range &) {
+		thrown = true;
+	}
+	ENSURE(thrown, "Add() beyond the end is rejected");
+	
+	thrown = false;
+	try {
+		array.Scale(95, 10, 2.f);
+	} catch (std::out_of_range &) {
+		thrown = true;
+	}
+	ENSURE(thrown, "Scale() beyond the end is rejected");
+	
+	array.Add(90, &values[0], values.size());
+	array.Scale(90, 10, 2.f);
+	ENSURE_EQUAL(array.Get(99), 2.f, "a range up to the end is fine");
+}
@@ -32,9 +32,11 @@
 #include "test/I3CLSimMediumPropertiesTester.h"
 
 #include <string>
+#include <algorithm>
 
 #include "opencl/I3CLSimHelperLoadProgramSource.h"
 #include "opencl/I3CLSimHelperGenerateMediumPropertiesSource.h"
+#include "opencl/I3CLSimHelperMath.h"
 #include "opencl/mwcrng_init.h"
 
 I3CLSimMediumPropertiesTester::I3CLSimMediumPropertiesTester
@@ -46,10 +48,12 @@ I3CLSimMediumPropertiesTester::I3CLSimMediumPropertiesTester
 :
 I3CLSimTesterBase(),
 mediumProperties_(mediumProperties),
-randomService_(randomService)
+randomService_(randomService),
+hasOpticalDepthTables_(false)
 {
     std::vector<std::string> source;
     FillSource(source, mediumProperties);
+    source.insert(source.begin(), I3CLSimHelper::GetMathPreamble(device, false));
     
     const bool hasDispersion = mediumProperties->GetPhaseRefractiveIndices()[0]->HasDerivative();
 
@@ -73,15 +77,23 @@ void I3CLSimMediumPropertiesTester::FillSource(std::vector<std::string> &source,
     
     std::string mwcrngSource = I3CLSimHelper::LoadProgramSource(kernelBaseDir+"/mwcrng_kernel.cl");
 
-    std::string mediumPropertiesSource = I3CLSimHelper::GenerateMediumPropertiesSource(*mediumProperties);
+    // generate the optical depth tables (if possible) in order to be able
+    // to compare both ways of propagating photons through the layers
+    std::string mediumPropertiesSource = I3CLSimHelper::GenerateMediumPropertiesSource(*mediumProperties, true);
+    hasOpticalDepthTables_ = (mediumPropertiesSource.find("#define MEDIUM_OPTICAL_DEPTH_TABLES") != std::string::npos);
 
     std::string testKernelHeader = I3CLSimHelper::LoadProgramSource(kernelBaseDir+"/medium_properties_test_kernel.h.cl");
     std::string testKernelSource = I3CLSimHelper::LoadProgramSource(kernelBaseDir+"/medium_properties_test_kernel.c.cl");
     
+    std::string propagationHeader = I3CLSimHelper::LoadProgramSource(kernelBaseDir+"/medium_propagation.h.cl");
+    std::string propagationSource = I3CLSimHelper::LoadProgramSource(kernelBaseDir+"/medium_propagation.c.cl");
+    
     // collect the program sources
     source.push_back(testKernelHeader);
     source.push_back(mwcrngSource);
     source.push_back(mediumPropertiesSource);
+    source.push_back(propagationHeader);
+    source.push_back(propagationSource);
     source.push_back(testKernelSource);
 }
 
@@ -126,6 +138,22 @@ void I3CLSimMediumPropertiesTester::InitBuffers(I3RandomServicePtr randomService
         kernel->setArg(3, *deviceBuffer_results);          // output data
     }
     log_debug("Kernel configured.");
+
+    log_debug("Configuring propagation kernel.");
+    try {
+        propagationKernel_ = boost::shared_ptr<cl::Kernel>(new cl::Kernel(*program, "testPropagationKernel"));
+    } catch (cl::Error &err) {
+        log_fatal("OpenCL ERROR (creating propagation kernel): %s (%i)", err.what(), err.err());
+    }
+    deviceBuffer_propagationInputs = boost::shared_ptr<cl::Buffer>(new cl::Buffer(*context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, workItemsPerIteration*sizeof(cl_float4), NULL));
+    deviceBuffer_propagationAbsLens = boost::shared_ptr<cl::Buffer>(new cl::Buffer(*context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, workItemsPerIteration*sizeof(float), NULL));
+    deviceBuffer_propagationResults = boost::shared_ptr<cl::Buffer>(new cl::Buffer(*context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, workItemsPerIteration*sizeof(cl_float4), NULL));
+    {
+        propagationKernel_->setArg(0, *deviceBuffer_propagationInputs);   // input data
+        propagationKernel_->setArg(1, *deviceBuffer_propagationAbsLens);  // input data
+        propagationKernel_->setArg(2, *deviceBuffer_propagationResults);  // output data
+    }
+    log_debug("Propagation kernel configured.");
 }
 
 
@@ -295,3 +323,77 @@ I3VectorFloatPtr I3CLSimMediumPropertiesTester::EvaluateIt(I3VectorFloatConstPtr
     
     return results;
 }
+
+std::vector<I3VectorFloatPtr> I3CLSimMediumPropertiesTester::EvaluatePropagation(I3VectorFloatConstPtr wavelengths,
+                                                                                  I3VectorFloatConstPtr zPositions,
+                                                                                  I3VectorFloatConstPtr zDirections,
+                                                                                  I3VectorFloatConstPtr scatteringLengths,
+                                                                                  I3VectorFloatConstPtr absorptionLengths,
+                                                                                  bool useOpticalDepthTables)
+{
+    if ((!wavelengths) || (!zPositions) || (!zDirections) || (!scatteringLengths) || (!absorptionLengths))
+        log_fatal("NULL pointer passed to EvaluatePropagation.");
+    const std::size_t numEntries = wavelengths->size();
+    if ((zPositions->size() != numEntries) || (zDirections->size() != numEntries) ||
+        (scatteringLengths->size() != numEntries) || (absorptionLengths->size() != numEntries))
+        log_fatal("the input vectors have to have the same size!");
+    if ((useOpticalDepthTables) && (!hasOpticalDepthTables_))
+        log_fatal("This medium does not support optical depth tables.");
+
+    propagationKernel_->setArg(3, static_cast<cl_uint>(useOpticalDepthTables?1:0));
+
+    // allocate the output vectors
+    std::vector<I3VectorFloatPtr> result;
+    for (std::size_t i=0;i<3;++i) {
+        result.push_back(I3VectorFloatPtr(new I3VectorFloat(numEntries, NAN)));
+    }
+
+    std::vector<cl_float4> inputs(workItemsPerIteration);
+    std::vector<float> absLens(workItemsPerIteration, 0.f);
+    std::vector<cl_float4> outputs(workItemsPerIteration);
+
+    for (std::size_t first=0;first<numEntries;first+=workItemsPerIteration)
+    {
+        const std::size_t entriesInThisIteration = std::min(static_cast<std::size_t>(workItemsPerIteration), numEntries-first);
+
+        // fill the input buffers (and pad them with harmless values)
+        for (std::size_t j=0;j<workItemsPerIteration;++j)
+        {
+            if (j<entriesInThisIteration) {
+                inputs[j].s[0] = (*wavelengths)[first+j];
+                inputs[j].s[1] = (*zPositions)[first+j];
+                inputs[j].s[2] = (*zDirections)[first+j];
+                inputs[j].s[3] = (*scatteringLengths)[first+j];
+                absLens[j] = (*absorptionLengths)[first+j];
+            } else {
+                inputs[j] = inputs[0];
+                absLens[j] = absLens[0];
+            }
+        }
+
+        try {
+            queue->enqueueWriteBuffer(*deviceBuffer_propagationInputs, CL_FALSE, 0, workItemsPerIteration*sizeof(cl_float4), &(inputs[0]));
+            queue->enqueueWriteBuffer(*deviceBuffer_propagationAbsLens, CL_FALSE, 0, workItemsPerIteration*sizeof(float), &(absLens[0]));
+
+            queue->enqueueNDRangeKernel(*propagationKernel_, 
+                                        cl::NullRange,    // current implementations force this to be NULL
+                                        cl::NDRange(workItemsPerIteration),    // number of work items
+                                        cl::NDRange(workgroupSize),
+                                        NULL,
+                                        NULL);
+
+            queue->enqueueReadBuffer(*deviceBuffer_propagationResults, CL_TRUE, 0, workItemsPerIteration*sizeof(cl_float4), &(outputs[0]));
+        } catch (cl::Error &err) {
+            log_fatal("OpenCL ERROR (running propagation kernel): %s (%i)", err.what(), err.err());
+        }
+
+        for (std::size_t j=0;j<entriesInThisIteration;++j)
+        {
+            (*(result[0]))[first+j] = outputs[j].s[0];
+            (*(result[1]))[first+j] = outputs[j].s[1];
+            (*(result[2]))[first+j] = outputs[j].s[2];
+        }
+    }
+    
+    return result;
+}
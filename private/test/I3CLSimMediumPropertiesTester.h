@@ -50,6 +50,19 @@ public:
     I3VectorFloatPtr EvaluateAbsorptionLength(I3VectorFloatConstPtr xValues, uint32_t layer);
     I3VectorFloatPtr EvaluateScatteringLength(I3VectorFloatConstPtr xValues, uint32_t layer);
 
+    // propagates photons to their next scattering (or absorption) point,
+    // either layer by layer or using the cumulative optical depth tables.
+    // Returns the distances, the absorption lengths left and the final layers.
+    std::vector<I3VectorFloatPtr> EvaluatePropagation(I3VectorFloatConstPtr wavelengths,
+                                                      I3VectorFloatConstPtr zPositions,
+                                                      I3VectorFloatConstPtr zDirections,
+                                                      I3VectorFloatConstPtr scatteringLengths,
+                                                      I3VectorFloatConstPtr absorptionLengths,
+                                                      bool useOpticalDepthTables);
+
+    // true if the medium could be converted to optical depth tables
+    inline bool HasOpticalDepthTables() const {return hasOpticalDepthTables_;}
+
 private:
     I3VectorFloatPtr EvaluateIt(I3VectorFloatConstPtr xValues, uint32_t layer, uint32_t mode);
 
@@ -65,6 +78,12 @@ private:
     boost::shared_ptr<cl::Buffer> deviceBuffer_results;
     boost::shared_ptr<cl::Buffer> deviceBuffer_inputs;
 
+    boost::shared_ptr<cl::Kernel> propagationKernel_;
+    boost::shared_ptr<cl::Buffer> deviceBuffer_propagationInputs;
+    boost::shared_ptr<cl::Buffer> deviceBuffer_propagationAbsLens;
+    boost::shared_ptr<cl::Buffer> deviceBuffer_propagationResults;
+    bool hasOpticalDepthTables_;
+
     I3CLSimMediumPropertiesConstPtr mediumProperties_;
     I3RandomServicePtr randomService_;
 };
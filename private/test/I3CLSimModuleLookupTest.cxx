@@ -0,0 +1,330 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimModuleLookupTest.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#include <I3Test.h>
+
+#include "clsim/I3CLSimModule.h"
+#include "clsim/I3CLSimSimpleGeometryUserConfigurable.h"
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include <vector>
+#include <map>
+#include <set>
+
+TEST_GROUP(I3CLSimModuleLookup);
+
+namespace {
+    typedef I3CLSimModule<I3PhotonSeriesMap>::particleCacheList particleCacheList;
+    typedef I3CLSimModule<I3PhotonSeriesMap>::particleCacheEntry particleCacheEntry;
+    typedef I3CLSimModule<I3PhotonSeriesMap>::domIndexLookupTable domIndexLookupTable;
+
+    typedef std::map<std::pair<int32_t, uint32_t>, int32_t> referenceMap;
+    typedef boost::random::uniform_int_distribution<int32_t> uniform_int_t;
+
+    // appends a particle for identifier NextIndex() and remembers the
+    // identifier in frameListEntry
+    uint32_t AppendParticle(particleCacheList &cache)
+    {
+        const uint32_t identifier = cache.NextIndex();
+        particleCacheEntry &entry = cache.Append();
+        entry.frameListEntry = identifier;
+        entry.particleMajorID = 1;
+        entry.particleMinorID = static_cast<int>(identifier);
+        entry.timeShift = 0.;
+        return identifier;
+    }
+
+    void EnsureCached(const particleCacheList &cache, uint32_t identifier)
+    {
+        const particleCacheEntry *entry = cache.Find(identifier);
+        ENSURE(entry != NULL, "live identifiers are found");
+        ENSURE_EQUAL(entry->frameListEntry, static_cast<std::size_t>(identifier),
+                     "the identifier finds its own entry");
+    }
+
+    // DOMs on randomly chosen strings, with random gaps on each string
+    I3CLSimSimpleGeometryUserConfigurable MakeGeometry(boost::random::mt19937 &rng,
+                                                       int32_t minString, int32_t maxString,
+                                                       uint32_t maxDom, referenceMap &reference)
+    {
+        uniform_int_t stringID(minString, maxString);
+        uniform_int_t domID(1, static_cast<int32_t>(maxDom));
+
+        std::set<std::pair<int32_t, uint32_t> > keys;
+        while (keys.size() < 500)
+            keys.insert(std::make_pair(stringID(rng), static_cast<uint32_t>(domID(rng))));
+
+        // the geometry order is not the key order
+        std::vector<std::pair<int32_t, uint32_t> > shuffled(keys.begin(), keys.end());
+        for (std::size_t i=shuffled.size();i>1;--i)
+            std::swap(shuffled[i-1], shuffled[uniform_int_t(0, static_cast<int32_t>(i-1))(rng)]);
+
+        I3CLSimSimpleGeometryUserConfigurable geometry(0.16510, shuffled.size());
+        reference.clear();
+        for (std::size_t i=0;i<shuffled.size();++i)
+        {
+            geometry.SetStringID(i, shuffled[i].first);
+            geometry.SetDomID(i, shuffled[i].second);
+            geometry.SetPosX(i, 0.);
+            geometry.SetPosY(i, 0.);
+            geometry.SetPosZ(i, 0.);
+            reference[shuffled[i]] = static_cast<int32_t>(i);
+        }
+        return geometry;
+    }
+
+    // compares Find() with a std::map for all DOMs and random other keys
+    void EnsureMatchesReference(boost::random::mt19937 &rng, const domIndexLookupTable &lookup,
+                                const referenceMap &reference,
+                                int32_t minString, int32_t maxString, uint32_t maxDom)
+    {
+        ENSURE_EQUAL(lookup.size(), reference.size(), "all DOMs are in the lookup");
+
+        for (referenceMap::const_iterator it=reference.begin();it!=reference.end();++it)
+        {
+            ENSURE_EQUAL(lookup.Find(it->first.first, it->first.second), it->second,
+                         "DOMs of the geometry are found at their geometry index");
+            const ModuleKey &key = lookup.moduleKeys.at(it->second);
+            ENSURE_EQUAL(key.GetString(), it->first.first, "the module key has the right string");
+            ENSURE_EQUAL(key.GetOM(), it->first.second, "the module key has the right DOM");
+        }
+
+        // also query keys around the range of the geometry
+        uniform_int_t stringID(minString-3, maxString+3);
+        uniform_int_t domID(0, static_cast<int32_t>(maxDom)+3);
+        for (unsigned int i=0;i<20000;++i)
+        {
+            const std::pair<int32_t, uint32_t> key(stringID(rng), static_cast<uint32_t>(domID(rng)));
+            referenceMap::const_iterator it = reference.find(key);
+            ENSURE_EQUAL(lookup.Find(key.first, key.second), (it == reference.end()) ? -1 : it->second,
+                         "Find() agrees with a map of the geometry");
+        }
+    }
+}
+
+TEST(ParticleCacheFindsLiveIdentifiers)
+{
+    particleCacheList cache;
+    ENSURE_EQUAL(cache.NextIndex(), 1u, "identifiers start at 1");
+
+    for (uint32_t i=1;i<=10;++i)
+        ENSURE_EQUAL(AppendParticle(cache), i, "identifiers are handed out in sequence");
+
+    for (uint32_t i=1;i<=10;++i)
+        EnsureCached(cache, i);
+    ENSURE(cache.Find(0) == NULL, "0 is never a valid identifier");
+    ENSURE(cache.Find(11) == NULL, "identifiers that were not handed out yet are not found");
+}
+
+TEST(ParticleCacheReleasesInOrder)
+{
+    particleCacheList cache;
+    for (unsigned int i=0;i<10;++i) AppendParticle(cache);
+
+    // released entries are gone even before the vector is compacted
+    cache.ReleaseOldest(3);
+    ENSURE_EQUAL(cache.firstIndex, 1u, "a few released entries are not compacted yet");
+    for (uint32_t i=1;i<=3;++i)
+        ENSURE(cache.Find(i) == NULL, "released identifiers are not found");
+    for (uint32_t i=4;i<=10;++i)
+        EnsureCached(cache, i);
+
+    // releasing half of the entries compacts the vector
+    cache.ReleaseOldest(2);
+    ENSURE_EQUAL(cache.firstIndex, 6u, "released entries are removed from the front");
+    ENSURE_EQUAL(cache.numReleased, 0u, "nothing released is left after compacting");
+    ENSURE_EQUAL(cache.entries.size(), 5u, "the live entries are kept");
+    for (uint32_t i=1;i<=5;++i)
+        ENSURE(cache.Find(i) == NULL, "released identifiers are not found");
+    for (uint32_t i=6;i<=10;++i)
+        EnsureCached(cache, i);
+
+    // the sequence continues after compacting
+    ENSURE_EQUAL(AppendParticle(cache), 11u, "identifiers continue after compacting");
+    EnsureCached(cache, 11);
+
+    // releasing more entries than there are releases all of them
+    cache.ReleaseOldest(100);
+    for (uint32_t i=1;i<=11;++i)
+        ENSURE(cache.Find(i) == NULL, "everything is released");
+    ENSURE_EQUAL(cache.NextIndex(), 12u, "releasing does not restart the sequence");
+}
+
+TEST(ParticleCacheWrapsAround)
+{
+    const uint32_t maxIndex = particleCacheList::maxIndex;
+
+    particleCacheList cache;
+    cache.Reset(maxIndex-2);
+
+    std::vector<uint32_t> identifiers;
+    for (unsigned int i=0;i<5;++i) identifiers.push_back(AppendParticle(cache));
+
+    ENSURE_EQUAL(identifiers[0], maxIndex-2, "the sequence starts at the reset identifier");
+    ENSURE_EQUAL(identifiers[2], maxIndex, "the largest identifier is used");
+    ENSURE_EQUAL(identifiers[3], 1u, "the sequence skips 0 after the largest identifier");
+    ENSURE_EQUAL(identifiers[4], 2u, "the sequence continues after wrapping");
+
+    for (unsigned int i=0;i<5;++i)
+        EnsureCached(cache, identifiers[i]);
+    ENSURE(cache.Find(0) == NULL, "0 is never a valid identifier");
+    ENSURE(cache.Find(3) == NULL, "identifiers that were not handed out yet are not found");
+    ENSURE(cache.Find(maxIndex-3) == NULL, "identifiers before the first one are not found");
+
+    // compacting across the wrap
+    cache.ReleaseOldest(3);
+    ENSURE_EQUAL(cache.firstIndex, 1u, "the first live identifier is after the wrap");
+    ENSURE(cache.Find(maxIndex) == NULL, "released identifiers are not found");
+    EnsureCached(cache, 1);
+    EnsureCached(cache, 2);
+}
+
+TEST(ParticleCacheResetAndSwap)
+{
+    particleCacheList cache;
+    for (unsigned int i=0;i<4;++i) AppendParticle(cache);
+
+    particleCacheList other;
+    other.Reset(100);
+    AppendParticle(other);
+
+    cache.swap(other);
+    ENSURE_EQUAL(cache.NextIndex(), 101u, "swap exchanges the sequences");
+    EnsureCached(cache, 100);
+    ENSURE(cache.Find(1) == NULL, "swap exchanges the entries");
+    EnsureCached(other, 4);
+
+    cache.Reset(7);
+    ENSURE(cache.Find(100) == NULL, "Reset() drops all entries");
+    ENSURE_EQUAL(AppendParticle(cache), 7u, "the sequence continues at the reset identifier");
+}
+
+TEST(DOMIndexDenseTable)
+{
+    boost::random::mt19937 rng(2017);
+    referenceMap reference;
+    // negative string ids as used by some geometries
+    const I3CLSimSimpleGeometryUserConfigurable geometry = MakeGeometry(rng, -5, 86, 66, reference);
+
+    domIndexLookupTable lookup;
+    lookup.Build(geometry);
+    ENSURE(!lookup.table.empty(), "compact ids use the dense table");
+    ENSURE(lookup.sortedKeys.empty(), "compact ids do not use the sorted keys");
+
+    EnsureMatchesReference(rng, lookup, reference, -5, 86, 66);
+}
+
+TEST(DOMIndexSparseIds)
+{
+    boost::random::mt19937 rng(2018);
+    referenceMap reference;
+    // too sparse for a dense table
+    const I3CLSimSimpleGeometryUserConfigurable geometry = MakeGeometry(rng, 1, 1000000, 5000, reference);
+
+    domIndexLookupTable lookup;
+    lookup.Build(geometry);
+    ENSURE(lookup.table.empty(), "sparse ids do not use the dense table");
+    ENSURE_EQUAL(lookup.sortedKeys.size(), geometry.size(), "sparse ids use the sorted keys");
+
+    EnsureMatchesReference(rng, lookup, reference, 1, 1000000, 5000);
+}
+
+TEST(DOMIndexAddsDOMsOutsideTheGeometry)
+{
+    const int32_t minStrings[] = {-5, 1};
+    const int32_t maxStrings[] = {86, 1000000};
+    const uint32_t maxDoms[] = {66, 5000};
+
+    // once with the dense table and once with the sorted keys
+    for (unsigned int t=0;t<2;++t)
+    {
+        boost::random::mt19937 rng(2019+t);
+        referenceMap reference;
+        const I3CLSimSimpleGeometryUserConfigurable geometry =
+            MakeGeometry(rng, minStrings[t], maxStrings[t], maxDoms[t], reference);
+
+        domIndexLookupTable lookup;
+        lookup.Build(geometry);
+        const int32_t numDOMs = static_cast<int32_t>(geometry.size());
+
+        // DOMs of the geometry keep their index and add nothing
+        for (referenceMap::const_iterator it=reference.begin();it!=reference.end();++it)
+            ENSURE_EQUAL(lookup.FindOrAdd(it->first.first, it->first.second), it->second,
+                         "FindOrAdd() finds DOMs of the geometry");
+        ENSURE_EQUAL(lookup.size(), geometry.size(), "DOMs of the geometry are not added again");
+
+        // a DOM inside the id range of the geometry, one beyond it and
+        // one with ids below it
+        std::pair<int32_t, uint32_t> inside(reference.begin()->first.first, 1);
+        while (reference.count(inside)) ++inside.second;
+        const std::pair<int32_t, uint32_t> beyond(maxStrings[t]+7, maxDoms[t]+20);
+        const std::pair<int32_t, uint32_t> below(minStrings[t]-1, 0);
+
+        ENSURE_EQUAL(lookup.FindOrAdd(inside.first, inside.second), numDOMs,
+                     "the first unknown DOM gets the index after the geometry");
+        ENSURE_EQUAL(lookup.FindOrAdd(beyond.first, beyond.second), numDOMs+1,
+                     "the next unknown DOM gets the next index");
+        ENSURE_EQUAL(lookup.FindOrAdd(inside.first, inside.second), numDOMs,
+                     "unknown DOMs keep their index");
+        ENSURE_EQUAL(lookup.FindOrAdd(below.first, below.second), numDOMs+2,
+                     "DOMs with ids below the geometry are added as well");
+        ENSURE_EQUAL(lookup.FindOrAdd(beyond.first, beyond.second), numDOMs+1,
+                     "unknown DOMs keep their index");
+        ENSURE_EQUAL(lookup.size(), geometry.size()+3, "every unknown DOM is added once");
+
+        ENSURE(lookup.moduleKeys.at(numDOMs) == ModuleKey(inside.first, inside.second),
+               "added DOMs have their module key");
+        ENSURE(lookup.moduleKeys.at(numDOMs+1) == ModuleKey(beyond.first, beyond.second),
+               "added DOMs have their module key");
+        ENSURE(lookup.moduleKeys.at(numDOMs+2) == ModuleKey(below.first, below.second),
+               "added DOMs have their module key");
+
+        // Find() only knows the geometry
+        ENSURE_EQUAL(lookup.Find(inside.first, inside.second), -1, "Find() does not return added DOMs");
+        ENSURE_EQUAL(lookup.Find(beyond.first, beyond.second), -1, "Find() does not return added DOMs");
+
+        // a new geometry drops the added DOMs
+        lookup.Build(geometry);
+        ENSURE_EQUAL(lookup.size(), geometry.size(), "Build() drops added DOMs");
+        ENSURE_EQUAL(lookup.FindOrAdd(beyond.first, beyond.second), numDOMs,
+                     "indices of added DOMs start after the geometry again");
+    }
+}
+
+TEST(DOMIndexEmptyGeometry)
+{
+    const I3CLSimSimpleGeometryUserConfigurable geometry(0.16510, 0);
+
+    domIndexLookupTable lookup;
+    lookup.Build(geometry);
+    ENSURE_EQUAL(lookup.size(), 0u, "the lookup is empty");
+    ENSURE_EQUAL(lookup.Find(1, 1), -1, "nothing is found in an empty geometry");
+    ENSURE_EQUAL(lookup.FindOrAdd(1, 1), 0, "unknown DOMs are added to an empty geometry");
+    ENSURE_EQUAL(lookup.FindOrAdd(1, 1), 0, "unknown DOMs keep their index");
+    ENSURE_EQUAL(lookup.size(), 1u, "the added DOM is in the lookup");
+}
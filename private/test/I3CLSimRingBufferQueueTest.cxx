@@ -0,0 +1,218 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimRingBufferQueueTest.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#include <I3Test.h>
+
+#include "clsim/I3CLSimRingBufferQueue.h"
+#include "clsim/I3CLSimQueue.h"
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <vector>
+#include <stdexcept>
+
+TEST_GROUP(I3CLSimRingBufferQueue);
+
+namespace {
+    const std::size_t numProducers = 4;
+    const std::size_t numConsumers = 4;
+    const std::size_t numPerProducer = 20000;
+
+    // every value encodes its producer and its position in that producer's sequence
+    void Produce(I3CLSimRingBufferQueue<std::size_t> *queue, std::size_t producer)
+    {
+        for (std::size_t i=0;i<numPerProducer;++i)
+        {
+            const std::size_t value = producer*numPerProducer + i;
+            if (i%3==0) {
+                queue->PutBatch(std::vector<std::size_t>(1, value));
+            } else {
+                queue->Put(value);
+            }
+        }
+    }
+
+    void Consume(I3CLSimRingBufferQueue<std::size_t> *queue,
+                 std::size_t num,
+                 std::vector<std::size_t> *received)
+    {
+        while (received->size() < num)
+        {
+            if (received->size()%2==0) {
+                received->push_back(queue->Get());
+            } else {
+                queue->GetBatch(*received, num-received->size());
+            }
+        }
+    }
+
+    template <typename Queue>
+    void WaitForever(Queue *queue)
+    {
+        try {
+            queue->Get();
+        } catch (boost::thread_interrupted &) {
+            // expected
+        }
+    }
+}
+
+TEST(ZeroSizeIsRejected)
+{
+    try {
+        I3CLSimRingBufferQueue<int> queue(0);
+    } catch (std::runtime_error &) {
+        return;
+    }
+    FAIL("a ring buffer queue without space should not be constructible");
+}
+
+TEST(SingleThreadOrder)
+{
+    I3CLSimRingBufferQueue<int> queue(5);
+    ENSURE(queue.empty(), "a new queue is empty");
+    ENSURE_EQUAL(queue.max_size(), 5u, "max_size is what was asked for");
+
+    int value;
+    ENSURE(!queue.GetNonBlocking(value), "nothing to get from an empty queue");
+    ENSURE_EQUAL(queue.Get(0.01, -1), -1, "timed Get() returns the dummy on timeout");
+
+    // go around the ring buffer a few times
+    for (int lap=0;lap<10;++lap)
+    {
+        for (int i=0;i<5;++i) queue.Put(lap*5+i);
+        ENSURE_EQUAL(queue.size(), 5u, "the queue is full");
+
+        ENSURE_EQUAL(queue.Get(), lap*5, "entries come out in order");
+        ENSURE(queue.GetNonBlocking(value), "the queue is not empty");
+        ENSURE_EQUAL(value, lap*5+1, "entries come out in order");
+        ENSURE_EQUAL(queue.Get(1., -1), lap*5+2, "entries come out in order");
+
+        std::vector<int> batch;
+        ENSURE_EQUAL(queue.GetBatch(batch, 10), 2u, "GetBatch() takes everything available");
+        ENSURE_EQUAL(batch[0], lap*5+3, "entries come out in order");
+        ENSURE_EQUAL(batch[1], lap*5+4, "entries come out in order");
+        ENSURE(queue.empty(), "the queue is empty again");
+    }
+}
+
+TEST(MaxSizeIsNotExceeded)
+{
+    // 5 is not a power of two, the ring buffer itself has 8 cells
+    I3CLSimRingBufferQueue<int> queue(5);
+    for (int i=0;i<5;++i) queue.Put(i);
+
+    boost::thread producer(boost::bind(&I3CLSimRingBufferQueue<int>::Put, &queue, 5));
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    ENSURE_EQUAL(queue.size(), 5u, "Put() waits while the queue is full");
+
+    ENSURE_EQUAL(queue.Get(), 0, "entries come out in order");
+    producer.join();
+    ENSURE_EQUAL(queue.size(), 5u, "the waiting Put() finished");
+
+    for (int i=1;i<=5;++i) ENSURE_EQUAL(queue.Get(), i, "entries come out in order");
+}
+
+TEST(ManyProducersAndConsumers)
+{
+    I3CLSimRingBufferQueue<std::size_t> queue(7);
+
+    const std::size_t numTotal = numProducers*numPerProducer;
+    std::vector<std::vector<std::size_t> > received(numConsumers);
+
+    boost::thread_group threads;
+    for (std::size_t i=0;i<numConsumers;++i)
+        threads.create_thread(boost::bind(&Consume, &queue, numTotal/numConsumers, &(received[i])));
+    for (std::size_t i=0;i<numProducers;++i)
+        threads.create_thread(boost::bind(&Produce, &queue, i));
+    threads.join_all();
+
+    ENSURE(queue.empty(), "all entries have been taken");
+
+    std::vector<unsigned int> seen(numTotal, 0);
+    for (std::size_t c=0;c<numConsumers;++c)
+    {
+        ENSURE_EQUAL(received[c].size(), numTotal/numConsumers, "every consumer got its share");
+
+        // a consumer sees the entries of each producer in order
+        std::vector<std::size_t> next(numProducers, 0);
+        for (std::size_t i=0;i<received[c].size();++i)
+        {
+            const std::size_t value = received[c][i];
+            ENSURE(value < numTotal, "no invented entries");
+            ++seen[value];
+
+            const std::size_t producer = value/numPerProducer;
+            ENSURE(value%numPerProducer >= next[producer], "entries of one producer stay in order");
+            next[producer] = value%numPerProducer + 1;
+        }
+    }
+
+    for (std::size_t i=0;i<numTotal;++i)
+        ENSURE_EQUAL(seen[i], 1u, "every entry arrives exactly once");
+}
+
+TEST(InterruptedWaitersDoNotBreakTheQueue)
+{
+    // consumers waiting in Get() are interrupted, e.g. when a converter
+    // shuts down. The queue has to keep working afterwards.
+    I3CLSimRingBufferQueue<int> ringBuffer(4);
+    I3CLSimQueue<int> unbounded;
+
+    boost::thread_group threads;
+    for (int i=0;i<3;++i)
+    {
+        threads.create_thread(boost::bind(&WaitForever<I3CLSimRingBufferQueue<int> >, &ringBuffer));
+        threads.create_thread(boost::bind(&WaitForever<I3CLSimQueue<int> >, &unbounded));
+    }
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    threads.interrupt_all();
+    threads.join_all();
+
+    for (int i=0;i<10;++i)
+    {
+        ringBuffer.Put(i);
+        unbounded.Put(i);
+        ENSURE_EQUAL(ringBuffer.Get(), i, "the ring buffer still works");
+        ENSURE_EQUAL(unbounded.Get(), i, "the unbounded queue still works");
+    }
+}
+
+TEST(QueueUsesTheRingBufferForBoundedSizes)
+{
+    I3CLSimQueue<int> bounded(3);
+    I3CLSimQueue<int> unbounded(0);
+
+    for (int i=0;i<3;++i) bounded.Put(i);
+    for (int i=0;i<1000;++i) unbounded.Put(i);
+
+    ENSURE_EQUAL(bounded.size(), 3u, "the bounded queue is full");
+    ENSURE_EQUAL(unbounded.size(), 1000u, "the unbounded queue has no limit");
+    ENSURE_EQUAL(bounded.Get(), 0, "entries come out in order");
+    ENSURE_EQUAL(unbounded.Get(), 0, "entries come out in order");
+}
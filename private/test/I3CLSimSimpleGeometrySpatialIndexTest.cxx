@@ -0,0 +1,195 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimSimpleGeometrySpatialIndexTest.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#include <I3Test.h>
+
+#include "clsim/I3CLSimSimpleGeometrySpatialIndex.h"
+#include "clsim/I3CLSimSimpleGeometryUserConfigurable.h"
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+
+#include <vector>
+#include <limits>
+#include <cmath>
+
+TEST_GROUP(I3CLSimSimpleGeometrySpatialIndex);
+
+namespace {
+    typedef boost::random::uniform_real_distribution<double> uniform_t;
+
+    // an IceCube-like detector: strings on a jittered grid
+    I3CLSimSimpleGeometryUserConfigurable MakeGeometry(boost::random::mt19937 &rng)
+    {
+        const std::size_t numStrings=36;
+        const std::size_t domsPerString=60;
+
+        I3CLSimSimpleGeometryUserConfigurable geometry(0.16510, numStrings*domsPerString);
+        uniform_t jitter(-20., 20.);
+
+        for (std::size_t s=0;s<numStrings;++s)
+        {
+            const double x = -300. + 125.*static_cast<double>(s%6) + jitter(rng);
+            const double y = -300. + 125.*static_cast<double>(s/6) + jitter(rng);
+            for (std::size_t d=0;d<domsPerString;++d)
+            {
+                const std::size_t i = s*domsPerString+d;
+                geometry.SetStringID(i, static_cast<int32_t>(s+1));
+                geometry.SetDomID(i, static_cast<uint32_t>(d+1));
+                geometry.SetPosX(i, x);
+                geometry.SetPosY(i, y);
+                geometry.SetPosZ(i, 500.-17.*static_cast<double>(d));
+            }
+        }
+
+        return geometry;
+    }
+
+    // the plain loop over all DOMs used before the index existed
+    double BruteForceDistance(const I3CLSimSimpleGeometry &geometry,
+                              const I3Position &pos, const I3Direction &dir,
+                              double tStart, double tEnd)
+    {
+        double closest = std::numeric_limits<double>::infinity();
+        for (std::size_t i=0;i<geometry.size();++i)
+        {
+            const double Ax = geometry.GetPosX(i)-pos.GetX();
+            const double Ay = geometry.GetPosY(i)-pos.GetY();
+            const double Az = geometry.GetPosZ(i)-pos.GetZ();
+
+            double t = Ax*dir.GetX() + Ay*dir.GetY() + Az*dir.GetZ();
+            if (t < tStart) t=tStart;
+            if (t > tEnd) t=tEnd;
+
+            const double dx = Ax-dir.GetX()*t;
+            const double dy = Ay-dir.GetY()*t;
+            const double dz = Az-dir.GetZ()*t;
+            closest = std::min(closest, std::sqrt(dx*dx+dy*dy+dz*dz));
+        }
+        return closest;
+    }
+
+    I3Direction RandomDirection(boost::random::mt19937 &rng)
+    {
+        uniform_t cosTheta(-1., 1.);
+        uniform_t phi(0., 2.*M_PI);
+        const double ct = cosTheta(rng);
+        const double st = std::sqrt(1.-ct*ct);
+        const double p = phi(rng);
+        return I3Direction(st*std::cos(p), st*std::sin(p), ct);
+    }
+}
+
+TEST(PointQueriesMatchBruteForce)
+{
+    boost::random::mt19937 rng(4711);
+    const I3CLSimSimpleGeometryUserConfigurable geometry = MakeGeometry(rng);
+    uniform_t coordinate(-1000., 1000.);
+
+    // default and deliberately small/large cells
+    const double cellSizes[] = {0., 7., 400.};
+    for (std::size_t c=0;c<sizeof(cellSizes)/sizeof(double);++c)
+    {
+        const I3CLSimSimpleGeometrySpatialIndex index(geometry, cellSizes[c]);
+        ENSURE_EQUAL(index.size(), geometry.size(), "all DOMs are in the index");
+
+        for (unsigned int i=0;i<2000;++i)
+        {
+            const I3Position pos(coordinate(rng), coordinate(rng), coordinate(rng));
+            const double expected = BruteForceDistance(geometry, pos, I3Direction(0.,0.,1.), 0., 0.);
+            ENSURE_DISTANCE(index.GetDistanceToClosestDOM(pos), expected, 1e-9,
+                            "point query differs from the loop over all DOMs");
+        }
+    }
+}
+
+TEST(SegmentQueriesMatchBruteForce)
+{
+    boost::random::mt19937 rng(815);
+    const I3CLSimSimpleGeometryUserConfigurable geometry = MakeGeometry(rng);
+    const I3CLSimSimpleGeometrySpatialIndex index(geometry);
+    uniform_t coordinate(-1500., 1500.);
+    uniform_t length(0., 2000.);
+
+    const double inf = std::numeric_limits<double>::infinity();
+
+    for (unsigned int i=0;i<2000;++i)
+    {
+        const I3Position pos(coordinate(rng), coordinate(rng), coordinate(rng));
+        const I3Direction dir = RandomDirection(rng);
+        const double len = length(rng);
+        const bool nostart = (i%4==1) || (i%4==3);
+        const bool nostop = (i%4==2) || (i%4==3);
+
+        const double exact = BruteForceDistance(geometry, pos, dir,
+                                                nostart?-inf:0., nostop?inf:len);
+
+        // without a cutoff the result is always exact
+        ENSURE_DISTANCE(index.GetDistanceToClosestDOM(pos, dir, len, nostart, nostop), exact, 1e-9,
+                        "segment query differs from the loop over all DOMs");
+
+        // with a cutoff it is exact below the cutoff and the cutoff otherwise
+        const double maxDistance = 300.;
+        ENSURE_DISTANCE(index.GetDistanceToClosestDOM(pos, dir, len, nostart, nostop, maxDistance),
+                        std::min(exact, maxDistance), 1e-9,
+                        "segment query with a cutoff differs from the loop over all DOMs");
+    }
+}
+
+TEST(AxisParallelSegments)
+{
+    boost::random::mt19937 rng(42);
+    const I3CLSimSimpleGeometryUserConfigurable geometry = MakeGeometry(rng);
+    const I3CLSimSimpleGeometrySpatialIndex index(geometry);
+    uniform_t coordinate(-800., 800.);
+
+    const I3Direction directions[] = {
+        I3Direction(1.,0.,0.), I3Direction(0.,1.,0.), I3Direction(0.,0.,1.),
+        I3Direction(-1.,0.,0.), I3Direction(0.,-1.,0.), I3Direction(0.,0.,-1.)
+    };
+
+    for (unsigned int i=0;i<600;++i)
+    {
+        const I3Position pos(coordinate(rng), coordinate(rng), coordinate(rng));
+        const I3Direction &dir = directions[i%6];
+
+        const double exact = BruteForceDistance(geometry, pos, dir, 0., 500.);
+        ENSURE_DISTANCE(index.GetDistanceToClosestDOM(pos, dir, 500., false, false, 200.),
+                        std::min(exact, 200.), 1e-9,
+                        "axis-parallel segment query differs from the loop over all DOMs");
+    }
+}
+
+TEST(EmptyGeometry)
+{
+    const I3CLSimSimpleGeometryUserConfigurable geometry(0.16510, 0);
+    const I3CLSimSimpleGeometrySpatialIndex index(geometry);
+
+    ENSURE_EQUAL(index.size(), 0u, "the index is empty");
+    ENSURE_EQUAL(index.GetDistanceToClosestDOM(I3Position(1.,2.,3.)), 0., "an empty index returns 0");
+    ENSURE_EQUAL(index.GetDistanceToClosestDOM(I3Position(1.,2.,3.), I3Direction(0.,0.,1.), 10.), 0.,
+                 "an empty index returns 0");
+}
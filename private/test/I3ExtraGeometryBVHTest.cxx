@@ -0,0 +1,314 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3ExtraGeometryBVHTest.cxx
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#include <I3Test.h>
+
+#include "clsim/shadow/I3ExtraGeometryBVH.h"
+#include "clsim/shadow/I3ExtraGeometryItemCylinder.h"
+#include "clsim/shadow/I3ExtraGeometryItemUnion.h"
+#include "clsim/shadow/I3ExtraGeometryItemMove.h"
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include <vector>
+#include <cmath>
+
+TEST_GROUP(I3ExtraGeometryBVH);
+
+namespace {
+    typedef boost::random::uniform_real_distribution<double> uniform_t;
+
+    // an item that is not a cylinder (the BVH has to use it as-is)
+    struct TestSphere : public I3ExtraGeometryItem
+    {
+        TestSphere(const I3Position &center, double radius)
+        : center_(center), radius_(radius) {;}
+
+        virtual bool DoesLineIntersect(const I3Position &lineStart,
+                                       const I3Position &lineEnd) const
+        {
+            const I3Position dir = lineEnd-lineStart;
+            const I3Position toCenter = center_-lineStart;
+            const double len2 = dir.GetX()*dir.GetX()+dir.GetY()*dir.GetY()+dir.GetZ()*dir.GetZ();
+            double t = (len2 > 0.)?((toCenter.GetX()*dir.GetX()+toCenter.GetY()*dir.GetY()+toCenter.GetZ()*dir.GetZ())/len2):0.;
+            if (t < 0.) t=0.;
+            if (t > 1.) t=1.;
+            const I3Position closest = lineStart + dir*t;
+            return ((closest-center_).Magnitude() <= radius_);
+        }
+
+        virtual std::pair<I3Position, I3Position> GetBoundingBox() const
+        {
+            return std::make_pair(I3Position(center_.GetX()-radius_, center_.GetY()-radius_, center_.GetZ()-radius_),
+                                  I3Position(center_.GetX()+radius_, center_.GetY()+radius_, center_.GetZ()+radius_));
+        }
+
+        I3Position center_;
+        double radius_;
+    };
+
+    I3Position RandomPosition(boost::random::mt19937 &rng, double extent)
+    {
+        uniform_t coordinate(-extent, extent);
+        return I3Position(coordinate(rng), coordinate(rng), coordinate(rng));
+    }
+
+    // cable-like cylinders, some of them in nested unions and behind moves
+    I3ExtraGeometryItemConstPtr MakeCables(boost::random::mt19937 &rng,
+                                           std::vector<I3ExtraGeometryItemCylinderConstPtr> &placedCylinders)
+    {
+        uniform_t radius(0.02, 0.1);
+        uniform_t length(0.5, 5.);
+        uniform_t tilt(-0.3, 0.3);
+
+        std::vector<I3ExtraGeometryItemConstPtr> topLevel;
+        for (unsigned int group=0;group<20;++group)
+        {
+            const I3Position groupOffset = RandomPosition(rng, 20.);
+            const bool moved = (group%2==1);
+
+            std::vector<I3ExtraGeometryItemConstPtr> elements;
+            for (unsigned int i=0;i<15;++i)
+            {
+                const I3Position from = RandomPosition(rng, 3.) + (moved?I3Position(0.,0.,0.):groupOffset);
+                const double len = length(rng);
+                const I3Position to = from + I3Position(tilt(rng)*len, tilt(rng)*len, len);
+                const double r = radius(rng);
+
+                elements.push_back(I3ExtraGeometryItemConstPtr(new I3ExtraGeometryItemCylinder(from, to, r)));
+
+                const I3Position offset = moved?groupOffset:I3Position(0.,0.,0.);
+                placedCylinders.push_back(I3ExtraGeometryItemCylinderConstPtr(new I3ExtraGeometryItemCylinder(from+offset, to+offset, r)));
+            }
+
+            I3ExtraGeometryItemConstPtr groupItem(new I3ExtraGeometryItemUnion(elements));
+            if (moved) groupItem = I3ExtraGeometryItemConstPtr(new I3ExtraGeometryItemMove(groupItem, groupOffset));
+            topLevel.push_back(groupItem);
+        }
+
+        return I3ExtraGeometryItemConstPtr(new I3ExtraGeometryItemUnion(topLevel));
+    }
+
+    // short segments close to the cables, so that there are hits and misses
+    void MakeSegments(boost::random::mt19937 &rng,
+                      const std::vector<I3ExtraGeometryItemCylinderConstPtr> &cylinders,
+                      std::size_t num,
+                      std::vector<I3Position> &starts,
+                      std::vector<I3Position> &ends)
+    {
+        boost::random::uniform_int_distribution<std::size_t> pick(0, cylinders.size()-1);
+        uniform_t fraction(0., 1.);
+        uniform_t length(0.05, 3.);
+
+        for (std::size_t i=0;i<num;++i)
+        {
+            const I3ExtraGeometryItemCylinder &cylinder = *cylinders[pick(rng)];
+            const I3Position onAxis = cylinder.GetFrom() + (cylinder.GetTo()-cylinder.GetFrom())*fraction(rng);
+            const I3Position start = onAxis + RandomPosition(rng, 0.5);
+
+            I3Position dir = RandomPosition(rng, 1.);
+            dir = dir*(length(rng)/dir.Magnitude());
+
+            // include some axis-parallel segments and
+            // some that cross the cylinder axis
+            if (i%10==0) dir = I3Position(0.,0.,dir.GetZ());
+            if (i%10==1) dir = I3Position(dir.GetX(),0.,0.);
+            if (i%10>=5) dir = (onAxis-start)*(1.+fraction(rng));
+
+            starts.push_back(start);
+            ends.push_back(start+dir);
+        }
+    }
+
+    bool Contains(const I3ExtraGeometryBVH::Node &outer, const double lower[3], const double upper[3])
+    {
+        for (unsigned int i=0;i<3;++i)
+        {
+            if (lower[i] < outer.lower[i]) return false;
+            if (upper[i] > outer.upper[i]) return false;
+        }
+        return true;
+    }
+
+    // walks the tree and checks that every node encloses its children
+    // and that every item is in exactly one leaf
+    void CheckNode(const I3ExtraGeometryBVH &bvh, uint32_t nodeIndex, std::size_t depth,
+                   std::size_t maxItemsPerLeaf, std::vector<unsigned int> &itemSeen)
+    {
+        const std::vector<I3ExtraGeometryBVH::Node> &nodes = bvh.GetNodes();
+        ENSURE(nodeIndex < nodes.size(), "node index is valid");
+        ENSURE(depth <= bvh.GetMaxDepth(), "GetMaxDepth() is the maximum depth");
+        const I3ExtraGeometryBVH::Node &node = nodes[nodeIndex];
+
+        if (node.numItems > 0) {
+            ENSURE(node.numItems <= maxItemsPerLeaf, "leaves are not larger than requested");
+            for (uint32_t j=node.index;j<node.index+node.numItems;++j)
+            {
+                ENSURE(j < itemSeen.size(), "item index is valid");
+                ++itemSeen[j];
+
+                const I3ExtraGeometryItemCylinderConstPtr &cylinder = bvh.GetCylinders()[j];
+                ENSURE(cylinder, "all items are cylinders");
+                const std::pair<I3Position, I3Position> box = cylinder->GetBoundingBox();
+                const double lower[3] = {std::min(box.first.GetX(), box.second.GetX()),
+                                         std::min(box.first.GetY(), box.second.GetY()),
+                                         std::min(box.first.GetZ(), box.second.GetZ())};
+                const double upper[3] = {std::max(box.first.GetX(), box.second.GetX()),
+                                         std::max(box.first.GetY(), box.second.GetY()),
+                                         std::max(box.first.GetZ(), box.second.GetZ())};
+                ENSURE(Contains(node, lower, upper), "leaves enclose their items");
+            }
+            return;
+        }
+
+        const uint32_t left = nodeIndex+1;
+        const uint32_t right = node.index;
+        ENSURE(right > left, "the right child comes after the left subtree");
+        ENSURE(Contains(node, nodes[left].lower, nodes[left].upper), "nodes enclose their left child");
+        ENSURE(Contains(node, nodes[right].lower, nodes[right].upper), "nodes enclose their right child");
+
+        CheckNode(bvh, left, depth+1, maxItemsPerLeaf, itemSeen);
+        CheckNode(bvh, right, depth+1, maxItemsPerLeaf, itemSeen);
+    }
+}
+
+TEST(QueriesMatchTheGeometry)
+{
+    boost::random::mt19937 rng(1234);
+    std::vector<I3ExtraGeometryItemCylinderConstPtr> cylinders;
+    const I3ExtraGeometryItemConstPtr geometry = MakeCables(rng, cylinders);
+
+    std::vector<I3Position> starts, ends;
+    MakeSegments(rng, cylinders, 20000, starts, ends);
+
+    const std::size_t leafSizes[] = {1, 2, 8};
+    for (std::size_t l=0;l<sizeof(leafSizes)/sizeof(std::size_t);++l)
+    {
+        const I3ExtraGeometryBVH bvh(geometry, leafSizes[l]);
+        ENSURE_EQUAL(bvh.GetNumItems(), cylinders.size(), "unions and moves are flattened");
+        ENSURE(bvh.ConsistsOfCylindersOnly(), "there are only cylinders");
+
+        std::size_t numHits=0;
+        for (std::size_t i=0;i<starts.size();++i)
+        {
+            const bool expected = geometry->DoesLineIntersect(starts[i], ends[i]);
+            ENSURE_EQUAL(bvh.DoesLineIntersect(starts[i], ends[i]), expected,
+                         "the BVH agrees with the item tree");
+            if (expected) ++numHits;
+        }
+
+        // make sure the test is meaningful
+        ENSURE(numHits > starts.size()/10, "enough segments hit a cable");
+        ENSURE(numHits < starts.size()*9/10, "enough segments miss all cables");
+    }
+}
+
+TEST(BatchQueriesMatchSingleQueries)
+{
+    boost::random::mt19937 rng(5678);
+    std::vector<I3ExtraGeometryItemCylinderConstPtr> cylinders;
+    const I3ExtraGeometryItemConstPtr geometry = MakeCables(rng, cylinders);
+    const I3ExtraGeometryBVH bvh(geometry);
+
+    std::vector<I3Position> starts, ends;
+    MakeSegments(rng, cylinders, 5000, starts, ends);
+
+    std::vector<bool> results;
+    bvh.DoLinesIntersect(starts, ends, results);
+    ENSURE_EQUAL(results.size(), starts.size(), "one result per segment");
+
+    for (std::size_t i=0;i<starts.size();++i)
+    {
+        ENSURE_EQUAL(results[i], bvh.DoesLineIntersect(starts[i], ends[i]),
+                     "batch and single queries agree");
+    }
+}
+
+TEST(TreeStructure)
+{
+    boost::random::mt19937 rng(91011);
+    std::vector<I3ExtraGeometryItemCylinderConstPtr> cylinders;
+    const I3ExtraGeometryItemConstPtr geometry = MakeCables(rng, cylinders);
+
+    const std::size_t maxItemsPerLeaf = 3;
+    const I3ExtraGeometryBVH bvh(geometry, maxItemsPerLeaf);
+
+    std::vector<unsigned int> itemSeen(bvh.GetNumItems(), 0);
+    CheckNode(bvh, 0, 1, maxItemsPerLeaf, itemSeen);
+
+    for (std::size_t i=0;i<itemSeen.size();++i)
+        ENSURE_EQUAL(itemSeen[i], 1u, "every item is in exactly one leaf");
+}
+
+TEST(MovesAreApplied)
+{
+    const I3ExtraGeometryItemConstPtr cylinder(new I3ExtraGeometryItemCylinder(I3Position(0.,0.,-1.), I3Position(0.,0.,1.), 0.1));
+    const I3ExtraGeometryItemConstPtr moved(new I3ExtraGeometryItemMove(cylinder, I3Position(10.,0.,0.)));
+    const I3ExtraGeometryBVH bvh(moved);
+
+    ENSURE_EQUAL(bvh.GetNumItems(), 1u, "one cylinder");
+    ENSURE(bvh.GetCylinders()[0], "the moved item is a cylinder");
+    ENSURE_DISTANCE(bvh.GetCylinders()[0]->GetFrom().GetX(), 10., 1e-12, "the offset is applied");
+    ENSURE_DISTANCE(bvh.GetCylinders()[0]->GetTo().GetX(), 10., 1e-12, "the offset is applied");
+
+    ENSURE(bvh.DoesLineIntersect(I3Position(9.,0.,0.), I3Position(11.,0.,0.)), "the moved cylinder is hit");
+    ENSURE(!bvh.DoesLineIntersect(I3Position(-1.,0.,0.), I3Position(1.,0.,0.)), "the original position is empty");
+}
+
+TEST(OtherItemsAreUsedAsIs)
+{
+    std::vector<I3ExtraGeometryItemConstPtr> elements;
+    elements.push_back(I3ExtraGeometryItemConstPtr(new I3ExtraGeometryItemCylinder(I3Position(0.,0.,-1.), I3Position(0.,0.,1.), 0.1)));
+    elements.push_back(I3ExtraGeometryItemConstPtr(new I3ExtraGeometryItemMove(I3ExtraGeometryItemConstPtr(new TestSphere(I3Position(0.,0.,0.), 0.5)),
+                                                                               I3Position(5.,0.,0.))));
+    const I3ExtraGeometryItemConstPtr geometry(new I3ExtraGeometryItemUnion(elements));
+    const I3ExtraGeometryBVH bvh(geometry);
+
+    ENSURE_EQUAL(bvh.GetNumItems(), 2u, "two items");
+    ENSURE(!bvh.ConsistsOfCylindersOnly(), "the sphere is not a cylinder");
+
+    ENSURE(bvh.DoesLineIntersect(I3Position(5.,-1.,0.), I3Position(5.,1.,0.)), "the moved sphere is hit");
+    ENSURE(bvh.DoesLineIntersect(I3Position(0.,-1.,0.), I3Position(0.,1.,0.)), "the cylinder is hit");
+    ENSURE(!bvh.DoesLineIntersect(I3Position(2.5,-1.,0.), I3Position(2.5,1.,0.)), "nothing in between");
+}
+
+TEST(EmptyGeometry)
+{
+    const I3ExtraGeometryItemConstPtr geometry(new I3ExtraGeometryItemUnion(std::vector<I3ExtraGeometryItemConstPtr>()));
+    const I3ExtraGeometryBVH bvh(geometry);
+
+    ENSURE_EQUAL(bvh.GetNumItems(), 0u, "no items");
+    ENSURE(bvh.GetNodes().empty(), "no nodes");
+    ENSURE(!bvh.DoesLineIntersect(I3Position(0.,0.,0.), I3Position(1.,1.,1.)), "nothing to hit");
+
+    std::vector<bool> results;
+    bvh.DoLinesIntersect(std::vector<I3Position>(3, I3Position(0.,0.,0.)),
+                         std::vector<I3Position>(3, I3Position(1.,1.,1.)), results);
+    ENSURE_EQUAL(results.size(), 3u, "one result per segment");
+    ENSURE(!results[0] && !results[1] && !results[2], "nothing to hit");
+}
@@ -0,0 +1,232 @@
+/**
+ * Copyright (c) 2015
+ * Jakob van Santen <jvansanten@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file RawTableTest.cxx
+ * @version $LastChangedRevision$
+ * @date $Date$
+ * @author Jakob van Santen
+ */
+
+#include <I3Test.h>
+
+#include "clsim/tabulator/RawTable.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+using namespace clsim::tabulator;
+namespace fs = boost::filesystem;
+
+TEST_GROUP(RawTable);
+
+namespace {
+
+AxesPtr
+MakeAxes(unsigned nTimeBins=10)
+{
+	std::vector<Axes::value_type> axes;
+	axes.push_back(boost::make_shared<PowerAxis>(0, 580, 20, 2));
+	axes.push_back(boost::make_shared<LinearAxis>(0, 180, 6));
+	axes.push_back(boost::make_shared<LinearAxis>(-1, 1, 8));
+	axes.push_back(boost::make_shared<PowerAxis>(0, 7000, nTimeBins, 2));
+	return boost::make_shared<SphericalAxes>(axes);
+}
+
+/// Fill a few sparse regions of the table with random weights
+void
+Fill(RawTable &table, boost::random::mt19937 &rng)
+{
+	BlockedArray &content = table.GetBinContent();
+	boost::random::uniform_int_distribution<size_t> index(0, content.size()-1);
+	boost::random::uniform_real_distribution<float> weight(0.f, 1.f);
+	for (unsigned i = 0; i < 500; i++) {
+		const size_t j = index(rng);
+		const float w = weight(rng);
+		content.Add(j, w);
+		if (table.HasSquaredWeights())
+			table.GetSquaredWeights().Add(j, w*w);
+	}
+	table.AddPhotons(500, 250.);
+	table.SetNormalization(1., 0.07, 1.5, 1.35, 1.32);
+}
+
+void
+EnsureEqual(const BlockedArray &a, const BlockedArray &b, float factor=1.f)
+{
+	ENSURE_EQUAL(a.size(), b.size(), "sizes match");
+	for (size_t i = 0; i < a.size(); i++)
+		ENSURE_DISTANCE(a.Get(i), factor*b.Get(i), 1e-6f*std::abs(factor*b.Get(i)), "contents match");
+}
+
+/// A checkpoint path in a fresh temporary directory, removed when the
+/// test is done
+struct TemporaryDirectory {
+	TemporaryDirectory() : path(fs::temp_directory_path() / fs::unique_path())
+	{
+		fs::create_directories(path);
+	}
+	~TemporaryDirectory()
+	{
+		fs::remove_all(path);
+	}
+	std::string File(const std::string &name) const
+	{
+		return (path / name).string();
+	}
+	fs::path path;
+};
+
+}
+
+TEST(RoundTrip)
+{
+	TemporaryDirectory dir;
+	boost::random::mt19937 rng(1337);
+	AxesPtr axes = MakeAxes();
+	
+	for (unsigned squared = 0; squared < 2; squared++) {
+		RawTable table(*axes, squared);
+		Fill(table, rng);
+		ENSURE_EQUAL(table.HasSquaredWeights(), bool(squared), "squared weights were requested");
+		
+		const std::string path = dir.File("table.checkpoint");
+		table.WriteCheckpoint(path);
+		ENSURE(fs::exists(path), "checkpoint was written");
+		ENSURE(!fs::exists(path + ".tmp"), "temporary file was moved into place");
+		
+		RawTable copy(path);
+		ENSURE_EQUAL(copy.GetNumPhotons(), table.GetNumPhotons(), "number of photons survives");
+		ENSURE_EQUAL(copy.GetSumOfPhotonWeights(), table.GetSumOfPhotonWeights(), "photon weights survive");
+		ENSURE_EQUAL(copy.HasSquaredWeights(), table.HasSquaredWeights(), "squared weights survive");
+		EnsureEqual(copy.GetBinContent(), table.GetBinContent());
+		if (squared)
+			EnsureEqual(copy.GetSquaredWeights(), table.GetSquaredWeights());
+		ENSURE_EQUAL(copy.GetBinContent().GetNAllocatedBlocks(),
+		    table.GetBinContent().GetNAllocatedBlocks(), "only filled blocks are stored");
+		
+		// a checkpoint of the copy is the same again
+		const std::string path2 = dir.File("copy.checkpoint");
+		copy.WriteCheckpoint(path2);
+		ENSURE_EQUAL(fs::file_size(path2), fs::file_size(path), "checkpoints of the copy are identical");
+	}
+}
+
+TEST(Merge)
+{
+	TemporaryDirectory dir;
+	boost::random::mt19937 rng(42);
+	AxesPtr axes = MakeAxes();
+	
+	RawTable first(*axes, true), second(*axes, true);
+	Fill(first, rng);
+	Fill(second, rng);
+	first.WriteCheckpoint(dir.File("first"));
+	second.WriteCheckpoint(dir.File("second"));
+	
+	// the sum of both tables, made in memory
+	RawTable sum(*axes, true);
+	sum.SetNormalization(1., 0.07, 1.5, 1.35, 1.32);
+	for (size_t i = 0; i < sum.GetBinContent().size(); i++) {
+		sum.GetBinContent().Add(i, first.GetBinContent().Get(i));
+		sum.GetBinContent().Add(i, second.GetBinContent().Get(i));
+		sum.GetSquaredWeights().Add(i, first.GetSquaredWeights().Get(i));
+		sum.GetSquaredWeights().Add(i, second.GetSquaredWeights().Get(i));
+	}
+	
+	RawTable merged(dir.File("first"));
+	merged.MergeCheckpoint(dir.File("second"));
+	ENSURE_EQUAL(merged.GetNumPhotons(), first.GetNumPhotons()+second.GetNumPhotons(), "photons are summed");
+	ENSURE_EQUAL(merged.GetSumOfPhotonWeights(),
+	    first.GetSumOfPhotonWeights()+second.GetSumOfPhotonWeights(), "photon weights are summed");
+	EnsureEqual(merged.GetBinContent(), sum.GetBinContent());
+	EnsureEqual(merged.GetSquaredWeights(), sum.GetSquaredWeights());
+	
+	// merging a table into itself doubles it
+	RawTable doubled(dir.File("first"));
+	doubled.MergeCheckpoint(dir.File("first"));
+	EnsureEqual(doubled.GetBinContent(), first.GetBinContent(), 2.f);
+	ENSURE_EQUAL(doubled.GetNumPhotons(), 2*first.GetNumPhotons(), "photons are doubled");
+}
+
+TEST(IncompatibleCheckpoints)
+{
+	TemporaryDirectory dir;
+	boost::random::mt19937 rng(7);
+	AxesPtr axes = MakeAxes();
+	
+	RawTable table(*axes, false);
+	Fill(table, rng);
+	table.WriteCheckpoint(dir.File("table"));
+	
+	// different binning
+	{
+		AxesPtr otherAxes = MakeAxes(12);
+		RawTable other(*otherAxes, false);
+		Fill(other, rng);
+		other.WriteCheckpoint(dir.File("binning"));
+	}
+	// squared weights
+	{
+		RawTable other(*axes, true);
+		Fill(other, rng);
+		other.WriteCheckpoint(dir.File("squared"));
+	}
+	// different normalization
+	{
+		RawTable other(*axes, false);
+		Fill(other, rng);
+		other.SetNormalization(2., 0.07, 1.5, 1.35, 1.32);
+		other.WriteCheckpoint(dir.File("normalization"));
+	}
+	// truncated
+	{
+		std::ifstream in(dir.File("table").c_str(), std::ios::binary);
+		std::ofstream out(dir.File("truncated").c_str(), std::ios::binary);
+		std::vector<char> buffer(fs::file_size(dir.File("table"))/2);
+		in.read(&buffer[0], buffer.size());
+		out.write(&buffer[0], buffer.size());
+	}
+	// not a checkpoint at all
+	{
+		std::ofstream out(dir.File("garbage").c_str());
+		out << "SIMPLE  =                    T";
+	}
+	
+	const char *names[] = {"binning", "squared", "normalization", "truncated", "garbage", "missing"};
+	for (unsigned i = 0; i < sizeof(names)/sizeof(names[0]); i++) {
+		const uint64_t numPhotons = table.GetNumPhotons();
+		bool thrown = false;
+		try {
+			table.MergeCheckpoint(dir.File(names[i]));
+		} catch (std::exception &) {
+			thrown = true;
+		}
+		ENSURE(thrown, std::string("merging the checkpoint should fail: ") + names[i]);
+		if (i < 3)
+			ENSURE_EQUAL(table.GetNumPhotons(), numPhotons, "a rejected checkpoint is not added");
+	}
+}
@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimDeviceScheduler.h
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#ifndef I3CLSIMDEVICESCHEDULER_H_INCLUDED
+#define I3CLSIMDEVICESCHEDULER_H_INCLUDED
+
+#include "clsim/I3CLSimStepToPhotonConverter.h"
+
+#include <vector>
+
+/**
+ * @brief Decides which of a number of converters should
+ * get the next bunch of steps.
+ *
+ * Every device is assigned the bunch it is expected to finish
+ * first. The expected completion time is the number of photons
+ * queued on the device (including the new bunch) divided by the
+ * photon throughput measured on that device so far (from
+ * GetTotalNumPhotonsGenerated() and GetTotalDeviceTime()).
+ * Devices without a measurement yet are assumed to be as fast
+ * as the average of the others. Ties go round-robin.
+ */
+class I3CLSimDeviceScheduler
+{
+public:
+    I3CLSimDeviceScheduler(const std::vector<I3CLSimStepToPhotonConverterPtr> &converters);
+    ~I3CLSimDeviceScheduler();
+
+    /**
+     * Returns the index of the converter that should get a bunch
+     * of steps with numPhotons photons. The bunch is booked to that
+     * converter, so it has to be enqueued there.
+     */
+    std::size_t SelectDevice(uint64_t numPhotons);
+
+    /**
+     * Returns the measured throughput of a device in photons per
+     * nanosecond of device time. Returns NaN if no kernel has
+     * finished on that device yet.
+     */
+    double GetPhotonRate(std::size_t deviceIndex) const;
+
+    /**
+     * Returns the number of photons booked to a device that have
+     * not been propagated yet.
+     */
+    uint64_t GetNumPendingPhotons(std::size_t deviceIndex) const;
+
+private:
+    std::vector<I3CLSimStepToPhotonConverterPtr> converters_;
+
+    // photons ever booked to each device (the converters count
+    // the ones they have finished)
+    std::vector<uint64_t> numPhotonsBooked_;
+
+    std::size_t lastDeviceIndex_;
+};
+
+I3_POINTER_TYPEDEFS(I3CLSimDeviceScheduler);
+
+#endif //I3CLSIMDEVICESCHEDULER_H_INCLUDED
@@ -37,6 +37,7 @@
 #include "clsim/I3CLSimQueue.h"
 
 #include <map>
+#include <deque>
 #include <string>
 
 /**
@@ -136,6 +137,18 @@ public:
      */
     virtual void EnqueueBarrier();
     
+    /**
+     * Adds a "flush marker" to the particle queue. All steps
+     * from light sources enqueued before the marker will be
+     * returned before the marker is reported as reached by
+     * GetConversionResultWithFlushInfo(). In contrast to
+     * EnqueueBarrier(), new light sources can be enqueued
+     * immediately.
+     * 
+     * Will throw if not initialized.
+     */
+    void EnqueueFlushMarker();
+    
     /**
      * Returns true an enqueued barrier is still active. And active
      * barrier means that no new particles can currently be added
@@ -169,6 +182,15 @@ public:
      */
     virtual I3CLSimStepSeriesConstPtr GetConversionResultWithBarrierInfo(bool &barrierWasReset, double timeout=NAN);
     
+    /**
+     * Same as GetConversionResultWithBarrierInfo(), but also
+     * reports if this was the last bunch of steps before a
+     * flush marker (see EnqueueFlushMarker()).
+     * 
+     * Will throw if not initialized.
+     */
+    I3CLSimStepSeriesConstPtr GetConversionResultWithFlushInfo(bool &barrierWasReset, bool &flushMarkerWasReached, double timeout=NAN);
+    
 private:
     void LogGeant4Messages(bool allAsWarn=false) const;
 
@@ -183,6 +205,7 @@ private:
 
     mutable boost::mutex barrier_is_enqueued_mutex_;
     bool barrier_is_enqueued_;
+    std::deque<bool> pendingFlushIsBarrier_; // one entry per enqueued barrier/flush marker, in order
 
     boost::shared_ptr<I3CLSimQueue<ToGeant4Pair_t> > queueToGeant4_;
     boost::shared_ptr<I3CLSimQueue<FromGeant4Pair_t> > queueFromGeant4_;
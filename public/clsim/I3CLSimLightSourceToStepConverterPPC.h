@@ -67,6 +67,13 @@ public:
 
     void SetUseCascadeExtension(bool v) { useCascadeExtension_ = v; };
 
+    /**
+     * Sets the number of threads pre-calculating random values for
+     * the cascade angular distribution. 0 (the default) means
+     * one thread per CPU core (up to 8).
+     */
+    void SetNumFeederThreads(unsigned int num);
+
     // inherited:
     
     virtual void SetBunchSizeGranularity(uint64_t num);
@@ -168,6 +175,7 @@ private:
     uint32_t highPhotonsPerStep_;
     double useHighPhotonsPerStepStartingFromNumPhotons_;
     bool useCascadeExtension_;
+    unsigned int numFeederThreads_;
     
     I3CLSimFunctionConstPtr wlenBias_;
     I3CLSimMediumPropertiesConstPtr mediumProperties_;
@@ -185,25 +193,27 @@ private:
     class GenerateStepPreCalculator
     {
     public:
+        // numberOfThreads==0 means one thread per CPU core (up to 8)
         GenerateStepPreCalculator(I3RandomServicePtr randomService,
                                   double angularDist_a=0.39,
                                   double angularDist_b=2.61,
-                                  std::size_t numberOfValues=102400);
+                                  std::size_t numberOfValues=102400,
+                                  unsigned int numberOfThreads=0);
         ~GenerateStepPreCalculator();
         
         inline void GetAngularCosSinValue(double &angular_cos, double &angular_sin, double &random_value)
         {
             if (index_ >= numberOfValues_) RegenerateValues();
             
-            const std::pair<std::pair<double, double>, double> &currentPair = (*currentVector_)[index_];
-            
-            angular_sin = currentPair.first.first;
-            angular_cos = currentPair.first.second;
-            random_value = currentPair.second;
+            angular_sin = currentVector_->sinValues[index_];
+            angular_cos = currentVector_->cosValues[index_];
+            random_value = currentVector_->randomValues[index_];
             
             ++index_;
         }
         
+        inline unsigned int GetNumberOfThreads() const {return numberOfThreads_;}
+        
     private:
         double one_over_angularDist_a_;
         double angularDist_b_;
@@ -211,8 +221,15 @@ private:
         
         std::size_t numberOfValues_;
         std::size_t index_;
+        unsigned int numberOfThreads_;
 
-        typedef std::vector<std::pair<std::pair<double, double>, double> > queueVector_t;
+        // one block of pre-calculated values (structure of arrays)
+        struct queueVector_t
+        {
+            std::vector<double> sinValues;
+            std::vector<double> cosValues;
+            std::vector<double> randomValues;
+        };
         boost::shared_ptr<queueVector_t> currentVector_;
         
         I3CLSimQueue<boost::shared_ptr<queueVector_t> > queueFromFeederThreads_;
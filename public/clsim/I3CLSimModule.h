@@ -48,8 +48,11 @@
 #include "clsim/I3CLSimSpectrumTable.h"
 
 #include "clsim/I3CLSimSimpleGeometryFromI3Geometry.h"
+#include "clsim/I3CLSimSimpleGeometrySpatialIndex.h"
 
 #include "clsim/I3CLSimStepToPhotonConverterOpenCL.h"
+#include "clsim/I3CLSimStepToPhotonConverterNative.h"
+#include "clsim/I3CLSimDeviceScheduler.h"
 #include "clsim/I3CLSimLightSourceToStepConverterGeant4.h"
 
 #include "clsim/I3CLSimLightSourceParameterization.h"
@@ -57,7 +60,9 @@
 #include "simclasses/I3Photon.h"
 
 #include "clsim/I3CLSimPhotonHistory.h"
+#include "clsim/shadow/I3ExtraGeometryItem.h"
 #include "clsim/I3CLSimEventStatistics.h"
+#include "clsim/I3CLSimQueue.h"
 
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
@@ -66,7 +71,12 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <deque>
 #include <string>
+#include <algorithm>
+#include <limits>
+
+namespace I3CLSimHelper { class WorkerPool; }
 
 
 
@@ -285,10 +295,55 @@ private:
     ///   If set to zero (the default) the largest possible workgroup size will be chosen.
     uint32_t limitWorkgroupSize_;
 
+    /// Parameter: Upload steps to the OpenCL device(s) in a compressed format
+    ///   (shared headers for consecutive steps of the same particle, quantized
+    ///   per-step positions and times).
+    bool compressSteps_;
+
+    /// Parameter: Propagate photons in chunks of this size pulled by a fixed number
+    ///   of work items instead of one step per work item. 0 (the default) disables it.
+    uint32_t photonChunkSize_;
+
+    /// Parameter: Use a counter-based RNG keyed on a per-job key, the step and the
+    ///   photon index instead of per-work-item MWC generators in the OpenCL kernel.
+    bool useCounterBasedRNG_;
+
+    /// Parameter: Find scattering and absorption points using cumulative optical depth
+    ///   tables of the medium layers instead of stepping through the layers.
+    bool useOpticalDepthTables_;
+
+    /// Parameter: Directory used to cache compiled OpenCL kernels. Jobs with the same
+    ///   medium, geometry, options and device/driver load the kernel from there
+    ///   instead of compiling it. Empty (the default) disables the cache.
+    std::string kernelCacheDirectory_;
+
+    /// Parameter: Cables and other objects shadowing the DOMs (cylinders in
+    ///   unions and moves). Photons hitting them are absorbed during propagation.
+    I3ExtraGeometryItemConstPtr extraGeometry_;
+
     /// Parameter: do not even start light from sources that do not have any DOMs closer to
     ///   to them than this distance. (default is 300m)
     double closestDOMDistanceCutoff_;
 
+    /// Parameter: Do not flush the frame cache using a global barrier. Instead, frames are
+    ///   pushed as soon as all of their photons have been returned from the GPU(s) while
+    ///   other frames are still being worked on. "MaxNumParallelEvents" then is the maximum
+    ///   number of frames held by the module at any time.
+    bool streamingMode_;
+
+    /// Parameter: Number of threads used to convert the photons returned from the GPU(s) to
+    ///   I3Photons and to add them to their frames. Set to 0 to use one thread per CPU core.
+    uint32_t photonAssemblyThreads_;
+
+    /// Parameter: Propagate photons on the host CPU(s) in addition to the
+    ///   OpenCL devices (if any). Not available with "SaveAllPhotons",
+    ///   "PhotonHistoryEntries" or "FixedNumberOfAbsorptionLengths".
+    bool useNativeCPUPropagator_;
+
+    /// Parameter: Number of threads used by the native CPU propagator.
+    ///   Set to 0 to use one thread per CPU core.
+    uint32_t nativeCPUPropagatorThreads_;
+
 
 private:
     // default, assignment, and copy constructor declared private
@@ -302,15 +357,41 @@ private:
     void Thread_starter();
     bool Thread(boost::this_thread::disable_interruption &di);
     boost::shared_ptr<boost::thread> threadObj_;
+
+    // threads that add the photons to their frames (not used with a
+    // single thread), kept for all flushes
+    boost::shared_ptr<I3CLSimHelper::WorkerPool> photonAssemblyPool_;
     boost::condition_variable_any threadStarted_cond_;
     boost::mutex threadStarted_mutex_;
     bool threadStarted_;
     bool threadFinishedOK_;
     std::vector<uint64_t> numBunchesSentToOpenCL_;
 
+    // streaming mode: the thread reports every bunch sent to
+    // OpenCL and every flush marker it encounters in this queue
+    struct streamingQueueEntry
+    {
+        bool isFlushMarker;
+        std::size_t deviceIndex; // OpenCL device the bunch was sent to
+        boost::shared_ptr<std::map<uint32_t, uint64_t> > photonNumGeneratedPerParticle;
+        boost::shared_ptr<std::map<uint32_t, double> > photonWeightSumGeneratedPerParticle;
+    };
+    boost::shared_ptr<I3CLSimQueue<streamingQueueEntry> > streamingQueue_;
+    std::deque<streamingQueueEntry> streamingEntriesInProgress_;
+    std::deque<std::size_t> framesAwaitingFlushMarker_; // absolute frame numbers
+    std::size_t streamingFramesFinished_; // all frames with smaller absolute numbers are finished
     
     // helper functions
     std::size_t FlushFrameCache();
+    void DrainStreamingResults(bool waitForOldestFrame);
+    std::size_t PushFinishedStreamingFrames();
+    void AddStreamingStatistics(const std::map<uint32_t, uint64_t> &photonNumPerParticle,
+                                const std::map<uint32_t, double> &photonWeightSumPerParticle,
+                                bool photonsAtDOMs);
+    void AddStreamingStatisticsForParticle(uint32_t identifier,
+                                           uint64_t numPhotons,
+                                           double weightSum,
+                                           bool photonsAtDOMs);
     void ConvertMCTreeToLightSources(const I3MCTree &mcTree,
                                      std::deque<I3CLSimLightSource> &lightSources,
                                      std::deque<double> &timeOffsets);
@@ -337,7 +418,9 @@ private:
     std::vector<I3CLSimRandomValueConstPtr> wavelengthGenerators_;
 
     I3CLSimSimpleGeometryFromI3GeometryPtr geometry_;
-    std::vector<I3CLSimStepToPhotonConverterOpenCLPtr> openCLStepsToPhotonsConverters_;
+    I3CLSimSimpleGeometrySpatialIndexPtr geometryIndex_;
+    std::vector<I3CLSimStepToPhotonConverterPtr> openCLStepsToPhotonsConverters_;
+    I3CLSimDeviceSchedulerPtr deviceScheduler_;
     I3CLSimLightSourceToStepConverterGeant4Ptr geant4ParticleToStepsConverter_;
     
     // list of all currently held frames, in order
@@ -347,20 +430,184 @@ private:
     std::vector<boost::shared_ptr<OutputMapType> > photonsForFrameList_;
     std::vector<int32_t> currentPhotonIdForFrame_;
     std::vector<bool> frameIsBeingWorkedOn_;
-    std::vector<std::set<ModuleKey> > maskedOMKeys_;
+    std::vector<std::vector<bool> > maskedDOMsForFrame_; // indexed by DOM index, empty if nothing is masked (may be shorter than domIndexLookup_)
+    std::vector<std::pair<uint32_t, uint32_t> > particleCacheIndicesForFrame_; // (first index, number of indices)
+    std::vector<I3CLSimEventStatisticsPtr> eventStatisticsForFrame_; // streaming mode only
+    std::size_t frameListOffset_; // absolute frame number of frameList_[0]
 
 public:
     struct particleCacheEntry
     {
-        std::size_t frameListEntry; // pointer to the frame list by entry number
+        std::size_t frameListEntry; // pointer to the frame list by (absolute) entry number
         uint64_t particleMajorID;
         int particleMinorID;
         double timeShift; // optional time that needs to be added to the final output photon
     };
+
+    /**
+     * All particles currently being simulated. Particle identifiers are
+     * handed out in sequence (skipping 0) and released in the same order,
+     * so the cache is a flat vector indexed by the identifier relative to
+     * the oldest entry.
+     */
+    struct particleCacheList
+    {
+        particleCacheList() : firstIndex(1), numReleased(0) {}
+
+        // identifiers cycle through [1, maxIndex]
+        static const uint32_t maxIndex = 0xFFFFFFFF;
+
+        static inline uint32_t AdvanceIndex(uint32_t index, std::size_t n)
+        {
+            return static_cast<uint32_t>((static_cast<uint64_t>(index-1) + n) % maxIndex) + 1;
+        }
+
+        // returns NULL if the identifier is not in the cache
+        inline const particleCacheEntry *Find(uint32_t identifier) const
+        {
+            if (identifier==0) return NULL;
+            const std::size_t slot = (identifier >= firstIndex) ?
+                (identifier-firstIndex) : (static_cast<std::size_t>(identifier)+maxIndex-firstIndex);
+            if ((slot < numReleased) || (slot >= entries.size())) return NULL;
+            return &(entries[slot]);
+        }
+
+        inline uint32_t NextIndex() const {return AdvanceIndex(firstIndex, entries.size());}
+
+        // the new entry has to be for identifier NextIndex()
+        inline particleCacheEntry &Append()
+        {
+            entries.push_back(particleCacheEntry());
+            return entries.back();
+        }
+
+        // releases the n oldest entries
+        inline void ReleaseOldest(std::size_t n)
+        {
+            numReleased += n;
+            if (numReleased > entries.size()) numReleased = entries.size();
+
+            // only compact once in a while
+            if (numReleased*2 < entries.size()) return;
+            entries.erase(entries.begin(), entries.begin()+numReleased);
+            firstIndex = AdvanceIndex(firstIndex, numReleased);
+            numReleased = 0;
+        }
+
+        inline void Reset(uint32_t nextIndex)
+        {
+            firstIndex = nextIndex;
+            numReleased = 0;
+            entries.clear();
+        }
+
+        inline void swap(particleCacheList &other)
+        {
+            std::swap(firstIndex, other.firstIndex);
+            std::swap(numReleased, other.numReleased);
+            entries.swap(other.entries);
+        }
+
+        uint32_t firstIndex; // identifier of entries[0]
+        std::size_t numReleased; // number of released entries at the front
+        std::vector<particleCacheEntry> entries;
+    };
+
+    /**
+     * Maps the string/OM ids of photons returned by OpenCL
+     * to the index of their DOM in the geometry.
+     */
+    struct domIndexLookupTable
+    {
+        domIndexLookupTable() : minStringID(0), minDomID(0), numStrings(0), numDomsPerString(0) {}
+
+        void Build(const I3CLSimSimpleGeometry &geometry)
+        {
+            const std::vector<int32_t> &stringIDs = geometry.GetStringIDVector();
+            const std::vector<uint32_t> &domIDs = geometry.GetDomIDVector();
+
+            moduleKeys.clear();
+            table.clear();
+            sortedKeys.clear();
+            extraIndices.clear();
+            numStrings=0;
+            numDomsPerString=0;
+            if (stringIDs.empty()) return;
+
+            minStringID = *std::min_element(stringIDs.begin(), stringIDs.end());
+            minDomID = *std::min_element(domIDs.begin(), domIDs.end());
+            numStrings = static_cast<std::size_t>(*std::max_element(stringIDs.begin(), stringIDs.end())-minStringID)+1;
+            numDomsPerString = static_cast<std::size_t>(*std::max_element(domIDs.begin(), domIDs.end())-minDomID)+1;
+
+            // use a dense table unless the ids are very sparse
+            const bool useTable = (static_cast<double>(numStrings)*static_cast<double>(numDomsPerString) <= 16777216.);
+            if (useTable) table.assign(numStrings*numDomsPerString, -1);
+
+            for (std::size_t i=0;i<stringIDs.size();++i)
+            {
+                moduleKeys.push_back(ModuleKey(stringIDs[i], domIDs[i]));
+
+                if (useTable) {
+                    table[static_cast<std::size_t>(stringIDs[i]-minStringID)*numDomsPerString + (domIDs[i]-minDomID)] = static_cast<int32_t>(i);
+                } else {
+                    sortedKeys.push_back(std::make_pair(std::make_pair(stringIDs[i], domIDs[i]), static_cast<int32_t>(i)));
+                }
+            }
+            std::sort(sortedKeys.begin(), sortedKeys.end());
+        }
+
+        // returns -1 for unknown DOMs
+        inline int32_t Find(int32_t stringID, uint32_t domID) const
+        {
+            if (!table.empty()) {
+                if ((stringID < minStringID) || (domID < minDomID)) return -1;
+                const std::size_t s = static_cast<std::size_t>(stringID-minStringID);
+                const std::size_t d = static_cast<std::size_t>(domID-minDomID);
+                if ((s >= numStrings) || (d >= numDomsPerString)) return -1;
+                return table[s*numDomsPerString + d];
+            }
+
+            const std::pair<int32_t, uint32_t> key(stringID, domID);
+            std::vector<std::pair<std::pair<int32_t, uint32_t>, int32_t> >::const_iterator it =
+            std::lower_bound(sortedKeys.begin(), sortedKeys.end(), std::make_pair(key, std::numeric_limits<int32_t>::min()));
+            if ((it == sortedKeys.end()) || (it->first != key)) return -1;
+            return it->second;
+        }
+
+        // Like Find(), but DOMs that are not in the geometry get new
+        // indices after the ones of the geometry (and keep them)
+        // instead of -1.
+        inline int32_t FindOrAdd(int32_t stringID, uint32_t domID)
+        {
+            const int32_t index = Find(stringID, domID);
+            if (index >= 0) return index;
+
+            const ModuleKey key(stringID, domID);
+            std::map<ModuleKey, int32_t>::const_iterator it = extraIndices.find(key);
+            if (it != extraIndices.end()) return it->second;
+
+            const int32_t newIndex = static_cast<int32_t>(moduleKeys.size());
+            moduleKeys.push_back(key);
+            extraIndices.insert(std::make_pair(key, newIndex));
+            return newIndex;
+        }
+
+        inline std::size_t size() const {return moduleKeys.size();}
+
+        std::vector<ModuleKey> moduleKeys; // by DOM index
+        int32_t minStringID;
+        uint32_t minDomID;
+        std::size_t numStrings;
+        std::size_t numDomsPerString;
+        std::vector<int32_t> table;
+        std::vector<std::pair<std::pair<int32_t, uint32_t>, int32_t> > sortedKeys; // only used for sparse ids
+        std::map<ModuleKey, int32_t> extraIndices; // DOMs that are not in the geometry
+    };
 private:
     // list of all particles (with pointrs to their frames)
     // currently being simulated
-    std::map<uint32_t, particleCacheEntry> particleCache_;
+    particleCacheList particleCache_;
+    domIndexLookupTable domIndexLookup_;
 
     SET_LOGGER("I3CLSimModule");
 };
@@ -37,12 +37,15 @@
 #include "clsim/I3CLSimSimpleGeometryFromI3Geometry.h"
 
 #include "clsim/I3CLSimStepToPhotonConverterOpenCL.h"
+#include "clsim/I3CLSimStepToPhotonConverterNative.h"
 #include "clsim/I3CLSimLightSourceToStepConverterGeant4.h"
 
 #include "clsim/I3CLSimLightSourceParameterization.h"
 
 #include "clsim/I3CLSimOpenCLDevice.h"
 
+#include "clsim/shadow/I3ExtraGeometryItem.h"
+
 #include <vector>
 #include <string>
 
@@ -62,7 +65,25 @@ namespace I3CLSimModuleHelper {
                      double fixedNumberOfAbsorptionLengths,
                      double pancakeFactor,
                      uint32_t photonHistoryEntries,
-                     uint32_t limitWorkgroupSize);
+                     uint32_t limitWorkgroupSize,
+                     bool compressSteps=false,
+                     bool compactPhotons=false,
+                     const std::string &kernelCacheDirectory="",
+                     I3ExtraGeometryItemConstPtr shadowGeometry=I3ExtraGeometryItemConstPtr(),
+                     uint32_t photonChunkSize=0,
+                     bool counterBasedRNG=false,
+                     uint64_t counterBasedRNGKey=0,
+                     bool opticalDepthTables=false);
+    
+    I3CLSimStepToPhotonConverterNativePtr
+    initializeNativeCPU(I3RandomServicePtr rng,
+                        I3CLSimSimpleGeometryFromI3GeometryPtr geometry,
+                        I3CLSimMediumPropertiesConstPtr medium,
+                        I3CLSimFunctionConstPtr wavelengthGenerationBias,
+                        const std::vector<I3CLSimRandomValueConstPtr> &wavelengthGenerators,
+                        uint32_t numThreads,
+                        bool stopDetectedPhotons,
+                        double pancakeFactor);
     
     I3CLSimLightSourceToStepConverterGeant4Ptr
     initializeGeant4(I3RandomServicePtr rng,
@@ -27,7 +27,9 @@
 #ifndef I3CLSIMQUEUE_H_INCLUDED
 #define I3CLSIMQUEUE_H_INCLUDED
 
-#include <queue>
+#include <deque>
+#include <vector>
+#include <algorithm>
 
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/locks.hpp>
@@ -35,6 +37,8 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/noncopyable.hpp>
 
+#include "clsim/I3CLSimRingBufferQueue.h"
+
 /**
  * @brief A thread-safe queue, storing objects of type T.
  * T will be copied around quite a bit, so make it light-weight.
@@ -42,6 +46,12 @@
  * 
  * Will block on Get if queue is empty and on Put if queue is full.
  * A max_size argument of 0 will get you a queue with no limit.
+ *
+ * Queues with a limit use a lock-free ring buffer
+ * (see I3CLSimRingBufferQueue), queues without a limit use
+ * a std::deque protected by a mutex. In both cases producers
+ * and consumers wait on separate condition variables and are
+ * only notified if somebody is actually waiting.
  */
 
 template <typename T>
@@ -49,56 +59,96 @@ class I3CLSimQueue : private boost::noncopyable
 {
 public:
     I3CLSimQueue(std::size_t max_size) 
-    : max_size_(max_size) {}
+    : max_size_(max_size), waitingConsumers_(0)
+    {
+        if (max_size_ > 0) ringBuffer_.reset(new I3CLSimRingBufferQueue<T>(max_size_));
+    }
     
-    I3CLSimQueue() {;}
+    I3CLSimQueue() : max_size_(0), waitingConsumers_(0) {;}
     
     ~I3CLSimQueue() {;}
 
     void Put(const T &msg)
     {
+        if (ringBuffer_) {ringBuffer_->Put(msg); return;}
+        
         // lock the mutex to ensure exclusive access to the queue
         boost::unique_lock<boost::mutex> guard(mutex_);
         
-        // as long as the queue is full, wait until something is taken off of it
-        while ((max_size_ > 0) && (queue_.size() >= max_size_))
-        {
-            cond_.wait(guard);
-        }
-
         // add the message to the queue
-        queue_.push(msg);
+        queue_.push_back(msg);
         
-        // notify the consumer thread
-        cond_.notify_one();
+        // notify a consumer thread
+        if (waitingConsumers_ > 0) notEmpty_.notify_one();
     }
     
+    // puts all entries in order
+    void PutBatch(const std::vector<T> &msgs)
+    {
+        if (ringBuffer_) {ringBuffer_->PutBatch(msgs); return;}
+        
+        // lock the mutex to ensure exclusive access to the queue
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        
+        // add the messages to the queue
+        queue_.insert(queue_.end(), msgs.begin(), msgs.end());
+        
+        // notify the consumer threads
+        if (waitingConsumers_ > 0) notEmpty_.notify_all();
+    }
     
     T Get()
     {
+        if (ringBuffer_) return ringBuffer_->Get();
+        
         // lock the mutex to ensure exclusive access to the queue
         boost::unique_lock<boost::mutex> guard(mutex_);
         
         // in case the queue is empty, sleep waiting for something to be put onto it
         while (queue_.empty())
         {
-            cond_.wait(guard);
+            I3CLSimWaitingThreadCounter<std::size_t> waiting(waitingConsumers_);
+            notEmpty_.wait(guard);
         }
         
         // the queue is not empty anymore, read the value
         T msg = queue_.front();
         
         // remove the current message from the queue
-        queue_.pop();
-        
-        // notify the producer that there is space on the queue now
-        cond_.notify_one();
+        queue_.pop_front();
         
         return msg;
     }
 
+    // waits for at least one entry, then takes everything else that is
+    // available without waiting, up to maxNum entries. Returns the number
+    // of entries appended to msgs.
+    std::size_t GetBatch(std::vector<T> &msgs, std::size_t maxNum)
+    {
+        if (ringBuffer_) return ringBuffer_->GetBatch(msgs, maxNum);
+        if (maxNum==0) return 0;
+        
+        // lock the mutex to ensure exclusive access to the queue
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        
+        // in case the queue is empty, sleep waiting for something to be put onto it
+        while (queue_.empty())
+        {
+            I3CLSimWaitingThreadCounter<std::size_t> waiting(waitingConsumers_);
+            notEmpty_.wait(guard);
+        }
+        
+        const std::size_t num = std::min(maxNum, queue_.size());
+        msgs.insert(msgs.end(), queue_.begin(), queue_.begin()+num);
+        queue_.erase(queue_.begin(), queue_.begin()+num);
+        
+        return num;
+    }
+
     bool GetNonBlocking(T &value)
     {
+        if (ringBuffer_) return ringBuffer_->GetNonBlocking(value);
+        
         // lock the mutex to ensure exclusive access to the queue
         boost::unique_lock<boost::mutex> guard(mutex_);
         
@@ -109,16 +159,15 @@ public:
         value = queue_.front();
         
         // remove the current message from the queue
-        queue_.pop();
-        
-        // notify the producer that there is space on the queue now
-        cond_.notify_one();
+        queue_.pop_front();
         
         return true;
     }
 
     T Get(double timeout, T returnOnTimeout) // timeout in seconds
     {
+        if (ringBuffer_) return ringBuffer_->Get(timeout, returnOnTimeout);
+        
         // lock the mutex to ensure exclusive access to the queue
         boost::unique_lock<boost::mutex> guard(mutex_);
         
@@ -126,9 +175,13 @@ public:
         while (queue_.empty())
         {
             boost::posix_time::time_duration td = boost::posix_time::milliseconds(static_cast<long>(timeout*1000.));
-            bool ret = cond_.timed_wait(guard, td);
+            bool ret;
+            {
+                I3CLSimWaitingThreadCounter<std::size_t> waiting(waitingConsumers_);
+                ret = notEmpty_.timed_wait(guard, td);
+            }
             
-            if (!ret) {
+            if ((!ret) && (queue_.empty())) {
                 // timeout reached, return dummy
                 return returnOnTimeout;
             }
@@ -138,16 +191,15 @@ public:
         T msg = queue_.front();
         
         // remove the current message from the queue
-        queue_.pop();
-        
-        // notify the producer that there is space on the queue now
-        cond_.notify_one();
+        queue_.pop_front();
         
         return msg;
     }
 
     bool empty() const
     {
+        if (ringBuffer_) return ringBuffer_->empty();
+        
         // lock the mutex to ensure exclusive access to the queue
         boost::unique_lock<boost::mutex> guard(mutex_);
         
@@ -156,6 +208,8 @@ public:
 
     std::size_t size() const
     {
+        if (ringBuffer_) return ringBuffer_->size();
+        
         // lock the mutex to ensure exclusive access to the queue
         boost::unique_lock<boost::mutex> guard(mutex_);
         
@@ -168,10 +222,15 @@ public:
     }
 
 private:
+    // only used for queues with a maximum size
+    boost::shared_ptr<I3CLSimRingBufferQueue<T> > ringBuffer_;
+    
+    // only used for queues without a maximum size
     mutable boost::mutex mutex_;
-    boost::condition_variable_any cond_;
-    std::queue<T> queue_;
+    boost::condition_variable_any notEmpty_;
+    std::deque<T> queue_;
     std::size_t max_size_;
+    std::size_t waitingConsumers_;
 };
 
 
@@ -0,0 +1,361 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimRingBufferQueue.h
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#ifndef I3CLSIMRINGBUFFERQUEUE_H_INCLUDED
+#define I3CLSIMRINGBUFFERQUEUE_H_INCLUDED
+
+#include <vector>
+#include <cstddef>
+#include <stdexcept>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/thread_time.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/noncopyable.hpp>
+
+/**
+ * @brief Counts a thread as waiting for as long as it exists, also
+ * if the wait is left with an exception (e.g. boost::thread_interrupted).
+ * Used by I3CLSimRingBufferQueue and I3CLSimQueue, the counter is either
+ * a boost::atomic or a plain integer protected by the queue's mutex.
+ */
+template <typename Counter>
+class I3CLSimWaitingThreadCounter : private boost::noncopyable
+{
+public:
+    explicit I3CLSimWaitingThreadCounter(Counter &counter) : counter_(counter)
+    {
+        ++counter_;
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    }
+    ~I3CLSimWaitingThreadCounter()
+    {
+        --counter_;
+    }
+private:
+    Counter &counter_;
+};
+
+/**
+ * @brief A bounded, thread-safe queue storing objects of type T,
+ * based on a lock-free ring buffer. Any number of threads may put
+ * and get at the same time.
+ *
+ * Put and Get do not take any locks as long as the queue is neither
+ * full nor empty. Only a thread that has to wait for space (or data)
+ * goes to sleep on a condition variable, and only then does the other
+ * side have to lock a mutex to wake it up. Producers and consumers
+ * wait on separate condition variables.
+ *
+ * The API is the same as the one of I3CLSimQueue. A max_size of
+ * 0 is not allowed, the ring buffer always has a fixed size.
+ *
+ * The ring buffer itself follows the bounded MPMC queue by D. Vyukov:
+ * every cell carries a sequence number telling producers and consumers
+ * whether it is free or filled for the current lap around the buffer.
+ */
+template <typename T>
+class I3CLSimRingBufferQueue : private boost::noncopyable
+{
+public:
+    I3CLSimRingBufferQueue(std::size_t max_size)
+    :
+    max_size_(max_size),
+    mask_(0),
+    enqueuePos_(0),
+    dequeuePos_(0),
+    waitingProducers_(0),
+    waitingConsumers_(0)
+    {
+        if (max_size_==0)
+            throw std::runtime_error("I3CLSimRingBufferQueue: max_size has to be > 0");
+
+        // the ring buffer size has to be a power of two
+        std::size_t bufferSize=1;
+        while (bufferSize < max_size_) bufferSize <<= 1;
+        mask_ = bufferSize-1;
+
+        cells_ = std::vector<cell_t>(bufferSize);
+        for (std::size_t i=0;i<bufferSize;++i)
+            cells_[i].sequence.store(i, boost::memory_order_relaxed);
+    }
+
+    ~I3CLSimRingBufferQueue() {;}
+
+    void Put(const T &msg)
+    {
+        PutWithoutWakeUp(msg);
+        WakeUp(waitingConsumers_, notEmpty_);
+    }
+
+    // puts all entries in order and wakes up waiting consumers only
+    // once at the end (or when the queue is full in between)
+    void PutBatch(const std::vector<T> &msgs)
+    {
+        for (typename std::vector<T>::const_iterator it=msgs.begin();it!=msgs.end();++it)
+        {
+            if (TryPut(*it)) continue;
+
+            // the queue is full, make sure consumers are running
+            WakeUp(waitingConsumers_, notEmpty_);
+            PutWithoutWakeUp(*it);
+        }
+        WakeUp(waitingConsumers_, notEmpty_);
+    }
+
+    T Get()
+    {
+        T msg = GetWithoutWakeUp();
+        WakeUp(waitingProducers_, notFull_);
+        return msg;
+    }
+
+    // waits for at least one entry, then takes everything else that is
+    // available without waiting, up to maxNum entries. Returns the number
+    // of entries appended to msgs.
+    std::size_t GetBatch(std::vector<T> &msgs, std::size_t maxNum)
+    {
+        if (maxNum==0) return 0;
+
+        msgs.push_back(GetWithoutWakeUp());
+        std::size_t num=1;
+
+        T msg;
+        while ((num < maxNum) && (TryGet(msg)))
+        {
+            msgs.push_back(msg);
+            ++num;
+        }
+
+        WakeUp(waitingProducers_, notFull_);
+        return num;
+    }
+
+    bool GetNonBlocking(T &value)
+    {
+        if (!TryGet(value)) return false;
+        WakeUp(waitingProducers_, notFull_);
+        return true;
+    }
+
+    T Get(double timeout, T returnOnTimeout) // timeout in seconds
+    {
+        T msg;
+        if (TryGet(msg)) {
+            WakeUp(waitingProducers_, notFull_);
+            return msg;
+        }
+
+        const boost::system_time deadline = boost::get_system_time() +
+            boost::posix_time::milliseconds(static_cast<long>(timeout*1000.));
+
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        I3CLSimWaitingThreadCounter<boost::atomic<std::size_t> > waiting(waitingConsumers_);
+        while (!TryGet(msg))
+        {
+            if (!notEmpty_.timed_wait(guard, deadline)) {
+                // one last try, something may have arrived just now
+                if (TryGet(msg)) break;
+
+                // timeout reached, return dummy
+                return returnOnTimeout;
+            }
+        }
+        guard.unlock();
+
+        WakeUp(waitingProducers_, notFull_);
+        return msg;
+    }
+
+    // this is only a snapshot if other threads are using the queue
+    bool empty() const
+    {
+        return (size()==0);
+    }
+
+    // this is only a snapshot if other threads are using the queue
+    std::size_t size() const
+    {
+        const std::size_t dequeuePos = dequeuePos_.load(boost::memory_order_acquire);
+        const std::size_t enqueuePos = enqueuePos_.load(boost::memory_order_acquire);
+        if (enqueuePos < dequeuePos) return 0;
+        const std::size_t num = enqueuePos-dequeuePos;
+        return (num > max_size_)?max_size_:num;
+    }
+
+    inline std::size_t max_size() const
+    {
+        return max_size_;
+    }
+
+private:
+    void PutWithoutWakeUp(const T &msg)
+    {
+        // the other side is usually just about to make progress,
+        // so try a few times before going to sleep
+        for (unsigned int i=0;i<numSpins;++i) {
+            if (TryPut(msg)) return;
+            boost::this_thread::yield();
+        }
+
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        I3CLSimWaitingThreadCounter<boost::atomic<std::size_t> > waiting(waitingProducers_);
+        while (!TryPut(msg))
+        {
+            notFull_.wait(guard);
+        }
+    }
+
+    T GetWithoutWakeUp()
+    {
+        T msg;
+        for (unsigned int i=0;i<numSpins;++i) {
+            if (TryGet(msg)) return msg;
+            boost::this_thread::yield();
+        }
+
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        I3CLSimWaitingThreadCounter<boost::atomic<std::size_t> > waiting(waitingConsumers_);
+        while (!TryGet(msg))
+        {
+            notEmpty_.wait(guard);
+        }
+
+        return msg;
+    }
+
+    // these never wait and never wake up anyone
+    bool TryPut(const T &msg)
+    {
+        cell_t *cell;
+        std::size_t pos = enqueuePos_.load(boost::memory_order_relaxed);
+        for (;;)
+        {
+            // do not use more than max_size_ entries of the ring buffer
+            const std::ptrdiff_t used = static_cast<std::ptrdiff_t>(pos - dequeuePos_.load(boost::memory_order_acquire));
+            if (used >= static_cast<std::ptrdiff_t>(max_size_)) return false;
+
+            cell = &cells_[pos & mask_];
+            const std::size_t seq = cell->sequence.load(boost::memory_order_acquire);
+            const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq - pos);
+            if (diff == 0) {
+                // the cell is free, try to claim it
+                if (enqueuePos_.compare_exchange_weak(pos, pos+1, boost::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                // the cell is still filled from the last lap: the queue is full
+                return false;
+            } else {
+                // another producer was faster
+                pos = enqueuePos_.load(boost::memory_order_relaxed);
+            }
+        }
+
+        cell->data = msg;
+        cell->sequence.store(pos+1, boost::memory_order_release);
+        return true;
+    }
+
+    bool TryGet(T &msg)
+    {
+        cell_t *cell;
+        std::size_t pos = dequeuePos_.load(boost::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            const std::size_t seq = cell->sequence.load(boost::memory_order_acquire);
+            const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq - (pos+1));
+            if (diff == 0) {
+                // the cell is filled, try to claim it
+                if (dequeuePos_.compare_exchange_weak(pos, pos+1, boost::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                // the cell has not been filled yet: the queue is empty
+                return false;
+            } else {
+                // another consumer was faster
+                pos = dequeuePos_.load(boost::memory_order_relaxed);
+            }
+        }
+
+        msg = cell->data;
+        cell->data = T(); // do not keep shared pointers alive in the buffer
+        cell->sequence.store(pos+mask_+1, boost::memory_order_release);
+        return true;
+    }
+
+    // Wakes up threads waiting on the other side of the queue, if there are
+    // any. Must not be called with the mutex held. The fence pairs with the
+    // one after incrementing the waiter count: either the waiting thread sees
+    // our change when it re-tries, or we see it waiting and notify it under
+    // the mutex.
+    inline void WakeUp(boost::atomic<std::size_t> &waiting, boost::condition_variable_any &cond)
+    {
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        if (waiting.load(boost::memory_order_relaxed) == 0) return;
+
+        boost::unique_lock<boost::mutex> guard(mutex_);
+        cond.notify_all();
+    }
+
+    struct cell_t
+    {
+        cell_t() : sequence(0) {}
+        cell_t(const cell_t &other) : sequence(other.sequence.load(boost::memory_order_relaxed)), data(other.data) {}
+        cell_t &operator=(const cell_t &other)
+        {
+            sequence.store(other.sequence.load(boost::memory_order_relaxed), boost::memory_order_relaxed);
+            data = other.data;
+            return *this;
+        }
+
+        boost::atomic<std::size_t> sequence;
+        T data;
+    };
+
+    static const unsigned int numSpins = 16;
+
+    std::size_t max_size_;
+    std::size_t mask_;
+    std::vector<cell_t> cells_;
+
+    // keep the positions on separate cache lines
+    char pad0_[64];
+    boost::atomic<std::size_t> enqueuePos_;
+    char pad1_[64];
+    boost::atomic<std::size_t> dequeuePos_;
+    char pad2_[64];
+
+    boost::atomic<std::size_t> waitingProducers_;
+    boost::atomic<std::size_t> waitingConsumers_;
+    boost::mutex mutex_;
+    boost::condition_variable_any notFull_;
+    boost::condition_variable_any notEmpty_;
+};
+
+
+#endif //I3CLSIMRINGBUFFERQUEUE_H_INCLUDED
@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file I3CLSimSimpleGeometrySpatialIndex.h
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#ifndef I3CLSIMSIMPLEGEOMETRYSPATIALINDEX_H_INCLUDED
+#define I3CLSIMSIMPLEGEOMETRYSPATIALINDEX_H_INCLUDED
+
+#include "clsim/I3CLSimSimpleGeometry.h"
+
+#include "dataclasses/I3Position.h"
+#include "dataclasses/I3Direction.h"
+
+#include <vector>
+#include <limits>
+#include <cmath>
+
+/**
+ * @brief A uniform grid over the DOM positions of an
+ * I3CLSimSimpleGeometry. Answers "distance to the closest DOM"
+ * queries for points and track segments without looking at
+ * every DOM.
+ *
+ * The DOM positions are copied, so the index does not keep
+ * a reference to the geometry.
+ */
+class I3CLSimSimpleGeometrySpatialIndex
+{
+public:
+    /**
+     * Builds the grid. If cellSize is <= 0 (the default), a
+     * cell size is chosen such that there are a few DOMs per
+     * cell on average.
+     */
+    I3CLSimSimpleGeometrySpatialIndex(const I3CLSimSimpleGeometry &geometry,
+                                      double cellSize=0.);
+    ~I3CLSimSimpleGeometrySpatialIndex();
+
+    /**
+     * Returns the distance from a point to the closest DOM (center).
+     * Returns 0 if the geometry is empty.
+     */
+    double GetDistanceToClosestDOM(const I3Position &pos) const;
+
+    /**
+     * Returns the distance from a track segment starting at pos with
+     * direction dir and a given length to the closest DOM (center).
+     * The track extends infinitely backwards if nostart is set
+     * and infinitely forwards if nostop is set.
+     *
+     * The result is exact if it is smaller than maxDistance. If no
+     * DOM is closer than maxDistance, maxDistance is returned. A finite
+     * maxDistance is what makes this query fast for long tracks.
+     * Returns 0 if the geometry is empty.
+     */
+    double GetDistanceToClosestDOM(const I3Position &pos,
+                                   const I3Direction &dir,
+                                   double length,
+                                   bool nostart=false,
+                                   bool nostop=false,
+                                   double maxDistance=std::numeric_limits<double>::infinity()) const;
+
+    inline std::size_t size() const {return posX_.size();}
+    inline double GetCellSize() const {return cellSize_;}
+
+private:
+    inline std::size_t CellIndex(std::size_t ix, std::size_t iy, std::size_t iz) const
+    {
+        return (iz*numCellsY_ + iy)*numCellsX_ + ix;
+    }
+
+    // cell coordinate of a position along one axis, clamped to the grid
+    inline std::size_t ClampedCellCoordinate(double val, double minVal, std::size_t numCells) const
+    {
+        const double cell = std::floor((val-minVal)/cellSize_);
+        if (!(cell > 0.)) return 0; // also catches NaN
+        if (cell >= static_cast<double>(numCells)) return numCells-1;
+        return static_cast<std::size_t>(cell);
+    }
+
+    double cellSize_;
+    double minX_, minY_, minZ_;
+    std::size_t numCellsX_, numCellsY_, numCellsZ_;
+
+    // DOM positions, sorted by cell. The DOMs in cell i are
+    // at [cellStart_[i], cellStart_[i+1]).
+    std::vector<std::size_t> cellStart_;
+    std::vector<double> posX_;
+    std::vector<double> posY_;
+    std::vector<double> posZ_;
+};
+
+I3_POINTER_TYPEDEFS(I3CLSimSimpleGeometrySpatialIndex);
+
+#endif //I3CLSIMSIMPLEGEOMETRYSPATIALINDEX_H_INCLUDED
@@ -89,6 +89,10 @@ public:
     inline uint8_t GetSourceType() const {return sourceType;}
     inline uint8_t GetDummy1() const {return dummy1;}
     inline uint16_t GetDummy2() const {return dummy2;}
+    // a 24 bit serial number kept in the dummy fields, set when steps enter
+    // the step store. It tells otherwise identical steps apart for the
+    // counter-based RNG.
+    inline uint32_t GetSerial() const {return (static_cast<uint32_t>(dummy1)<<16) | static_cast<uint32_t>(dummy2);}
 
     inline I3PositionPtr GetPos() const {return I3PositionPtr(new I3Position(((const cl_float *)&posAndTime)[0], ((const cl_float *)&posAndTime)[1], ((const cl_float *)&posAndTime)[2]));}
 
@@ -115,6 +119,7 @@ public:
     inline void SetSourceType(const uint8_t &val) {sourceType=val;}
     inline void SetDummy1(const uint8_t &val) {dummy1=val;}
     inline void SetDummy2(const uint16_t &val) {dummy2=val;}
+    inline void SetSerial(const uint32_t &val) {dummy1=static_cast<cl_uchar>((val>>16)&0xff); dummy2=static_cast<cl_ushort>(val&0xffff);}
     
     inline void SetPos(const I3Position &pos) {((cl_float *)&posAndTime)[0]=pos.GetX(); ((cl_float *)&posAndTime)[1]=pos.GetY(); ((cl_float *)&posAndTime)[2]=pos.GetZ();}
 
@@ -67,6 +67,7 @@ private:
 public:
     I3CLSimTemplateStore(std::size_t initialSize):
     bins_(initialSize, NULL),
+    numInserted_(initialSize, 0),
     currentSize_(0)
     {
         for (std::size_t i=0;i<initialSize;++i)
@@ -110,6 +111,7 @@ public:
             const std::size_t newSize = static_cast<std::size_t>(index+1);
 
             bins_.resize(newSize, NULL);
+            numInserted_.resize(newSize, 0);
             
             for (std::size_t i = oldSize; i < newSize; ++i)
             {
@@ -118,11 +120,22 @@ public:
         }
         
         bins_[index]->push_back(T());
+        ++numInserted_[index];
         ++currentSize_;
         
         return bins_[index]->back();
     }
     
+    /**
+     * the number of entries ever inserted at a certain
+     * index (including the ones that were popped since)
+     */
+    inline uint64_t num_inserted(U index) const
+    {
+        if (index >= numInserted_.size()) return 0;
+        return numInserted_[index];
+    }
+    
     inline std::size_t size() const
     {
         return currentSize_;
@@ -221,6 +234,7 @@ public:
     
 private:
     std::vector<TDequeType *> bins_;
+    std::vector<uint64_t> numInserted_;
     std::size_t currentSize_;
 };
 
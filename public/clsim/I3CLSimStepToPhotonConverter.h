@@ -175,7 +175,24 @@ public:
      * Will throw if not initialized.
      */
     virtual ConversionResult_t GetConversionResult() = 0;
-    
+
+    /**
+     * Statistics. Times are in nanoseconds, the device
+     * time is the time spent propagating photons.
+     * Implementations that do not keep statistics
+     * return 0. Photons of bunches that had to be propagated
+     * again (e.g. after an output buffer overflow) are counted
+     * in GetTotalNumPhotonsGenerated() for every run and
+     * additionally in GetTotalNumPhotonsRerun() for every
+     * repetition.
+     */
+    virtual double GetTotalDeviceTime() {return 0.;}
+    virtual double GetTotalHostTime() {return 0.;}
+    virtual uint64_t GetNumKernelCalls() {return 0;}
+    virtual uint64_t GetTotalNumPhotonsGenerated() {return 0;}
+    virtual uint64_t GetTotalNumPhotonsAtDOMs() {return 0;}
+    virtual uint64_t GetTotalNumPhotonsRerun() {return 0;}
+
 protected:
 };
 
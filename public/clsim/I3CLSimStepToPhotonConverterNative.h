@@ -0,0 +1,281 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ *
+ * @file I3CLSimStepToPhotonConverterNative.h
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#ifndef I3CLSIMSTEPTOPHOTONCONVERTERNATIVE_H_INCLUDED
+#define I3CLSIMSTEPTOPHOTONCONVERTERNATIVE_H_INCLUDED
+
+#include "clsim/I3CLSimStepToPhotonConverter.h"
+
+#include "phys-services/I3RandomService.h"
+
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "clsim/I3CLSimQueue.h"
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+/**
+ * @brief Creates photons from a given list of steps and propagates
+ * them to a DOM on the host CPU(s), without OpenCL.
+ *
+ * This is a port of the OpenCL propagation kernel (without the
+ * table-making, "save all photons" and photon history options).
+ * The output is statistically equivalent to the one of
+ * I3CLSimStepToPhotonConverterOpenCL: photons are returned with
+ * their string and OM IDs set, in the order the step bunches
+ * were enqueued.
+ *
+ * Each bunch of steps is split into chunks that are propagated by
+ * a pool of worker threads. Every chunk gets its own random number
+ * stream, so the results do not depend on the order in which the
+ * threads pick up the chunks (only on the number of threads).
+ * Medium properties are tabulated in wavelength on initialization.
+ *
+ * The photons of a step are propagated in batches, one scatter at
+ * a time for the whole batch. The batch is stored as structure-of-
+ * arrays, so that moving and scattering the photons vectorizes.
+ * resources/tests/testNativePropagator.py compares the output to
+ * the one of the OpenCL kernel.
+ */
+struct I3CLSimStepToPhotonConverterNative : public I3CLSimStepToPhotonConverter
+{
+public:
+    /**
+     * A number of threads of 0 uses one thread per CPU core.
+     */
+    I3CLSimStepToPhotonConverterNative(I3RandomServicePtr randomService,
+                                       std::size_t numThreads=0);
+    virtual ~I3CLSimStepToPhotonConverterNative();
+
+    /**
+     * Returns the number of worker threads.
+     */
+    std::size_t GetNumThreads() const;
+
+    /**
+     * Sets the maximum number of steps per bunch.
+     *
+     * Will throw if already initialized.
+     */
+    void SetMaxNumWorkitems(std::size_t val);
+
+    /**
+     * Gets the maximum number of steps per bunch.
+     */
+    std::size_t GetMaxNumWorkitems() const;
+
+    /**
+     * Steps can be enqueued in bunches of any size,
+     * so this is always 1.
+     */
+    std::size_t GetWorkgroupSize() const;
+
+    /**
+     * Configures behaviour for photons that
+     * hit a DOM. If this is true (the default)
+     * photons will be stopped once they hit a
+     * DOM. If this is false, they continue to
+     * propagate.
+     *
+     * Will throw if already initialized.
+     */
+    void SetStopDetectedPhotons(bool value);
+
+    /**
+     * Returns true if detected photons are stopped.
+     */
+    bool GetStopDetectedPhotons() const;
+
+    /**
+     * Sets the "pancake" factor for DOMs.
+     * (See I3CLSimStepToPhotonConverterOpenCL.)
+     *
+     * Will throw if already initialized.
+     */
+    void SetDOMPancakeFactor(double value);
+
+    /**
+     * Returns the "pancake" factor for DOMs.
+     */
+    double GetDOMPancakeFactor() const;
+
+    virtual void SetWlenGenerators(const std::vector<I3CLSimRandomValueConstPtr> &wlenGenerators);
+    virtual void SetWlenBias(I3CLSimFunctionConstPtr wlenBias);
+    virtual void SetMediumProperties(I3CLSimMediumPropertiesConstPtr mediumProperties);
+    virtual void SetGeometry(I3CLSimSimpleGeometryConstPtr geometry);
+
+    /**
+     * Tabulates the medium properties, builds the
+     * DOM lookup grid and starts the worker threads.
+     * Will throw if already initialized.
+     */
+    virtual void Initialize();
+
+    virtual bool IsInitialized() const;
+
+    virtual void EnqueueSteps(I3CLSimStepSeriesConstPtr steps, uint32_t identifier);
+    virtual std::size_t QueueSize() const;
+    virtual bool MorePhotonsAvailable() const;
+    virtual I3CLSimStepToPhotonConverter::ConversionResult_t GetConversionResult();
+
+    /**
+     * The "device time" is the time the worker threads spent
+     * propagating photons divided by the number of threads, the
+     * "host time" is the wall-clock time during which at least
+     * one bunch was being worked on.
+     */
+    virtual double GetTotalDeviceTime() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return static_cast<double>(statistics_total_device_duration_in_nanoseconds_)/static_cast<double>(numThreads_);}
+    virtual double GetTotalHostTime() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return static_cast<double>(statistics_total_host_duration_in_nanoseconds_);}
+    virtual uint64_t GetNumKernelCalls() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return statistics_total_kernel_calls_;}
+    virtual uint64_t GetTotalNumPhotonsGenerated() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return statistics_total_num_photons_generated_;}
+    virtual uint64_t GetTotalNumPhotonsAtDOMs() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return statistics_total_num_photons_atDOMs_;}
+
+private:
+    typedef std::pair<uint32_t, I3CLSimStepSeriesConstPtr> ToNativePair_t;
+
+    // a bunch of steps in flight (defined in the .cxx file)
+    struct Bunch;
+    typedef boost::shared_ptr<Bunch> BunchPtr;
+
+    // a part of a bunch handled by one worker thread
+    struct Chunk
+    {
+        Chunk() : chunkIndex(0), firstStep(0), numSteps(0), seed(0) {;}
+
+        BunchPtr bunch;
+        std::size_t chunkIndex;
+        std::size_t firstStep;
+        std::size_t numSteps;
+        uint32_t seed;
+    };
+
+    void TabulateMediumProperties();
+    void BuildDOMGrid();
+
+    void DispatcherThread();
+    void DispatcherThread_impl(boost::this_thread::disable_interruption &di);
+    void WorkerThread();
+    void WorkerThread_impl(boost::this_thread::disable_interruption &di);
+    void CollectorThread();
+    void CollectorThread_impl(boost::this_thread::disable_interruption &di);
+
+    // propagates all photons of a number of steps and
+    // appends the ones hitting DOMs to "photons".
+    // Returns the number of photons generated.
+    uint64_t PropagateSteps(const I3CLSimStep *steps,
+                            std::size_t numSteps,
+                            const I3RandomServicePtr &rng,
+                            I3CLSimPhotonSeries &photons) const;
+
+    // checks a photon path segment for DOM intersections. With
+    // stopDetectedPhotons_, the segment is shortened to the closest
+    // hit (hitIndex is set to its DOM and true is returned).
+    // Otherwise the distances to all hits are appended to hitDistances
+    // and their DOMs to hitIndices.
+    bool CheckForCollisions(const double *pos,
+                            const double *dir,
+                            double &segmentLength,
+                            std::size_t &hitIndex,
+                            std::vector<double> &hitDistances,
+                            std::vector<std::size_t> &hitIndices) const;
+
+    boost::mutex statistics_mutex_;
+    uint64_t statistics_total_device_duration_in_nanoseconds_;
+    uint64_t statistics_total_host_duration_in_nanoseconds_;
+    uint64_t statistics_total_kernel_calls_;
+    uint64_t statistics_total_num_photons_generated_;
+    uint64_t statistics_total_num_photons_atDOMs_;
+
+    boost::shared_ptr<boost::thread> dispatcherThreadObj_;
+    boost::shared_ptr<boost::thread> collectorThreadObj_;
+    std::vector<boost::shared_ptr<boost::thread> > workerThreadObjs_;
+
+    boost::shared_ptr<I3CLSimQueue<ToNativePair_t> > queueToNative_;
+    boost::shared_ptr<I3CLSimQueue<Chunk> > queueToWorkers_;
+    boost::shared_ptr<I3CLSimQueue<BunchPtr> > queueToCollector_;
+    boost::shared_ptr<I3CLSimQueue<I3CLSimStepToPhotonConverter::ConversionResult_t> > queueFromNative_;
+
+    I3RandomServicePtr randomService_;
+
+    // chunk random number streams are seeded with consecutive
+    // numbers starting from a random value (dispatcher thread only)
+    uint32_t nextChunkSeed_;
+
+    std::size_t numThreads_;
+    std::size_t maxNumWorkitems_;
+
+    bool initialized_;
+    std::vector<I3CLSimRandomValueConstPtr> wlenGenerators_;
+    I3CLSimFunctionConstPtr wlenBias_;
+    I3CLSimMediumPropertiesConstPtr mediumProperties_;
+    I3CLSimSimpleGeometryConstPtr geometry_;
+
+    bool stopDetectedPhotons_;
+    double pancakeFactor_;
+
+    // medium properties, tabulated in wavelength. The per-layer
+    // tables are stored as [wavelength point][layer].
+    uint32_t layersNum_;
+    double layersZStart_;
+    double layersHeight_;
+    double tableMinWlen_;
+    double tableWlenStep_;
+    std::size_t tableNumWlens_;
+    std::vector<double> tableScatteringLength_;
+    std::vector<double> tableAbsorptionLength_;
+    std::vector<double> tablePhaseRefIndex_;
+    std::vector<double> tableGroupVelocity_;
+
+    // these are skipped if they are known to do nothing
+    I3CLSimScalarFieldConstPtr iceTiltZShift_;
+    I3CLSimScalarFieldConstPtr directionalAbsLenCorrection_;
+    I3CLSimVectorTransformConstPtr preScatterDirectionTransform_;
+    I3CLSimVectorTransformConstPtr postScatterDirectionTransform_;
+
+    // all DOMs, sorted by their cell in an x-y grid and by z within
+    // each cell. Cell i holds DOMs [gridCellStart_[i], gridCellStart_[i+1]).
+    double omRadius_;
+    double gridMinX_;
+    double gridMinY_;
+    double gridCellSize_;
+    std::size_t gridNumCellsX_;
+    std::size_t gridNumCellsY_;
+    std::vector<uint32_t> gridCellStart_;
+    std::vector<double> domPosX_;
+    std::vector<double> domPosY_;
+    std::vector<double> domPosZ_;
+    std::vector<int16_t> domStringID_;
+    std::vector<uint16_t> domOMID_;
+};
+
+I3_POINTER_TYPEDEFS(I3CLSimStepToPhotonConverterNative);
+
+#endif //I3CLSIMSTEPTOPHOTONCONVERTERNATIVE_H_INCLUDED
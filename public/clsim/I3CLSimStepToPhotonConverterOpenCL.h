@@ -30,6 +30,7 @@
 #include "clsim/I3CLSimStepToPhotonConverter.h"
 
 #include "phys-services/I3RandomService.h"
+#include "dataclasses/I3Position.h"
 
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
@@ -39,6 +40,8 @@
 
 #include "clsim/I3CLSimOpenCLDevice.h"
 
+#include "clsim/shadow/I3ExtraGeometryItem.h"
+
 #include <vector>
 #include <map>
 #include <string>
@@ -219,6 +222,151 @@ public:
      */
     uint32_t GetPhotonHistoryEntries() const;
 
+    /**
+     * Enables the compressed step format for uploads
+     * to the device. Consecutive steps sharing their
+     * particle identifier, beta and weight (as generated
+     * by the PPC and muon parameterizations) are uploaded
+     * as one shared header and 20 bytes per step instead
+     * of 48 bytes per step. Positions and times are stored
+     * relative to the first step of the group with a
+     * resolution of 1mm and 0.01ns, directions with a
+     * resolution of ~5e-5 rad. Geant4 steps change beta
+     * from step to step and are mostly uploaded as-is,
+     * just like any bunch that does not compress well.
+     *
+     * Will throw if already initialized.
+     */
+    void SetCompressSteps(bool value);
+
+    /**
+     * Returns true if the compressed step format is used.
+     */
+    bool GetCompressSteps() const;
+
+    /**
+     * Balances the load of the propagation kernel on photons
+     * instead of steps. A fixed number of work items pulls
+     * chunks of up to this many photons (of any step) from a
+     * global counter until all photons of a bunch are done,
+     * so work items with dim steps do not idle while others
+     * propagate bright ones. The kernel launch is then sized
+     * by the number of chunks instead of the number of steps.
+     * Set to 0 (the default) to propagate all photons of one
+     * step per work item.
+     *
+     * Will throw if already initialized.
+     */
+    void SetPhotonChunkSize(uint32_t value);
+
+    /**
+     * Returns the photon chunk size (0 if disabled).
+     */
+    uint32_t GetPhotonChunkSize() const;
+
+    /**
+     * Replaces the per-work-item multiply-with-carry random
+     * number generators with a counter-based generator
+     * (Philox4x32-10). Its random numbers only depend on
+     * the key set with SetCounterBasedRNGKey(), the step
+     * (including its serial, see I3CLSimStep::GetSerial())
+     * and the index of the photon within its step, so the
+     * photons do not depend on the device, the workgroup
+     * size or the way bunches are distributed to devices.
+     * There is no RNG state to seed or upload.
+     *
+     * Will throw if already initialized.
+     */
+    void SetCounterBasedRNG(bool value);
+
+    /**
+     * Returns true if the counter-based RNG is used.
+     */
+    bool GetCounterBasedRNG() const;
+
+    /**
+     * Sets the key of the counter-based RNG. Use the same key
+     * for all devices to get the same photons from each.
+     * Defaults to 0.
+     *
+     * Will throw if already initialized.
+     */
+    void SetCounterBasedRNGKey(uint64_t value);
+
+    /**
+     * Returns the key of the counter-based RNG.
+     */
+    uint64_t GetCounterBasedRNGKey() const;
+
+    /**
+     * Propagates photons through the medium layers using
+     * tables of the cumulative vertical optical depth at all
+     * layer boundaries. The scattering and absorption points
+     * are then found with a binary search instead of stepping
+     * through every layer crossed. This requires both the
+     * scattering and absorption lengths to be IceCube-style
+     * parameterizations; the layer-by-layer propagation is
+     * used otherwise.
+     *
+     * Will throw if already initialized.
+     */
+    void SetOpticalDepthTables(bool value);
+
+    /**
+     * Returns true if optical depth tables are requested.
+     */
+    bool GetOpticalDepthTables() const;
+
+    /**
+     * Makes the kernel write a reduced-precision output
+     * record of 32 bytes per photon instead of 80 bytes.
+     * Positions relative to the DOM, directions, wavelengths
+     * and group velocities are stored at half precision.
+     * The start position/direction, the Cherenkov distance
+     * and the distance in absorption lengths are not
+     * available (they are set to NaN). Cannot be used
+     * with saveAllPhotons or photon histories.
+     *
+     * Will throw if already initialized.
+     */
+    void SetCompactPhotons(bool value);
+
+    /**
+     * Returns true if the compact output format is used.
+     */
+    bool GetCompactPhotons() const;
+
+    /**
+     * Sets a directory used to cache compiled kernel binaries.
+     * Compile() loads the binary from there if the kernel source,
+     * the build options, the device and the driver version are
+     * the same as for a previous job, and stores it otherwise.
+     * An empty string (the default) disables the cache.
+     *
+     * Will throw if already initialized.
+     */
+    void SetKernelCacheDirectory(const std::string &value);
+
+    /**
+     * Returns the kernel binary cache directory.
+     */
+    const std::string &GetKernelCacheDirectory() const;
+
+    /**
+     * Sets cables and other objects shadowing the DOMs. Photons
+     * hitting any of them are absorbed during propagation.
+     * The geometry may only consist of cylinders (in unions
+     * and moves). NULL (the default) disables shadowing.
+     *
+     * Will throw if already initialized.
+     */
+    void SetShadowGeometry(I3ExtraGeometryItemConstPtr value);
+
+    /**
+     * Returns the shadowing geometry.
+     */
+    I3ExtraGeometryItemConstPtr GetShadowGeometry() const;
+
     /**
      * Sets the number of absorption lengths each photon
      * should be propagated. If set to NaN (the default),
@@ -316,6 +464,7 @@ public:
     std::string GetWlenGeneratorSource();
     std::string GetWlenBiasSource();
     virtual std::string GetGeometrySource();
+    std::string GetShadowGeometrySource();
     virtual std::string GetCollisionDetectionSource(bool header=true);
     
     /**
@@ -377,6 +526,7 @@ public:
     inline uint64_t GetNumKernelCalls() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return statistics_total_kernel_calls_;}
     inline uint64_t GetTotalNumPhotonsGenerated() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return statistics_total_num_photons_generated_;}
     inline uint64_t GetTotalNumPhotonsAtDOMs() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return statistics_total_num_photons_atDOMs_;}
+    inline uint64_t GetTotalNumPhotonsRerun() {boost::unique_lock<boost::mutex> guard(statistics_mutex_); return statistics_total_num_photons_rerun_;}
     
 private:
     typedef std::pair<uint32_t, I3CLSimStepSeriesConstPtr> ToOpenCLPair_t;
@@ -384,6 +534,12 @@ private:
     // sets up OpenCL
     void SetupQueueAndKernel(const cl::Platform& platform, const cl::Device &device);
 
+    // (re-)sets all kernel arguments for one of the buffers
+    void SetKernelArgs(unsigned int bufferIndex);
+
+    // re-allocates the output buffers so they can hold at least minNumOutputPhotons photons
+    void GrowOutputBuffers(unsigned int bufferIndex, uint32_t minNumOutputPhotons);
+
     
     void OpenCLThread();
     void OpenCLThread_impl(boost::this_thread::disable_interruption &di);
@@ -398,7 +554,9 @@ private:
     void OpenCLThread_impl_downloadPhotons(boost::this_thread::disable_interruption &di,
                                            bool &shouldBreak,
                                            unsigned int bufferIndex,
-                                           uint32_t stepsIdentifier);
+                                           uint32_t stepsIdentifier,
+                                           uint64_t totalNumberOfPhotons,
+                                           std::size_t numberOfInputSteps);
     void OpenCLThread_impl_runKernel(unsigned int bufferIndex,
                                      cl::Event &kernelFinishEvent,
                                      std::size_t numberOfInputSteps);
@@ -417,6 +575,7 @@ private:
     uint64_t statistics_total_kernel_calls_;
     uint64_t statistics_total_num_photons_generated_;
     uint64_t statistics_total_num_photons_atDOMs_;
+    uint64_t statistics_total_num_photons_rerun_; // also part of statistics_total_num_photons_generated_
 
     
     boost::shared_ptr<boost::thread> openCLThreadObj_;
@@ -449,14 +608,24 @@ private:
     double pancakeFactor_;
     
     uint32_t photonHistoryEntries_;
+    bool compressSteps_;
+    uint32_t photonChunkSize_;
+    bool counterBasedRNG_;
+    uint64_t counterBasedRNGKey_;
+    bool opticalDepthTables_;
+    bool compactPhotons_;
+    std::string kernelCacheDirectory_;
+    I3ExtraGeometryItemConstPtr shadowGeometry_;
     
     // some kernel sources loaded on construction
     std::string prependSource_;
     std::string mwcrngKernelSource_;
+    std::string philoxKernelSource_;
     std::string wlenGeneratorSource_;
     std::string wlenBiasSource_;
     std::string mediumPropertiesSource_;
     std::string geometrySource_;
+    std::string shadowGeometrySource_;
     std::string propagationKernelSource_;
     
     // this is extra geometry information, we upload it to global memory
@@ -467,6 +636,9 @@ private:
 
     // this allows us to convert the DOM index back to the DOM ID (which may be non-contiguous)
     std::vector<std::vector<unsigned int> > domIndexToDomIDBuffer_perStringIndex_;
+
+    // DOM positions by string/DOM index (used to decode compact photons)
+    std::vector<std::vector<I3Position> > domPositionsPerStringIndex_;
     
     // OpenCL command queue and kernel
     std::vector<boost::shared_ptr<cl::CommandQueue> > queue_;
@@ -491,6 +663,19 @@ private:
     std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_OutputPhotons;
     std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_CurrentNumOutputPhotons;
     std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_PhotonHistory;
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_InputStepGroups; // only used with compressed steps
+    
+    // number of step group headers in the current bunch of each buffer (0 if not compressed)
+    std::vector<uint32_t> numInputStepGroups_;
+    
+    // only used with photon chunks: the index of the first chunk of each step
+    // (plus the total number of chunks) and the counter the work items pull from
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_StepChunkStart;
+    std::vector<boost::shared_ptr<cl::Buffer> > deviceBuffer_PhotonChunkCounter;
+    
+    // number of steps and photon chunks in the current bunch of each buffer
+    std::vector<uint32_t> numInputSteps_;
+    std::vector<uint32_t> numPhotonChunks_;
     
     // this one is constant, so we only need one
     boost::shared_ptr<cl::Buffer> deviceBuffer_GeoLayerToOMNumIndexPerStringSet;
@@ -498,6 +683,10 @@ private:
     // Size of output photon storage (maximum amount of photons per step bunch)
     uint32_t maxNumOutputPhotons_;
     
+    // Current size of the output photon storage of each buffer. This starts
+    // at maxNumOutputPhotons_ and grows whenever a step bunch overflows it.
+    std::vector<uint32_t> maxNumOutputPhotonsPerBuffer_;
+    
     SET_LOGGER("I3CLSimStepToPhotonConverterOpenCL");
 };
 
@@ -31,6 +31,7 @@
 #include "icetray/I3ConditionalModule.h"
 
 #include "dataclasses/geometry/I3Geometry.h"
+#include "dataclasses/geometry/I3ModuleGeo.h"
 #include "dataclasses/calibration/I3Calibration.h"
 #include "dataclasses/status/I3DetectorStatus.h"
 #include "dataclasses/physics/I3MCTree.h"
@@ -41,6 +42,12 @@
 #include "clsim/function/I3CLSimFunction.h"
 
 #include <string>
+#include <map>
+#include <vector>
+
+#include <boost/scoped_ptr.hpp>
+
+namespace I3CLSimHelper { class WorkerPool; }
 
 /**
  * @brief This module reads I3PhotonSeriesMaps generated
@@ -127,6 +134,9 @@ private:
     /// Parameter: Make photon position/radius check a warning only (instead of a fatal condition)
     bool onlyWarnAboutInvalidPhotonPositions_;
 
+    /// Parameter: Number of threads the DOMs of a frame are distributed over (0: one per core)
+    unsigned int numThreads_;
+
     
 private:
     // default, assignment, and copy constructor declared private
@@ -140,6 +150,48 @@ private:
     I3CalibrationConstPtr calibration_;
     I3DetectorStatusConstPtr status_;
     
+    /// Everything about a DOM that does not depend on the photons.
+    /// Only changes with the geometry, calibration and detector status.
+    struct DOMInfo
+    {
+        bool ignore;
+        double posX, posY, posZ;
+        double dirX, dirY, dirZ;
+        double efficiency;
+    };
+    const DOMInfo &GetDOMInfo(const ModuleKey &module_key,
+                              const I3OMGeoMap &omgeo,
+                              const I3ModuleGeoMap &modulegeo);
+    
+    std::map<ModuleKey, DOMInfo> domInfo_;
+    // the geometry domInfo_ was filled from
+    I3OMGeoMapConstPtr domInfoOMGeo_;
+    I3ModuleGeoMapConstPtr domInfoModuleGeo_;
+    
+    /// per-thread buffers for the photons on one DOM
+    struct WorkArrays;
+    std::vector<boost::shared_ptr<WorkArrays> > workArrays_;
+    
+    /// threads the DOMs are distributed over, kept for all frames
+    /// (not used with a single thread)
+    boost::scoped_ptr<I3CLSimHelper::WorkerPool> workerPool_;
+    
+    /// distributes the DOMs of one frame over numThreads_ threads
+    template <typename PhotonSeries>
+    class ConversionJob;
+    
+    /// Applies the acceptances to the photons on a single DOM. Only reads
+    /// module state, so it may be called from several threads at once.
+    /// Random numbers are taken from a stream that only depends on
+    /// frameSeed and the DOM.
+    template <typename PhotonSeries>
+    void ConvertDOM(const OMKey &key,
+                    const PhotonSeries &photons,
+                    const DOMInfo &dom,
+                    uint64_t frameSeed,
+                    WorkArrays &work,
+                    I3MCPESeries &hits) const;
+    
     // record some statistics
     uint64_t numGeneratedHits_;
     
@@ -31,6 +31,7 @@
 #include "icetray/I3TrayHeaders.h"
 
 #include <string>
+#include <cstddef>
 
 /**
  * @brief A function value dependent on photon wavelength (or anything else)
@@ -61,6 +62,14 @@ public:
      */
     virtual double GetValue(double wlen) const = 0;
 
+    /**
+     * Evaluates the function at num wavelengths at once,
+     * values[i]=GetValue(wlens[i]). The default implementation
+     * calls GetValue() for each entry, implementations that are
+     * evaluated often on the host should override it.
+     */
+    virtual void GetValues(const double *wlens, double *values, std::size_t num) const;
+
     /**
      * Shall return the derivative at a requested wavelength (dn/dlambda)
      */
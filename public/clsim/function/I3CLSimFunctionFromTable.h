@@ -42,7 +42,7 @@ struct I3CLSimFunctionFromTable : public I3CLSimFunction
 public:
     static const bool default_storeDataAsHalfPrecision;
     
-    // arbitrary wavelength values
+    // arbitrary (non-decreasing) wavelength values
     I3CLSimFunctionFromTable(const std::vector<double> &wlens,
                              const std::vector<double> &values,
                              bool storeDataAsHalfPrecision=default_storeDataAsHalfPrecision);
@@ -71,6 +71,11 @@ public:
      */
     virtual double GetValue(double wlen) const;
     
+    /**
+     * Evaluates the function at num wavelengths at once
+     */
+    virtual void GetValues(const double *wlens, double *values, std::size_t num) const;
+    
     /**
      * Shall return the minimal supported wavelength (possibly -inf)
      */
@@ -125,6 +130,13 @@ public:
 private:
     I3CLSimFunctionFromTable();
     
+    // builds the uniform index grid for non-equal spacings
+    void InitWlenIndex();
+    
+    // the bin containing a wavelength in (wlens_[0], wlens_[N-1]]
+    // (the same one a linear search over wlens_ would find)
+    std::size_t FindWlenBin(double wlen) const;
+    
     double startWlen_;
     double wlenStep_;
     std::vector<double> wlens_;
@@ -134,6 +146,11 @@ private:
     
     bool storeDataAsHalfPrecision_;
     
+    // non-equal spacings: a uniform grid over the wavelength range
+    // holding the bin of each grid cell's lower edge (not serialized)
+    std::vector<unsigned int> wlenIndex_;
+    double wlenIndexInvCellWidth_;
+    
     friend class icecube::serialization::access;
     template <class Archive> void serialize(Archive & ar, unsigned version);
 };
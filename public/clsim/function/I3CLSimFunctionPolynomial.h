@@ -84,6 +84,11 @@ public:
      */
     virtual double GetValue(double wlen) const;
     
+    /**
+     * Evaluates the function at num wavelengths at once
+     */
+    virtual void GetValues(const double *wlens, double *values, std::size_t num) const;
+    
     /**
      * Shall return the minimal supported wavelength (possibly -inf)
      */
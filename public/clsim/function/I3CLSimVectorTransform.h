@@ -59,6 +59,14 @@ public:
      */
     virtual std::vector<double> ApplyTransform(const std::vector<double> &vec) const = 0;
 
+    /**
+     * apply the transform to a 3-vector in place.
+     * The default implementation calls ApplyTransform().
+     * Transforms used by the native propagator override
+     * this to avoid a temporary std::vector per call.
+     */
+    virtual void ApplyTransformInPlace(double *vec) const;
+
     /**
      * Return an OpenCL-compatible function named
      * functionName with a single float4* argument.
@@ -47,6 +47,8 @@ public:
 
     virtual std::vector<double> ApplyTransform(const std::vector<double> &vec) const;
 
+    virtual void ApplyTransformInPlace(double *vec) const;
+
     /**
      * Return an OpenCL-compatible function named
      * functionName with a single float4* argument.
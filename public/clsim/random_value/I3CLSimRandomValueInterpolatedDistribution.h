@@ -76,6 +76,9 @@ private:
 
     std::vector<double> data_acu_;
     std::vector<double> data_beta_;
+    // guide table: for u in [i/N,(i+1)/N), the CDF bin of u
+    // is at or after data_guide_[i] (N=number of bins)
+    std::vector<unsigned int> data_guide_;
 
     std::vector<double> x_;
     std::vector<double> y_;
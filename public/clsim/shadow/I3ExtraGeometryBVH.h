@@ -0,0 +1,134 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ *
+ * @file I3ExtraGeometryBVH.h
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#ifndef I3EXTRAGEOMETRYBVH_H_INCLUDED
+#define I3EXTRAGEOMETRYBVH_H_INCLUDED
+
+#include <vector>
+#include <utility>
+
+#include "icetray/I3PointerTypedefs.h"
+
+#include "dataclasses/I3Position.h"
+
+#include "clsim/shadow/I3ExtraGeometryItem.h"
+#include "clsim/shadow/I3ExtraGeometryItemCylinder.h"
+
+/**
+ * @brief A bounding volume hierarchy over all items of an
+ * I3ExtraGeometryItem tree.
+ *
+ * Unions are flattened and moves are applied to the items
+ * they contain, so the leaves of the hierarchy only hold
+ * cylinders (with their final positions) and any other
+ * items that cannot be broken up further. The hierarchy
+ * is stored as a flat list of nodes in depth-first order:
+ * the left child of an inner node is the next node in the
+ * list, the right child is stored explicitly.
+ */
+class I3ExtraGeometryBVH
+{
+public:
+    struct Node
+    {
+        double lower[3];
+        double upper[3];
+        
+        // leaves: first item, inner nodes: right child
+        uint32_t index;
+        
+        // number of items in a leaf, 0 for inner nodes
+        uint32_t numItems;
+    };
+    
+    I3ExtraGeometryBVH(I3ExtraGeometryItemConstPtr geometry,
+                       std::size_t maxItemsPerLeaf=2);
+    ~I3ExtraGeometryBVH();
+    
+    /**
+     * Returns true if the line segment intersects any item.
+     */
+    bool DoesLineIntersect(const I3Position &lineStart,
+                           const I3Position &lineEnd) const;
+    
+    /**
+     * Checks a batch of line segments at once. The result
+     * vector will be resized to the number of segments.
+     */
+    void DoLinesIntersect(const std::vector<I3Position> &lineStarts,
+                          const std::vector<I3Position> &lineEnds,
+                          std::vector<bool> &results) const;
+    
+    /**
+     * Returns true if all items are cylinders. Only
+     * cylinders can be handled inside OpenCL kernels.
+     */
+    bool ConsistsOfCylindersOnly() const;
+    
+    inline std::size_t GetNumItems() const {return items_.size();}
+    inline const std::vector<Node> &GetNodes() const {return nodes_;}
+    
+    /**
+     * The leaves refer to items in this order. Entries
+     * are NULL for items that are not cylinders.
+     */
+    inline const std::vector<I3ExtraGeometryItemCylinderConstPtr> &GetCylinders() const {return cylinders_;}
+    
+    /**
+     * The maximum number of nodes on the path from the
+     * root to any leaf (the stack size needed for traversal).
+     */
+    inline std::size_t GetMaxDepth() const {return maxDepth_;}
+    
+private:
+    void Flatten(const I3ExtraGeometryItemConstPtr &item,
+                 const I3Position &offset);
+    uint32_t Build(std::size_t begin, std::size_t end, std::size_t depth);
+    bool DoesLineIntersect(const I3Position &lineStart,
+                           const I3Position &lineEnd,
+                           std::vector<uint32_t> &stack) const;
+
+    std::size_t maxItemsPerLeaf_;
+    std::size_t maxDepth_;
+    
+    std::vector<I3ExtraGeometryItemConstPtr> items_;
+    std::vector<I3ExtraGeometryItemCylinderConstPtr> cylinders_;
+    std::vector<std::pair<I3Position, I3Position> > boxes_;
+    std::vector<Node> nodes_;
+    
+private:
+    // default, assignment, and copy constructor declared private
+    I3ExtraGeometryBVH();
+    I3ExtraGeometryBVH(const I3ExtraGeometryBVH&);
+    I3ExtraGeometryBVH& operator=(const I3ExtraGeometryBVH&);
+    
+    SET_LOGGER("I3ExtraGeometryBVH");
+};
+
+I3_POINTER_TYPEDEFS(I3ExtraGeometryBVH);
+
+#endif //I3EXTRAGEOMETRYBVH_H_INCLUDED
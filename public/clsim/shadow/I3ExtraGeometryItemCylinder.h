@@ -48,6 +48,10 @@ public:
                            const I3Position &lineEnd) const;
     virtual std::pair<I3Position, I3Position> GetBoundingBox() const;
 
+    inline const I3Position &GetFrom() const {return from_;}
+    inline const I3Position &GetTo() const {return to_;}
+    inline double GetRadius() const {return radius_;}
+
     virtual std::ostream& operator<<(std::ostream& oss) const;
 
 private:
@@ -34,7 +34,7 @@
 /**
  * @brief Describes a moved item.
  */
-static const unsigned i3extrageometryitemmove_version_ = 0;
+static const unsigned i3extrageometryitemmove_version_ = 1;
 
 struct I3ExtraGeometryItemMove : public I3ExtraGeometryItem
 {
@@ -48,6 +48,9 @@ public:
                            const I3Position &lineEnd) const;
     virtual std::pair<I3Position, I3Position> GetBoundingBox() const;
 
+    inline I3ExtraGeometryItemConstPtr GetElement() const {return element_;}
+    inline const I3Position &GetOffset() const {return offset_;}
+
     virtual std::ostream& operator<<(std::ostream& oss) const;
 
 private:
@@ -48,6 +48,8 @@ public:
                            const I3Position &lineEnd) const;
     virtual std::pair<I3Position, I3Position> GetBoundingBox() const;
 
+    inline const std::vector<I3ExtraGeometryItemConstPtr> &GetElements() const {return elements_;}
+
     virtual std::ostream& operator<<(std::ostream& oss) const;
 
 private:
@@ -29,18 +29,28 @@
 
 #include "simclasses/I3Photon.h"
 
+#include "clsim/shadow/I3ExtraGeometryItem.h"
+#include "clsim/shadow/I3ExtraGeometryBVH.h"
+
 #include <string>
+#include <vector>
 
 
 /**
  * @brief This class checks if a photon path intersects with 
  *   any shadowing part of the detecor (such as cables).
- *   This code is NOT functional at the moment.
+ *
+ * The path of a photon is only known where its scattering
+ * points have been recorded (i.e. if photon histories are
+ * enabled in I3CLSimModule, or if the photon has not been
+ * scattered at all). Unknown parts of the path are not checked.
+ * Shadowing during propagation (the "ExtraGeometry" parameter
+ * of I3CLSimModule) does not have this limitation.
  */
 class I3ShadowedPhotonRemover
 {
 public:
-    I3ShadowedPhotonRemover();
+    I3ShadowedPhotonRemover(I3ExtraGeometryItemConstPtr extraGeometry);
     ~I3ShadowedPhotonRemover();
     
     
@@ -49,14 +59,25 @@ public:
      */
     bool IsPhotonShadowed(const I3Photon &photon) const;
     
+    /**
+     * checks all photons of a series at once, isShadowed
+     * will be resized to the number of photons.
+     */
+    void FindShadowedPhotons(const I3PhotonSeries &photons,
+                             std::vector<bool> &isShadowed) const;
 
     
 private:
-    // parameters
+    // appends all known segments of the photon path
+    static void AppendPathSegments(const I3Photon &photon,
+                                   std::vector<I3Position> &segmentStarts,
+                                   std::vector<I3Position> &segmentEnds);
+
+    I3ExtraGeometryBVHConstPtr bvh_;
     
 private:
     // assignment and copy constructor declared private
-    //I3ShadowedPhotonRemover();
+    I3ShadowedPhotonRemover();
     I3ShadowedPhotonRemover(const I3ShadowedPhotonRemover&);
     I3ShadowedPhotonRemover& operator=(const I3ShadowedPhotonRemover&);
     
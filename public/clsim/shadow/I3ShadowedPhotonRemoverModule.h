@@ -33,6 +33,7 @@
 #include "dataclasses/geometry/I3Geometry.h"
 
 #include "clsim/shadow/I3ShadowedPhotonRemover.h"
+#include "clsim/shadow/I3ExtraGeometryItem.h"
 
 #include <string>
 
@@ -40,7 +41,8 @@
 /**
  * @brief This module removes photons that have paths intersecting 
  *   with any shadowing part of the detecor (such as cables).
- *   This code is NOT functional at the moment.
+ *   See I3ShadowedPhotonRemover for the limitations of doing
+ *   this after propagation.
  */
 class I3ShadowedPhotonRemoverModule : public I3ConditionalModule
 {
@@ -75,6 +77,9 @@ private:
     /// Parameter: Name of the output I3PhotonSeriesMap frame object. 
     std::string outputPhotonSeriesMapName_;
 
+    /// Parameter: An I3ExtraGeometryItem describing cables and other objects shadowing the DOMs.
+    I3ExtraGeometryItemConstPtr extraGeometry_;
+
     I3ShadowedPhotonRemoverPtr shadowedPhotonRemover_;
     
 private:
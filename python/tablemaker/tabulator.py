@@ -441,7 +441,8 @@ def I3CLSimTabulatePhotons(tray, name,
 def TabulatePhotonsFromSource(tray, name, PhotonSource="cascade", Zenith=0.*I3Units.degree, Azimuth=0.*I3Units.degree, ZCoordinate=0.*I3Units.m,
     Energy=1.*I3Units.GeV, FlasherWidth=127, FlasherBrightness=127, Seed=12345, NEvents=100,
     IceModel='spice_mie', DisableTilt=False, Filename="", TabulateImpactAngle=False,
-    PhotonPrescale=1, Axes=None, Directions=None, Sensor='DOM', RecordErrors=False):
+    PhotonPrescale=1, Axes=None, Directions=None, Sensor='DOM', RecordErrors=False,
+    CheckpointFilename="", CheckpointInterval=0):
     
     """
     Tabulate the distribution of photoelectron yields on IceCube DOMs from various
@@ -487,6 +488,12 @@ def TabulatePhotonsFromSource(tray, name, PhotonSource="cascade", Zenith=0.*I3Un
         'photonics_wham/Ice_table.wham.i3coords.cos094.11jul2011.txt' Photonics-style WHAM! table
     :param DisableTilt: if true, disable tilt in ice model
     :param Filename: the name of the FITS file to write
+    :param CheckpointFilename: the name of a file to write the unnormalized
+           table to. Checkpoints from many jobs can be summed and normalized
+           with resources/tablemaker/merge_checkpoints.py. The file must not
+           exist yet.
+    :param CheckpointInterval: write a checkpoint every this many events
+           (0 to only write one at the end)
     :param TabulateImpactAngle: if True, tabulate the impact position of the
            photon on the DOM instead of weighting by the DOM's angular acceptance
     :param Axes: a subclass of :cpp:class:`clsim::tabulator::Axes` that defines the coordinate system.
@@ -692,6 +699,7 @@ def TabulatePhotonsFromSource(tray, name, PhotonSource="cascade", Zenith=0.*I3Un
         UseGeant4=False,
         OverrideApproximateNumberOfWorkItems=1,     # if you *would* use multi-threading, this would be the maximum number of jobs to run in parallel (OpenCL is free to split them)
         ExtraArgumentsToI3CLSimModule=dict(Filename=Filename, TableHeader=header,
-            Axes=Axes, PhotonsPerBunch=200, EntriesPerPhoton=5000, RecordErrors=RecordErrors),
+            Axes=Axes, PhotonsPerBunch=200, EntriesPerPhoton=5000, RecordErrors=RecordErrors,
+            CheckpointFilename=CheckpointFilename, CheckpointInterval=CheckpointInterval),
         MediumProperties=parseIceModel(expandvars("$I3_SRC/clsim/resources/ice/" + IceModel), disableTilt=DisableTilt),
     )
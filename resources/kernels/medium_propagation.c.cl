@@ -0,0 +1,257 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file medium_propagation.c.cl
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+#ifdef DOUBLE_PRECISION
+// can't have native_math with double precision
+#ifdef USE_NATIVE_MATH
+#undef USE_NATIVE_MATH
+#endif
+#endif
+
+#ifdef USE_NATIVE_MATH
+inline floating_t my_divide(floating_t a, floating_t b) {return native_divide(a,b);}
+inline floating_t my_recip(floating_t a) {return native_recip(a);}
+inline floating_t my_powr(floating_t a, floating_t b) {return native_powr(a,b);}
+inline floating_t my_sqrt(floating_t a) {return native_sqrt(a);}
+inline floating_t my_rsqrt(floating_t a) {return native_rsqrt(a);}
+inline floating_t my_cos(floating_t a) {return native_cos(a);}
+inline floating_t my_sin(floating_t a) {return native_sin(a);}
+inline floating_t my_log(floating_t a) {return native_log(a);}
+inline floating_t my_exp(floating_t a) {return native_exp(a);}
+#else
+inline floating_t my_divide(floating_t a, floating_t b) {return a/b;}
+inline floating_t my_recip(floating_t a) {return 1.f/a;}
+inline floating_t my_powr(floating_t a, floating_t b) {return powr(a,b);}
+inline floating_t my_sqrt(floating_t a) {return sqrt(a);}
+inline floating_t my_rsqrt(floating_t a) {return rsqrt(a);}
+inline floating_t my_cos(floating_t a) {return cos(a);}
+inline floating_t my_sin(floating_t a) {return sin(a);}
+inline floating_t my_log(floating_t a) {return log(a);}
+inline floating_t my_exp(floating_t a) {return exp(a);}
+#endif
+
+#ifdef USE_FABS_WORKAROUND
+inline floating_t my_fabs(floating_t a) {return (a<ZERO)?(-a):(a);}
+#else
+inline floating_t my_fabs(floating_t a) {return fabs(a);}
+#endif
+inline floating_t sqr(floating_t a) {return a*a;}
+
+
+
+
+inline int findLayerForGivenZPos(floating_t posZ)
+{
+    return convert_int((posZ-(floating_t)MEDIUM_LAYER_BOTTOM_POS)/(floating_t)MEDIUM_LAYER_THICKNESS);
+}
+
+inline floating_t mediumLayerBoundary(int layer)
+{
+    return (convert_floating_t(layer)*((floating_t)MEDIUM_LAYER_THICKNESS)) + (floating_t)MEDIUM_LAYER_BOTTOM_POS;
+}
+
+#ifdef MEDIUM_OPTICAL_DEPTH_TABLES
+// The medium source provides, for the scattering and the absorption length,
+// 1/L(layer,wlen) = w1(wlen)*invLengthTerm1[layer] + w2(wlen)*invLengthTerm2[layer]
+// and the cumulative sums of both terms at the layer boundaries.
+#define SCA_DEPTH_TABLES getScatteringLength_invLengthTerm1, getScatteringLength_invLengthTerm2, getScatteringLength_depthTerm1, getScatteringLength_depthTerm2
+#define ABS_DEPTH_TABLES getAbsorptionLength_invLengthTerm1, getAbsorptionLength_invLengthTerm2, getAbsorptionLength_depthTerm1, getAbsorptionLength_depthTerm2
+#define DEPTH_TABLE_ARGS __constant const float *invLengthTerm1, __constant const float *invLengthTerm2, __constant const float *depthTerm1, __constant const float *depthTerm2
+#define DEPTH_TABLE_ARGS_TO_CALL invLengthTerm1, invLengthTerm2, depthTerm1, depthTerm2
+
+// the inverse length in a given layer
+inline floating_t mediumInvLength(DEPTH_TABLE_ARGS, float2 weights, int layer)
+{
+    return (floating_t)(weights.x*invLengthTerm1[layer] + weights.y*invLengthTerm2[layer]);
+}
+
+// the vertical optical depth between the bottom of the medium and
+// the bottom of a given layer (0..MEDIUM_LAYERS)
+inline floating_t mediumDepthAtBoundary(DEPTH_TABLE_ARGS, float2 weights, int boundary)
+{
+    return ((floating_t)MEDIUM_LAYER_THICKNESS)*(floating_t)(weights.x*depthTerm1[boundary] + weights.y*depthTerm2[boundary]);
+}
+
+// the vertical optical depth at height z inside a given layer
+// (the top and bottom layers extend to infinity)
+inline floating_t mediumDepthAtZ(DEPTH_TABLE_ARGS, float2 weights, int layer, floating_t z)
+{
+    return mediumDepthAtBoundary(DEPTH_TABLE_ARGS_TO_CALL, weights, layer) +
+        (z-mediumLayerBoundary(layer))*mediumInvLength(DEPTH_TABLE_ARGS_TO_CALL, weights, layer);
+}
+
+// The distance a photon starting at height z in a given layer, with
+// the z-component dz of its direction, travels until it has crossed
+// opticalDepth lengths. The layer it ends up in is stored in endLayer.
+// Uses a binary search on the cumulative depths instead of a loop
+// over all layers in between.
+inline floating_t mediumDistanceForOpticalDepth(DEPTH_TABLE_ARGS, float2 weights,
+    int layer, floating_t z, floating_t dz, floating_t opticalDepth,
+    int *endLayer)
+{
+    const floating_t invLength = mediumInvLength(DEPTH_TABLE_ARGS_TO_CALL, weights, layer);
+    const floating_t targetDepth =
+        mediumDepthAtBoundary(DEPTH_TABLE_ARGS_TO_CALL, weights, layer) +
+        (z-mediumLayerBoundary(layer))*invLength +
+        opticalDepth*dz;
+
+    // the last layer (in the direction of travel) whose bottom is below the target depth
+    int lo = (dz<ZERO)?0:layer;
+    int hi = (dz<ZERO)?layer:MEDIUM_LAYERS-1;
+    while (lo<hi) {
+        const int mid = (lo+hi+1)/2;
+        if (mediumDepthAtBoundary(DEPTH_TABLE_ARGS_TO_CALL, weights, mid) <= targetDepth) {
+            lo=mid;
+        } else {
+            hi=mid-1;
+        }
+    }
+    *endLayer=lo;
+
+    if (lo==layer) return my_divide(opticalDepth, invLength);
+
+    const floating_t endZ = mediumLayerBoundary(lo) +
+        my_divide(targetDepth-mediumDepthAtBoundary(DEPTH_TABLE_ARGS_TO_CALL, weights, lo),
+                  mediumInvLength(DEPTH_TABLE_ARGS_TO_CALL, weights, lo));
+    return my_divide(endZ-z, dz);
+}
+#endif
+
+// Propagates a photon at (tilt-corrected) height effective_z in
+// currentPhotonLayer, with the z-component photon_dz of its direction,
+// until it has crossed sca_step_left scattering lengths or *abs_lens_left
+// absorption lengths, whichever comes first. Returns the distance
+// propagated, updates *abs_lens_left and stores the layer of the end
+// point in *endLayer. This is along the lines of the PPC kernel.
+inline floating_t mediumPropagateLayerByLayer(int currentPhotonLayer,
+    floating_t effective_z,
+    floating_t photon_dz,
+    float wavelength,
+    floating_t sca_step_left,
+    floating_t *abs_lens_left,
+    int *endLayer)
+{
+    // the "next" medium boundary (either top or bottom, depending on step direction)
+    floating_t mediumBoundary = (photon_dz<ZERO)?(mediumLayerBoundary(currentPhotonLayer)):(mediumLayerBoundary(currentPhotonLayer)+(floating_t)MEDIUM_LAYER_THICKNESS);
+
+    floating_t currentScaLen = getScatteringLength(currentPhotonLayer, wavelength);
+    floating_t currentAbsLen = getAbsorptionLength(currentPhotonLayer, wavelength);
+
+    floating_t ais=( photon_dz*sca_step_left - my_divide((mediumBoundary-effective_z),currentScaLen) )*(ONE/(floating_t)MEDIUM_LAYER_THICKNESS);
+    floating_t aia=( photon_dz*(*abs_lens_left) - my_divide((mediumBoundary-effective_z),currentAbsLen) )*(ONE/(floating_t)MEDIUM_LAYER_THICKNESS);
+
+    // propagate through layers
+    int j=currentPhotonLayer;
+    if(photon_dz<0) {
+        for (; (j>0) && (ais<ZERO) && (aia<ZERO); 
+             mediumBoundary-=(floating_t)MEDIUM_LAYER_THICKNESS,
+             currentScaLen=getScatteringLength(j, wavelength),
+             currentAbsLen=getAbsorptionLength(j, wavelength),
+             ais+=my_recip(currentScaLen),
+             aia+=my_recip(currentAbsLen)) --j;
+    } else {
+        for (; (j<MEDIUM_LAYERS-1) && (ais>ZERO) && (aia>ZERO);
+             mediumBoundary+=(floating_t)MEDIUM_LAYER_THICKNESS,
+             currentScaLen=getScatteringLength(j, wavelength),
+             currentAbsLen=getAbsorptionLength(j, wavelength),
+             ais-=my_recip(currentScaLen),
+             aia-=my_recip(currentAbsLen)) ++j;
+    }
+    *endLayer=j;
+
+    floating_t distancePropagated;
+    floating_t distanceToAbsorption;
+    if ((currentPhotonLayer==j) || ((my_fabs(photon_dz))<EPSILON)) {
+        distancePropagated=sca_step_left*currentScaLen;
+        distanceToAbsorption=(*abs_lens_left)*currentAbsLen;
+    } else {
+        const floating_t recip_photon_dz = my_recip(photon_dz);
+        distancePropagated=(ais*((floating_t)MEDIUM_LAYER_THICKNESS)*currentScaLen+mediumBoundary-effective_z)*recip_photon_dz;
+        distanceToAbsorption=(aia*((floating_t)MEDIUM_LAYER_THICKNESS)*currentAbsLen+mediumBoundary-effective_z)*recip_photon_dz;
+    }
+
+    // get overburden for distance
+    if (distanceToAbsorption<distancePropagated) {
+        distancePropagated=distanceToAbsorption;
+        *abs_lens_left=ZERO;
+    } else {
+        *abs_lens_left=my_divide(distanceToAbsorption-distancePropagated, currentAbsLen);
+    }
+
+    return distancePropagated;
+}
+
+#ifdef MEDIUM_OPTICAL_DEPTH_TABLES
+// Same as mediumPropagateLayerByLayer(), but finds the scattering and
+// absorption points on the cumulative optical depth tables instead of
+// stepping through the layers. The weights are the ones returned by
+// get{Scattering,Absorption}Length_depthWeights() for the wavelength.
+inline floating_t mediumPropagateWithDepthTables(int currentPhotonLayer,
+    floating_t effective_z,
+    floating_t photon_dz,
+    float wavelength,
+    float2 scaDepthWeights,
+    float2 absDepthWeights,
+    floating_t sca_step_left,
+    floating_t *abs_lens_left,
+    int *endLayer)
+{
+    int scaLayer=currentPhotonLayer;
+    int absLayer=currentPhotonLayer;
+    floating_t distancePropagated;
+    floating_t distanceToAbsorption;
+    if ((my_fabs(photon_dz))<EPSILON) {
+        distancePropagated=sca_step_left*getScatteringLength(currentPhotonLayer, wavelength);
+        distanceToAbsorption=(*abs_lens_left)*getAbsorptionLength(currentPhotonLayer, wavelength);
+    } else {
+        distancePropagated=mediumDistanceForOpticalDepth(SCA_DEPTH_TABLES, scaDepthWeights,
+            currentPhotonLayer, effective_z, photon_dz, sca_step_left, &scaLayer);
+        distanceToAbsorption=mediumDistanceForOpticalDepth(ABS_DEPTH_TABLES, absDepthWeights,
+            currentPhotonLayer, effective_z, photon_dz, *abs_lens_left, &absLayer);
+    }
+
+    // get overburden for distance
+    if (distanceToAbsorption<distancePropagated) {
+        *endLayer=absLayer;
+        *abs_lens_left=ZERO;
+        return distanceToAbsorption;
+    }
+
+    // subtract the absorption lengths crossed on the way to the scattering point
+    if (scaLayer==currentPhotonLayer) {
+        *abs_lens_left-=distancePropagated*mediumInvLength(ABS_DEPTH_TABLES, absDepthWeights, currentPhotonLayer);
+    } else {
+        *abs_lens_left-=my_divide(
+            mediumDepthAtZ(ABS_DEPTH_TABLES, absDepthWeights, scaLayer, effective_z+distancePropagated*photon_dz) -
+            mediumDepthAtZ(ABS_DEPTH_TABLES, absDepthWeights, currentPhotonLayer, effective_z),
+            photon_dz);
+    }
+    *abs_lens_left=max(*abs_lens_left, ZERO);
+    *endLayer=scaLayer;
+
+    return distancePropagated;
+}
+#endif
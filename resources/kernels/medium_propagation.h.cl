@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ * @file medium_propagation.h.cl
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+// Math helpers and the propagation of photons through the layers of
+// the medium, shared by the propagation kernel and the medium tests.
+// Requires the math preamble and the medium properties source.
+
+#ifdef DOUBLE_PRECISION
+    #define EPSILON 0.00000001
+#else
+    #define EPSILON 0.00001f
+#endif
+
+///////////////// forward declarations
+
+inline floating_t my_divide(floating_t a, floating_t b);
+inline floating_t my_recip(floating_t a);
+inline floating_t my_powr(floating_t a, floating_t b);
+inline floating_t my_sqrt(floating_t a);
+inline floating_t my_rsqrt(floating_t a);
+inline floating_t my_cos(floating_t a);
+inline floating_t my_sin(floating_t a);
+inline floating_t my_log(floating_t a);
+inline floating_t my_exp(floating_t a);
+inline floating_t my_fabs(floating_t a);
+inline floating_t sqr(floating_t a);
+
+inline int findLayerForGivenZPos(floating_t posZ);
+
+inline floating_t mediumLayerBoundary(int layer);
+
+inline floating_t mediumPropagateLayerByLayer(int currentPhotonLayer,
+    floating_t effective_z,
+    floating_t photon_dz,
+    float wavelength,
+    floating_t sca_step_left,
+    floating_t *abs_lens_left,
+    int *endLayer);
+
+#ifdef MEDIUM_OPTICAL_DEPTH_TABLES
+inline floating_t mediumPropagateWithDepthTables(int currentPhotonLayer,
+    floating_t effective_z,
+    floating_t photon_dz,
+    float wavelength,
+    float2 scaDepthWeights,
+    float2 absDepthWeights,
+    floating_t sca_step_left,
+    floating_t *abs_lens_left,
+    int *endLayer);
+#endif
@@ -70,3 +70,42 @@ __kernel void testKernel(__global ulong* MWC_RNG_x,
     MWC_RNG_x[i] = real_rnd_x;
     MWC_RNG_a[i] = real_rnd_a;
 }
+
+// propagates photons with (wavelength, z, dirZ, scattering lengths) given
+// in inputs and the absorption lengths in absLensValues to their next
+// scattering (or absorption) point. Writes
+// (distance, absorption lengths left, final layer, 0) to outputs.
+__kernel void testPropagationKernel(__global const float4* inputs,
+                                    __global const float* absLensValues,
+                                    __global float4* outputs,
+                                    uint useTables)
+{
+    unsigned int i = get_global_id(0);
+
+    const float4 input = inputs[i];
+    const float wavelength = input.x;
+    const floating_t effective_z = input.y;
+    const floating_t photon_dz = input.z;
+    const floating_t sca_step_left = input.w;
+    floating_t abs_lens_left = absLensValues[i];
+
+    int currentPhotonLayer = min(max(findLayerForGivenZPos(effective_z), 0), MEDIUM_LAYERS-1);
+
+    int j;
+    floating_t distancePropagated;
+#ifdef MEDIUM_OPTICAL_DEPTH_TABLES
+    if (useTables) {
+        distancePropagated=mediumPropagateWithDepthTables(currentPhotonLayer, effective_z, photon_dz,
+            wavelength,
+            getScatteringLength_depthWeights(wavelength),
+            getAbsorptionLength_depthWeights(wavelength),
+            sca_step_left, &abs_lens_left, &j);
+    } else
+#endif
+    {
+        distancePropagated=mediumPropagateLayerByLayer(currentPhotonLayer, effective_z, photon_dz,
+            wavelength, sca_step_left, &abs_lens_left, &j);
+    }
+
+    outputs[i] = (float4)(distancePropagated, abs_lens_left, (float)j, 0.f);
+}
@@ -43,3 +43,8 @@ __kernel void testKernel(__global ulong* MWC_RNG_x,
                          __global float* yValues,
                          uint layer,
                          uint mode);
+
+__kernel void testPropagationKernel(__global const float4* inputs,
+                                    __global const float* absLensValues,
+                                    __global float4* outputs,
+                                    uint useTables);
@@ -0,0 +1,111 @@
+// Counter-based Philox4x32-10 random number generator for OpenCL along
+// the lines of Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"
+// (SC11). Random numbers are a pure function of a 64bit key and a 128bit
+// counter, so there is no state to seed or keep per work item.
+//
+// The counter is made of the photon index within its step, the number
+// of the 4-number block drawn for this photon and a 64bit key derived
+// from the step itself. Photons thus get the same random numbers no
+// matter which work item or device propagates them.
+
+struct PhiloxRNGState
+{
+    uint4 counter;  // photon index, block index, step key (lo,hi)
+    uint2 key;      // run key
+    uint block[4];  // the current block of random numbers
+    uint used;      // the number of entries of block[] already used
+};
+
+// prototypes to make some compilers happy
+inline uint4 philox4x32_10(uint4 counter, uint2 key);
+inline void rngPhiloxInit(struct PhiloxRNGState *rng, uint keyLo, uint keyHi);
+inline void rngPhiloxStartStep(struct PhiloxRNGState *rng, uint4 stepDataA, uint4 stepDataB, uint4 stepDataC);
+inline void rngPhiloxStartPhoton(struct PhiloxRNGState *rng, uint photonIndex);
+inline float rand_Philox_co(struct PhiloxRNGState *rng);
+inline float rand_Philox_oc(struct PhiloxRNGState *rng);
+
+//////////////////////////////////////////////////////////////////////////////
+//   The Philox4x32 bijection with 10 rounds
+//////////////////////////////////////////////////////////////////////////////
+inline uint4 philox4x32_10(uint4 counter, uint2 key)
+{
+    for (uint round=0;round<10;++round)
+    {
+        if (round>0) key += (uint2)(0x9E3779B9u, 0xBB67AE85u);
+
+        const uint hi0 = mul_hi(0xD2511F53u, counter.x);
+        const uint lo0 = 0xD2511F53u*counter.x;
+        const uint hi1 = mul_hi(0xCD9E8D57u, counter.z);
+        const uint lo1 = 0xCD9E8D57u*counter.z;
+
+        counter = (uint4)(hi1^counter.y^key.x, lo1, hi0^counter.w^key.y, lo0);
+    }
+
+    return counter;
+}
+
+inline void rngPhiloxInit(struct PhiloxRNGState *rng, uint keyLo, uint keyHi)
+{
+    rng->counter = (uint4)(0, 0, 0, 0);
+    rng->key = (uint2)(keyLo, keyHi);
+    rng->used = 4;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Derives the step key from the (bit patterns of the) step contents
+//////////////////////////////////////////////////////////////////////////////
+inline void rngPhiloxStartStep(struct PhiloxRNGState *rng, uint4 stepDataA, uint4 stepDataB, uint4 stepDataC)
+{
+    uint4 hash = philox4x32_10(stepDataA, rng->key);
+    hash = philox4x32_10(hash ^ stepDataB, rng->key);
+    hash = philox4x32_10(hash ^ stepDataC, rng->key);
+
+    rng->counter = (uint4)(0, 0, hash.x, hash.y);
+    rng->used = 4;
+}
+
+inline void rngPhiloxStartPhoton(struct PhiloxRNGState *rng, uint photonIndex)
+{
+    rng->counter.x = photonIndex;
+    rng->counter.y = 0;
+    rng->used = 4;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Generates a random number between 0 and 1 [0,1)
+//////////////////////////////////////////////////////////////////////////////
+inline float rand_Philox_co(struct PhiloxRNGState *rng)
+{
+    if (rng->used >= 4) {
+        const uint4 block = philox4x32_10(rng->counter, rng->key);
+        rng->block[0] = block.x;
+        rng->block[1] = block.y;
+        rng->block[2] = block.z;
+        rng->block[3] = block.w;
+        rng->used = 0;
+        ++(rng->counter.y);
+    }
+
+    const uint value = rng->block[rng->used];
+    ++(rng->used);
+
+#ifdef USE_NATIVE_MATH
+    return native_divide(convert_float_rtz(value),(float)0x100000000); // OpenCL - native divide
+#else
+    return (convert_float_rtz(value)/(float)0x100000000); // OpenCL
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Generates a random number between 0 and 1 (0,1]
+//////////////////////////////////////////////////////////////////////////////
+inline float rand_Philox_oc(struct PhiloxRNGState *rng)
+{
+    return 1.0f-rand_Philox_co(rng);
+}
+
+// typedefs for later use
+#define RNG_ARGS struct PhiloxRNGState *rng
+#define RNG_ARGS_TO_CALL rng
+#define RNG_CALL_UNIFORM_CO rand_Philox_co(rng)
+#define RNG_CALL_UNIFORM_OC rand_Philox_oc(rng)
@@ -31,55 +31,6 @@
 #endif
 
 
-#ifdef DOUBLE_PRECISION
-// can't have native_math with double precision
-#ifdef USE_NATIVE_MATH
-#undef USE_NATIVE_MATH
-#endif
-#endif
-
-#ifdef USE_NATIVE_MATH
-inline floating_t my_divide(floating_t a, floating_t b) {return native_divide(a,b);}
-inline floating_t my_recip(floating_t a) {return native_recip(a);}
-inline floating_t my_powr(floating_t a, floating_t b) {return native_powr(a,b);}
-inline floating_t my_sqrt(floating_t a) {return native_sqrt(a);}
-inline floating_t my_rsqrt(floating_t a) {return native_rsqrt(a);}
-inline floating_t my_cos(floating_t a) {return native_cos(a);}
-inline floating_t my_sin(floating_t a) {return native_sin(a);}
-inline floating_t my_log(floating_t a) {return native_log(a);}
-inline floating_t my_exp(floating_t a) {return native_exp(a);}
-#else
-inline floating_t my_divide(floating_t a, floating_t b) {return a/b;}
-inline floating_t my_recip(floating_t a) {return 1.f/a;}
-inline floating_t my_powr(floating_t a, floating_t b) {return powr(a,b);}
-inline floating_t my_sqrt(floating_t a) {return sqrt(a);}
-inline floating_t my_rsqrt(floating_t a) {return rsqrt(a);}
-inline floating_t my_cos(floating_t a) {return cos(a);}
-inline floating_t my_sin(floating_t a) {return sin(a);}
-inline floating_t my_log(floating_t a) {return log(a);}
-inline floating_t my_exp(floating_t a) {return exp(a);}
-#endif
-
-#ifdef USE_FABS_WORKAROUND
-inline floating_t my_fabs(floating_t a) {return (a<ZERO)?(-a):(a);}
-#else
-inline floating_t my_fabs(floating_t a) {return fabs(a);}
-#endif
-inline floating_t sqr(floating_t a) {return a*a;}
-
-
-
-
-inline int findLayerForGivenZPos(floating_t posZ)
-{
-    return convert_int((posZ-(floating_t)MEDIUM_LAYER_BOTTOM_POS)/(floating_t)MEDIUM_LAYER_THICKNESS);
-}
-
-inline floating_t mediumLayerBoundary(int layer)
-{
-    return (convert_floating_t(layer)*((floating_t)MEDIUM_LAYER_THICKNESS)) + (floating_t)MEDIUM_LAYER_BOTTOM_POS;
-}
-
 void scatterDirectionByAngle(floating_t cosa,
     floating_t sina,
     floating4_t *direction,
@@ -225,6 +176,19 @@ inline float2 sphDirFromCar(float4 carDir)
 
 #ifdef TABULATE
 
+#ifdef TABULATE_ACCUMULATE
+// There are no atomic float operations in OpenCL 1.x,
+// emulate them with compare-and-exchange on the bits.
+inline void atomicAddFloat(volatile __global float *address, const float value)
+{
+    union { uint u; float f; } oldValue, newValue;
+    do {
+        oldValue.f = *address;
+        newValue.f = oldValue.f + value;
+    } while (atomic_cmpxchg((volatile __global uint *)address, oldValue.u, newValue.u) != oldValue.u);
+}
+#endif
+
 inline bool savePath(
     const struct I3CLSimStep *step,
     const struct I3CLSimReferenceParticle *source,
@@ -237,8 +201,15 @@ inline bool savePath(
     const floating_t thisStepDepth, /* additional depth penetrated in this step */
     uint thread_id,
     bool *stop,
+#ifdef TABULATE_ACCUMULATE
+    __global float *binContent,
+#ifdef TABULATE_SQUARED_WEIGHTS
+    __global float *squaredWeights,
+#endif
+#else
     __global uint *entry_counter,
     __global struct I3CLSimTableEntry *entries,
+#endif
     RNG_ARGS)
 {
     // NB: the quantum efficiency of the receiver is already taken into
@@ -254,9 +225,14 @@ inline bool savePath(
     
     floating_t d = *prevStepLength;
     //dbg_printf("first step is %f\n", d);
+#ifdef TABULATE_ACCUMULATE
+    // bin directly into the table, this never runs out of space
+    for (; d < thisStepLength; d += VOLUME_MODE_STEP) {
+#else
     uint offset = *entry_counter;
     for (; d < thisStepLength && offset < TABLE_ENTRIES_PER_STREAM;
         d += VOLUME_MODE_STEP, offset++) {
+#endif
 
         floating4_t pos = photonPosAndTime;
         pos.x = photonPosAndTime.x + d*photonDirAndWlen.x;
@@ -280,16 +256,29 @@ inline bool savePath(
             break;
         }
         
-        entries[thread_id*TABLE_ENTRIES_PER_STREAM + offset].index
-            = getBinIndex(coords);
         // Weight the photon by its probability of:
         // 1) Being detected, given its wavelength
         // 2) Being detected, given its impact angle with the DOM
         // 3) Having survived this far without being absorbed
+#ifdef TABULATE_ACCUMULATE
+        const uint index = getBinIndex(coords);
+        const float weight = impactWeight*my_exp(-(depth + (d/thisStepLength)*thisStepDepth));
+        atomicAddFloat(&binContent[index], weight);
+#ifdef TABULATE_SQUARED_WEIGHTS
+        atomicAddFloat(&squaredWeights[index], weight*weight);
+#endif
+#else
+        entries[thread_id*TABLE_ENTRIES_PER_STREAM + offset].index
+            = getBinIndex(coords);
         entries[thread_id*TABLE_ENTRIES_PER_STREAM + offset].weight =
             impactWeight*my_exp(-(depth + (d/thisStepLength)*thisStepDepth));
+#endif
     }
     
+#ifdef TABULATE_ACCUMULATE
+    *prevStepLength = d - thisStepLength;
+    return true;
+#else
     if (d < thisStepLength && !(*stop)) {
         // we ran out of space. erase.
         return false;
@@ -299,6 +288,7 @@ inline bool savePath(
         *prevStepLength = d - thisStepLength;
         return true;
     }
+#endif
 
 }
 #endif
@@ -319,7 +309,7 @@ inline void saveHit(
     unsigned short hitOnDom,
     __global uint* hitIndex,
     uint maxHitIndex,
-    __global struct I3CLSimPhoton *outputPhotons
+    __global struct I3CLSimOutputPhoton *outputPhotons
 #ifdef SAVE_PHOTON_HISTORY
   , __global float4 *photonHistory,
     float4 *currentPhotonHistory
@@ -334,6 +324,34 @@ inline void saveHit(
         //    myIndex);
 #endif
 
+#ifdef COMPACT_PHOTONS
+        // store the position relative to the DOM center (the host
+        // adds the DOM position back) and everything except for
+        // time, weight and the ids at half precision
+        {
+            floating_t domPosX, domPosY, domPosZ;
+            geometryGetDomPosition(hitOnString, hitOnDom, &domPosX, &domPosY, &domPosZ);
+
+            __global struct I3CLSimCompactPhoton *outputPhoton = &(outputPhotons[myIndex]);
+            const float2 dir = sphDirFromCar(photonDirAndWlen);
+
+            outputPhoton->time = photonPosAndTime.w+thisStepLength*inv_groupvel;
+            outputPhoton->weight = step->weight / getWavelengthBias(photonDirAndWlen.w);
+            outputPhoton->identifier = step->identifier;
+            outputPhoton->stringID = convert_short(hitOnString);
+            outputPhoton->omID = convert_ushort(hitOnDom);
+
+            vstore_half(convert_float(photonPosAndTime.x+thisStepLength*photonDirAndWlen.x-domPosX), 0, (__global half *)&(outputPhoton->relPosX));
+            vstore_half(convert_float(photonPosAndTime.y+thisStepLength*photonDirAndWlen.y-domPosY), 0, (__global half *)&(outputPhoton->relPosY));
+            vstore_half(convert_float(photonPosAndTime.z+thisStepLength*photonDirAndWlen.z-domPosZ), 0, (__global half *)&(outputPhoton->relPosZ));
+            vstore_half(dir.x, 0, (__global half *)&(outputPhoton->dirTheta));
+            vstore_half(dir.y, 0, (__global half *)&(outputPhoton->dirPhi));
+            vstore_half(convert_float(photonDirAndWlen.w*1e9f), 0, (__global half *)&(outputPhoton->wavelength));
+            vstore_half(convert_float(my_recip(inv_groupvel)), 0, (__global half *)&(outputPhoton->groupVelocity));
+
+            outputPhoton->numScatters = convert_ushort_sat(photonNumScatters);
+        }
+#else
         outputPhotons[myIndex].posAndTime = (float4)
             (
             photonPosAndTime.x+thisStepLength*photonDirAndWlen.x,
@@ -363,6 +381,7 @@ inline void saveHit(
         outputPhotons[myIndex].groupVelocity = my_recip(inv_groupvel);
 
         outputPhotons[myIndex].distInAbsLens = distanceTraveledInAbsorptionLengths;
+#endif
 
 #ifdef SAVE_PHOTON_HISTORY
         for (uint i=0;i<NUM_PHOTONS_IN_HISTORY;++i)
@@ -383,6 +402,14 @@ inline void saveHit(
     
 }
 
+#if defined(COMPACT_PHOTONS) && (defined(SAVE_ALL_PHOTONS) || defined(SAVE_PHOTON_HISTORY))
+#error "COMPACT_PHOTONS cannot be used with SAVE_ALL_PHOTONS or SAVE_PHOTON_HISTORY"
+#endif
+
+#if defined(COMPRESSED_STEPS) && defined(TABULATE)
+#error "COMPRESSED_STEPS cannot be used with TABULATE (the kernel writes back to the input steps)"
+#endif
+
 __kernel void propKernel(
 #ifndef TABULATE
     __global uint *hitIndex,   // deviceBuffer_CurrentNumOutputPhotons
@@ -393,8 +420,17 @@ __kernel void propKernel(
 #endif
 
     __global struct I3CLSimStep *inputSteps, // deviceBuffer_InputSteps
+#ifdef COMPRESSED_STEPS
+    __global const struct I3CLSimStepGroupHeader *inputStepGroups, // deviceBuffer_InputStepGroups
+    const uint numInputStepGroups, // 0 if inputSteps are not compressed
+#endif
+#ifdef PHOTON_CHUNK_SIZE
+    __global const uint *stepChunkStart, // index of the first photon chunk of each step, numInputSteps+1 entries
+    const uint numInputSteps,
+    __global uint *chunkCounter, // next chunk to be propagated (zero at launch)
+#endif
 #ifndef TABULATE
-    __global struct I3CLSimPhoton *outputPhotons, // deviceBuffer_OutputPhotons
+    __global struct I3CLSimOutputPhoton *outputPhotons, // deviceBuffer_OutputPhotons
 
 #ifdef SAVE_PHOTON_HISTORY
     __global float4 *photonHistory,
@@ -402,12 +438,24 @@ __kernel void propKernel(
 
 #else // TABULATE
     __global struct I3CLSimReferenceParticle *referenceParticle,
+#ifdef TABULATE_ACCUMULATE
+    __global float *tableBinContent,
+#ifdef TABULATE_SQUARED_WEIGHTS
+    __global float *tableSquaredWeights,
+#endif
+#else
     __global struct I3CLSimTableEntry *outputTableEntries,
     __global uint *numOutputEntries,
 #endif
+#endif
 
+#ifdef COUNTER_BASED_RNG
+    const uint rngKeyLo,
+    const uint rngKeyHi)
+#else
     __global ulong* MWC_RNG_x,
     __global uint* MWC_RNG_a)
+#endif
 {
     unsigned int i = get_global_id(0);
 
@@ -434,29 +482,146 @@ __kernel void propKernel(
     float4 currentPhotonHistory[NUM_PHOTONS_IN_HISTORY];
 #endif
 
+#ifdef COUNTER_BASED_RNG
+#ifdef TABULATE
+#error COUNTER_BASED_RNG cannot be used with TABULATE
+#endif
+    // the random numbers only depend on the key, the step and the photon index
+    struct PhiloxRNGState real_rng;
+    struct PhiloxRNGState *rng = &real_rng;
+    rngPhiloxInit(rng, rngKeyLo, rngKeyHi);
+#else
     //download MWC RNG state
     ulong real_rnd_x = MWC_RNG_x[i];
     uint real_rnd_a = MWC_RNG_a[i];
     ulong *rnd_x = &real_rnd_x;
     uint *rnd_a = &real_rnd_a;
+#endif
+
+#ifdef PHOTON_CHUNK_SIZE
+#ifdef TABULATE
+#error PHOTON_CHUNK_SIZE cannot be used with TABULATE
+#endif
+    // Work items keep pulling chunks of up to PHOTON_CHUNK_SIZE photons until
+    // all steps are done, so a few bright steps do not keep the rest of their
+    // wavefront idle. The body of this loop propagates the photons of one chunk.
+    const uint numChunks = stepChunkStart[numInputSteps];
+    for (;;)
+    {
+    const uint chunk = atom_inc(chunkCounter);
+    if (chunk >= numChunks) break;
+
+    // find the step this chunk belongs to (the last one starting at or before it)
+    uint stepIndex = 0;
+    {
+        uint stepHigh = numInputSteps;
+        while (stepHigh-stepIndex > 1) {
+            const uint stepMid = (stepIndex+stepHigh)/2;
+            if (stepChunkStart[stepMid] <= chunk) {
+                stepIndex = stepMid;
+            } else {
+                stepHigh = stepMid;
+            }
+        }
+    }
+#else
+    {
+    const uint stepIndex = i;
+#endif
 
     // download the step
     struct I3CLSimStep step;
-    step.posAndTime = inputSteps[i].posAndTime;
-    step.dirAndLengthAndBeta = inputSteps[i].dirAndLengthAndBeta;
-    step.numPhotons = inputSteps[i].numPhotons;
-    step.weight = inputSteps[i].weight;
-    step.identifier = inputSteps[i].identifier;
+#ifdef COUNTER_BASED_RNG
+    uint stepSerial;
+#endif
+#ifdef COMPRESSED_STEPS
+    if (numInputStepGroups > 0) {
+        // find the group this step belongs to (the last one starting at or before stepIndex)
+        uint groupLow = 0;
+        uint groupHigh = numInputStepGroups;
+        while (groupHigh-groupLow > 1) {
+            const uint groupMid = (groupLow+groupHigh)/2;
+            if (inputStepGroups[groupMid].firstStep <= stepIndex) {
+                groupLow = groupMid;
+            } else {
+                groupHigh = groupMid;
+            }
+        }
+        
+        __global const struct I3CLSimCompressedStep *compressedStep = &(((__global const struct I3CLSimCompressedStep *)inputSteps)[stepIndex]);
+        const float4 delta = convert_float4(compressedStep->posAndTimeDelta);
+        const float2 dir = convert_float2(compressedStep->dir) * (float2)(COMPRESSED_STEP_THETA_QUANTUM, COMPRESSED_STEP_PHI_QUANTUM);
+        const float2 groupBetaAndWeight = inputStepGroups[groupLow].betaAndWeight;
+        
+        step.posAndTime = inputStepGroups[groupLow].posAndTime +
+            delta * (float4)(COMPRESSED_STEP_POS_QUANTUM, COMPRESSED_STEP_POS_QUANTUM, COMPRESSED_STEP_POS_QUANTUM, COMPRESSED_STEP_TIME_QUANTUM);
+        step.dirAndLengthAndBeta = (float4)(dir.x, dir.y, compressedStep->length, groupBetaAndWeight.x);
+        step.numPhotons = compressedStep->numPhotons;
+        step.weight = groupBetaAndWeight.y;
+        step.identifier = inputStepGroups[groupLow].identifier;
 #ifndef NO_FLASHER
-    // only needed for flashers
-    step.sourceType = inputSteps[i].sourceType;
+        // only needed for flashers
+        step.sourceType = inputStepGroups[groupLow].sourceType;
+#endif
+#ifdef COUNTER_BASED_RNG
+#ifdef NO_FLASHER
+        // part of the step key
+        step.sourceType = inputStepGroups[groupLow].sourceType;
+#endif
+        // steps in a group have consecutive serials
+        stepSerial = (((uint)inputStepGroups[groupLow].dummy1 << 16) + (uint)inputStepGroups[groupLow].dummy2 +
+            (stepIndex - inputStepGroups[groupLow].firstStep)) & 0xffffffu;
+#endif
+    } else
+#endif
+    {
+        step.posAndTime = inputSteps[stepIndex].posAndTime;
+        step.dirAndLengthAndBeta = inputSteps[stepIndex].dirAndLengthAndBeta;
+        step.numPhotons = inputSteps[stepIndex].numPhotons;
+        step.weight = inputSteps[stepIndex].weight;
+        step.identifier = inputSteps[stepIndex].identifier;
+#ifndef NO_FLASHER
+        // only needed for flashers
+        step.sourceType = inputSteps[stepIndex].sourceType;
+#endif
+#ifdef COUNTER_BASED_RNG
+#ifdef NO_FLASHER
+        // part of the step key
+        step.sourceType = inputSteps[stepIndex].sourceType;
+#endif
+        // the serial is kept in the dummy fields
+        stepSerial = ((uint)inputSteps[stepIndex].dummy1 << 16) | (uint)inputSteps[stepIndex].dummy2;
+#endif
+        //step = inputSteps[stepIndex]; // Intel OpenCL does not like this
+    }
+
+#ifdef COUNTER_BASED_RNG
+    // Derive the step key from the contents of the step and its serial
+    // (which is unique among steps with the same number of photons, so
+    // that identical steps, e.g. from a flasher, get different keys).
+    // This has to happen before the step is cut into chunks.
+    rngPhiloxStartStep(rng,
+        as_uint4(step.posAndTime),
+        as_uint4(step.dirAndLengthAndBeta),
+        (uint4)(step.numPhotons, step.identifier, as_uint(step.weight), convert_uint(step.sourceType) | (stepSerial << 8)));
+    
+    // the index of the first photon of this work item in its step
+    uint firstPhotonIndex = 0;
+#endif
+
+#ifdef PHOTON_CHUNK_SIZE
+    // only propagate the photons of this chunk
+    step.numPhotons = min((uint)PHOTON_CHUNK_SIZE,
+        step.numPhotons - (chunk-stepChunkStart[stepIndex])*(uint)PHOTON_CHUNK_SIZE);
+#ifdef COUNTER_BASED_RNG
+    firstPhotonIndex = (chunk-stepChunkStart[stepIndex])*(uint)PHOTON_CHUNK_SIZE;
+#endif
 #endif
-    //step.dummy1 = inputSteps[i].dummy1;  // NOT USED
-    //step.dummy2 = inputSteps[i].dummy2;  // NOT USED
-    //step = inputSteps[i]; // Intel OpenCL does not like this
 
 #ifdef TABULATE
-    struct I3CLSimReferenceParticle refParticle = *referenceParticle;
+    // steps from several sources may share a launch; the step
+    // identifier is the index of its reference particle
+    struct I3CLSimReferenceParticle refParticle = referenceParticle[step.identifier];
 #endif
 
     floating4_t stepDir;
@@ -479,12 +644,6 @@ __kernel void propKernel(
     //    step.numPhotons);
 #endif
 
-#ifdef DOUBLE_PRECISION
-    #define EPSILON 0.00000001
-#else
-    #define EPSILON 0.00001f
-#endif
-
     uint photonsLeftToPropagate=step.numPhotons;
     floating_t abs_lens_left=ZERO;
     floating_t abs_lens_initial=ZERO;
@@ -501,6 +660,11 @@ __kernel void propKernel(
 #ifdef getTiltZShift_IS_CONSTANT
     int currentPhotonLayer;
 #endif
+#ifdef MEDIUM_OPTICAL_DEPTH_TABLES
+    // the wavelength-dependent weights of both optical depth tables
+    float2 scaDepthWeights;
+    float2 absDepthWeights;
+#endif
 
 #ifndef FUNCTION_getGroupVelocity_DOES_NOT_DEPEND_ON_LAYER
 #error This kernel only works with a constant group velocity (constant w.r.t. layers)
@@ -522,6 +686,10 @@ __kernel void propKernel(
             // an empty output buffer
             prev_rnd_x = real_rnd_x;
             prev_rnd_a = real_rnd_a;
+#endif
+#ifdef COUNTER_BASED_RNG
+            // every photon has its own sequence of random numbers
+            rngPhiloxStartPhoton(rng, firstPhotonIndex + (step.numPhotons-photonsLeftToPropagate));
 #endif
             // create a new photon
             createPhotonFromTrack(&step,
@@ -556,6 +724,10 @@ __kernel void propKernel(
 #endif
 
             inv_groupvel = my_recip(getGroupVelocity(0, photonDirAndWlen.w));
+#ifdef MEDIUM_OPTICAL_DEPTH_TABLES
+            scaDepthWeights = getScatteringLength_depthWeights(photonDirAndWlen.w);
+            absDepthWeights = getAbsorptionLength_depthWeights(photonDirAndWlen.w);
+#endif
             
             // the photon needs a lifetime. determine distance to next scatter and absorption
             // (this is in units of absorption/scattering lengths)
@@ -604,56 +776,21 @@ __kernel void propKernel(
 
             abs_lens_left *= abs_len_correction_factor;
 
-            // the "next" medium boundary (either top or bottom, depending on step direction)
-            floating_t mediumBoundary = (photon_dz<ZERO)?(mediumLayerBoundary(currentPhotonLayer)):(mediumLayerBoundary(currentPhotonLayer)+(floating_t)MEDIUM_LAYER_THICKNESS);
-
             // track this thing to the next scattering point
             floating_t sca_step_left = -my_log(RNG_CALL_UNIFORM_OC);
 #ifdef PRINTF_ENABLED
             //dbg_printf("   - next scatter in %f scattering lengths\n", sca_step_left);
 #endif
-            
-            floating_t currentScaLen = getScatteringLength(currentPhotonLayer, photonDirAndWlen.w);
-            floating_t currentAbsLen = getAbsorptionLength(currentPhotonLayer, photonDirAndWlen.w);
-            
-            floating_t ais=( photon_dz*sca_step_left - my_divide((mediumBoundary-effective_z),currentScaLen) )*(ONE/(floating_t)MEDIUM_LAYER_THICKNESS);
-            floating_t aia=( photon_dz*abs_lens_left - my_divide((mediumBoundary-effective_z),currentAbsLen) )*(ONE/(floating_t)MEDIUM_LAYER_THICKNESS);
 
-#ifdef PRINTF_ENABLED
-            //dbg_printf("   - ais=%f, aia=%f, j_initial=%i\n", ais, aia, currentPhotonLayer);
-#endif
-        
-            // propagate through layers
-            int j=currentPhotonLayer;
-            if(photon_dz<0) {
-                for (; (j>0) && (ais<ZERO) && (aia<ZERO); 
-                     mediumBoundary-=(floating_t)MEDIUM_LAYER_THICKNESS,
-                     currentScaLen=getScatteringLength(j, photonDirAndWlen.w),
-                     currentAbsLen=getAbsorptionLength(j, photonDirAndWlen.w),
-                     ais+=my_recip(currentScaLen),
-                     aia+=my_recip(currentAbsLen)) --j;
-            } else {
-                for (; (j<MEDIUM_LAYERS-1) && (ais>ZERO) && (aia>ZERO);
-                     mediumBoundary+=(floating_t)MEDIUM_LAYER_THICKNESS,
-                     currentScaLen=getScatteringLength(j, photonDirAndWlen.w),
-                     currentAbsLen=getAbsorptionLength(j, photonDirAndWlen.w),
-                     ais-=my_recip(currentScaLen),
-                     aia-=my_recip(currentAbsLen)) ++j;
-            }
-        
-#ifdef PRINTF_ENABLED
-            //dbg_printf("   - j_final=%i\n", j);
+            // find the next scattering (or the absorption) point
+            int j;
+#ifdef MEDIUM_OPTICAL_DEPTH_TABLES
+            distancePropagated=mediumPropagateWithDepthTables(currentPhotonLayer, effective_z, photon_dz,
+                photonDirAndWlen.w, scaDepthWeights, absDepthWeights, sca_step_left, &abs_lens_left, &j);
+#else
+            distancePropagated=mediumPropagateLayerByLayer(currentPhotonLayer, effective_z, photon_dz,
+                photonDirAndWlen.w, sca_step_left, &abs_lens_left, &j);
 #endif
-        
-            floating_t distanceToAbsorption;
-            if ((currentPhotonLayer==j) || ((my_fabs(photon_dz))<EPSILON)) {
-                distancePropagated=sca_step_left*currentScaLen;
-                distanceToAbsorption=abs_lens_left*currentAbsLen;
-            } else {
-                const floating_t recip_photon_dz = my_recip(photon_dz);
-                distancePropagated=(ais*((floating_t)MEDIUM_LAYER_THICKNESS)*currentScaLen+mediumBoundary-effective_z)*recip_photon_dz;
-                distanceToAbsorption=(aia*((floating_t)MEDIUM_LAYER_THICKNESS)*currentAbsLen+mediumBoundary-effective_z)*recip_photon_dz;
-            }
 #ifdef getTiltZShift_IS_CONSTANT
             currentPhotonLayer=j;
 #endif
@@ -661,20 +798,26 @@ __kernel void propKernel(
 #ifdef PRINTF_ENABLED
             //dbg_printf("   - distancePropagated=%f\n", distancePropagated);
 #endif
-        
-            // get overburden for distance
-            if (distanceToAbsorption<distancePropagated) {
-                distancePropagated=distanceToAbsorption;
-                abs_lens_left=ZERO;
-            } else {
-                abs_lens_left=my_divide(distanceToAbsorption-distancePropagated, currentAbsLen);
-            }
 
             // hoist the correction factor back out of the absorption length
             abs_lens_left=my_divide(abs_lens_left, abs_len_correction_factor);
 
         }
 
+#ifdef SHADOW_GEOMETRY
+        // photons hitting a cable (or any other shadowing object) are
+        // absorbed there and cannot reach DOMs behind it
+        bool photonIsShadowed = false;
+        {
+            const floating_t distanceToShadow =
+                findShadowingDistance(photonPosAndTime, photonDirAndWlen, distancePropagated);
+            if (distanceToShadow < distancePropagated) {
+                distancePropagated = distanceToShadow;
+                photonIsShadowed = true;
+            }
+        }
+#endif
+
 
 #ifndef SAVE_ALL_PHOTONS
         // no photon collission detection in case all photons should be saved
@@ -744,8 +887,15 @@ __kernel void propKernel(
                  abs_lens_initial-abs_lens_left-depthPropagated,
                  i,
                  &stop,
+#ifdef TABULATE_ACCUMULATE
+                 tableBinContent,
+#ifdef TABULATE_SQUARED_WEIGHTS
+                 tableSquaredWeights,
+#endif
+#else
                  &numOutputEntries[i],
                  outputTableEntries,
+#endif
                  RNG_ARGS_TO_CALL
                  ))
         {
@@ -762,6 +912,9 @@ __kernel void propKernel(
             abs_lens_left = ZERO;
         }
         depthPropagated = abs_lens_initial-abs_lens_left;
+#endif
+#ifdef SHADOW_GEOMETRY
+        if (photonIsShadowed) abs_lens_left = ZERO;
 #endif
         // update the track to its next position
         photonPosAndTime.x += photonDirAndWlen.x*distancePropagated;
@@ -877,17 +1030,21 @@ __kernel void propKernel(
 
     }
 
-#ifdef PRINTF_ENABLED
-    //dbg_printf("Stop kernel... (work item %u of %u)\n", i, global_size);
-    //dbg_printf("Kernel finished.\n");
-#endif
-
 #ifdef TABULATE
     // mark this step as done
     inputSteps[i].numPhotons = 0;
 #endif
 
+    } // photon chunks (or the single step of this work item)
+
+#ifdef PRINTF_ENABLED
+    //dbg_printf("Stop kernel... (work item %u of %u)\n", i, global_size);
+    //dbg_printf("Kernel finished.\n");
+#endif
+
+#ifndef COUNTER_BASED_RNG
     //upload MWC RNG state
     MWC_RNG_x[i] = real_rnd_x;
     MWC_RNG_a[i] = real_rnd_a;
+#endif
 }
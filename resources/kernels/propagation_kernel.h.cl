@@ -62,6 +62,30 @@ struct __attribute__ ((packed)) I3CLSimStep
                                                             // total: 12x 32bit float = 48 bytes
 };
 
+#ifdef COMPRESSED_STEPS
+// compressed step format (see I3CLSimHelperCompressSteps.h)
+struct __attribute__ ((packed)) I3CLSimStepGroupHeader
+{
+    float4 posAndTime;   // x,y,z,time of the first step    // 4x 32bit float
+    float2 betaAndWeight;                                   // 2x 32bit float
+    uint identifier;                                        //    32bit unsigned
+    uint firstStep;                                         //    32bit unsigned
+    uchar sourceType;                                       //     8bit unsigned
+    uchar dummy1;                                           //     8bit unsigned
+    ushort dummy2;                                          //    16bit unsigned
+                                                            // total: 9x 32bit float = 36 bytes
+};
+
+struct __attribute__ ((packed)) I3CLSimCompressedStep
+{
+    short4 posAndTimeDelta; // x,y,z,time relative to the group header
+    ushort2 dir;            // theta,phi (quantized)
+    uint numPhotons;                                        //    32bit unsigned
+    float length;                                           //    32bit float
+                                                            // total: 5x 32bit float = 20 bytes
+};
+#endif
+
 struct __attribute__ ((packed)) I3CLSimPhoton 
 {
     float4 posAndTime;   // x,y,z,time                      // 4x 32bit float
@@ -80,6 +104,32 @@ struct __attribute__ ((packed)) I3CLSimPhoton
                                                             // total: 20x 32bit float = 80 bytes
 };
 
+#ifdef COMPACT_PHOTONS
+// reduced-precision output format (see I3CLSimHelperCompactPhotons.h).
+// All ushort members except for numScatters hold IEEE half precision
+// values written using vstore_half().
+struct __attribute__ ((packed)) I3CLSimCompactPhoton
+{
+    float time;                                             //    32bit float
+    float weight;                                           //    32bit float
+    uint identifier;                                        //    32bit unsigned
+    short stringID;                                         //    16bit signed
+    ushort omID;                                            //    16bit unsigned
+    ushort relPosX; // x,y,z relative to the DOM center [m] //    16bit half
+    ushort relPosY;                                         //    16bit half
+    ushort relPosZ;                                         //    16bit half
+    ushort dirTheta;                                        //    16bit half
+    ushort dirPhi;                                          //    16bit half
+    ushort wavelength; // [nm]                              //    16bit half
+    ushort groupVelocity; // [m/ns]                         //    16bit half
+    ushort numScatters; // saturates at 0xFFFF              //    16bit unsigned
+                                                            // total: 8x 32bit float = 32 bytes
+};
+#define I3CLSimOutputPhoton I3CLSimCompactPhoton
+#else
+#define I3CLSimOutputPhoton I3CLSimPhoton
+#endif
+
 struct __attribute__ ((packed)) I3CLSimTableEntry
 {
     uint index;
@@ -95,10 +145,6 @@ struct __attribute__ ((packed)) I3CLSimReferenceParticle
 
 ///////////////// forward declarations
 
-inline int findLayerForGivenZPos(floating_t posZ);
-
-inline floating_t mediumLayerBoundary(int layer);
-
 void scatterDirectionByAngle(floating_t cosa,
     floating_t sina,
     floating4_t *direction,
@@ -131,7 +177,7 @@ inline void saveHit(
     unsigned short hitOnDom,
     __global uint* hitIndex,
     uint maxHitIndex,
-    __global struct I3CLSimPhoton *outputPhotons
+    __global struct I3CLSimOutputPhoton *outputPhotons
 #ifdef SAVE_PHOTON_HISTORY
   , __global float4 *photonHistory,
     float4 *currentPhotonHistory
@@ -151,16 +197,3 @@ __constant float PI = 3.14159265359f;
 #endif
 
 ///////////////////////////
-
-
-inline floating_t my_divide(floating_t a, floating_t b);
-inline floating_t my_recip(floating_t a);
-inline floating_t my_powr(floating_t a, floating_t b);
-inline floating_t my_sqrt(floating_t a);
-inline floating_t my_rsqrt(floating_t a);
-inline floating_t my_cos(floating_t a);
-inline floating_t my_sin(floating_t a);
-inline floating_t my_log(floating_t a);
-inline floating_t my_exp(floating_t a);
-inline floating_t my_fabs(floating_t a);
-inline floating_t sqr(floating_t a);
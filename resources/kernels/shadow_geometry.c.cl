@@ -0,0 +1,152 @@
+/**
+ * Copyright (c) 2011, 2012
+ * Claudio Kopper <claudio.kopper@icecube.wisc.edu>
+ * and the IceCube Collaboration <http://www.icecube.wisc.edu>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *
+ * $Id$
+ *
+ *
+ * @file shadow_geometry.c.cl
+ * @version $Revision$
+ * @date $Date$
+ * @author Claudio Kopper
+ */
+
+// Intersection of photon paths with cables and other objects shadowing
+// the DOMs. The geometry (a list of cylinders and a bounding volume
+// hierarchy over them) is generated by
+// I3CLSimHelper::GenerateShadowGeometrySource().
+
+// Returns the distance along the photon direction to the first
+// intersection with the cylinder or a number >= maxDistance if there
+// is none. Cylinders are stored as (from.xyz, axis.xyz, length, radius)
+// with a normalized axis.
+inline floating_t shadowCylinderIntersection(__constant const float *cylinder,
+                                             const floating4_t photonPosAndTime,
+                                             const floating4_t photonDirAndWlen,
+                                             floating_t maxDistance)
+{
+    const floating_t px = photonPosAndTime.x - (floating_t)cylinder[0];
+    const floating_t py = photonPosAndTime.y - (floating_t)cylinder[1];
+    const floating_t pz = photonPosAndTime.z - (floating_t)cylinder[2];
+    const floating_t ax = (floating_t)cylinder[3];
+    const floating_t ay = (floating_t)cylinder[4];
+    const floating_t az = (floating_t)cylinder[5];
+    const floating_t length = (floating_t)cylinder[6];
+    const floating_t radius = (floating_t)cylinder[7];
+
+    // position and direction along the axis and perpendicular to it
+    const floating_t pa = px*ax + py*ay + pz*az;
+    const floating_t da = photonDirAndWlen.x*ax + photonDirAndWlen.y*ay + photonDirAndWlen.z*az;
+    const floating_t ppx = px - pa*ax;
+    const floating_t ppy = py - pa*ay;
+    const floating_t ppz = pz - pa*az;
+    const floating_t dpx = photonDirAndWlen.x - da*ax;
+    const floating_t dpy = photonDirAndWlen.y - da*ay;
+    const floating_t dpz = photonDirAndWlen.z - da*az;
+
+    const floating_t a = dpx*dpx + dpy*dpy + dpz*dpz;
+    const floating_t b = ppx*dpx + ppy*dpy + ppz*dpz;
+    const floating_t c = ppx*ppx + ppy*ppy + ppz*ppz - radius*radius;
+
+    floating_t result = maxDistance;
+
+    // the cylinder wall
+    if (a > ZERO) {
+        const floating_t discr = b*b - a*c;
+        if (discr >= ZERO) {
+            const floating_t t = my_divide(-b - my_sqrt(discr), a);
+            const floating_t z = pa + t*da;
+            if ((t >= ZERO) && (t < result) && (z >= ZERO) && (z <= length)) result = t;
+        }
+    }
+
+    // the end caps
+    if (da != ZERO) {
+        const floating_t recip_da = my_recip(da);
+        for (int cap=0;cap<2;++cap)
+        {
+            const floating_t t = ((cap==0)?(-pa):(length-pa))*recip_da;
+            if ((t < ZERO) || (t >= result)) continue;
+
+            const floating_t qx = ppx + t*dpx;
+            const floating_t qy = ppy + t*dpy;
+            const floating_t qz = ppz + t*dpz;
+            if (qx*qx + qy*qy + qz*qz <= radius*radius) result = t;
+        }
+    }
+
+    return result;
+}
+
+// Returns the distance to the first shadowing object along the photon
+// path or a number >= maxDistance if there is none within that distance.
+inline floating_t findShadowingDistance(const floating4_t photonPosAndTime,
+                                        const floating4_t photonDirAndWlen,
+                                        floating_t maxDistance)
+{
+    // the inverse direction for the slab tests. Infinities are fine
+    // here, fmin/fmax drop the NaNs they can produce.
+    const floating_t recip_dx = my_recip(photonDirAndWlen.x);
+    const floating_t recip_dy = my_recip(photonDirAndWlen.y);
+    const floating_t recip_dz = my_recip(photonDirAndWlen.z);
+
+    floating_t result = maxDistance;
+
+    uint stack[SHADOW_BVH_STACK_SIZE];
+    uint stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const uint node = stack[--stackSize];
+        __constant const float *bounds = &(shadowBVHNodeBounds[node*6]);
+
+        {
+            const floating_t tx0 = ((floating_t)bounds[0] - photonPosAndTime.x)*recip_dx;
+            const floating_t tx1 = ((floating_t)bounds[3] - photonPosAndTime.x)*recip_dx;
+            const floating_t ty0 = ((floating_t)bounds[1] - photonPosAndTime.y)*recip_dy;
+            const floating_t ty1 = ((floating_t)bounds[4] - photonPosAndTime.y)*recip_dy;
+            const floating_t tz0 = ((floating_t)bounds[2] - photonPosAndTime.z)*recip_dz;
+            const floating_t tz1 = ((floating_t)bounds[5] - photonPosAndTime.z)*recip_dz;
+
+            const floating_t tmin = fmax(fmax(fmax(fmin(tx0, tx1), fmin(ty0, ty1)), fmin(tz0, tz1)), ZERO);
+            const floating_t tmax = fmin(fmin(fmin(fmax(tx0, tx1), fmax(ty0, ty1)), fmax(tz0, tz1)), result);
+
+            if (tmin > tmax) continue;
+        }
+
+        const uint index = shadowBVHNodeIndex[node*2];
+        const uint numItems = shadowBVHNodeIndex[node*2+1];
+
+        if (numItems == 0) {
+            // inner node: the left child directly follows its parent
+            stack[stackSize++] = index;
+            stack[stackSize++] = node+1;
+            continue;
+        }
+
+        for (uint i=index;i<index+numItems;++i)
+        {
+            result = min(result, shadowCylinderIntersection(&(shadowCylinders[i*8]),
+                                                            photonPosAndTime,
+                                                            photonDirAndWlen,
+                                                            result));
+        }
+    }
+
+    return result;
+}
@@ -45,7 +45,7 @@ inline void checkForCollision_OnString(
     const struct I3CLSimStep *step,
     __global uint* hitIndex,
     uint maxHitIndex,
-    __global struct I3CLSimPhoton *outputPhotons,
+    __global struct I3CLSimOutputPhoton *outputPhotons,
 #ifdef SAVE_PHOTON_HISTORY
     __global float4 *photonHistory,
     float4 *currentPhotonHistory,
@@ -211,7 +211,7 @@ inline void checkForCollision_InCell(
     const struct I3CLSimStep *step,
     __global uint* hitIndex,
     uint maxHitIndex,
-    __global struct I3CLSimPhoton *outputPhotons,
+    __global struct I3CLSimOutputPhoton *outputPhotons,
 #ifdef SAVE_PHOTON_HISTORY
     __global float4 *photonHistory,
     float4 *currentPhotonHistory,
@@ -322,7 +322,7 @@ inline void checkForCollision_InCells(
     const struct I3CLSimStep *step,
     __global uint* hitIndex,
     uint maxHitIndex,
-    __global struct I3CLSimPhoton *outputPhotons,
+    __global struct I3CLSimOutputPhoton *outputPhotons,
 #ifdef SAVE_PHOTON_HISTORY
     __global float4 *photonHistory,
     float4 *currentPhotonHistory,
@@ -475,7 +475,7 @@ inline bool checkForCollision(const floating4_t photonPosAndTime,
 #endif
     __global uint* hitIndex,
     uint maxHitIndex,
-    __global struct I3CLSimPhoton *outputPhotons,
+    __global struct I3CLSimOutputPhoton *outputPhotons,
 #ifdef SAVE_PHOTON_HISTORY
     __global float4 *photonHistory,
    float4 *currentPhotonHistory,
@@ -0,0 +1,65 @@
+#!/usr/bin/env python
+#
+# Copyright (c) 2012, 2015
+# Jakob van Santen <jvansanten@icecube.wisc.edu>
+# and the IceCube Collaboration <http://www.icecube.wisc.edu>
+# 
+# Permission to use, copy, modify, and/or distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+# OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+# CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+# 
+# 
+# $Id$
+# 
+# @file merge_checkpoints.py
+# @version $LastChangedRevision$
+# @date $Date$
+# @author Jakob van Santen
+
+"""
+Sum the checkpoints written by I3CLSimTabulatorModule (see its
+CheckpointFilename option) and write the normalized table. The checkpoints
+have to have the same binning and be made with the same settings.
+"""
+
+from optparse import OptionParser
+from os import path, unlink
+
+usage = "usage: %prog [options] checkpoint [checkpoint ...] outputfile"
+parser = OptionParser(usage, description=__doc__)
+parser.add_option("--checkpoint", dest="checkpoint", action="store_true", default=False,
+    help="Write the sum as another (unnormalized) checkpoint instead of a FITS table")
+parser.add_option("--overwrite", dest="overwrite", action="store_true", default=False,
+    help="Overwrite output file if it already exists")
+
+opts, args = parser.parse_args()
+
+if len(args) < 2:
+	parser.error("You must specify at least one checkpoint and an output file!")
+inputs, outfile = args[:-1], args[-1]
+if path.exists(outfile):
+	if opts.overwrite:
+		unlink(outfile)
+	else:
+		parser.error("Output file exists! Pass --overwrite to overwrite it.")
+
+from icecube.clsim.tabulator import RawTable
+
+# the first checkpoint defines the binning, the rest are added one by one
+table = RawTable(inputs[0])
+for fname in inputs[1:]:
+	table.merge_checkpoint(fname)
+print("%d photons in %d checkpoints" % (table.n_photons, len(inputs)))
+
+if opts.checkpoint:
+	table.write_checkpoint(outfile)
+else:
+	table.write_fits(outfile)
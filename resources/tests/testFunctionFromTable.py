@@ -0,0 +1,100 @@
+#!/usr/bin/env python
+
+from __future__ import print_function
+import numpy
+
+from icecube import icetray, dataclasses, clsim
+from I3Tray import I3Units
+
+# test parameters
+numberOfTrials = 100000
+maximumRelativeDeviation = 1e-5
+# OpenCL interpolates in single precision, which loses a few digits of
+# the interpolation fraction in narrow bins
+maximumRelativeDeviationOpenCL = 1e-3
+
+# get OpenCL devices
+openCLDevices = [device for device in clsim.I3CLSimOpenCLDevice.GetAllDevices()]
+if len(openCLDevices)==0:
+    raise RuntimeError("No OpenCL devices available!")
+openCLDevice = openCLDevices[0]
+
+openCLDevice.useNativeMath=False
+workgroupSize = 1
+workItemsPerIteration = 10240
+print("           using platform:", openCLDevice.platform)
+print("             using device:", openCLDevice.device)
+print("            workgroupSize:", workgroupSize)
+print("    workItemsPerIteration:", workItemsPerIteration)
+
+def evaluatePython(wlens, values, x):
+    # linear interpolation in the first bin with wlens[bin] < x <= wlens[bin+1]
+    wlens = numpy.asarray(wlens, dtype=float)
+    values = numpy.asarray(values, dtype=float)
+    bins = numpy.clip(numpy.searchsorted(wlens, x, side='left')-1, 0, len(wlens)-2)
+    fractions = numpy.clip((x-wlens[bins])/(wlens[bins+1]-wlens[bins]), 0., 1.)
+    return values[bins] + (values[bins+1]-values[bins])*fractions
+
+def check(name, wlens, values):
+    function = clsim.I3CLSimFunctionFromTable(wlens=list(wlens), values=list(values))
+    tester = clsim.I3CLSimFunctionTester(device=openCLDevice,
+                                         workgroupSize=workgroupSize,
+                                         workItemsPerIteration=workItemsPerIteration,
+                                         wlenDependentValue=function)
+
+    # random wavelengths covering the table (and a bit beyond it)
+    # plus all table entries themselves
+    width = wlens[-1]-wlens[0]
+    x = numpy.concatenate((numpy.random.uniform(wlens[0]-0.05*width, wlens[-1]+0.05*width, numberOfTrials),
+                           numpy.asarray(wlens)))
+    vector = dataclasses.I3VectorFloat(x)
+    x = numpy.array(vector) # the wavelengths as seen by both implementations
+
+    results_OpenCL = numpy.array(tester.EvaluateFunction(vector))
+    results_Ref    = numpy.array(tester.EvaluateReferenceFunction(vector))
+    results_Python = evaluatePython(wlens, values, x)
+
+    scale = numpy.max(numpy.abs(values))
+    deviation_RefFromPython = numpy.abs(results_Ref-results_Python)/scale
+
+    # float rounding of the table may put wavelengths right at a step
+    # (a repeated wavelength) on its other side in OpenCL
+    steps = numpy.asarray(wlens)[1:][numpy.diff(wlens)==0.]
+    nearStep = numpy.zeros(len(x), dtype=bool)
+    for step in steps:
+        nearStep |= numpy.abs(x-step) <= 1e-6*step
+    deviation_OclFromRef = numpy.abs(results_OpenCL-results_Ref)/scale
+    deviation_OclFromRef[nearStep] = 0.
+
+    print("%24s: maximum deviation in reference implementation: %g" % (name, numpy.max(deviation_RefFromPython)))
+    print("%24s: maximum deviation in OpenCL implementation:    %g" % (name, numpy.max(deviation_OclFromRef)))
+
+    if numpy.max(deviation_RefFromPython) > maximumRelativeDeviation:
+        raise RuntimeError("%s: python implementation results differ from C++ reference implementation results!" % name)
+    if numpy.max(deviation_OclFromRef) > maximumRelativeDeviationOpenCL:
+        raise RuntimeError("%s: OpenCL implementation results differ from C++ reference implementation results!" % name)
+
+# uneven spacing
+wlens  = numpy.array([260., 270., 271., 300., 305., 400., 401., 402., 550., 690.])*I3Units.nanometer
+values = numpy.array([0.1,  0.5,  0.3,  0.9,  1.2,  2.0,  1.0,  1.5,  0.7,  0.2])
+check("uneven spacing", wlens, values)
+
+# repeated wavelengths (steps in the function)
+wlens  = numpy.array([260., 300., 300., 350., 400., 400., 400., 500., 690.])*I3Units.nanometer
+values = numpy.array([1.0,  1.0,  2.0,  2.5,  2.0,  0.5,  0.8,  0.3,  0.1])
+check("repeated wavelengths", wlens, values)
+
+# very uneven spacing (the index grid is capped)
+wlens  = numpy.concatenate(([260.], numpy.linspace(400., 405., 11), [690.]))*I3Units.nanometer
+values = numpy.sin(numpy.arange(len(wlens)))+2.
+check("very uneven spacing", wlens, values)
+
+# decreasing wavelengths are not accepted
+try:
+    clsim.I3CLSimFunctionFromTable(wlens=[300.*I3Units.nanometer, 290.*I3Units.nanometer, 310.*I3Units.nanometer], values=[1.,2.,3.])
+except Exception:
+    pass
+else:
+    raise RuntimeError("decreasing wavelengths should have been rejected!")
+
+print("test successful!")
@@ -0,0 +1,101 @@
+#!/usr/bin/env python
+
+from __future__ import print_function
+import numpy
+
+from icecube import icetray, dataclasses, clsim, phys_services
+
+# test parameters
+numberOfHostSamples = 100000
+openCLIterations = 10
+# Kolmogorov-Smirnov critical value for a significance of ~0.001
+ksCriticalValue = 1.95
+
+# get OpenCL devices
+openCLDevices = [device for device in clsim.I3CLSimOpenCLDevice.GetAllDevices()]
+if len(openCLDevices)==0:
+    raise RuntimeError("No OpenCL devices available!")
+openCLDevice = openCLDevices[0]
+
+openCLDevice.useNativeMath=False
+workgroupSize = 1
+workItemsPerIteration = 10240
+print("           using platform:", openCLDevice.platform)
+print("             using device:", openCLDevice.device)
+print("            workgroupSize:", workgroupSize)
+print("    workItemsPerIteration:", workItemsPerIteration)
+
+rng = phys_services.I3GSLRandomService(seed=3244)
+
+def exactCDF(x, y, values):
+    # the CDF of the piecewise linear density through (x,y)
+    x = numpy.asarray(x, dtype=float)
+    y = numpy.asarray(y, dtype=float)
+    widths = x[1:]-x[:-1]
+    slopes = (y[1:]-y[:-1])/widths
+    areas = numpy.concatenate(([0.], numpy.cumsum(0.5*(y[1:]+y[:-1])*widths)))
+
+    bins = numpy.clip(numpy.searchsorted(x, values, side='right')-1, 0, len(widths)-1)
+    dx = numpy.clip(values-x[bins], 0., widths[bins])
+    return (areas[bins] + y[bins]*dx + 0.5*slopes[bins]*dx*dx)/areas[-1]
+
+def ksDistanceToCDF(values, x, y):
+    values = numpy.sort(numpy.asarray(values, dtype=float))
+    n = len(values)
+    cdf = exactCDF(x, y, values)
+    return max(numpy.max(numpy.arange(1,n+1)/float(n)-cdf), numpy.max(cdf-numpy.arange(0,n)/float(n)))
+
+def ksDistanceTwoSample(values1, values2):
+    values1 = numpy.sort(numpy.asarray(values1, dtype=float))
+    values2 = numpy.sort(numpy.asarray(values2, dtype=float))
+    allValues = numpy.concatenate((values1, values2))
+    cdf1 = numpy.searchsorted(values1, allValues, side='right')/float(len(values1))
+    cdf2 = numpy.searchsorted(values2, allValues, side='right')/float(len(values2))
+    return numpy.max(numpy.abs(cdf1-cdf2))
+
+def check(name, distribution, x, y):
+    tester = clsim.I3CLSimRandomDistributionTester(device=openCLDevice,
+                                                   workgroupSize=workgroupSize,
+                                                   workItemsPerIteration=workItemsPerIteration,
+                                                   randomService=rng,
+                                                   randomDistribution=distribution)
+    valuesOpenCL = numpy.array(tester.GenerateRandomNumbers(openCLIterations))
+    valuesHost = numpy.array([distribution.SampleFromDistribution(rng, []) for i in range(numberOfHostSamples)])
+
+    nOpenCL = len(valuesOpenCL)
+    nHost = len(valuesHost)
+
+    # no sample may fall outside the support or into a region without density
+    for values, impl in [(valuesOpenCL, "OpenCL"), (valuesHost, "host")]:
+        if numpy.any(values < x[0]) or numpy.any(values > x[-1]):
+            raise RuntimeError("%s: %s samples outside of the distribution's range!" % (name, impl))
+
+    dOpenCL = ksDistanceToCDF(valuesOpenCL, x, y)
+    dHost = ksDistanceToCDF(valuesHost, x, y)
+    dTwoSample = ksDistanceTwoSample(valuesOpenCL, valuesHost)
+
+    print("%22s: KS distance OpenCL/exact: %g (critical: %g)" % (name, dOpenCL, ksCriticalValue/numpy.sqrt(nOpenCL)))
+    print("%22s: KS distance host/exact:   %g (critical: %g)" % (name, dHost, ksCriticalValue/numpy.sqrt(nHost)))
+    print("%22s: KS distance OpenCL/host:  %g (critical: %g)" % (name, dTwoSample, ksCriticalValue*numpy.sqrt(float(nOpenCL+nHost)/float(nOpenCL*nHost))))
+
+    if dOpenCL > ksCriticalValue/numpy.sqrt(nOpenCL):
+        raise RuntimeError("%s: OpenCL samples do not follow the distribution!" % name)
+    if dHost > ksCriticalValue/numpy.sqrt(nHost):
+        raise RuntimeError("%s: host samples do not follow the distribution!" % name)
+    if dTwoSample > ksCriticalValue*numpy.sqrt(float(nOpenCL+nHost)/float(nOpenCL*nHost)):
+        raise RuntimeError("%s: OpenCL and host samples differ!" % name)
+
+# arbitrary x values with a narrow spike and a gap without any density,
+# so that guide table cells cover several bins as well as empty ones
+x = [0., 1., 1.01, 1.02, 2., 3., 3.5, 4., 10.]
+y = [0., 1., 50.,  1.,   0., 0., 2.,  0.5, 0.5]
+check("arbitrary spacing", clsim.I3CLSimRandomValueInterpolatedDistribution(x=x, y=y), x, y)
+
+# constant spacing with many bins
+xFirst = -1.
+xSpacing = 0.002
+y = numpy.abs(numpy.sin(numpy.linspace(0., 20., 1001)))**3 + 0.01
+x = xFirst + xSpacing*numpy.arange(len(y))
+check("constant spacing", clsim.I3CLSimRandomValueInterpolatedDistribution(xFirst=xFirst, xSpacing=xSpacing, y=list(y)), x, y)
+
+print("test successful!")
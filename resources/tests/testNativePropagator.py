@@ -0,0 +1,175 @@
+#!/usr/bin/env python
+
+"""
+Compare the photons from the native CPU propagator to the ones from the
+OpenCL kernel for a toy detector: hit counts on each string and the
+distributions of arrival times, arrival directions and number of scatters
+have to agree within their statistical uncertainties.
+"""
+
+from __future__ import print_function
+import numpy
+
+from icecube import icetray, dataclasses, clsim, phys_services
+from I3Tray import I3Units
+
+# test parameters
+numberOfBunches = 4
+numberOfSteps = 300
+photonsPerStep = 12000
+# Kolmogorov-Smirnov critical value for a significance of ~0.001
+ksCriticalValue = 1.95
+# maximum deviation of hit counts in units of their standard deviation
+maximumSigmas = 4.
+
+# get OpenCL devices
+openCLDevices = [device for device in clsim.I3CLSimOpenCLDevice.GetAllDevices()]
+if len(openCLDevices)==0:
+    raise RuntimeError("No OpenCL devices available!")
+openCLDevice = openCLDevices[0]
+
+openCLDevice.useNativeMath=False
+workgroupSize = 1
+workItemsPerIteration = 10240
+print("           using platform:", openCLDevice.platform)
+print("             using device:", openCLDevice.device)
+print("            workgroupSize:", workgroupSize)
+print("    workItemsPerIteration:", workItemsPerIteration)
+
+def makeGeometry():
+    # 3x3 strings with 10 DOMs each. The DOMs are larger than real
+    # ones to get enough hits in a short time.
+    geometry = clsim.I3CLSimSimpleGeometryUserConfigurable(OMRadius=0.5*I3Units.m, numOMs=90)
+    for string in range(9):
+        for om in range(10):
+            i = string*10+om
+            geometry.SetStringID(i, string+1)
+            geometry.SetDomID(i, om+1)
+            geometry.SetPosX(i, 60.*I3Units.m*(string%3-1))
+            geometry.SetPosY(i, 60.*I3Units.m*(string//3-1)+5.*I3Units.m)
+            geometry.SetPosZ(i, -150.*I3Units.m+17.*I3Units.m*om)
+            geometry.SetSubdetector(i, "IceCube")
+    return geometry
+
+def makeMediumProperties():
+    # layers with different absorption lengths, so that photons
+    # crossing layer boundaries are tested, too
+    m = clsim.I3CLSimMediumProperties(mediumDensity=0.9216*I3Units.g/I3Units.cm3,
+                                      layersNum=10,
+                                      layersZStart=-200.*I3Units.m,
+                                      layersHeight=40.*I3Units.m,
+                                      rockZCoordinate=-1000.*I3Units.m,
+                                      airZCoordinate=1000.*I3Units.m)
+    m.ForcedMinWlen = 265.*I3Units.nanometer
+    m.ForcedMaxWlen = 675.*I3Units.nanometer
+    for i in range(10):
+        m.SetAbsorptionLength(i, clsim.I3CLSimFunctionConstant((30.+5.*i)*I3Units.m))
+        m.SetScatteringLength(i, clsim.I3CLSimFunctionConstant(25.*I3Units.m))
+        m.SetPhaseRefractiveIndex(i, clsim.I3CLSimFunctionConstant(1.33))
+    m.SetScatteringCosAngleDistribution(clsim.I3CLSimRandomValueHenyeyGreenstein(meanCosine=0.9))
+    m.SetDirectionalAbsorptionLengthCorrection(clsim.I3CLSimScalarFieldConstant(1.))
+    m.SetPreScatterDirectionTransform(clsim.I3CLSimVectorTransformConstant())
+    m.SetPostScatterDirectionTransform(clsim.I3CLSimVectorTransformConstant())
+    m.SetIceTiltZShift(clsim.I3CLSimScalarFieldConstant(0.))
+    return m
+
+def makeSteps():
+    # a straight track with 1m Cherenkov steps passing between the strings
+    steps = clsim.I3CLSimStepSeries()
+    for i in range(numberOfSteps):
+        step = clsim.I3CLSimStep()
+        step.x = -20.*I3Units.m
+        step.y = -150.*I3Units.m + float(i)*I3Units.m
+        step.z = -100.*I3Units.m
+        step.time = float(i)*I3Units.m/dataclasses.I3Constants.c
+        step.theta = numpy.pi/2.
+        step.phi = numpy.pi/2.
+        step.length = 1.*I3Units.m
+        step.beta = 1.
+        step.num = photonsPerStep
+        step.weight = 1.
+        step.id = 1
+        step.sourceType = 0
+        steps.append(step)
+    return steps
+
+def configure(converter, geometry, medium):
+    wlenGenerators = clsim.I3CLSimRandomValuePtrSeries()
+    wlenGenerators.append(clsim.I3CLSimRandomValueUniform(300.*I3Units.nanometer, 500.*I3Units.nanometer))
+    converter.SetWlenGenerators(wlenGenerators)
+    converter.SetWlenBias(clsim.I3CLSimFunctionConstant(1.))
+    converter.SetMediumProperties(medium)
+    converter.SetGeometry(geometry)
+    converter.SetStopDetectedPhotons(True)
+    converter.SetDOMPancakeFactor(1.)
+
+def propagate(converter, steps):
+    for i in range(numberOfBunches):
+        converter.EnqueueSteps(steps, i)
+    photons = []
+    for i in range(numberOfBunches):
+        photons.extend(converter.GetConversionResult().photons)
+
+    return dict(string      = numpy.array([p.stringID for p in photons]),
+                time        = numpy.array([p.time for p in photons]),
+                cosTheta    = numpy.array([numpy.cos(p.theta) for p in photons]),
+                phi         = numpy.array([p.phi for p in photons]),
+                numScatters = numpy.array([p.numScatters for p in photons]))
+
+def ksDistanceTwoSample(values1, values2):
+    values1 = numpy.sort(numpy.asarray(values1, dtype=float))
+    values2 = numpy.sort(numpy.asarray(values2, dtype=float))
+    allValues = numpy.concatenate((values1, values2))
+    cdf1 = numpy.searchsorted(values1, allValues, side='right')/float(len(values1))
+    cdf2 = numpy.searchsorted(values2, allValues, side='right')/float(len(values2))
+    return numpy.max(numpy.abs(cdf1-cdf2))
+
+geometry = makeGeometry()
+medium = makeMediumProperties()
+steps = makeSteps()
+
+openCLConverter = clsim.I3CLSimStepToPhotonConverterOpenCL(RandomService=phys_services.I3GSLRandomService(seed=1234), UseNativeMath=False)
+openCLConverter.SetDevice(openCLDevice)
+configure(openCLConverter, geometry, medium)
+openCLConverter.Compile()
+openCLConverter.SetWorkgroupSize(workgroupSize)
+openCLConverter.SetMaxNumWorkitems(workItemsPerIteration)
+openCLConverter.Initialize()
+
+nativeConverter = clsim.I3CLSimStepToPhotonConverterNative(RandomService=phys_services.I3GSLRandomService(seed=5678))
+configure(nativeConverter, geometry, medium)
+nativeConverter.Initialize()
+
+photonsOpenCL = propagate(openCLConverter, steps)
+photonsNative = propagate(nativeConverter, steps)
+
+nOpenCL = len(photonsOpenCL['time'])
+nNative = len(photonsNative['time'])
+print("number of hits: OpenCL %u, native %u" % (nOpenCL, nNative))
+if nOpenCL < 1000 or nNative < 1000:
+    raise RuntimeError("too few hits to compare the propagators!")
+
+# hit counts (Poisson) in total and on each string
+sigmas = abs(nOpenCL-nNative)/numpy.sqrt(nOpenCL+nNative)
+print("%12s: OpenCL/native differ by %.2f sigma" % ("all strings", sigmas))
+if sigmas > maximumSigmas:
+    raise RuntimeError("the total number of hits differs!")
+for string in range(1, 10):
+    hitsOpenCL = numpy.sum(photonsOpenCL['string']==string)
+    hitsNative = numpy.sum(photonsNative['string']==string)
+    if hitsOpenCL+hitsNative == 0:
+        continue
+    sigmas = abs(hitsOpenCL-hitsNative)/numpy.sqrt(hitsOpenCL+hitsNative)
+    print("%12s: OpenCL %u, native %u hits (%.2f sigma)" % ("string %u" % string, hitsOpenCL, hitsNative, sigmas))
+    if sigmas > maximumSigmas:
+        raise RuntimeError("the number of hits on string %u differs!" % string)
+
+# arrival time and direction distributions
+critical = ksCriticalValue*numpy.sqrt(float(nOpenCL+nNative)/float(nOpenCL*nNative))
+for name in ['time', 'cosTheta', 'phi', 'numScatters']:
+    d = ksDistanceTwoSample(photonsOpenCL[name], photonsNative[name])
+    print("%12s: KS distance OpenCL/native: %g (critical: %g)" % (name, d, critical))
+    if d > critical:
+        raise RuntimeError("the %s distributions of the OpenCL and native propagators differ!" % name)
+
+print("test successful!")
@@ -0,0 +1,84 @@
+#!/usr/bin/env python
+
+from __future__ import print_function
+import numpy
+
+from icecube import icetray, dataclasses, clsim, phys_services
+from I3Tray import I3Units
+
+# test parameters
+numberOfTrials = 100000
+# single precision rounding accumulates differently in both methods
+# when crossing many layers
+maximumRelativeDeviation = 1e-3
+maximumAbsLensDeviation = 1e-4
+maximumLayerMismatchFraction = 1e-3
+
+# get OpenCL devices
+openCLDevices = [device for device in clsim.I3CLSimOpenCLDevice.GetAllDevices()]
+if len(openCLDevices)==0:
+    raise RuntimeError("No OpenCL devices available!")
+openCLDevice = openCLDevices[0]
+
+openCLDevice.useNativeMath=False
+workgroupSize = 1
+workItemsPerIteration = 10240
+print("           using platform:", openCLDevice.platform)
+print("             using device:", openCLDevice.device)
+print("            workgroupSize:", workgroupSize)
+print("    workItemsPerIteration:", workItemsPerIteration)
+
+mediumProps = clsim.MakeIceCubeMediumProperties()
+
+tester = clsim.I3CLSimMediumPropertiesTester(device=openCLDevice,
+                                             workgroupSize=workgroupSize,
+                                             workItemsPerIteration=workItemsPerIteration,
+                                             mediumProperties=mediumProps)
+
+if not tester.HasOpticalDepthTables():
+    raise RuntimeError("the IceCube medium should support optical depth tables!")
+
+# start photons well inside the layered part of the medium
+zMin = mediumProps.LayersZStart + 10.*mediumProps.LayersHeight
+zMax = mediumProps.LayersZStart + (mediumProps.LayersNum-10)*mediumProps.LayersHeight
+
+def propagate(wavelengths, zPositions, zDirections, scaLens, absLens, useOpticalDepthTables):
+    results = tester.EvaluatePropagation(dataclasses.I3VectorFloat(wavelengths),
+                                         dataclasses.I3VectorFloat(zPositions),
+                                         dataclasses.I3VectorFloat(zDirections),
+                                         dataclasses.I3VectorFloat(scaLens),
+                                         dataclasses.I3VectorFloat(absLens),
+                                         useOpticalDepthTables)
+    return [numpy.array(result) for result in results]
+
+def compare(name, zDirections):
+    wavelengths = numpy.random.uniform(265., 675., numberOfTrials)*I3Units.nanometer
+    zPositions  = numpy.random.uniform(zMin, zMax, numberOfTrials)
+    scaLens     = numpy.random.exponential(1., numberOfTrials)
+    absLens     = numpy.random.exponential(1., numberOfTrials)
+
+    distLoop,  absLeftLoop,  layerLoop  = propagate(wavelengths, zPositions, zDirections, scaLens, absLens, False)
+    distTable, absLeftTable, layerTable = propagate(wavelengths, zPositions, zDirections, scaLens, absLens, True)
+
+    deviation_dist = numpy.abs(distTable-distLoop)/numpy.maximum(distLoop, 1.*I3Units.m)
+    deviation_absLeft = numpy.abs(absLeftTable-absLeftLoop)/numpy.maximum(absLeftLoop, 1.)
+    layerMismatchFraction = numpy.mean(layerTable != layerLoop)
+
+    print("%12s: maximum relative deviation in distance:  %g" % (name, numpy.max(deviation_dist)))
+    print("%12s: maximum deviation in absorption lengths: %g" % (name, numpy.max(deviation_absLeft)))
+    print("%12s: fraction of final layers that differ:    %g" % (name, layerMismatchFraction))
+
+    if numpy.max(deviation_dist) > maximumRelativeDeviation:
+        raise RuntimeError("%s: distances from the optical depth tables differ from the layer-by-layer propagation!" % name)
+    if numpy.max(deviation_absLeft) > maximumAbsLensDeviation:
+        raise RuntimeError("%s: absorption lengths from the optical depth tables differ from the layer-by-layer propagation!" % name)
+    if layerMismatchFraction > maximumLayerMismatchFraction:
+        raise RuntimeError("%s: final layers from the optical depth tables differ from the layer-by-layer propagation!" % name)
+
+# stay away from |dz|~0, where the distance is (optical depth)/dz and any
+# rounding difference between both methods is amplified
+compare("up-going",   numpy.random.uniform( 0.05, 1., numberOfTrials))
+compare("down-going", numpy.random.uniform(-1., -0.05, numberOfTrials))
+compare("horizontal", numpy.zeros(numberOfTrials))
+
+print("test successful!")
@@ -0,0 +1,190 @@
+#!/usr/bin/env python
+
+"""
+Propagate photons through a toy detector with extra (shadowing) geometry
+set on the OpenCL converter. This builds the kernel including the shadow
+geometry source and checks that
+ - sleeves enclosing all strings absorb every photon before it can reach a DOM,
+ - cables far away from the DOMs do not change the number of hits, and
+ - the kernel binary cache keeps kernels for different shadow geometries apart.
+"""
+
+from __future__ import print_function
+import numpy
+import os
+import shutil
+import tempfile
+
+from icecube import icetray, dataclasses, clsim, phys_services
+from I3Tray import I3Units
+
+# test parameters
+numberOfBunches = 2
+numberOfSteps = 300
+photonsPerStep = 12000
+# maximum deviation of hit counts in units of their standard deviation
+maximumSigmas = 5.
+
+# get OpenCL devices
+openCLDevices = [device for device in clsim.I3CLSimOpenCLDevice.GetAllDevices()]
+if len(openCLDevices)==0:
+    raise RuntimeError("No OpenCL devices available!")
+openCLDevice = openCLDevices[0]
+
+openCLDevice.useNativeMath=False
+workgroupSize = 1
+workItemsPerIteration = 10240
+print("           using platform:", openCLDevice.platform)
+print("             using device:", openCLDevice.device)
+print("            workgroupSize:", workgroupSize)
+print("    workItemsPerIteration:", workItemsPerIteration)
+
+OMRadius = 0.5*I3Units.m
+
+def stringPosition(string):
+    return (60.*I3Units.m*(string%3-1), 60.*I3Units.m*(string//3-1)+5.*I3Units.m)
+
+def makeGeometry():
+    # 3x3 strings with 10 DOMs each. The DOMs are larger than real
+    # ones to get enough hits in a short time.
+    geometry = clsim.I3CLSimSimpleGeometryUserConfigurable(OMRadius=OMRadius, numOMs=90)
+    for string in range(9):
+        x, y = stringPosition(string)
+        for om in range(10):
+            i = string*10+om
+            geometry.SetStringID(i, string+1)
+            geometry.SetDomID(i, om+1)
+            geometry.SetPosX(i, x)
+            geometry.SetPosY(i, y)
+            geometry.SetPosZ(i, -150.*I3Units.m+17.*I3Units.m*om)
+            geometry.SetSubdetector(i, "IceCube")
+    return geometry
+
+def makeMediumProperties():
+    m = clsim.I3CLSimMediumProperties(mediumDensity=0.9216*I3Units.g/I3Units.cm3,
+                                      layersNum=10,
+                                      layersZStart=-200.*I3Units.m,
+                                      layersHeight=40.*I3Units.m,
+                                      rockZCoordinate=-1000.*I3Units.m,
+                                      airZCoordinate=1000.*I3Units.m)
+    m.ForcedMinWlen = 265.*I3Units.nanometer
+    m.ForcedMaxWlen = 675.*I3Units.nanometer
+    for i in range(10):
+        m.SetAbsorptionLength(i, clsim.I3CLSimFunctionConstant((30.+5.*i)*I3Units.m))
+        m.SetScatteringLength(i, clsim.I3CLSimFunctionConstant(25.*I3Units.m))
+        m.SetPhaseRefractiveIndex(i, clsim.I3CLSimFunctionConstant(1.33))
+    m.SetScatteringCosAngleDistribution(clsim.I3CLSimRandomValueHenyeyGreenstein(meanCosine=0.9))
+    m.SetDirectionalAbsorptionLengthCorrection(clsim.I3CLSimScalarFieldConstant(1.))
+    m.SetPreScatterDirectionTransform(clsim.I3CLSimVectorTransformConstant())
+    m.SetPostScatterDirectionTransform(clsim.I3CLSimVectorTransformConstant())
+    m.SetIceTiltZShift(clsim.I3CLSimScalarFieldConstant(0.))
+    return m
+
+def makeSteps():
+    # a straight track with 1m Cherenkov steps passing between the strings
+    steps = clsim.I3CLSimStepSeries()
+    for i in range(numberOfSteps):
+        step = clsim.I3CLSimStep()
+        step.x = -20.*I3Units.m
+        step.y = -150.*I3Units.m + float(i)*I3Units.m
+        step.z = -100.*I3Units.m
+        step.time = float(i)*I3Units.m/dataclasses.I3Constants.c
+        step.theta = numpy.pi/2.
+        step.phi = numpy.pi/2.
+        step.length = 1.*I3Units.m
+        step.beta = 1.
+        step.num = photonsPerStep
+        step.weight = 1.
+        step.id = 1
+        step.sourceType = 0
+        steps.append(step)
+    return steps
+
+def makeSleeves():
+    # closed cylinders around each string that contain all of its DOMs.
+    # Photons are emitted outside of them, so none can reach a DOM.
+    items = []
+    for string in range(9):
+        x, y = stringPosition(string)
+        items.append(clsim.I3ExtraGeometryItemCylinder(dataclasses.I3Position(x, y, -160.*I3Units.m),
+                                                       dataclasses.I3Position(x, y, 10.*I3Units.m),
+                                                       2.*OMRadius))
+    return clsim.I3ExtraGeometryItemUnion(items)
+
+def makeDistantCables():
+    # cables above the detector that hardly any detected photon can cross
+    items = []
+    for string in range(9):
+        x, y = stringPosition(string)
+        items.append(clsim.I3ExtraGeometryItemCylinder(dataclasses.I3Position(x, y, 400.*I3Units.m),
+                                                       dataclasses.I3Position(x, y, 800.*I3Units.m),
+                                                       0.05*I3Units.m))
+    return clsim.I3ExtraGeometryItemUnion(items)
+
+def countHits(shadowGeometry, kernelCacheDirectory, seed):
+    converter = clsim.I3CLSimStepToPhotonConverterOpenCL(RandomService=phys_services.I3GSLRandomService(seed=seed), UseNativeMath=False)
+    converter.SetDevice(openCLDevice)
+
+    wlenGenerators = clsim.I3CLSimRandomValuePtrSeries()
+    wlenGenerators.append(clsim.I3CLSimRandomValueUniform(300.*I3Units.nanometer, 500.*I3Units.nanometer))
+    converter.SetWlenGenerators(wlenGenerators)
+    converter.SetWlenBias(clsim.I3CLSimFunctionConstant(1.))
+    converter.SetMediumProperties(medium)
+    converter.SetGeometry(geometry)
+    converter.SetStopDetectedPhotons(True)
+    converter.SetDOMPancakeFactor(1.)
+    if shadowGeometry is not None:
+        converter.SetShadowGeometry(shadowGeometry)
+    converter.SetKernelCacheDirectory(kernelCacheDirectory)
+
+    converter.Compile()
+    converter.SetWorkgroupSize(workgroupSize)
+    converter.SetMaxNumWorkitems(workItemsPerIteration)
+    converter.Initialize()
+
+    for i in range(numberOfBunches):
+        converter.EnqueueSteps(steps, i)
+    numHits = 0
+    for i in range(numberOfBunches):
+        numHits += len(converter.GetConversionResult().photons)
+    return numHits
+
+def compare(name, numHits, numHitsReference):
+    sigmas = abs(numHits-numHitsReference)/numpy.sqrt(numHits+numHitsReference)
+    print("%16s: %u hits, %u without shadowing (%.2f sigma)" % (name, numHits, numHitsReference, sigmas))
+    if sigmas > maximumSigmas:
+        raise RuntimeError("%s: the number of hits differs from the one without shadowing!" % name)
+
+geometry = makeGeometry()
+medium = makeMediumProperties()
+steps = makeSteps()
+
+kernelCacheDirectory = tempfile.mkdtemp()
+try:
+    numHitsNoShadow = countHits(None, "", 1234)
+    print("%16s: %u hits" % ("no shadowing", numHitsNoShadow))
+    if numHitsNoShadow < 1000:
+        raise RuntimeError("too few hits to test the shadowing!")
+
+    numHitsSleeves = countHits(makeSleeves(), kernelCacheDirectory, 2345)
+    print("%16s: %u hits" % ("sleeves", numHitsSleeves))
+    if numHitsSleeves != 0:
+        raise RuntimeError("photons went through the sleeves around the strings!")
+
+    # a different shadow geometry must not re-use the cached sleeves kernel
+    numHitsCables = countHits(makeDistantCables(), kernelCacheDirectory, 3456)
+    compare("distant cables", numHitsCables, numHitsNoShadow)
+
+    numCacheFiles = len([f for f in os.listdir(kernelCacheDirectory) if f.endswith(".bin")])
+    print("%16s: %u" % ("cached kernels", numCacheFiles))
+    if numCacheFiles != 2:
+        raise RuntimeError("expected one cached kernel binary per shadow geometry, found %u!" % numCacheFiles)
+
+    # the cached kernels give the same results as freshly built ones
+    if countHits(makeSleeves(), kernelCacheDirectory, 4567) != 0:
+        raise RuntimeError("photons went through the sleeves around the strings with the cached kernel!")
+    compare("cached cables", countHits(makeDistantCables(), kernelCacheDirectory, 5678), numHitsNoShadow)
+finally:
+    shutil.rmtree(kernelCacheDirectory)
+
+print("test successful!")